@@ -2421,9 +2421,10 @@ SysRes VG_(am_mmap_anon_float_client) ( SizeT length, Int prot )
 
 /* Map anonymously at an unconstrained address for V, and update the
    segment array accordingly.  This is fundamentally how V allocates
-   itself more address space when needed. */
+   itself more address space when needed.  'sharing' is
+   VKI_MAP_PRIVATE or VKI_MAP_SHARED. */
 
-SysRes VG_(am_mmap_anon_float_valgrind)( SizeT length )
+static SysRes am_mmap_anon_float_valgrind_flags( SizeT length, UInt sharing )
 {
    SysRes     sres;
    NSegment   seg;
@@ -2472,7 +2473,7 @@ SysRes VG_(am_mmap_anon_float_valgrind)( SizeT length )
    sres = VG_(am_do_mmap_NO_NOTIFY)( 
              advised, length, 
              VKI_PROT_READ|VKI_PROT_WRITE|VKI_PROT_EXEC, 
-             VKI_MAP_FIXED|VKI_MAP_PRIVATE|VKI_MAP_ANONYMOUS, 
+             VKI_MAP_FIXED|sharing|VKI_MAP_ANONYMOUS, 
              VM_TAG_VALGRIND, 0
           );
 #if defined(VGO_darwin) || defined(ENABLE_INNER)
@@ -2482,7 +2483,7 @@ SysRes VG_(am_mmap_anon_float_valgrind)( SizeT length )
        sres = VG_(am_do_mmap_NO_NOTIFY)( 
              0, length, 
              VKI_PROT_READ|VKI_PROT_WRITE|VKI_PROT_EXEC, 
-             /*VKI_MAP_FIXED|*/VKI_MAP_PRIVATE|VKI_MAP_ANONYMOUS, 
+             /*VKI_MAP_FIXED|*/sharing|VKI_MAP_ANONYMOUS, 
              VM_TAG_VALGRIND, 0
           );
    }
@@ -2516,6 +2517,11 @@ SysRes VG_(am_mmap_anon_float_valgrind)( SizeT length )
    return sres;
 }
 
+SysRes VG_(am_mmap_anon_float_valgrind)( SizeT length )
+{
+   return am_mmap_anon_float_valgrind_flags( length, VKI_MAP_PRIVATE );
+}
+
 /* Really just a wrapper around VG_(am_mmap_anon_float_valgrind). */
 
 void* VG_(am_shadow_alloc)(SizeT size)
@@ -2524,6 +2530,15 @@ void* VG_(am_shadow_alloc)(SizeT size)
    return sr_isError(sres) ? NULL : (void*)sr_Res(sres);
 }
 
+/* As VG_(am_shadow_alloc), but the mapping is shared rather than
+   private, so it stays shared with processes created by VG_(fork). */
+
+void* VG_(am_shared_alloc)(SizeT size)
+{
+   SysRes sres = am_mmap_anon_float_valgrind_flags( size, VKI_MAP_SHARED );
+   return sr_isError(sres) ? NULL : (void*)sr_Res(sres);
+}
+
 /* Map a file at an unconstrained address for V, and update the
    segment array accordingly. Use the provided flags */
 
@@ -99,6 +99,12 @@ static SizeT        ec_htab_size_idx; /* 0 .. N_EC_PRIMES-1 */
 /* ECU serial number */
 static UInt ec_next_ecu = 4; /* We must never issue zero */
 
+/* ec_by_ecu[ecu / 4] is the ExeContext with that ecu, for
+   ecu < ec_next_ecu.  Allows tools to store 32-bit ECUs instead of
+   ExeContext pointers, and still get the ExeContext back quickly. */
+static ExeContext** ec_by_ecu;
+static UInt         ec_by_ecu_size; /* # entries allocated */
+
 static ExeContext* null_ExeContext;
 
 /* Stats only: the number of times the system was searched to locate a
@@ -435,6 +441,12 @@ static ExeContext* record_ExeContext_wrk2 ( Addr* ips, UInt n_ips )
          and have run out of numbers.  Not sure what to do. */
       VG_(core_panic)("m_execontext: more than 2^30 ExeContexts created");
    }
+   if (new_ec->ecu / 4 >= ec_by_ecu_size) {
+      ec_by_ecu_size = ec_by_ecu_size == 0 ? 1024 : 2 * ec_by_ecu_size;
+      ec_by_ecu = VG_(realloc)("execontext.rEw2.1", ec_by_ecu,
+                               ec_by_ecu_size * sizeof(ExeContext*));
+   }
+   ec_by_ecu[new_ec->ecu / 4] = new_ec;
 
    new_ec->n_ips = n_ips;
    new_ec->chain = ec_htab[hash];
@@ -482,17 +494,11 @@ Int VG_(get_ExeContext_n_ips)( ExeContext* e ) {
 
 ExeContext* VG_(get_ExeContext_from_ECU)( UInt ecu )
 {
-   UWord i;
-   ExeContext* ec;
    vg_assert(VG_(is_plausible_ECU)(ecu));
    vg_assert(ec_htab_size > 0);
-   for (i = 0; i < ec_htab_size; i++) {
-      for (ec = ec_htab[i]; ec; ec = ec->chain) {
-         if (ec->ecu == ecu)
-            return ec;
-      }
-   }
-   return NULL;
+   if (ecu >= ec_next_ecu)
+      return NULL;
+   return ec_by_ecu[ecu / 4];
 }
 
 ExeContext* VG_(make_ExeContext_from_StackTrace)( Addr* ips, UInt n_ips )
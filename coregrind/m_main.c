@@ -173,12 +173,21 @@ static void usage_NORETURN ( Bool debug_help )
 "    --sim-hints=hint1,hint2,...  known hints:\n"
 "                                 lax-ioctls, enable-outer, fuse-compatible [none]\n"
 "    --fair-sched=no|yes|try   schedule threads fairly on multicore systems [no]\n"
+"    --parallel-sched=no|yes   let threads run in parallel (some tools only) [no]\n"
 "    --kernel-variant=variant1,variant2,...  known variants: bproc [none]\n"
 "                              handle non-standard kernel variants\n"
 "    --merge-recursive-frames=<number>  merge frames between identical\n"
 "           program counters in max <number> frames) [0]\n"
 "    --num-transtab-sectors=<number> size of translated code cache [%d]\n"
 "           more sectors may increase performance, but use more memory.\n"
+"    --hot-transtab-sectors=<number>  how many of those sectors keep only\n"
+"           frequently executed translations [0]\n"
+"    --persistent-transtab=<file>  save translations to <file> at exit and\n"
+"           reuse them in later runs (some tools only) [none]\n"
+"    --translate-ahead=<number>  translate up to <number> likely successors\n"
+"           of each new block before they are reached [0]\n"
+"    --retranslate-hot-sbs=<number>  translate blocks executed <number>\n"
+"           times again, as traces along their hot successors [0]\n"
 "    --aspace-minaddr=0xPP     avoid mapping memory below 0xPP [guessed]\n"
 "    --show-emwarns=no|yes     show warnings about emulation limits? [no]\n"
 "    --require-text-symbol=:sonamepattern:symbolpattern    abort run if the\n"
@@ -576,6 +585,7 @@ void main_process_cmd_line_options ( /*OUT*/Bool* logging_to_fd,
             VG_(fmsg_bad_option)(arg, "");
 
       }
+      else if VG_BOOL_CLO(arg, "--parallel-sched",   VG_(clo_parallel_sched)) {}
       else if VG_BOOL_CLO(arg, "--trace-sched",      VG_(clo_trace_sched)) {}
       else if VG_BOOL_CLO(arg, "--trace-signals",    VG_(clo_trace_signals)) {}
       else if VG_BOOL_CLO(arg, "--trace-symtab",     VG_(clo_trace_symtab)) {}
@@ -603,6 +613,16 @@ void main_process_cmd_line_options ( /*OUT*/Bool* logging_to_fd,
       else if VG_BINT_CLO(arg, "--num-transtab-sectors",
                                VG_(clo_num_transtab_sectors),
                                MIN_N_SECTORS, MAX_N_SECTORS) {}
+      else if VG_BINT_CLO(arg, "--hot-transtab-sectors",
+                               VG_(clo_hot_transtab_sectors),
+                               0, MAX_N_SECTORS - MIN_N_SECTORS) {}
+      else if VG_BINT_CLO(arg, "--translate-ahead",
+                               VG_(clo_translate_ahead), 0, 100) {}
+      else if VG_BINT_CLO(arg, "--retranslate-hot-sbs",
+                               VG_(clo_retranslate_hot_sbs),
+                               0, 1000000000) {}
+      else if VG_STR_CLO (arg, "--persistent-transtab",
+                               VG_(clo_persistent_transtab)) {}
       else if VG_BINT_CLO(arg, "--merge-recursive-frames",
                                VG_(clo_merge_recursive_frames), 0,
                                VG_DEEPEST_BACKTRACE) {}
@@ -844,6 +864,14 @@ void main_process_cmd_line_options ( /*OUT*/Bool* logging_to_fd,
 
    VG_(dyn_vgdb_error) = VG_(clo_vgdb_error);
 
+   if (VG_(clo_hot_transtab_sectors) + MIN_N_SECTORS
+       > VG_(clo_num_transtab_sectors)) {
+      VG_(fmsg_bad_option)("--hot-transtab-sectors",
+         "At least %d of the --num-transtab-sectors=%u sectors\n"
+         "must remain for new translations.\n",
+         MIN_N_SECTORS, VG_(clo_num_transtab_sectors));
+   }
+
    if (VG_(clo_gen_suppressions) > 0 && 
        !VG_(needs).core_errors && !VG_(needs).tool_errors) {
       VG_(fmsg_bad_option)("--gen-suppressions=yes",
@@ -2497,6 +2525,9 @@ void shutdown_actions_NORETURN( ThreadId tid,
 
    VG_(sanity_check_general)( True /*include expensive checks*/ );
 
+   /* Save translations for the next run, if requested. */
+   VG_(save_persistent_transtab)();
+
    if (VG_(clo_stats))
       VG_(print_all_stats)(VG_(clo_verbosity) > 2, /* Memory stats */
                            False /* tool prints stats in the tool fini */);
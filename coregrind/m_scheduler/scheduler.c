@@ -41,7 +41,9 @@
    to run at once.  This is controlled with the CPU Big Lock,
    "the_BigLock".  Any time a thread wants to run client code or
    manipulate any shared state (which is anything other than its own
-   ThreadState entry), it must hold the_BigLock.
+   ThreadState entry), it must hold the_BigLock.  (With
+   --parallel-sched=yes, threads may run translated code without it;
+   see "Parallel execution" below.)
 
    When a thread is about to block in a blocking syscall, it releases
    the_BigLock, and re-takes it when it becomes runnable again (either
@@ -145,6 +147,10 @@ static ULong stats__n_xindir_misses = 0;
 static UInt sanity_fast_count = 0;
 static UInt sanity_slow_count = 0;
 
+/* Parallel execution counts. */
+static ULong stats__n_parallel_runs = 0;
+static ULong stats__n_world_stops   = 0;
+
 void VG_(print_scheduler_stats)(void)
 {
    VG_(message)(Vg_DebugMsg,
@@ -157,6 +163,10 @@ void VG_(print_scheduler_stats)(void)
    VG_(message)(Vg_DebugMsg,
       "scheduler: %'llu/%'llu major/minor sched events.\n",
       n_scheduling_events_MAJOR, n_scheduling_events_MINOR);
+   if (VG_(clo_parallel_sched))
+      VG_(message)(Vg_DebugMsg,
+                   "scheduler: %'llu parallel runs, %'llu world stops\n",
+                   stats__n_parallel_runs, stats__n_world_stops);
    VG_(message)(Vg_DebugMsg, 
                 "   sanity: %d cheap, %d expensive checks.\n",
                 sanity_fast_count, sanity_slow_count );
@@ -167,6 +177,142 @@ void VG_(print_scheduler_stats)(void)
  */
 static struct sched_lock *the_BigLock;
 
+/* ---------------------------------------------------------------------
+   Parallel execution (--parallel-sched=yes).
+
+   For tools which declare VG_(needs_thread_safe_instrumentation), a
+   thread may run translated code without holding the_BigLock: just
+   before entering generated code it marks itself as running in
+   parallel and drops the lock, and on leaving generated code it
+   takes the lock again.  Translated code only reads the translation
+   table and VG_(tt_fast), and only writes its own thread's guest
+   state, so this is safe provided that nobody adds, chains, unchains
+   or discards translations, or looks at another thread's state,
+   while any thread is running in parallel.
+
+   Hence there are two ways of holding the_BigLock.
+   VG_(acquire_BigLock) and VG_(acquire_BigLock_LL) take the lock and
+   then "stop the world": they wait until all threads running in
+   parallel have left generated code, asking them to do so by cutting
+   short their timeslices.  Everything outside the scheduler uses
+   those, and so sees the same world as it would with the_BigLock
+   held throughout.  The scheduler itself, when a thread leaves
+   generated code merely because its timeslice ran out or it
+   yielded, takes the lock without stopping the world, does the
+   per-thread housekeeping and goes straight back into generated
+   code.  Any other reason for leaving generated code (a fast-cache
+   miss, a chain-me request, a syscall, a client request, a fault,
+   ...) stops the world before it is handled.
+
+   This only scales for threads which mostly compute: each syscall or
+   new translation still makes all threads wait.
+   ------------------------------------------------------------------ */
+
+/* Are we scheduling in parallel?  Decided at startup. */
+static Bool parallel_sched = False;
+
+/* The number of threads running generated code in parallel, and
+   which they are.  A thread sets its flag and increments the count
+   while holding the_BigLock, but clears and decrements them without
+   it.  Hence, when holding the_BigLock, a count of zero stays
+   zero. */
+static volatile Int  n_threads_in_parallel = 0;
+static volatile Bool in_parallel[VG_N_THREADS];
+
+/* Wait until no thread is running generated code in parallel.  The
+   caller must hold the_BigLock. */
+static void stop_the_world ( void )
+{
+   ThreadId tid;
+
+   if (n_threads_in_parallel == 0)
+      return;
+
+   stats__n_world_stops++;
+   while (True) {
+      __sync_synchronize();
+      if (n_threads_in_parallel == 0)
+         break;
+      /* Make them come back to the scheduler soon, by cutting their
+         timeslices to a single block.  (Not zero: a no-redir
+         translation must be able to run its one block.)  This can
+         race with a thread which is just leaving generated code, and
+         so miscount its blocks; that is harmless. */
+      for (tid = 1; tid < VG_N_THREADS; tid++) {
+         volatile UInt* ctr = &VG_(threads)[tid].arch.vex.host_EvC_COUNTER;
+         if (in_parallel[tid] && (Int)*ctr > 1)
+            *ctr = 1;
+      }
+      VG_(do_syscall0)(__NR_sched_yield);
+   }
+   __sync_synchronize();
+}
+
+/* tid holds the_BigLock and is about to run generated code: let it
+   do so in parallel with others. */
+static void enter_parallel_code ( ThreadId tid )
+{
+   vg_assert(VG_(is_running_thread)(tid));
+   vg_assert(VG_(in_generated_code));
+   vg_assert(!in_parallel[tid]);
+
+   stats__n_parallel_runs++;
+   VG_(in_generated_code) = False;
+   VG_(running_tid) = VG_INVALID_THREADID;
+   in_parallel[tid] = True;
+   __sync_fetch_and_add(&n_threads_in_parallel, 1);
+   ML_(release_sched_lock)(the_BigLock);
+}
+
+/* tid has left generated code which it was running in parallel:
+   take the_BigLock again, stopping the world if requested.  Returns
+   False, and does nothing, if tid wasn't running in parallel. */
+static Bool leave_parallel_code ( ThreadId tid, Bool stop )
+{
+   if (!in_parallel[tid])
+      return False;
+
+   in_parallel[tid] = False;
+   __sync_fetch_and_sub(&n_threads_in_parallel, 1);
+   ML_(acquire_sched_lock)(the_BigLock);
+   if (stop)
+      stop_the_world();
+
+   vg_assert(VG_(running_tid) == VG_INVALID_THREADID);
+   VG_(running_tid) = tid;
+   vg_assert(!VG_(in_generated_code));
+   VG_(in_generated_code) = True;
+   return True;
+}
+
+/* See pub_core_scheduler.h for description */
+Bool VG_(leave_parallel_code) ( ThreadId tid )
+{
+   return leave_parallel_code(tid, True/*stop the world*/);
+}
+
+/* See pub_core_scheduler.h for description */
+void VG_(reenter_parallel_code) ( ThreadId tid )
+{
+   enter_parallel_code(tid);
+}
+
+/* See pub_core_scheduler.h for description */
+void VG_(stop_the_world) ( void )
+{
+   stop_the_world();
+}
+
+/* Can the scheduler deal with this VG_TRC_* value without stopping
+   the world? */
+static Bool is_parallel_safe_trc ( HWord trc )
+{
+   return trc == VG_TRC_INNER_COUNTERZERO
+          || trc == VEX_TRC_JMP_YIELD
+          || trc == VG_TRC_BORING
+          || trc == VEX_TRC_JMP_BORING;
+}
+
 
 /* ---------------------------------------------------------------------
    Helper functions for the scheduler.
@@ -190,10 +336,33 @@ void maybe_show_sb_profile ( void )
    vg_assert(delta >= 0);
    if ((ULong)delta >= VG_(clo_profyle_interval)) {
       bbs_done_lastcheck = bbs_done;
+      if (parallel_sched)
+         stop_the_world();
       VG_(get_and_show_SB_profile)(bbs_done);
    }
 }
 
+/* For --retranslate-hot-sbs: look for hot blocks every so often.
+   This scans the whole translation table, hence not too often. */
+#define HOT_SB_SCAN_INTERVAL 10000000
+
+static
+void maybe_retranslate_hot_sbs ( ThreadId tid )
+{
+   /* DO NOT MAKE NON-STATIC */
+   static ULong bbs_done_lastcheck = 0;
+   /* */
+   vg_assert(VG_(clo_retranslate_hot_sbs) > 0);
+   Long delta = (Long)(bbs_done - bbs_done_lastcheck);
+   vg_assert(delta >= 0);
+   if ((ULong)delta >= HOT_SB_SCAN_INTERVAL) {
+      bbs_done_lastcheck = bbs_done;
+      if (parallel_sched)
+         stop_the_world();
+      VG_(retranslate_hot_SBs)(tid, bbs_done);
+   }
+}
+
 static
 const HChar* name_of_sched_event ( UInt event )
 {
@@ -355,6 +524,8 @@ static void deinit_BigLock(void)
 void VG_(acquire_BigLock_LL) ( const HChar* who )
 {
    ML_(acquire_sched_lock)(the_BigLock);
+   if (parallel_sched)
+      stop_the_world();
 }
 
 /* See pub_core_scheduler.h for description */
@@ -574,6 +745,11 @@ static void sched_fork_cleanup(ThreadId me)
       }
    }
 
+   /* only this thread exists now, and it's not in generated code */
+   n_threads_in_parallel = 0;
+   for (tid = 0; tid < VG_N_THREADS; tid++)
+      in_parallel[tid] = False;
+
    /* re-init and take the sema */
    deinit_BigLock();
    init_BigLock();
@@ -608,6 +784,15 @@ ThreadId VG_(scheduler_init_phase1) ( void )
 
    init_BigLock();
 
+   if (VG_(clo_parallel_sched)) {
+      if (VG_(needs).thread_safe_instrumentation)
+         parallel_sched = True;
+      else
+         VG_(message)(Vg_UserMsg,
+                      "Warning: --parallel-sched=yes is not supported "
+                      "by this tool; ignoring it\n");
+   }
+
    for (i = 0 /* NB; not 1 */; i < VG_N_THREADS; i++) {
       /* Paranoia .. completely zero it out. */
       VG_(memset)( & VG_(threads)[i], 0, sizeof( VG_(threads)[i] ) );
@@ -850,6 +1035,11 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
    volatile ThreadState* tst            = NULL; /* stop gcc complaining */
    volatile Int          done_this_time = 0;
    volatile HWord        host_code_addr = 0;
+   /* Run in parallel with other threads?  If so, other threads may
+      be running generated code right now, so we mustn't update
+      VG_(tt_fast) under their feet. */
+   const Bool            run_parallel   = parallel_sched;
+   const Bool            world_stopped  = n_threads_in_parallel == 0;
 
    /* Paranoia */
    vg_assert(VG_(is_valid_tid)(tid));
@@ -861,9 +1051,13 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
    do_pre_run_checks( (ThreadState*)tst );
    /* end Paranoia */
 
-   /* Futz with the XIndir stats counters. */
-   vg_assert(VG_(stats__n_xindirs_32) == 0);
-   vg_assert(VG_(stats__n_xindir_misses_32) == 0);
+   /* Futz with the XIndir stats counters.  Threads running in
+      parallel update them without synchronisation, so they are only
+      approximate then. */
+   if (!run_parallel) {
+      vg_assert(VG_(stats__n_xindirs_32) == 0);
+      vg_assert(VG_(stats__n_xindir_misses_32) == 0);
+   }
 
    /* Clear return area. */
    two_words[0] = two_words[1] = 0;
@@ -884,7 +1078,7 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
             to the scheduler. */
          Bool  found = VG_(search_transtab)(&res, NULL, NULL,
                                             (Addr)tst->arch.vex.VG_INSTR_PTR,
-                                            True/*upd cache*/
+                                            world_stopped/*upd cache*/
                                             );
          if (LIKELY(found)) {
             host_code_addr = res;
@@ -928,6 +1122,9 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
    vg_assert(VG_(in_generated_code) == False);
    VG_(in_generated_code) = True;
 
+   if (run_parallel)
+      enter_parallel_code(tid);
+
    SCHEDSETJMP(
       tid, 
       jumped, 
@@ -938,6 +1135,12 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
       )
    );
 
+   /* Take the_BigLock again.  The world is stopped later on, if the
+      reason for leaving needs it.  If we got here by the signal
+      handler's longjmp, the handler has done this already. */
+   if (run_parallel)
+      leave_parallel_code(tid, False/*don't stop the world*/);
+
    vg_assert(VG_(in_generated_code) == True);
    VG_(in_generated_code) = False;
 
@@ -980,8 +1183,11 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
       else
          /* value was changed due to gdbserver invocation via ptrace */
          vgdb_next_poll = NO_VGDB_POLL;
-      if (VG_(gdbserver_activity) (tid))
+      if (VG_(gdbserver_activity) (tid)) {
+         if (run_parallel)
+            stop_the_world();
          VG_(gdbserver) (tid);
+      }
    }
 
    /* TRC value and possible auxiliary patch-address word are already
@@ -1017,6 +1223,7 @@ static void handle_tt_miss ( ThreadId tid )
          found = VG_(search_transtab)( NULL, NULL, NULL,
                                        ip, True ); 
          vg_assert2(found, "handle_tt_miss: missing tt_fast entry");
+         VG_(translate_ahead)( tid, bbs_done );
       
       } else {
 	 // If VG_(translate)() fails, it's because it had to throw a
@@ -1035,6 +1242,7 @@ void handle_chain_me ( ThreadId tid, void* place_to_chain, Bool toFastEP )
    Addr ip             = VG_(get_IP)(tid);
    UInt to_sNo         = (UInt)-1;
    UInt to_tteNo       = (UInt)-1;
+   Bool translated     = False;
 
    found = VG_(search_transtab)( NULL, &to_sNo, &to_tteNo,
                                  ip, False/*dont_upd_fast_cache*/ );
@@ -1045,6 +1253,7 @@ void handle_chain_me ( ThreadId tid, void* place_to_chain, Bool toFastEP )
          found = VG_(search_transtab)( NULL, &to_sNo, &to_tteNo,
                                        ip, False ); 
          vg_assert2(found, "handle_chain_me: missing tt_fast entry");
+         translated = True;
       } else {
 	 // If VG_(translate)() fails, it's because it had to throw a
 	 // signal because the client jumped to a bad address.  That
@@ -1063,6 +1272,11 @@ void handle_chain_me ( ThreadId tid, void* place_to_chain, Bool toFastEP )
       in the case that the destination block gets deleted. */
    VG_(tt_tc_do_chaining)( place_to_chain,
                            to_sNo, to_tteNo, toFastEP );
+
+   /* Only now, since translating more may throw away the blocks just
+      chained. */
+   if (translated)
+      VG_(translate_ahead)( tid, bbs_done );
 }
 
 static void handle_syscall(ThreadId tid, UInt trc)
@@ -1231,15 +1445,23 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
 	 /* 3 Aug 06: doing sys__nsleep works but crashes some apps.
             sys_yield also helps the problem, whilst not crashing apps. */
 
-	 VG_(release_BigLock)(tid, VgTs_Yielding, 
-                                   "VG_(scheduler):timeslice");
-	 /* ------------ now we don't have The Lock ------------ */
+	 /* When scheduling in parallel, other threads got the lock
+	    whenever we were in generated code, so there is no need
+	    to yield it here. */
+	 if (!parallel_sched) {
+	    VG_(release_BigLock)(tid, VgTs_Yielding, 
+                                      "VG_(scheduler):timeslice");
+	    /* ------------ now we don't have The Lock ------------ */
 
-	 VG_(acquire_BigLock)(tid, "VG_(scheduler):timeslice");
-	 /* ------------ now we do have The Lock ------------ */
+	    VG_(acquire_BigLock)(tid, "VG_(scheduler):timeslice");
+	    /* ------------ now we do have The Lock ------------ */
+	 }
 
 	 /* OK, do some relatively expensive housekeeping stuff */
 	 scheduler_sanity(tid);
+	 if (parallel_sched
+	     && (VG_(needs).sanity_checks || VG_(clo_sanity_level) > 1))
+	    stop_the_world();
 	 VG_(sanity_check_general)(False);
 
 	 /* Look for any pending signals for this thread, and set them up
@@ -1285,6 +1507,9 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
 	 print_sched_event(tid, buf);
       }
 
+      if (parallel_sched && !is_parallel_safe_trc(trc[0]))
+         stop_the_world();
+
       if (trc[0] == VEX_TRC_JMP_NOREDIR) {
          /* If we got a request to run a no-redir version of
             something, do so now -- handle_noredir_jump just (creates
@@ -1321,6 +1546,9 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
             complex. */
          vg_assert(trc[0] != VG_TRC_CHAIN_ME_TO_SLOW_EP
                    && trc[0] != VG_TRC_CHAIN_ME_TO_FAST_EP);
+
+         if (parallel_sched && !is_parallel_safe_trc(trc[0]))
+            stop_the_world();
       }
 
       switch (trc[0]) {
@@ -1566,6 +1794,9 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
 
       if (UNLIKELY(VG_(clo_profyle_sbs)) && VG_(clo_profyle_interval) > 0)
          maybe_show_sb_profile();
+
+      if (UNLIKELY(VG_(clo_retranslate_hot_sbs) > 0))
+         maybe_retranslate_hot_sbs(tid);
    }
 
    if (VG_(clo_trace_sched))
@@ -2511,6 +2511,12 @@ void sync_signalhandler ( Int sigNo,
 {
    ThreadId tid = VG_(lwpid_to_vgtid)(VG_(gettid)());
    Bool from_user;
+   Bool in_parallel;
+
+   /* If the thread was running generated code in parallel with
+      others, it doesn't hold the big lock.  Get it, and stop the
+      others, before doing anything else. */
+   in_parallel = VG_(leave_parallel_code)(tid);
 
    if (0) 
       VG_(printf)("sync_sighandler(%d, %p, %p)\n", sigNo, info, uc);
@@ -2557,6 +2563,10 @@ void sync_signalhandler ( Int sigNo,
    } else {
       sync_signalhandler_from_kernel(tid, sigNo, info, uc);
    }
+
+   /* We're going back to the faulting instruction. */
+   if (in_parallel)
+      VG_(reenter_parallel_code)(tid);
 }
 
 
@@ -2669,9 +2679,12 @@ void VG_(poll_signals)(ThreadId tid)
       /* OK, something to do; deliver it */
       if (VG_(clo_trace_signals))
          VG_(dmsg)("Polling found signal %d for tid %d\n", sip->si_signo, tid);
-      if (!is_sig_ign(sip->si_signo, tid))
+      if (!is_sig_ign(sip->si_signo, tid)) {
+         /* Delivery may affect other threads (eg, by killing the
+            process), so make sure none is running in parallel. */
+         VG_(stop_the_world)();
 	 deliver_signal(tid, sip, NULL);
-      else if (VG_(clo_trace_signals))
+      } else if (VG_(clo_trace_signals))
          VG_(dmsg)("   signal %d ignored\n", sip->si_signo);
 	 
       sip->si_signo = 0;	/* remove from signal queue, if that's
@@ -97,7 +97,9 @@ VgNeeds VG_(needs) = {
    .var_info	         = False,
    .malloc_replacement   = False,
    .xml_output           = False,
-   .final_IR_tidy_pass   = False
+   .final_IR_tidy_pass   = False,
+   .reusable_translations = False,
+   .thread_safe_instrumentation = False
 };
 
 /* static */
@@ -353,6 +355,16 @@ void VG_(needs_final_IR_tidy_pass)(
    VG_(tdict).tool_final_IR_tidy_pass = final_tidy;
 }
 
+void VG_(needs_reusable_translations)( void )
+{
+   VG_(needs).reusable_translations = True;
+}
+
+void VG_(needs_thread_safe_instrumentation)( void )
+{
+   VG_(needs).thread_safe_instrumentation = True;
+}
+
 /*--------------------------------------------------------------------*/
 /* Tracked events.  Digit 'n' on DEFn is the REGPARMness. */
 
@@ -63,6 +63,13 @@
 
 #include "libvex_emnote.h"        // For PPC, EmWarn_PPC64_redir_underflow
 
+/* Vex's own copy of the VexControl given to LibVEX_Init
+   (VEX/priv/main_globals.c).  Vex has no call for changing it once
+   initialised, but traces need different chase settings from
+   ordinary translations, so VG_(translate) changes them around each
+   trace translation and then puts the user's settings back. */
+extern VexControl vex_control;
+
 /*------------------------------------------------------------*/
 /*--- Stats                                                ---*/
 /*------------------------------------------------------------*/
@@ -71,6 +78,15 @@ static UInt n_SP_updates_fast            = 0;
 static UInt n_SP_updates_generic_known   = 0;
 static UInt n_SP_updates_generic_unknown = 0;
 
+static ULong n_ahead_queued     = 0;
+static ULong n_ahead_translated = 0;
+static ULong n_ahead_present    = 0;
+static ULong n_ahead_refused    = 0;
+
+static ULong n_traces_made      = 0;
+static ULong n_traces_extended  = 0;
+static ULong n_traces_refused   = 0;
+
 void VG_(print_translation_stats) ( void )
 {
    HChar buf[7];
@@ -90,6 +106,19 @@ void VG_(print_translation_stats) ( void )
    VG_(message)(Vg_DebugMsg,
       "translate: generic_unknown SP updates identified: %'u (%s)\n",
       n_SP_updates_generic_unknown, buf );
+
+   if (VG_(clo_translate_ahead) > 0)
+      VG_(message)(Vg_DebugMsg,
+         "translate: ahead: %'llu queued, %'llu translated, "
+         "%'llu already done, %'llu refused\n",
+         n_ahead_queued, n_ahead_translated,
+         n_ahead_present, n_ahead_refused );
+
+   if (VG_(clo_retranslate_hot_sbs) > 0)
+      VG_(message)(Vg_DebugMsg,
+         "translate: traces: %'llu made (%'llu spanning several blocks), "
+         "%'llu refused\n",
+         n_traces_made, n_traces_extended, n_traces_refused );
 }
 
 /*------------------------------------------------------------*/
@@ -852,6 +881,10 @@ static UInt needs_self_check ( void* closureV,
    Chasing across them obviously defeats the redirect mechanism, with
    bad effects for Memcheck, Helgrind, DRD, Massif, and possibly others.
 */
+/* True while re-translating a hot superblock as a trace.  Only used
+   with --retranslate-hot-sbs. */
+static Bool translating_trace = False;
+
 static Bool chase_into_ok ( void* closureV, Addr64 addr64 )
 {
    Addr               addr    = (Addr)addr64;
@@ -895,6 +928,14 @@ static Bool chase_into_ok ( void* closureV, Addr64 addr64 )
      goto dontchase;
 #  endif
 
+   /* A trace is translated with Vex asking about every chase it could
+      make, including across conditional branches (see
+      VG_(translate)).  It follows only successors which are themselves
+      hot. */
+   if (translating_trace
+       && VG_(get_SB_count)(addr64) < VG_(clo_retranslate_hot_sbs) / 2)
+      goto dontchase;
+
    /* well, ok then.  go on and chase. */
    return True;
 
@@ -907,6 +948,35 @@ static Bool chase_into_ok ( void* closureV, Addr64 addr64 )
 }
 
 
+/* --------------- persistent translation helpers --------------- */
+
+/* Does the translation of vge need gdbserver instrumentation?  If so,
+   it cannot be saved for, nor taken from, the persistent translation
+   cache. */
+static Bool needs_gdbserver_instrumentation ( VexGuestExtents* vge )
+{
+   return VG_(clo_vgdb) != Vg_VgdbNo
+          && VG_(gdbserver_instrumentation_needed)( vge ) != Vg_VgdbNo;
+}
+
+/* Would a translation of vge made right now come out the same as one
+   saved from an earlier run?  The guest code is known to be the same,
+   so it remains to check that none of the decisions taken by the
+   callbacks above would be different. */
+static Bool saved_translation_usable ( VgCallbackClosure* closure,
+                                       VexGuestExtents* vge )
+{
+   UInt i;
+   if (needs_self_check( closure, vge ) != 0)
+      return False;
+   for (i = 1; i < vge->n_used; i++) {
+      if (!chase_into_ok( closure, vge->base[i] ))
+         return False;
+   }
+   return !needs_gdbserver_instrumentation( vge );
+}
+
+
 /* --------------- helpers for with-TOC platforms --------------- */
 
 /* NOTE: with-TOC platforms are: ppc64-linux. */
@@ -1299,6 +1369,134 @@ static Bool const_True ( Addr64 guest_addr )
    return True;
 }
 
+/* --------------- translating ahead --------------- */
+
+/* With --translate-ahead=N, the constant jump targets of each block
+   translated on demand are noted, and after that translation the
+   scheduler calls VG_(translate_ahead) to translate up to N of them,
+   and in turn their successors, most recently noted first.  This
+   makes a thread entering new code come back to the scheduler less
+   often, and with --parallel-sched=yes it means that all threads are
+   stopped once for several translations rather than once for each.
+
+   These translations are speculative: the client may never go there,
+   so a target which can't be translated is quietly dropped, rather
+   than causing a fault as in VG_(translate). */
+
+/* Max number of targets noted for the block being translated. */
+#define N_SUCCS 4
+
+/* Max number of targets waiting to be translated.  When full, the
+   oldest ones are forgotten. */
+#define N_AHEAD 64
+
+static Addr64 succs[N_SUCCS];
+static Int    n_succs = 0;
+
+static Addr64 ahead[N_AHEAD];
+static Int    ahead_next = 0;   /* where the next one goes */
+static Int    ahead_used = 0;
+
+/* True while translating a block speculatively. */
+static Bool   translating_ahead = False;
+
+static void note_succ ( IRConst* con, IRJumpKind jk )
+{
+   Addr64 a;
+
+   if (jk != Ijk_Boring && jk != Ijk_Call)
+      return;
+   switch (con->tag) {
+      case Ico_U32: a = (Addr64)con->Ico.U32; break;
+      case Ico_U64: a = con->Ico.U64; break;
+      default: return;
+   }
+   if (n_succs < N_SUCCS)
+      succs[n_succs++] = a;
+}
+
+/* Instrumentation callback used instead of the tool's (or
+   gdbserver's) one, which first notes the block's successors. */
+static
+IRSB* note_succs_then_instrument ( VgCallbackClosure* closureV,
+                                   IRSB*              sb_in,
+                                   VexGuestLayout*    layout,
+                                   VexGuestExtents*   vge,
+                                   VexArchInfo*       vai,
+                                   IRType             gWordTy,
+                                   IRType             hWordTy )
+{
+   Int i;
+
+   /* Fall-through last, so that it is translated first. */
+   for (i = 0; i < sb_in->stmts_used; i++) {
+      IRStmt* st = sb_in->stmts[i];
+      if (st && st->tag == Ist_Exit)
+         note_succ(st->Ist.Exit.dst, st->Ist.Exit.jk);
+   }
+   if (sb_in->next->tag == Iex_Const)
+      note_succ(sb_in->next->Iex.Const.con, sb_in->jumpkind);
+
+   return (VG_(clo_vgdb) != Vg_VgdbNo
+              ? tool_instrument_then_gdbserver_if_needed
+              : VG_(tdict).tool_instrument)
+          (closureV, sb_in, layout, vge, vai, gWordTy, hWordTy);
+}
+
+/* Queue up the successors noted while translating a block. */
+static void queue_succs ( void )
+{
+   Int i;
+
+   for (i = 0; i < n_succs; i++) {
+      ahead[ahead_next] = succs[i];
+      ahead_next = (ahead_next + 1) % N_AHEAD;
+      if (ahead_used < N_AHEAD)
+         ahead_used++;
+      n_ahead_queued++;
+   }
+   n_succs = 0;
+}
+
+void VG_(translate_ahead) ( ThreadId tid, ULong bbs_done )
+{
+   UInt n_done = 0;
+
+   if (VG_(clo_translate_ahead) == 0)
+      return;
+   vg_assert(!translating_ahead);
+
+   translating_ahead = True;
+   while (n_done < VG_(clo_translate_ahead) && ahead_used > 0) {
+      Addr64 a;
+      ahead_next = (ahead_next + N_AHEAD - 1) % N_AHEAD;
+      ahead_used--;
+      a = ahead[ahead_next];
+      if (VG_(search_transtab)( NULL, NULL, NULL, a, False )) {
+         n_ahead_present++;
+         continue;
+      }
+      if (VG_(translate)( tid, a, /*debug*/False, 0/*not verbose*/,
+                          bbs_done, True/*allow redirection*/ )) {
+         n_ahead_translated++;
+         n_done++;
+      } else {
+         n_ahead_refused++;
+      }
+   }
+   translating_ahead = False;
+}
+
+/* Is it safe to read guest code at addr without the client having
+   gone there?  Vex may read up to guest_max_insns instructions from
+   it, so they must all be in seg. */
+static Bool ahead_ok_in_seg ( NSegment const* seg, Addr64 addr )
+{
+   Addr64 max_len = 16 * (Addr64)VG_(clo_vex_control).guest_max_insns;
+   return addr + max_len - 1 <= (Addr64)seg->end;
+}
+
+
 /* --------------- main translation function --------------- */
 
 /* Note: see comments at top of m_redir.c for the Big Picture on how
@@ -1347,6 +1545,7 @@ Bool VG_(translate) ( ThreadId tid,
    VexTranslateArgs   vta;
    VexTranslateResult tres;
    VgCallbackClosure  closure;
+   VexControl         saved_vex_control;
 
    /* Make sure Vex is initialised right. */
 
@@ -1399,7 +1598,7 @@ Bool VG_(translate) ( ThreadId tid,
                    addr, name2 );
    }
 
-   if (!debugging_translation)
+   if (!debugging_translation && !translating_ahead && !translating_trace)
       VG_TRACK( pre_mem_read, Vg_CoreTranslate, 
                               tid, "(translator)", addr, 1 );
 
@@ -1427,6 +1626,12 @@ Bool VG_(translate) ( ThreadId tid,
    { /* BEGIN new scope specially for 'seg' */
    NSegment const* seg = VG_(am_find_nsegment)(addr);
 
+   if ((translating_ahead || translating_trace)
+       && ( (!translations_allowable_from_seg(seg, addr))
+            || addr == TRANSTAB_BOGUS_GUEST_ADDR
+            || (translating_ahead && !ahead_ok_in_seg(seg, addr)) ))
+      return False;
+
    if ( (!translations_allowable_from_seg(seg, addr))
         || addr == TRANSTAB_BOGUS_GUEST_ADDR ) {
       if (VG_(clo_trace_signals))
@@ -1524,6 +1729,34 @@ Bool VG_(translate) ( ThreadId tid,
    closure.nraddr = nraddr;
    closure.readdr = addr;
 
+   /* Try to use a translation saved by an earlier run, if this one is
+      not for debugging or profiling. */
+   if (!debugging_translation && verbosity == 0 && kind != T_NoRedir
+       && !VG_(clo_profyle_sbs) && VG_(clo_hot_transtab_sectors) == 0
+       && VG_(clo_retranslate_hot_sbs) == 0) {
+      AddrH saved_code;
+      UInt  saved_code_len, saved_n_guest_instrs;
+      if (VG_(search_persistent_transtab)( &vge, &saved_code,
+                                           &saved_code_len,
+                                           &saved_n_guest_instrs,
+                                           nraddr, (UInt)kind )
+          && vge.base[0] == (Addr64)addr
+          && saved_translation_usable( &closure, &vge )) {
+         for (i = 0; i < vge.n_used; i++) {
+            NSegment const* segi = i == 0 ? seg
+                                   : VG_(am_find_nsegment)( vge.base[i] );
+            VG_(am_set_segment_hasT_if_SkFileC_or_SkAnonC)( segi );
+         }
+         VG_(add_to_transtab)( &vge, nraddr, saved_code, saved_code_len,
+                               False, -1, saved_n_guest_instrs, False,
+                               vex_arch );
+         VG_(add_to_persistent_transtab)( &vge, nraddr, (UInt)kind,
+                                          saved_code, saved_code_len,
+                                          saved_n_guest_instrs );
+         return True;
+      }
+   }
+
    /* Set up args for LibVEX_Translate. */
    vta.arch_guest       = vex_arch;
    vta.archinfo_guest   = vex_archinfo;
@@ -1547,7 +1780,10 @@ Bool VG_(translate) ( ThreadId tid,
      IRSB*(*f)(VgCallbackClosure*,
                IRSB*,VexGuestLayout*,VexGuestExtents*, VexArchInfo*,
                IRType,IRType)
-        = VG_(clo_vgdb) != Vg_VgdbNo
+        = VG_(clo_translate_ahead) > 0 && allow_redirection
+          && !debugging_translation
+             ? note_succs_then_instrument
+             : VG_(clo_vgdb) != Vg_VgdbNo
              ? tool_instrument_then_gdbserver_if_needed
              : VG_(tdict).tool_instrument;
      IRSB*(*g)(void*,
@@ -1568,7 +1804,10 @@ Bool VG_(translate) ( ThreadId tid,
    vta.preamble_function = preamble_fn;
    vta.traceflags        = verbosity;
    vta.sigill_diag       = VG_(clo_sigill_diag);
-   vta.addProfInc        = VG_(clo_profyle_sbs) && kind != T_NoRedir;
+   vta.addProfInc        = (VG_(clo_profyle_sbs)
+                            || VG_(clo_hot_transtab_sectors) > 0
+                            || VG_(clo_retranslate_hot_sbs) > 0)
+                           && kind != T_NoRedir;
 
    /* Set up the dispatch continuation-point info.  If this is a
       no-redir translation then it cannot be chained, and the chain-me
@@ -1598,8 +1837,22 @@ Bool VG_(translate) ( ThreadId tid,
    vta.disp_cp_xassisted
       = VG_(fnptr_to_fnentry)( &VG_(disp_cp_xassisted) );
 
+   /* A trace replaces the existing translation.  That has to go
+      before instrumenting, since tools may keep per-superblock info
+      and expect to be told of its discard before it is made again. */
+   if (translating_trace && !debugging_translation)
+      VG_(discard_translation_of_entry)( nraddr );
+
    /* Sheesh.  Finally, actually _do_ the translation! */
+   n_succs = 0;
+   if (translating_trace) {
+      saved_vex_control = vex_control;
+      vex_control.guest_chase_thresh = vex_control.guest_max_insns - 1;
+      vex_control.guest_chase_cond   = True;
+   }
    tres = LibVEX_Translate ( &vta );
+   if (translating_trace)
+      vex_control = saved_vex_control;
 
    vg_assert(tres.status == VexTransOK);
    vg_assert(tres.n_sc_extents >= 0 && tres.n_sc_extents <= 3);
@@ -1642,7 +1895,19 @@ Bool VG_(translate) ( ThreadId tid,
                                 tres.n_sc_extents > 0,
                                 tres.offs_profInc,
                                 tres.n_guest_instrs,
+                                translating_trace,
                                 vex_arch );
+          if (translating_trace && vge.n_used > 1)
+             n_traces_extended++;
+          if (tres.n_sc_extents == 0 && tres.offs_profInc == -1
+              && !needs_gdbserver_instrumentation( &vge ))
+             VG_(add_to_persistent_transtab)( &vge,
+                                              nraddr,
+                                              (UInt)kind,
+                                              (Addr)(&tmpbuf[0]),
+                                              tmpbuf_used,
+                                              tres.n_guest_instrs );
+          queue_succs();
       } else {
           vg_assert(tres.offs_profInc == -1); /* -1 == unset */
           VG_(add_to_unredir_transtab)( &vge,
@@ -1655,6 +1920,33 @@ Bool VG_(translate) ( ThreadId tid,
    return True;
 }
 
+
+/* --------------- re-translating hot blocks --------------- */
+
+/* Max number of hot blocks re-translated per call. */
+#define N_HOT_SBS 32
+
+void VG_(retranslate_hot_SBs) ( ThreadId tid, ULong bbs_done )
+{
+   Addr64 hot[N_HOT_SBS];
+   UInt   i, n;
+
+   if (VG_(clo_retranslate_hot_sbs) == 0)
+      return;
+   vg_assert(!translating_trace);
+
+   n = VG_(get_hot_SBs)( hot, N_HOT_SBS, VG_(clo_retranslate_hot_sbs) );
+   translating_trace = True;
+   for (i = 0; i < n; i++) {
+      if (VG_(translate)( tid, hot[i], /*debug*/False, 0/*not verbose*/,
+                          bbs_done, True/*allow redirection*/ ))
+         n_traces_made++;
+      else
+         n_traces_refused++;
+   }
+   translating_trace = False;
+}
+
 /*--------------------------------------------------------------------*/
 /*--- end                                                          ---*/
 /*--------------------------------------------------------------------*/
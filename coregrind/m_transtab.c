@@ -44,6 +44,9 @@
 #include "pub_core_mallocfree.h" // VG_(out_of_memory_NORETURN)
 #include "pub_core_xarray.h"
 #include "pub_core_dispatch.h"   // For VG_(disp_cp*) addresses
+#include "pub_core_libcfile.h"   // For the persistent translation cache
+#include "pub_core_clientstate.h" // VG_(args_for_valgrind)
+#include "pub_core_oset.h"
 
 
 #define DEBUG_TRANSTAB 0
@@ -59,6 +62,13 @@ UInt VG_(clo_num_transtab_sectors) = N_SECTORS_DEFAULT;
    Will be set by VG_(init_tt_tc) to VG_(clo_num_transtab_sectors). */
 static UInt n_sectors = 0;
 
+/* Nr of those sectors which hold only hot translations, provided via
+   command line parameter.  0 means no generational scheme. */
+UInt VG_(clo_hot_transtab_sectors) = 0;
+/* Set by VG_(init_tt_tc) to VG_(clo_hot_transtab_sectors).  The hot
+   sectors are the last n_hot_sectors of the n_sectors. */
+static UInt n_hot_sectors = 0;
+
 /*------------------ CONSTANTS ------------------*/
 /* Number of TC entries in each sector.  This needs to be a prime
    number to work properly, it must be <= 65535 (so that a TT index
@@ -144,6 +154,16 @@ typedef
       ULong    count;
       UShort   weight;
 
+      /* Offset in the host code of the profile counter increment, or
+         -1 if there is none.  Needed to re-point the increment at
+         .count if the translation is moved to a hot sector. */
+      Int      offs_profInc;
+
+      /* True if this is a trace made by re-translating a hot
+         superblock (--retranslate-hot-sbs), or if it has already been
+         picked for that.  Either way, it is not picked again. */
+      Bool     is_trace;
+
       /* Status of the slot.  Note, we need to be able to do lazy
          deletion, hence the Deleted state. */
       enum { InUse, Deleted, Empty } status;
@@ -293,6 +313,16 @@ typedef
    }
    HostExtent;
 
+/* An entry in a sector's guest_index: one of the guest code extents
+   of one of its translations. */
+typedef
+   struct {
+      Addr64 start;
+      UInt   tteNo;
+      UShort len;
+   }
+   GuestExtentRef;
+
 /* Finally, a sector itself.  Each sector contains an array of
    TCEntries, which hold code, and an array of TTEntries, containing
    all required administrative info.  Profiling is supported using the
@@ -309,6 +339,10 @@ typedef
          its load limit (SECTOR_TT_LIMIT_PERCENT). */
       ULong* tc;
 
+      /* The number of ULongs in tc.  This is tc_sector_szQ as it was
+         when tc was allocated. */
+      Int tc_szQ;
+
       /* The TTEntry array.  This is a fixed size, always containing
          exactly N_TTES_PER_SECTOR entries. */
       TTEntry* tt;
@@ -331,6 +365,16 @@ typedef
          in strictly non-overlapping order, so we can binary search
          them at any time. */
       XArray* host_extents; /* XArray* of HostExtent */
+
+      /* The guest extents of all InUse translations, ordered by start
+         address, so that discarding a range of guest code need only
+         look at the translations which intersect it.  This is only
+         built, by delete_translations_in_sector, when a discard needs
+         it, and is then kept up to date until the sector is recycled.
+         NULL if not built.  guest_index_maxlen is the length of the
+         longest extent in it. */
+      OSet*   guest_index; /* OSet* of GuestExtentRef */
+      UShort  guest_index_maxlen;
    }
    Sector;
 
@@ -348,14 +392,38 @@ typedef
    When running, youngest sector should be between >= 0 and <
    N_TC_SECTORS.  The initial -1 value indicates the TT/TC system is
    not yet initialised. 
+
+   If there are hot sectors, the round robin above only involves the
+   other sectors.  When one of those is recycled, its translations
+   that have been executed at least HOT_TTE_MIN_COUNT times are moved
+   to youngest_hot_sector rather than thrown away.  The hot sectors
+   are themselves filled and recycled round robin, but, since only a
+   small fraction of translations get that far, much more slowly.
+   youngest_hot_sector is -1 if there are no hot sectors.
 */
 static Sector sectors[MAX_N_SECTORS];
 static Int    youngest_sector = -1;
+static Int    youngest_hot_sector = -1;
 
-/* The number of ULongs in each TCEntry area.  This is computed once
-   at startup and does not change. */
+#define HOT_TTE_MIN_COUNT 1000
+
+/* The number of ULongs in each TCEntry area allocated from now on.
+   This is computed at startup from the tool's estimate of the average
+   translation size, and then adjusted to the code actually generated,
+   each time a sector becomes full. */
 static Int    tc_sector_szQ = 0;
 
+/* The startup value of tc_sector_szQ; adjustments stay within a
+   factor of 4 of it. */
+static Int    tc_sector_szQ_initial = 0;
+
+/* Guest entry points of translations recently thrown out for lack of
+   space, so that we can count how often such a translation has to be
+   made again.  Direct-mapped and lossy, so the count is a lower
+   bound. */
+#define N_EVICTED_ENTRIES 16384
+static Addr64 evicted_entries[N_EVICTED_ENTRIES];
+
 
 /* A list of sector numbers, in the order which they should be
    searched to find translations.  This is an optimisation to be used
@@ -389,6 +457,14 @@ typedef
 /*global*/ __attribute__((aligned(16)))
            FastCacheEntry VG_(tt_fast)[VG_TT_FAST_SIZE];
 
+/* The second way of the fast cache.  The dispatchers only look in
+   VG_(tt_fast), which is way 0; an entry pushed out of there by a
+   colliding one moves here, and VG_(search_transtab) looks here
+   before doing a full lookup, swapping the two back on a hit.  So two
+   hot blocks whose addresses collide cost a cheap swap each time
+   rather than a full lookup. */
+static FastCacheEntry tt_fast_way1[VG_TT_FAST_SIZE];
+
 /* Make sure we're not used before initialisation. */
 static Bool init_done = False;
 
@@ -399,6 +475,12 @@ static Bool init_done = False;
 static ULong n_fast_flushes = 0;
 static ULong n_fast_updates = 0;
 
+/* Number of lookups after misses in way 0 of the fast cache, of those
+   found in way 1, and of single fast-cache entries invalidated. */
+static ULong n_fast_misses     = 0;
+static ULong n_fast_way1_hits  = 0;
+static ULong n_fast_inv_single = 0;
+
 /* Number of full lookups done. */
 static ULong n_full_lookups = 0;
 static ULong n_lookup_probes = 0;
@@ -418,6 +500,22 @@ static ULong n_dump_osize = 0;
 static ULong n_disc_count = 0;
 static ULong n_disc_osize = 0;
 
+/* Number of guest indexes built, and of their entries visited by
+   discards. */
+static ULong n_gindex_builds = 0;
+static ULong n_gindex_visits = 0;
+
+/* Number/osize of translations moved to a hot sector rather than
+   being dumped. */
+static ULong n_promo_count = 0;
+static ULong n_promo_osize = 0;
+
+/* Number of dumped translations made again later. */
+static ULong n_retrans_count = 0;
+
+/* Number of changes to tc_sector_szQ. */
+static ULong n_tc_resizes = 0;
+
 
 /*-------------------------------------------------------------*/
 /*--- Misc                                                  ---*/
@@ -866,10 +964,13 @@ static void unchain_one ( VexArch vex_arch,
 
 /* The specified block is about to be deleted.  Update the preds and
    succs of its associated blocks accordingly.  This includes undoing
-   any chained jumps to this block. */
+   any chained jumps to this block.  If and_exits, also undo the
+   chained jumps from this block, so that its code can be copied
+   elsewhere. */
 static
 void unchain_in_preparation_for_deletion ( VexArch vex_arch,
-                                           UInt here_sNo, UInt here_tteNo )
+                                           UInt here_sNo, UInt here_tteNo,
+                                           Bool and_exits )
 {
    if (DEBUG_TRANSTAB)
       VG_(printf)("QQQ unchain_in_prep %u.%u...\n", here_sNo, here_tteNo);
@@ -920,6 +1021,12 @@ void unchain_in_preparation_for_deletion ( VexArch vex_arch,
            break;
       }
       vg_assert(j < m); // "ie must be findable"
+      if (and_exits) {
+         UChar* to_slow_EP = (UChar*)to_tte->tcptr;
+         UChar* to_fast_EP = to_slow_EP + evCheckSzB;
+         unchain_one(vex_arch, InEdgeArr__index(&to_tte->in_edges, j),
+                     to_fast_EP, to_slow_EP);
+      }
       InEdgeArr__deleteIndex(&to_tte->in_edges, j);
    }
 
@@ -1093,7 +1200,7 @@ static Bool sanity_check_eclasses_in_sector ( Sector* sec )
    if (sec->tt_n_inuse < 0 || sec->tt_n_inuse > N_TTES_PER_SECTOR_USABLE)
       BAD("invalid sec->tt_n_inuse");
    tce = sec->tc_next;
-   if (tce < &sec->tc[0] || tce > &sec->tc[tc_sector_szQ])
+   if (tce < &sec->tc[0] || tce > &sec->tc[sec->tc_szQ])
       BAD("sec->tc_next points outside tc");
 
    /* For each eclass ... */
@@ -1320,6 +1427,13 @@ static inline UInt HASH_TT ( Addr64 key )
 static void setFastCacheEntry ( Addr64 key, ULong* tcptr )
 {
    UInt cno = (UInt)VG_TT_FAST_HASH(key);
+   if (VG_(tt_fast)[cno].guest != (Addr)key
+       && VG_(tt_fast)[cno].guest != TRANSTAB_BOGUS_GUEST_ADDR) {
+      /* Keep the entry being displaced in way 1. */
+      tt_fast_way1[cno] = VG_(tt_fast)[cno];
+   } else if (tt_fast_way1[cno].guest == (Addr)key) {
+      tt_fast_way1[cno].guest = TRANSTAB_BOGUS_GUEST_ADDR;
+   }
    VG_(tt_fast)[cno].guest = (Addr)key;
    VG_(tt_fast)[cno].host  = (Addr)tcptr;
    n_fast_updates++;
@@ -1344,9 +1458,362 @@ static void invalidateFastCache ( void )
    }
 
    vg_assert(j == VG_TT_FAST_SIZE);
+   for (j = 0; j < VG_TT_FAST_SIZE; j++)
+      tt_fast_way1[j].guest = TRANSTAB_BOGUS_GUEST_ADDR;
    n_fast_flushes++;
 }
 
+/* Invalidate whichever fast cache entry, if any, maps key to
+   tcptr.  Since entries are only ever made for a translation's own
+   entry point, this is all that is needed when one translation is
+   deleted, and is much cheaper than invalidateFastCache. */
+static void invalidateFastCacheEntry ( Addr64 key, ULong* tcptr )
+{
+   UInt cno = (UInt)VG_TT_FAST_HASH(key);
+   if (VG_(tt_fast)[cno].guest == (Addr)key
+       && VG_(tt_fast)[cno].host == (Addr)tcptr) {
+      /* Let way 1 move up, so as not to lose it. */
+      VG_(tt_fast)[cno] = tt_fast_way1[cno];
+      tt_fast_way1[cno].guest = TRANSTAB_BOGUS_GUEST_ADDR;
+   }
+   else if (tt_fast_way1[cno].guest == (Addr)key
+            && tt_fast_way1[cno].host == (Addr)tcptr) {
+      tt_fast_way1[cno].guest = TRANSTAB_BOGUS_GUEST_ADDR;
+   }
+   n_fast_inv_single++;
+}
+
+static inline UInt evicted_slot ( Addr64 entry )
+{
+   return (UInt)(entry ^ (entry >> 14)) & (N_EVICTED_ENTRIES - 1);
+}
+
+/* Sector y has just been declared full.  If that happened well before
+   its TT reached its load limit, or its TC was still largely unused,
+   then the TC was the wrong size for the code actually being made.
+   Adjust tc_sector_szQ so that the TC and TT of sectors allocated or
+   recycled from now on fill up at about the same time. */
+static void adjust_tc_sector_size ( Int y )
+{
+   Sector* sec   = &sectors[y];
+   Long    usedQ = sec->tc_next - sec->tc;
+   Long    newQ;
+
+   /* Too few translations to say anything useful. */
+   if (sec->tt_n_inuse < N_TTES_PER_SECTOR_USABLE / 8)
+      return;
+
+   /* Scale up to a full TT, plus a little slack, and only move half
+      way there, so as not to overreact to one unusual sector. */
+   newQ = (usedQ * N_TTES_PER_SECTOR_USABLE) / sec->tt_n_inuse;
+   newQ += newQ / 16;
+   newQ = (tc_sector_szQ + newQ) / 2;
+
+   if (newQ < tc_sector_szQ_initial / 4)
+      newQ = tc_sector_szQ_initial / 4;
+   if (newQ > 4 * (Long)tc_sector_szQ_initial)
+      newQ = 4 * (Long)tc_sector_szQ_initial;
+   if (newQ < 2 * N_TTES_PER_SECTOR_USABLE)
+      newQ = 2 * N_TTES_PER_SECTOR_USABLE;
+   if (newQ > 100 * N_TTES_PER_SECTOR_USABLE)
+      newQ = 100 * N_TTES_PER_SECTOR_USABLE;
+
+   /* Resizing means remapping each TC as it is recycled, so don't
+      bother for small changes. */
+   if (newQ >= tc_sector_szQ - tc_sector_szQ / 8
+       && newQ <= tc_sector_szQ + tc_sector_szQ / 8)
+      return;
+
+   VG_(debugLog)(1,"transtab", "TC size for new sectors %d -> %d bytes\n",
+                   8 * tc_sector_szQ, 8 * (Int)newQ);
+   if (VG_(clo_stats))
+      VG_(dmsg)("transtab: " "TC size for new sectors %d -> %d bytes\n",
+                8 * tc_sector_szQ, 8 * (Int)newQ);
+   tc_sector_szQ = (Int)newQ;
+   n_tc_resizes++;
+}
+
+/* Maintenance of Sector.guest_index. */
+
+static Word GuestExtentRef__cmp ( const void* v1, const void* v2 )
+{
+   const GuestExtentRef* r1 = v1;
+   const GuestExtentRef* r2 = v2;
+   if (r1->start < r2->start) return -1;
+   if (r1->start > r2->start) return 1;
+   if (r1->tteNo < r2->tteNo) return -1;
+   if (r1->tteNo > r2->tteNo) return 1;
+   return 0;
+}
+
+static void guest_index_add ( /*MOD*/Sector* sec, UInt tteno )
+{
+   VexGuestExtents* vge = &sec->tt[tteno].vge;
+   UInt i;
+   for (i = 0; i < vge->n_used; i++) {
+      GuestExtentRef* ref
+         = VG_(OSetGen_AllocNode)(sec->guest_index, sizeof(GuestExtentRef));
+      ref->start = vge->base[i];
+      ref->tteNo = tteno;
+      ref->len   = vge->len[i];
+      VG_(OSetGen_Insert)(sec->guest_index, ref);
+      if (ref->len > sec->guest_index_maxlen)
+         sec->guest_index_maxlen = ref->len;
+   }
+}
+
+static void guest_index_remove ( /*MOD*/Sector* sec, UInt tteno )
+{
+   VexGuestExtents* vge = &sec->tt[tteno].vge;
+   GuestExtentRef   key;
+   UInt i;
+   for (i = 0; i < vge->n_used; i++) {
+      key.start = vge->base[i];
+      key.tteNo = tteno;
+      GuestExtentRef* ref = VG_(OSetGen_Remove)(sec->guest_index, &key);
+      vg_assert(ref);
+      VG_(OSetGen_FreeNode)(sec->guest_index, ref);
+   }
+}
+
+static void guest_index_build ( /*MOD*/Sector* sec )
+{
+   UInt i;
+   vg_assert(sec->guest_index == NULL);
+   sec->guest_index
+      = VG_(OSetGen_Create)( /*keyOff*/0, GuestExtentRef__cmp,
+                             ttaux_malloc, "transtab.guest_index",
+                             ttaux_free );
+   sec->guest_index_maxlen = 0;
+   for (i = 0; i < N_TTES_PER_SECTOR; i++) {
+      if (sec->tt[i].status == InUse)
+         guest_index_add(sec, i);
+   }
+   n_gindex_builds++;
+}
+
+static void guest_index_destroy ( /*MOD*/Sector* sec )
+{
+   if (sec->guest_index) {
+      VG_(OSetGen_Destroy)(sec->guest_index);
+      sec->guest_index = NULL;
+   }
+}
+
+
+static void initialiseSector ( Int sno );
+
+/* The profile counter increment Vex generates is the same in every
+   translation until LibVEX_PatchProfInc points it at the
+   translation's own counter, and LibVEX_PatchProfInc insists on
+   finding it unpatched.  So that promote_hot_translations can copy
+   code which has already been patched, keep the unpatched bytes of
+   the first increment seen: profInc_tmpl_len bytes, which start
+   profInc_tmpl_offs bytes from the increment's offs_profInc. */
+static UChar profInc_tmpl[64];
+static UInt  profInc_tmpl_len  = 0;
+static Int   profInc_tmpl_offs = 0;
+
+/* Copy a translation, temporarily in code[0 .. code_len-1], into
+   sector y, which must have room for it, and return the number of
+   the TTEntry made for it. */
+static UInt insert_translation ( Int              y,
+                                 VexGuestExtents* vge,
+                                 Addr64           entry,
+                                 UChar*           code,
+                                 UInt             code_len,
+                                 Int              offs_profInc,
+                                 UShort           weight,
+                                 Bool             is_trace,
+                                 VexArch          arch_host )
+{
+   Int    tcAvailQ, reqdQ, i;
+   ULong  *tcptr, *tcptr2;
+   UChar* srcP;
+   UChar* dstP;
+
+   reqdQ = (code_len + 7) >> 3;
+
+   /* Be sure ... */
+   tcAvailQ = ((ULong*)(&sectors[y].tc[sectors[y].tc_szQ]))
+              - ((ULong*)(sectors[y].tc_next));
+   vg_assert(tcAvailQ >= 0);
+   vg_assert(tcAvailQ <= sectors[y].tc_szQ);
+   vg_assert(tcAvailQ >= reqdQ);
+   vg_assert(sectors[y].tt_n_inuse < N_TTES_PER_SECTOR_USABLE);
+   vg_assert(sectors[y].tt_n_inuse >= 0);
+ 
+   /* Copy into tc. */
+   tcptr = sectors[y].tc_next;
+   vg_assert(tcptr >= &sectors[y].tc[0]);
+   vg_assert(tcptr <= &sectors[y].tc[sectors[y].tc_szQ]);
+
+   dstP = (UChar*)tcptr;
+   srcP = code;
+   VG_(memcpy)(dstP, srcP, code_len);
+   sectors[y].tc_next += reqdQ;
+   sectors[y].tt_n_inuse++;
+
+   /* more paranoia */
+   tcptr2 = sectors[y].tc_next;
+   vg_assert(tcptr2 >= &sectors[y].tc[0]);
+   vg_assert(tcptr2 <= &sectors[y].tc[sectors[y].tc_szQ]);
+
+   /* Find an empty tt slot, and use it.  There must be such a slot
+      since tt is never allowed to get completely full. */
+   i = HASH_TT(entry);
+   vg_assert(i >= 0 && i < N_TTES_PER_SECTOR);
+   while (True) {
+      if (sectors[y].tt[i].status == Empty
+          || sectors[y].tt[i].status == Deleted)
+         break;
+      i++;
+      if (i >= N_TTES_PER_SECTOR)
+         i = 0;
+   }
+
+   TTEntry__init(&sectors[y].tt[i]);
+   sectors[y].tt[i].status = InUse;
+   sectors[y].tt[i].tcptr  = tcptr;
+   sectors[y].tt[i].count  = 0;
+   sectors[y].tt[i].weight = weight;
+   sectors[y].tt[i].offs_profInc = offs_profInc;
+   sectors[y].tt[i].is_trace = is_trace;
+   sectors[y].tt[i].vge    = *vge;
+   sectors[y].tt[i].entry  = entry;
+
+   /* Patch in the profile counter location, if necessary. */
+   if (offs_profInc != -1) {
+      vg_assert(offs_profInc >= 0 && offs_profInc < code_len);
+      VexInvalRange vir
+         = LibVEX_PatchProfInc( arch_host,
+                                dstP + offs_profInc,
+                                &sectors[y].tt[i].count );
+      VG_(invalidate_icache)( (void*)vir.start, vir.len );
+      if (profInc_tmpl_len == 0) {
+         /* 'code' itself is still unpatched. */
+         profInc_tmpl_offs = (Int)((UChar*)vir.start
+                                   - (dstP + offs_profInc));
+         vg_assert(vir.len > 0 && vir.len <= sizeof(profInc_tmpl));
+         vg_assert(profInc_tmpl_offs >= -offs_profInc);
+         vg_assert(offs_profInc + profInc_tmpl_offs + vir.len <= code_len);
+         VG_(memcpy)(profInc_tmpl,
+                     code + offs_profInc + profInc_tmpl_offs, vir.len);
+         profInc_tmpl_len = vir.len;
+      }
+   }
+
+   VG_(invalidate_icache)( dstP, code_len );
+
+   /* Add this entry to the host_extents map, checking that we're
+      adding in order. */
+   { HostExtent hx;
+     hx.start = (UChar*)tcptr;
+     hx.len   = code_len;
+     hx.tteNo = i;
+     vg_assert(hx.len > 0); /* bsearch fails w/ zero length entries */
+     XArray* hx_array = sectors[y].host_extents;
+     vg_assert(hx_array);
+     Word n = VG_(sizeXA)(hx_array);
+     if (n > 0) {
+        HostExtent* hx_prev = (HostExtent*)VG_(indexXA)(hx_array, n-1);
+        vg_assert(hx_prev->start + hx_prev->len <= hx.start);
+     }
+     VG_(addToXA)(hx_array, &hx);
+     if (DEBUG_TRANSTAB)
+        VG_(printf)("... hx.start 0x%p hx.len %u sector %d ttslot %d\n",
+                    hx.start, hx.len, y, i);
+   }
+
+   /* Update the fast-cache. */
+   setFastCacheEntry( entry, tcptr );
+
+   /* Note the eclass numbers for this translation. */
+   upd_eclasses_after_add( &sectors[y], i );
+
+   if (sectors[y].guest_index)
+      guest_index_add( &sectors[y], i );
+
+   return (UInt)i;
+}
+
+/* Sector sno, which is not a hot sector, is about to be recycled.
+   Move those of its translations which are hot into the youngest hot
+   sector, so that they survive.  At most a quarter of a hot sector's
+   worth is moved, which limits the cost of doing this, and stops a
+   phase change which makes everything look hot from wiping out the
+   hot sectors at one go. */
+static void promote_hot_translations ( VexArch vex_arch, Int sno )
+{
+   Sector* sec = &sectors[sno];
+   Int     n_promoted = 0;
+   Word    i, n;
+
+   vg_assert(n_hot_sectors > 0);
+   vg_assert(sno < n_sectors - n_hot_sectors);
+
+   n = VG_(sizeXA)(sec->host_extents);
+   for (i = 0; i < n; i++) {
+      HostExtent hx = *(HostExtent*)VG_(indexXA)(sec->host_extents, i);
+      TTEntry*   tte = &sec->tt[hx.tteNo];
+      if (HostExtent__is_dead(&hx, sec) || tte->status != InUse)
+         continue;
+      if (tte->count < HOT_TTE_MIN_COUNT || tte->offs_profInc == -1)
+         continue;
+      if (n_promoted >= N_TTES_PER_SECTOR_USABLE / 4)
+         break;
+
+      /* Find room in the hot sectors, recycling the oldest if
+         needed.  Hot sectors have nowhere further to promote to. */
+      Int    h     = youngest_hot_sector;
+      Int    reqdQ = (hx.len + 7) >> 3;
+      if (sectors[h].tc == NULL)
+         initialiseSector(h);
+      if (sectors[h].tc_next + reqdQ > &sectors[h].tc[sectors[h].tc_szQ]
+          || sectors[h].tt_n_inuse >= N_TTES_PER_SECTOR_USABLE) {
+         youngest_hot_sector++;
+         if (youngest_hot_sector >= n_sectors)
+            youngest_hot_sector = n_sectors - n_hot_sectors;
+         h = youngest_hot_sector;
+         initialiseSector(h);
+      }
+
+      /* The code can only be copied once it no longer contains any
+         chained jumps, since those may be PC-relative.  Its profile
+         counter increment still refers to tte->count, so put back
+         the placeholder that insert_translation will patch to refer
+         to the new entry's count. */
+      unchain_in_preparation_for_deletion(vex_arch, sno, hx.tteNo, True);
+      vg_assert(profInc_tmpl_len > 0);
+      vg_assert(tte->offs_profInc + profInc_tmpl_offs + profInc_tmpl_len
+                <= hx.len);
+      UChar* code = ttaux_malloc("transtab.promote_hot_translations",
+                                 hx.len);
+      VG_(memcpy)(code, hx.start, hx.len);
+      VG_(memcpy)(code + tte->offs_profInc + profInc_tmpl_offs,
+                  profInc_tmpl, profInc_tmpl_len);
+      UInt hot_tteNo
+         = insert_translation( h, &tte->vge, tte->entry, code, hx.len,
+                               tte->offs_profInc, tte->weight,
+                               tte->is_trace, vex_arch );
+      ttaux_free(code);
+      sectors[h].tt[hot_tteNo].count = tte->count;
+
+      n_promo_count++;
+      n_promo_osize += vge_osize(&tte->vge);
+      n_promoted++;
+
+      /* The old copy is now simply forgotten.  Its eclass entries go
+         when the sector's eclass structures are freed. */
+      tte->status   = Empty;
+      tte->n_tte2ec = 0;
+      sec->tt_n_inuse--;
+   }
+
+   VG_(debugLog)(1,"transtab", "promoted %d translations from sector %d\n",
+                   n_promoted, sno);
+}
+
 static void initialiseSector ( Int sno )
 {
    Int     i;
@@ -1384,6 +1851,7 @@ static void initialiseSector ( Int sno )
 	 /*NOTREACHED*/
       }
       sec->tc = (ULong*)(AddrH)sr_Res(sres);
+      sec->tc_szQ = tc_sector_szQ;
 
       sres = VG_(am_mmap_anon_float_valgrind)
                 ( N_TTES_PER_SECTOR * sizeof(TTEntry) );
@@ -1425,11 +1893,16 @@ static void initialiseSector ( Int sno )
 
       vg_assert(sec->tt != NULL);
       vg_assert(sec->tc_next != NULL);
-      n_dump_count += sec->tt_n_inuse;
 
       VexArch vex_arch = VexArch_INVALID;
       VG_(machine_get_VexArchInfo)( &vex_arch, NULL );
 
+      /* Save what is worth saving first. */
+      if (n_hot_sectors > 0 && sno < n_sectors - n_hot_sectors)
+         promote_hot_translations(vex_arch, sno);
+
+      n_dump_count += sec->tt_n_inuse;
+
       /* Visit each just-about-to-be-abandoned translation. */
       if (DEBUG_TRANSTAB) VG_(printf)("QQQ unlink-entire-sector: %d START\n",
                                       sno);
@@ -1438,13 +1911,15 @@ static void initialiseSector ( Int sno )
             vg_assert(sec->tt[i].n_tte2ec >= 1);
             vg_assert(sec->tt[i].n_tte2ec <= 3);
             n_dump_osize += vge_osize(&sec->tt[i].vge);
+            evicted_entries[evicted_slot(sec->tt[i].entry)]
+               = sec->tt[i].entry;
             /* Tell the tool too. */
             if (VG_(needs).superblock_discards) {
                VG_TDICT_CALL( tool_discard_superblock_info,
                               sec->tt[i].entry,
                               sec->tt[i].vge );
             }
-            unchain_in_preparation_for_deletion(vex_arch, sno, i);
+            unchain_in_preparation_for_deletion(vex_arch, sno, i, False);
          } else {
             vg_assert(sec->tt[i].n_tte2ec == 0);
          }
@@ -1473,6 +1948,24 @@ static void initialiseSector ( Int sno )
       VG_(dropTailXA)(sec->host_extents, VG_(sizeXA)(sec->host_extents));
       vg_assert(VG_(sizeXA)(sec->host_extents) == 0);
 
+      /* The guest index can be rebuilt if needed again. */
+      guest_index_destroy(sec);
+
+      /* Give the TC its new size, if that has changed since it was
+         allocated.  Nothing refers to the old code any more. */
+      if (sec->tc_szQ != tc_sector_szQ) {
+         sres = VG_(am_munmap_valgrind)( (Addr)sec->tc, 8 * sec->tc_szQ );
+         vg_assert(!sr_isError(sres));
+         sres = VG_(am_mmap_anon_float_valgrind)( 8 * tc_sector_szQ );
+         if (sr_isError(sres)) {
+            VG_(out_of_memory_NORETURN)("initialiseSector(TC)", 
+                                        8 * tc_sector_szQ );
+            /*NOTREACHED*/
+         }
+         sec->tc = (ULong*)(AddrH)sr_Res(sres);
+         sec->tc_szQ = tc_sector_szQ;
+      }
+
       /* Sanity check: ensure it is already in
          sector_search_order[]. */
       for (i = 0; i < n_sectors; i++) {
@@ -1497,7 +1990,8 @@ static void initialiseSector ( Int sno )
 
 
 /* Add a translation of vge to TT/TC.  The translation is temporarily
-   in code[0 .. code_len-1].
+   in code[0 .. code_len-1].  is_trace marks the translation as a
+   trace made by VG_(retranslate_hot_SBs).
 
    pre: youngest_sector points to a valid (although possibly full)
    sector.
@@ -1509,12 +2003,11 @@ void VG_(add_to_transtab)( VexGuestExtents* vge,
                            Bool             is_self_checking,
                            Int              offs_profInc,
                            UInt             n_guest_instrs,
+                           Bool             is_trace,
                            VexArch          arch_host )
 {
-   Int    tcAvailQ, reqdQ, y, i;
-   ULong  *tcptr, *tcptr2;
-   UChar* srcP;
-   UChar* dstP;
+   Int  tcAvailQ, reqdQ, y;
+   UInt e;
 
    vg_assert(init_done);
    vg_assert(vge->n_used >= 1 && vge->n_used <= 3);
@@ -1535,8 +2028,15 @@ void VG_(add_to_transtab)( VexGuestExtents* vge,
    if (is_self_checking)
       n_in_sc_count++;
 
+   e = evicted_slot(entry);
+   if (evicted_entries[e] == entry) {
+      n_retrans_count++;
+      evicted_entries[e] = TRANSTAB_BOGUS_GUEST_ADDR;
+   }
+
    y = youngest_sector;
    vg_assert(isValidSector(y));
+   vg_assert(y < n_sectors - n_hot_sectors);
 
    if (sectors[y].tc == NULL)
       initialiseSector(y);
@@ -1545,10 +2045,10 @@ void VG_(add_to_transtab)( VexGuestExtents* vge,
    reqdQ = (code_len + 7) >> 3;
 
    /* Will it fit in tc? */
-   tcAvailQ = ((ULong*)(&sectors[y].tc[tc_sector_szQ]))
+   tcAvailQ = ((ULong*)(&sectors[y].tc[sectors[y].tc_szQ]))
               - ((ULong*)(sectors[y].tc_next));
    vg_assert(tcAvailQ >= 0);
-   vg_assert(tcAvailQ <= tc_sector_szQ);
+   vg_assert(tcAvailQ <= sectors[y].tc_szQ);
 
    if (tcAvailQ < reqdQ 
        || sectors[y].tt_n_inuse >= N_TTES_PER_SECTOR_USABLE) {
@@ -1556,11 +2056,11 @@ void VG_(add_to_transtab)( VexGuestExtents* vge,
          used before, in which case it will get its tt/tc allocated
          now, or it has been used before, in which case it is set to be
          empty, hence throwing out the oldest sector. */
-      vg_assert(tc_sector_szQ > 0);
+      vg_assert(sectors[y].tc_szQ > 0);
       Int tt_loading_pct = (100 * sectors[y].tt_n_inuse) 
                            / N_TTES_PER_SECTOR;
-      Int tc_loading_pct = (100 * (tc_sector_szQ - tcAvailQ)) 
-                           / tc_sector_szQ;
+      Int tc_loading_pct = (100 * (sectors[y].tc_szQ - tcAvailQ)) 
+                           / sectors[y].tc_szQ;
       VG_(debugLog)(1,"transtab", 
                       "declare sector %d full "
                       "(TT loading %2d%%, TC loading %2d%%)\n",
@@ -1571,96 +2071,17 @@ void VG_(add_to_transtab)( VexGuestExtents* vge,
                    "(TT loading %2d%%, TC loading %2d%%)\n",
                    y, tt_loading_pct, tc_loading_pct);
       }
+      adjust_tc_sector_size(y);
       youngest_sector++;
-      if (youngest_sector >= n_sectors)
+      if (youngest_sector >= n_sectors - n_hot_sectors)
          youngest_sector = 0;
       y = youngest_sector;
       initialiseSector(y);
    }
 
-   /* Be sure ... */
-   tcAvailQ = ((ULong*)(&sectors[y].tc[tc_sector_szQ]))
-              - ((ULong*)(sectors[y].tc_next));
-   vg_assert(tcAvailQ >= 0);
-   vg_assert(tcAvailQ <= tc_sector_szQ);
-   vg_assert(tcAvailQ >= reqdQ);
-   vg_assert(sectors[y].tt_n_inuse < N_TTES_PER_SECTOR_USABLE);
-   vg_assert(sectors[y].tt_n_inuse >= 0);
- 
-   /* Copy into tc. */
-   tcptr = sectors[y].tc_next;
-   vg_assert(tcptr >= &sectors[y].tc[0]);
-   vg_assert(tcptr <= &sectors[y].tc[tc_sector_szQ]);
-
-   dstP = (UChar*)tcptr;
-   srcP = (UChar*)code;
-   VG_(memcpy)(dstP, srcP, code_len);
-   sectors[y].tc_next += reqdQ;
-   sectors[y].tt_n_inuse++;
-
-   /* more paranoia */
-   tcptr2 = sectors[y].tc_next;
-   vg_assert(tcptr2 >= &sectors[y].tc[0]);
-   vg_assert(tcptr2 <= &sectors[y].tc[tc_sector_szQ]);
-
-   /* Find an empty tt slot, and use it.  There must be such a slot
-      since tt is never allowed to get completely full. */
-   i = HASH_TT(entry);
-   vg_assert(i >= 0 && i < N_TTES_PER_SECTOR);
-   while (True) {
-      if (sectors[y].tt[i].status == Empty
-          || sectors[y].tt[i].status == Deleted)
-         break;
-      i++;
-      if (i >= N_TTES_PER_SECTOR)
-         i = 0;
-   }
-
-   TTEntry__init(&sectors[y].tt[i]);
-   sectors[y].tt[i].status = InUse;
-   sectors[y].tt[i].tcptr  = tcptr;
-   sectors[y].tt[i].count  = 0;
-   sectors[y].tt[i].weight = n_guest_instrs == 0 ? 1 : n_guest_instrs;
-   sectors[y].tt[i].vge    = *vge;
-   sectors[y].tt[i].entry  = entry;
-
-   /* Patch in the profile counter location, if necessary. */
-   if (offs_profInc != -1) {
-      vg_assert(offs_profInc >= 0 && offs_profInc < code_len);
-      VexInvalRange vir
-         = LibVEX_PatchProfInc( arch_host,
-                                dstP + offs_profInc,
-                                &sectors[y].tt[i].count );
-      VG_(invalidate_icache)( (void*)vir.start, vir.len );
-   }
-
-   VG_(invalidate_icache)( dstP, code_len );
-
-   /* Add this entry to the host_extents map, checking that we're
-      adding in order. */
-   { HostExtent hx;
-     hx.start = (UChar*)tcptr;
-     hx.len   = code_len;
-     hx.tteNo = i;
-     vg_assert(hx.len > 0); /* bsearch fails w/ zero length entries */
-     XArray* hx_array = sectors[y].host_extents;
-     vg_assert(hx_array);
-     Word n = VG_(sizeXA)(hx_array);
-     if (n > 0) {
-        HostExtent* hx_prev = (HostExtent*)VG_(indexXA)(hx_array, n-1);
-        vg_assert(hx_prev->start + hx_prev->len <= hx.start);
-     }
-     VG_(addToXA)(hx_array, &hx);
-     if (DEBUG_TRANSTAB)
-        VG_(printf)("... hx.start 0x%p hx.len %u sector %d ttslot %d\n",
-                    hx.start, hx.len, y, i);
-   }
-
-   /* Update the fast-cache. */
-   setFastCacheEntry( entry, tcptr );
-
-   /* Note the eclass numbers for this translation. */
-   upd_eclasses_after_add( &sectors[y], i );
+   insert_translation( y, vge, entry, (UChar*)code, code_len, offs_profInc,
+                       n_guest_instrs == 0 ? 1 : n_guest_instrs,
+                       is_trace, arch_host );
 }
 
 
@@ -1677,6 +2098,24 @@ Bool VG_(search_transtab) ( /*OUT*/AddrH* res_hcode,
    Int i, j, k, kstart, sno;
 
    vg_assert(init_done);
+
+   /* A fast cache miss, most likely.  If the caller only wants the
+      host address, see if it is in way 1 before doing it the hard
+      way. */
+   if (upd_cache && res_sNo == NULL && res_tteNo == NULL) {
+      UInt cno = (UInt)VG_TT_FAST_HASH(guest_addr);
+      n_fast_misses++;
+      if (tt_fast_way1[cno].guest == (Addr)guest_addr) {
+         FastCacheEntry tmp = VG_(tt_fast)[cno];
+         n_fast_way1_hits++;
+         if (res_hcode)
+            *res_hcode = (AddrH)tt_fast_way1[cno].host;
+         VG_(tt_fast)[cno] = tt_fast_way1[cno];
+         tt_fast_way1[cno] = tmp;
+         return True;
+      }
+   }
+
    /* Find the initial probe point just once.  It will be the same in
       all sectors and avoids multiple expensive % operations. */
    n_full_lookups++;
@@ -1789,7 +2228,10 @@ static void delete_tte ( /*MOD*/Sector* sec, UInt secNo, Int tteno,
    vg_assert(tte->n_tte2ec >= 1 && tte->n_tte2ec <= 3);
 
    /* Unchain .. */
-   unchain_in_preparation_for_deletion(vex_arch, secNo, tteno);
+   unchain_in_preparation_for_deletion(vex_arch, secNo, tteno, False);
+
+   if (sec->guest_index)
+      guest_index_remove(sec, tteno);
 
    /* Deal with the ec-to-tte links first. */
    for (i = 0; i < tte->n_tte2ec; i++) {
@@ -1804,9 +2246,11 @@ static void delete_tte ( /*MOD*/Sector* sec, UInt secNo, Int tteno,
       sec->ec2tte[ec_num][ec_idx] = EC2TTE_DELETED;
    }
 
-   /* Now fix up this TTEntry. */
+   /* Now fix up this TTEntry, and make sure the fast cache no longer
+      leads to it. */
    tte->status   = Deleted;
    tte->n_tte2ec = 0;
+   invalidateFastCacheEntry( tte->entry, tte->tcptr );
 
    /* Stats .. */
    sec->tt_n_inuse--;
@@ -1870,21 +2314,75 @@ Bool delete_translations_in_sector ( /*MOD*/Sector* sec, UInt secNo,
                                      Addr64 guest_start, ULong range,
                                      VexArch vex_arch )
 {
-   Int  i;
-   Bool anyDeld = False;
+   GuestExtentRef  key;
+   GuestExtentRef* ref;
+   Addr64 end = guest_start + range;
+   Word   i, n;
+   Bool   anyDeld = False;
+
+   if (end < guest_start)
+      end = ~(Addr64)0;
+
+   if (sec->guest_index == NULL)
+      guest_index_build(sec);
+
+   /* Find the translations with an extent starting at most
+      guest_index_maxlen before the range and before its end.  They
+      can't be deleted until the iteration is done, since that changes
+      the index. */
+   XArray* to_delete
+      = VG_(newXA)(ttaux_malloc, "transtab.delete_translations_in_sector",
+                   ttaux_free, sizeof(UInt));
+   key.start = guest_start > sec->guest_index_maxlen
+                  ? guest_start - sec->guest_index_maxlen : 0;
+   key.tteNo = 0;
+   VG_(OSetGen_ResetIterAt)(sec->guest_index, &key);
+   while ((ref = VG_(OSetGen_Next)(sec->guest_index)) != NULL
+          && ref->start < end) {
+      n_gindex_visits++;
+      if (ref->start + ref->len > guest_start) {
+         UInt tteNo = ref->tteNo;
+         VG_(addToXA)(to_delete, &tteNo);
+      }
+   }
 
-   for (i = 0; i < N_TTES_PER_SECTOR; i++) {
-      if (sec->tt[i].status == InUse
-          && overlaps( guest_start, range, &sec->tt[i].vge )) {
+   /* A translation may have more than one extent in the range. */
+   n = VG_(sizeXA)(to_delete);
+   for (i = 0; i < n; i++) {
+      UInt tteNo = *(UInt*)VG_(indexXA)(to_delete, i);
+      if (sec->tt[tteNo].status == InUse) {
+         vg_assert(overlaps( guest_start, range, &sec->tt[tteNo].vge ));
          anyDeld = True;
-         delete_tte( sec, secNo, i, vex_arch );
+         delete_tte( sec, secNo, tteNo, vex_arch );
       }
    }
+   VG_(deleteXA)(to_delete);
 
    return anyDeld;
 } 
 
 
+/* Check that every fast cache entry leads to the live translation of
+   its guest address.  Expensive. */
+static Bool sanity_check_fastcache ( void )
+{
+   UInt  j;
+   AddrH hcode;
+   for (j = 0; j < VG_TT_FAST_SIZE; j++) {
+      FastCacheEntry* e0 = &VG_(tt_fast)[j];
+      FastCacheEntry* e1 = &tt_fast_way1[j];
+      if (e0->guest != TRANSTAB_BOGUS_GUEST_ADDR
+          && (!VG_(search_transtab)( &hcode, NULL, NULL, e0->guest, False )
+              || hcode != e0->host))
+         return False;
+      if (e1->guest != TRANSTAB_BOGUS_GUEST_ADDR
+          && (!VG_(search_transtab)( &hcode, NULL, NULL, e1->guest, False )
+              || hcode != e1->host))
+         return False;
+   }
+   return True;
+}
+
 void VG_(discard_translations) ( Addr64 guest_start, ULong range,
                                  const HChar* who )
 {
@@ -1918,11 +2416,11 @@ void VG_(discard_translations) ( Addr64 guest_start, ULong range,
       that equivalence class, and also in the "sin-bin" equivalence
       class ECLASS_MISC.
 
-      Otherwise, the invalidation is of a larger range and probably
-      results from munmap.  In this case it's (probably!) faster just
-      to inspect all translations, dump those we don't want, and
-      regenerate the equivalence class information (since modifying it
-      in-situ is even more expensive).
+      Otherwise, the invalidation is of a larger range, resulting
+      from munmap, or from a JIT rewriting its code a page at a time.
+      Then we look up the affected translations in each sector's
+      guest_index, which is ordered by guest address, building it
+      first if necessary.
    */
 
    /* First off, figure out if the range falls within a single class, 
@@ -1975,8 +2473,13 @@ void VG_(discard_translations) ( Addr64 guest_start, ULong range,
 
    }
 
-   if (anyDeleted)
-      invalidateFastCache();
+   /* There is no need to invalidate the whole fast cache, since
+      delete_tte has removed the entries for the deleted translations
+      (and there are no others). */
+   if (anyDeleted && VG_(clo_sanity_level >= 4)) {
+      Bool sane = sanity_check_fastcache();
+      vg_assert(sane);
+   }
 
    /* don't forget the no-redir cache */
    unredir_discard_translations( guest_start, range );
@@ -2004,6 +2507,23 @@ void VG_(discard_translations) ( Addr64 guest_start, ULong range,
 }
 
 
+/* Discard just the translation whose entry point is 'entry', if
+   there is one, leaving any others covering the same code alone.
+   Used when a translation is about to be replaced by a better one. */
+void VG_(discard_translation_of_entry) ( Addr64 entry )
+{
+   UInt sno, tteno;
+
+   vg_assert(init_done);
+   if (!VG_(search_transtab)( NULL, &sno, &tteno, entry, False ))
+      return;
+
+   VexArch vex_arch = VexArch_INVALID;
+   VG_(machine_get_VexArchInfo)( &vex_arch, NULL );
+   delete_tte( &sectors[sno], sno, tteno, vex_arch );
+}
+
+
 /*------------------------------------------------------------*/
 /*--- AUXILIARY: the unredirected TT/TC                    ---*/
 /*------------------------------------------------------------*/
@@ -2168,6 +2688,537 @@ static void unredir_discard_translations( Addr64 guest_start, ULong range )
 }
 
 
+/*------------------------------------------------------------*/
+/*--- AUXILIARY: the persistent translation cache          ---*/
+/*------------------------------------------------------------*/
+
+/* With --persistent-transtab=<file>, each translation added to the
+   main TT/TC is also appended, in its pristine (unchained) form, to a
+   new version of <file>, which replaces the old one at exit.  At
+   startup the old <file>, if any, is mapped in and indexed, and
+   VG_(translate) consults it before asking Vex for a new
+   translation.
+
+   Saved translations are only valid for the same tool executable,
+   the same Valgrind and tool options, and the same host CPU
+   capabilities.  These are summarised in a 64-bit key held in the
+   file header; if the key does not match, or the file looks damaged
+   in any way, the whole file is ignored.  Each saved translation is
+   keyed on its (unredirected) guest entry address and carries a copy
+   of the guest bytes it was made from, which must match the current
+   contents of guest memory before the translation is reused.  Hence
+   reuse only happens if the client has exactly the same code at
+   exactly the same address as in the run that made the translation.
+   That is typically the case for non-PIE executables, and for all
+   code when address space randomisation is disabled.
+
+   Only tools which declare VG_(needs_reusable_translations) use
+   this, since the instrumented code must not refer to any data
+   allocated at run time.  Nor is it used if the tool tracks stack
+   allocation with ECUs, since VG_(translate) embeds the ECU of the
+   allocating code, which is only meaningful in the run that made
+   it, in the calls to those handlers. */
+
+#define PTT_MAGIC 0x3130305454504756ULL /* "VGPTT001" */
+
+typedef
+   struct {
+      ULong magic;
+      ULong key;    /* ptt_compute_key() of the run that wrote it */
+      ULong n_recs; /* number of PTTRecs following */
+      ULong szB;    /* total file size, including this header */
+   }
+   PTTHeader;
+
+/* A saved translation.  It is followed by the guest bytes, and then
+   the host code, each padded to a multiple of 8 bytes. */
+typedef
+   struct {
+      Addr64          entry;
+      VexGuestExtents vge;
+      UInt            flavour;   /* caller-defined translation kind */
+      UInt            n_guest_instrs;
+      UInt            guest_len; /* == vge_osize(&vge) */
+      UInt            code_len;
+   }
+   PTTRec;
+
+static inline SizeT PTTRec__szB ( const PTTRec* rec )
+{
+   return sizeof(PTTRec) + VG_ROUNDUP(rec->guest_len, 8)
+                         + VG_ROUNDUP(rec->code_len, 8);
+}
+
+/* The file saved by an earlier run, if any, and an open-addressing
+   hash table of the offsets of its records.  A zero entry denotes an
+   empty slot, which is unambiguous since no record starts at offset
+   zero. */
+static UChar* ptt_map        = NULL;
+static SizeT  ptt_map_szB    = 0;
+static UInt*  ptt_index      = NULL;
+static UInt   ptt_index_size = 0; /* a power of 2 */
+
+/* The file being written by this run.  It is written under a
+   temporary name and renamed at exit, so that concurrent runs never
+   see partially written files.  Only the process which opened it may
+   write to it; forked children leave it alone. */
+static ULong  ptt_key        = 0;
+static Int    ptt_out_fd     = -1;
+static Int    ptt_out_pid    = 0;
+static HChar* ptt_out_name   = NULL;
+static HChar* ptt_tmp_name   = NULL;
+static ULong  ptt_out_n_recs = 0;
+static ULong  ptt_out_szB    = 0;
+static OSet*  ptt_out_saved  = NULL; /* OSetWord of entries saved */
+
+#define PTT_OUTBUF_SZB 65536
+static UChar  ptt_outbuf[PTT_OUTBUF_SZB];
+static Int    ptt_outbuf_used = 0;
+
+/* Stats */
+static ULong n_ptt_loaded = 0;
+static ULong n_ptt_reused = 0;
+static ULong n_ptt_stale  = 0;
+static ULong n_ptt_saved  = 0;
+
+static inline UInt ptt_hash ( Addr64 entry )
+{
+   return (UInt)((entry * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static ULong ptt_hash_bytes ( ULong h, const void* p, SizeT n )
+{
+   const UChar* b = p;
+   SizeT i;
+   for (i = 0; i < n; i++) {
+      h ^= b[i];
+      h *= 0x100000001b3ULL;
+   }
+   return h;
+}
+
+/* Options which only affect what is printed, or where, and so can
+   differ between runs sharing translations.  Leading dashes are left
+   out. */
+static const HChar* ptt_output_opts[] = {
+   "q", "quiet", "v", "verbose", "d",
+   "stats=", "command-line-only=", "persistent-transtab=",
+   "log-fd=", "log-file=", "log-socket=",
+   "xml=", "xml-fd=", "xml-file=", "xml-socket=",
+   "xml-user-comment=", "time-stamp=", "error-limit=",
+   NULL
+};
+
+/* Can 'arg' change code generation or instrumentation, as far as we
+   can tell?  'tool' is the name given to --tool. */
+static Bool ptt_option_matters ( const HChar* arg, const HChar* tool )
+{
+   const HChar* name;
+   Int          i, len;
+
+   /* "--othertool:foo" is ignored; "--tool:foo" is just "--foo". */
+   for (name = arg; *name && *name != ':' && *name != '='; name++)
+      ;
+   if (*name == ':') {
+      len = VG_(strlen)(tool);
+      if (!VG_STREQN(2, arg, "--") || name - (arg + 2) != len
+          || !VG_STREQN(len, arg + 2, tool))
+         return False;
+      name++;
+   } else {
+      name = arg;
+   }
+   while (*name == '-')
+      name++;
+
+   for (i = 0; ptt_output_opts[i]; i++) {
+      len = VG_(strlen)(ptt_output_opts[i]);
+      if (ptt_output_opts[i][len-1] == '='
+          ? VG_STREQN(len, name, ptt_output_opts[i])
+          : VG_STREQ(name, ptt_output_opts[i]))
+         return False;
+   }
+   return True;
+}
+
+/* Compute the key which identifies runs whose translations are
+   interchangeable.  Returns 0 if that cannot be established. */
+static ULong ptt_compute_key ( void )
+{
+   ULong          h = 0xcbf29ce484222325ULL;
+   VexArch        vex_arch = VexArch_INVALID;
+   VexArchInfo    vex_archinfo;
+   struct vg_stat st;
+   SysRes         sres;
+   Int            i;
+   const HChar*   tool = "memcheck";
+
+   /* Helper function and dispatcher addresses are baked into the
+      generated code, so insist on the very same tool executable. */
+   sres = VG_(stat)("/proc/self/exe", &st);
+   if (sr_isError(sres))
+      return 0;
+   h = ptt_hash_bytes(h, &st.dev,   sizeof(st.dev));
+   h = ptt_hash_bytes(h, &st.ino,   sizeof(st.ino));
+   h = ptt_hash_bytes(h, &st.size,  sizeof(st.size));
+   h = ptt_hash_bytes(h, &st.mtime, sizeof(st.mtime));
+
+   h = ptt_hash_bytes(h, VG_(details).name, VG_(strlen)(VG_(details).name));
+
+   VG_(machine_get_VexArchInfo)( &vex_arch, &vex_archinfo );
+   h = ptt_hash_bytes(h, &vex_arch, sizeof(vex_arch));
+   h = ptt_hash_bytes(h, &vex_archinfo.hwcaps, sizeof(vex_archinfo.hwcaps));
+
+   /* Apart from those which only affect output, any option may affect
+      code generation or instrumentation, so take all of them into
+      account, including those from ~/.valgrindrc and $VALGRIND_OPTS. */
+   for (i = 0; i < VG_(sizeXA)( VG_(args_for_valgrind) ); i++) {
+      HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_valgrind), i );
+      if (VG_STREQN(7, arg, "--tool="))
+         tool = arg + 7;
+   }
+   for (i = 0; i < VG_(sizeXA)( VG_(args_for_valgrind) ); i++) {
+      HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_valgrind), i );
+      if (ptt_option_matters(arg, tool))
+         h = ptt_hash_bytes(h, arg, VG_(strlen)(arg) + 1);
+   }
+
+   return h == 0 ? 1 : h;
+}
+
+/* Check the mapped-in file is plausible and was written by a run
+   with the same key, and if so index its records. */
+static Bool ptt_index_file ( ULong key )
+{
+   const PTTHeader* hdr = (const PTTHeader*)ptt_map;
+   const PTTRec*    rec;
+   SizeT            off;
+   ULong            n_recs;
+   UInt             i, mask;
+
+   if (ptt_map_szB < sizeof(PTTHeader)
+       || hdr->magic != PTT_MAGIC || hdr->key != key
+       || hdr->szB != ptt_map_szB)
+      return False;
+
+   n_recs = 0;
+   for (off = sizeof(PTTHeader); off < ptt_map_szB; off += PTTRec__szB(rec)) {
+      if (ptt_map_szB - off < sizeof(PTTRec))
+         return False;
+      rec = (const PTTRec*)(ptt_map + off);
+      if (rec->vge.n_used < 1 || rec->vge.n_used > 3
+          || rec->code_len == 0 || rec->code_len >= 60000
+          || rec->guest_len != vge_osize((VexGuestExtents*)&rec->vge)
+          || PTTRec__szB(rec) > ptt_map_szB - off)
+         return False;
+      n_recs++;
+   }
+   if (n_recs != hdr->n_recs)
+      return False;
+
+   ptt_index_size = 16;
+   while (ptt_index_size < 2 * n_recs)
+      ptt_index_size *= 2;
+   ptt_index = ttaux_malloc("transtab.ptt_index_file",
+                            ptt_index_size * sizeof(UInt));
+   VG_(memset)(ptt_index, 0, ptt_index_size * sizeof(UInt));
+
+   mask = ptt_index_size - 1;
+   for (off = sizeof(PTTHeader); off < ptt_map_szB; off += PTTRec__szB(rec)) {
+      rec = (const PTTRec*)(ptt_map + off);
+      i = ptt_hash(rec->entry) & mask;
+      while (ptt_index[i] != 0)
+         i = (i + 1) & mask;
+      ptt_index[i] = (UInt)off;
+   }
+
+   n_ptt_loaded = n_recs;
+   return True;
+}
+
+static void ptt_load ( const HChar* name, ULong key )
+{
+   struct vg_stat st;
+   SysRes         sres;
+   Int            fd;
+
+   sres = VG_(open)(name, VKI_O_RDONLY, 0);
+   if (sr_isError(sres))
+      return; /* Nothing saved yet.  Not an error. */
+   fd = sr_Res(sres);
+
+   /* Offsets in ptt_index are 32 bits. */
+   if (VG_(fstat)(fd, &st) != 0 || st.size <= 0 || st.size >= 0x7FFFFFFF)
+      goto out;
+
+   sres = VG_(am_mmap_file_float_valgrind)( st.size, VKI_PROT_READ, fd, 0 );
+   if (sr_isError(sres))
+      goto out;
+   ptt_map     = (UChar*)(AddrH)sr_Res(sres);
+   ptt_map_szB = st.size;
+
+   if (!ptt_index_file(key)) {
+      if (VG_(clo_verbosity) > 1)
+         VG_(message)(Vg_UserMsg,
+                      "persistent-transtab: ignoring stale or damaged %s\n",
+                      name);
+      VG_(am_munmap_valgrind)( (Addr)ptt_map, ptt_map_szB );
+      ptt_map     = NULL;
+      ptt_map_szB = 0;
+   }
+
+  out:
+   VG_(close)(fd);
+}
+
+static void ptt_abandon_output ( void )
+{
+   vg_assert(ptt_out_fd >= 0);
+   VG_(message)(Vg_UserMsg,
+                "persistent-transtab: error writing %s; "
+                "translations will not be saved\n", ptt_tmp_name);
+   VG_(close)(ptt_out_fd);
+   VG_(unlink)(ptt_tmp_name);
+   ptt_out_fd = -1;
+}
+
+static void ptt_flush ( void )
+{
+   Int off = 0;
+   while (ptt_out_fd >= 0 && off < ptt_outbuf_used) {
+      Int n = VG_(write)(ptt_out_fd, &ptt_outbuf[off], ptt_outbuf_used - off);
+      if (n <= 0)
+         ptt_abandon_output();
+      else
+         off += n;
+   }
+   ptt_outbuf_used = 0;
+}
+
+static void ptt_emit ( const void* p, SizeT n )
+{
+   const UChar* b = p;
+   ptt_out_szB += n;
+   while (n > 0) {
+      SizeT chunk = PTT_OUTBUF_SZB - ptt_outbuf_used;
+      if (chunk > n)
+         chunk = n;
+      VG_(memcpy)(&ptt_outbuf[ptt_outbuf_used], b, chunk);
+      ptt_outbuf_used += chunk;
+      b += chunk;
+      n -= chunk;
+      if (ptt_outbuf_used == PTT_OUTBUF_SZB)
+         ptt_flush();
+   }
+}
+
+static void ptt_emit_padding ( SizeT n )
+{
+   static const UChar zeroes[8] = { 0 };
+   ptt_emit(zeroes, VG_ROUNDUP(n, 8) - n);
+}
+
+/* Will VG_(translate) embed ECUs in calls to the tool's stack
+   allocation handlers? */
+static Bool tool_tracks_new_mem_stack_w_ECU ( void )
+{
+   return VG_(tdict).track_new_mem_stack_4_w_ECU   != NULL
+          || VG_(tdict).track_new_mem_stack_8_w_ECU   != NULL
+          || VG_(tdict).track_new_mem_stack_12_w_ECU  != NULL
+          || VG_(tdict).track_new_mem_stack_16_w_ECU  != NULL
+          || VG_(tdict).track_new_mem_stack_32_w_ECU  != NULL
+          || VG_(tdict).track_new_mem_stack_112_w_ECU != NULL
+          || VG_(tdict).track_new_mem_stack_128_w_ECU != NULL
+          || VG_(tdict).track_new_mem_stack_144_w_ECU != NULL
+          || VG_(tdict).track_new_mem_stack_160_w_ECU != NULL
+          || VG_(tdict).track_new_mem_stack_w_ECU     != NULL;
+}
+
+static void init_persistent_transtab ( void )
+{
+   SysRes    sres;
+   PTTHeader hdr;
+
+   vg_assert(VG_(clo_persistent_transtab) != NULL);
+   vg_assert(sizeof(PTTRec) % 8 == 0);
+   vg_assert(sizeof(PTTHeader) % 8 == 0);
+
+   if (!VG_(needs).reusable_translations
+       || tool_tracks_new_mem_stack_w_ECU()) {
+      VG_(message)(Vg_UserMsg,
+                   "Warning: --persistent-transtab is not supported "
+                   "by this tool with these options; ignoring it\n");
+      return;
+   }
+
+   ptt_key = ptt_compute_key();
+   if (ptt_key == 0) {
+      VG_(message)(Vg_UserMsg,
+                   "Warning: cannot identify the tool executable; "
+                   "ignoring --persistent-transtab\n");
+      return;
+   }
+
+   ptt_out_name = VG_(expand_file_name)("--persistent-transtab",
+                                        VG_(clo_persistent_transtab));
+   ptt_load(ptt_out_name, ptt_key);
+
+   ptt_out_pid  = VG_(getpid)();
+   ptt_tmp_name = ttaux_malloc("transtab.init_persistent_transtab",
+                               VG_(strlen)(ptt_out_name) + 32);
+   VG_(sprintf)(ptt_tmp_name, "%s.tmp-%d", ptt_out_name, ptt_out_pid);
+   sres = VG_(open)(ptt_tmp_name, VKI_O_CREAT|VKI_O_WRONLY|VKI_O_TRUNC,
+                                  VKI_S_IRUSR|VKI_S_IWUSR);
+   if (sr_isError(sres)) {
+      VG_(message)(Vg_UserMsg,
+                   "Warning: cannot create %s; "
+                   "translations will not be saved\n", ptt_tmp_name);
+      return;
+   }
+   ptt_out_fd    = sr_Res(sres);
+   ptt_out_saved = VG_(OSetWord_Create)(ttaux_malloc,
+                                        "transtab.ptt_out_saved",
+                                        ttaux_free);
+
+   /* A placeholder, rewritten by VG_(save_persistent_transtab). */
+   VG_(memset)(&hdr, 0, sizeof(hdr));
+   ptt_emit(&hdr, sizeof(hdr));
+
+   if (VG_(clo_verbosity) > 1)
+      VG_(message)(Vg_UserMsg,
+                   "persistent-transtab: %'llu translations loaded "
+                   "from %s\n", n_ptt_loaded, ptt_out_name);
+}
+
+/* Guest code may have changed since the translation was saved, or
+   not be mapped at all.  Compare against the saved copy. */
+static Bool ptt_guest_code_matches ( const PTTRec* rec )
+{
+   const UChar* saved = (const UChar*)(rec + 1);
+   UInt i;
+   for (i = 0; i < rec->vge.n_used; i++) {
+      Addr  a   = (Addr)rec->vge.base[i];
+      SizeT len = (SizeT)rec->vge.len[i];
+      if (len == 0)
+         continue;
+      if (!VG_(am_is_valid_for_client)(a, len, VKI_PROT_READ))
+         return False;
+      if (VG_(memcmp)((void*)a, saved, len) != 0)
+         return False;
+      saved += len;
+   }
+   return True;
+}
+
+Bool VG_(search_persistent_transtab) ( /*OUT*/VexGuestExtents* vge,
+                                       /*OUT*/AddrH*  code,
+                                       /*OUT*/UInt*   code_len,
+                                       /*OUT*/UInt*   n_guest_instrs,
+                                       Addr64         entry,
+                                       UInt           flavour )
+{
+   UInt i, mask;
+
+   if (ptt_index == NULL)
+      return False;
+
+   mask = ptt_index_size - 1;
+   for (i = ptt_hash(entry) & mask; ptt_index[i] != 0; i = (i + 1) & mask) {
+      const PTTRec* rec = (const PTTRec*)(ptt_map + ptt_index[i]);
+      if (rec->entry != entry || rec->flavour != flavour)
+         continue;
+      if (!ptt_guest_code_matches(rec)) {
+         n_ptt_stale++;
+         continue;
+      }
+      *vge            = rec->vge;
+      *code           = (AddrH)((const UChar*)(rec + 1)
+                                + VG_ROUNDUP(rec->guest_len, 8));
+      *code_len       = rec->code_len;
+      *n_guest_instrs = rec->n_guest_instrs;
+      n_ptt_reused++;
+      return True;
+   }
+   return False;
+}
+
+void VG_(add_to_persistent_transtab)( VexGuestExtents* vge,
+                                      Addr64           entry,
+                                      UInt             flavour,
+                                      AddrH            code,
+                                      UInt             code_len,
+                                      UInt             n_guest_instrs )
+{
+   PTTRec rec;
+   UInt   i;
+
+   if (ptt_out_fd < 0 || VG_(getpid)() != ptt_out_pid)
+      return;
+
+   /* Keep only the first translation made at any given address.
+      Retranslations are mostly of the same code anyway. */
+   if (VG_(OSetWord_Contains)(ptt_out_saved, (UWord)entry))
+      return;
+   VG_(OSetWord_Insert)(ptt_out_saved, (UWord)entry);
+
+   VG_(memset)(&rec, 0, sizeof(rec));
+   rec.entry          = entry;
+   rec.vge            = *vge;
+   rec.flavour        = flavour;
+   rec.n_guest_instrs = n_guest_instrs;
+   rec.guest_len      = vge_osize(vge);
+   rec.code_len       = code_len;
+
+   ptt_emit(&rec, sizeof(rec));
+   /* The guest code has just been translated, so must be readable. */
+   for (i = 0; i < vge->n_used; i++)
+      ptt_emit((void*)(Addr)vge->base[i], (SizeT)vge->len[i]);
+   ptt_emit_padding(rec.guest_len);
+   ptt_emit((void*)code, code_len);
+   ptt_emit_padding(code_len);
+
+   ptt_out_n_recs++;
+   n_ptt_saved++;
+}
+
+void VG_(save_persistent_transtab) ( void )
+{
+   PTTHeader hdr;
+
+   if (ptt_out_fd < 0 || VG_(getpid)() != ptt_out_pid)
+      return;
+
+   ptt_flush();
+   if (ptt_out_fd < 0)
+      return;
+
+   hdr.magic  = PTT_MAGIC;
+   hdr.key    = ptt_key;
+   hdr.n_recs = ptt_out_n_recs;
+   hdr.szB    = ptt_out_szB;
+   if (VG_(lseek)(ptt_out_fd, 0, VKI_SEEK_SET) != 0
+       || VG_(write)(ptt_out_fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+      ptt_abandon_output();
+      return;
+   }
+   VG_(close)(ptt_out_fd);
+   ptt_out_fd = -1;
+
+   if (VG_(rename)(ptt_tmp_name, ptt_out_name) != 0) {
+      VG_(message)(Vg_UserMsg,
+                   "persistent-transtab: cannot rename %s to %s\n",
+                   ptt_tmp_name, ptt_out_name);
+      VG_(unlink)(ptt_tmp_name);
+      return;
+   }
+
+   if (VG_(clo_verbosity) > 1)
+      VG_(message)(Vg_UserMsg,
+                   "persistent-transtab: %'llu translations saved "
+                   "to %s\n", ptt_out_n_recs, ptt_out_name);
+}
+
+
 /*------------------------------------------------------------*/
 /*--- Initialisation.                                      ---*/
 /*------------------------------------------------------------*/
@@ -2203,14 +3254,21 @@ void VG_(init_tt_tc) ( void )
    /* Ensure the calculated value is not way crazy. */
    vg_assert(tc_sector_szQ >= 2 * N_TTES_PER_SECTOR_USABLE);
    vg_assert(tc_sector_szQ <= 100 * N_TTES_PER_SECTOR_USABLE);
+   tc_sector_szQ_initial = tc_sector_szQ;
 
    n_sectors = VG_(clo_num_transtab_sectors);
    vg_assert(n_sectors >= MIN_N_SECTORS);
    vg_assert(n_sectors <= MAX_N_SECTORS);
 
+   /* There must remain at least MIN_N_SECTORS for new translations;
+      m_main ensures that. */
+   n_hot_sectors = VG_(clo_hot_transtab_sectors);
+   vg_assert(n_hot_sectors + MIN_N_SECTORS <= n_sectors);
+
    /* Initialise the sectors, even the ones we aren't going to use.
       Set all fields to zero. */
    youngest_sector = 0;
+   youngest_hot_sector = n_hot_sectors > 0 ? n_sectors - n_hot_sectors : -1;
    for (i = 0; i < MAX_N_SECTORS; i++)
       VG_(memset)(&sectors[i], 0, sizeof(sectors[i]));
 
@@ -2222,9 +3280,17 @@ void VG_(init_tt_tc) ( void )
    /* Initialise the fast cache. */
    invalidateFastCache();
 
+   /* Nothing has been evicted yet. */
+   for (i = 0; i < N_EVICTED_ENTRIES; i++)
+      evicted_entries[i] = TRANSTAB_BOGUS_GUEST_ADDR;
+
    /* and the unredir tt/tc */
    init_unredir_tt_tc();
 
+   /* and the persistent cache, if requested */
+   if (VG_(clo_persistent_transtab))
+      init_persistent_transtab();
+
    if (VG_(clo_verbosity) > 2 || VG_(clo_stats)
        || VG_(debugLog_getLevel) () >= 2) {
       VG_(message)(Vg_DebugMsg,
@@ -2266,8 +3332,13 @@ void VG_(print_tt_tc_stats) ( void )
       "    tt/tc: %'llu tt lookups requiring %'llu probes\n",
       n_full_lookups, n_lookup_probes );
    VG_(message)(Vg_DebugMsg,
-      "    tt/tc: %'llu fast-cache updates, %'llu flushes\n",
-      n_fast_updates, n_fast_flushes );
+      "    tt/tc: %'llu fast-cache updates, %'llu flushes, "
+      "%'llu single invalidations\n",
+      n_fast_updates, n_fast_flushes, n_fast_inv_single );
+   VG_(message)(Vg_DebugMsg,
+      "    tt/tc: %'llu fast-cache misses, %'llu (%llu%%) hit in way 1\n",
+      n_fast_misses, n_fast_way1_hits,
+      safe_idiv(100 * n_fast_way1_hits, n_fast_misses) );
 
    VG_(message)(Vg_DebugMsg,
                 " transtab: new        %'lld "
@@ -2281,6 +3352,23 @@ void VG_(print_tt_tc_stats) ( void )
    VG_(message)(Vg_DebugMsg,
                 " transtab: discarded  %'llu (%'llu -> ?" "?)\n",
                 n_disc_count, n_disc_osize );
+   if (n_hot_sectors > 0)
+      VG_(message)(Vg_DebugMsg,
+                   " transtab: promoted   %'llu (%'llu -> ?" "?)\n",
+                   n_promo_count, n_promo_osize );
+   VG_(message)(Vg_DebugMsg,
+                " transtab: retranslated %'llu dumped, "
+                "TC resized %'llu times (now %'d bytes)\n",
+                n_retrans_count, n_tc_resizes, 8 * tc_sector_szQ );
+   VG_(message)(Vg_DebugMsg,
+                " transtab: discard index: %'llu built, %'llu entries "
+                "visited\n",
+                n_gindex_builds, n_gindex_visits );
+   if (VG_(clo_persistent_transtab))
+      VG_(message)(Vg_DebugMsg,
+                   " transtab: persistent %'llu loaded, %'llu reused, "
+                   "%'llu stale, %'llu saved\n",
+                   n_ptt_loaded, n_ptt_reused, n_ptt_stale, n_ptt_saved );
 
    if (DEBUG_TRANSTAB) {
       Int i;
@@ -2369,6 +3457,37 @@ ULong VG_(get_SB_profile) ( SBProfEntry tops[], UInt n_tops )
    return score_total;
 }
 
+ULong VG_(get_SB_count) ( Addr64 entry )
+{
+   UInt sno, tteno;
+   if (!VG_(search_transtab)( NULL, &sno, &tteno, entry, False ))
+      return 0;
+   return sectors[sno].tt[tteno].count;
+}
+
+UInt VG_(get_hot_SBs) ( /*OUT*/Addr64 entries[], UInt n_max,
+                        ULong min_count )
+{
+   Int      sno, i;
+   UInt     n = 0;
+   TTEntry* tte;
+
+   for (sno = 0; sno < n_sectors; sno++) {
+      if (sectors[sno].tc == NULL)
+         continue;
+      for (i = 0; i < N_TTES_PER_SECTOR; i++) {
+         tte = &sectors[sno].tt[i];
+         if (tte->status != InUse || tte->is_trace || tte->count < min_count)
+            continue;
+         if (n == n_max)
+            return n;
+         tte->is_trace = True;
+         entries[n++] = tte->entry;
+      }
+   }
+   return n;
+}
+
 /*--------------------------------------------------------------------*/
 /*--- end                                                          ---*/
 /*--------------------------------------------------------------------*/
@@ -146,6 +146,10 @@ extern IRSB* VG_(instrument_for_gdbserver_if_needed)
       VexGuestExtents* vge,
       IRType gWordTy, IRType hWordTy);
 
+/* Returns the reason for which the translation of vge needs
+   gdbserver instrumentation, or Vg_VgdbNo if it doesn't. */
+extern VgVgdb VG_(gdbserver_instrumentation_needed) (VexGuestExtents* vge);
+
 /* reason for which gdbserver connection must be finished */
 typedef
    enum {
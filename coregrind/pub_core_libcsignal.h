@@ -61,18 +61,8 @@ extern void VG_(sigintersectset)    ( vki_sigset_t* dst, vki_sigset_t* src );
 extern void VG_(sigcomplementset)   ( vki_sigset_t* dst, vki_sigset_t* src );
 
 /* --- Mess with the kernel's sig state --- */
-/* VG_(sigprocmask) is in pub_tool_libcsignal.h. */
-
-extern Int VG_(sigaction)   ( Int signum,
-                              const vki_sigaction_toK_t* act,
-                              vki_sigaction_fromK_t* oldact );
-
-/* Convert a sigaction which you got from the kernel (a _fromK_t) to
-   one which you can give back to the kernel (a _toK_t).  On Linux,
-   vki_sigaction_{toK,fromK}_t are identical, so this is a no-op
-   (structure copy), but on Darwin it's not a no-op. */
-extern void VG_(convert_sigaction_fromK_to_toK)(
-               vki_sigaction_fromK_t*, /*OUT*/vki_sigaction_toK_t*);
+/* VG_(sigprocmask), VG_(sigaction) and
+   VG_(convert_sigaction_fromK_to_toK) are in pub_tool_libcsignal.h. */
 
 
 extern Int VG_(kill)        ( Int pid, Int signo );
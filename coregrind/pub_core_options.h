@@ -204,6 +204,9 @@ extern Bool  VG_(clo_trace_redir);
 /* Enable fair scheduling on multicore systems? default: NO */
 enum FairSchedType { disable_fair_sched, enable_fair_sched, try_fair_sched };
 extern enum FairSchedType VG_(clo_fair_sched);
+/* Let threads run translated code in parallel, for tools which
+   support it?  default: NO */
+extern Bool  VG_(clo_parallel_sched);
 /* DEBUG: print thread scheduling events?  default: NO */
 extern Bool  VG_(clo_trace_sched);
 /* DEBUG: do heap profiling?  default: NO */
@@ -297,6 +300,26 @@ extern Int VG_(clo_merge_recursive_frames);
 /* Max number of sectors that will be used by the translation code cache. */
 extern UInt VG_(clo_num_transtab_sectors);
 
+/* How many of those sectors hold only translations which have proven
+   to be hot, so that they survive the recycling of the other sectors.
+   0 disables this. */
+extern UInt VG_(clo_hot_transtab_sectors);
+
+/* If not NULL, the file in which translations are saved at exit, and
+   from which they are reloaded at startup, so as to avoid
+   re-translating the same code on every run.  Only used by tools
+   which declare VG_(needs_reusable_translations).  Default: NULL. */
+extern const HChar* VG_(clo_persistent_transtab);
+
+/* When a new block is translated, how many of its likely successors
+   to translate straight away, rather than waiting for each to be
+   reached.  Default: 0. */
+extern UInt VG_(clo_translate_ahead);
+
+/* Superblocks executed this many times are translated again as
+   traces which extend along their hot successors.  0 means never. */
+extern UInt VG_(clo_retranslate_hot_sbs);
+
 /* Only client requested fixed mapping can be done below 
    VG_(clo_aspacem_minAddr). */
 extern Addr VG_(clo_aspacem_minAddr);
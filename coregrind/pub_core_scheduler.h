@@ -84,6 +84,24 @@ extern void VG_(release_BigLock_LL) ( const HChar* who );
 /* Whether the specified thread owns the big lock. */
 extern Bool VG_(owns_BigLock_LL) ( ThreadId tid );
 
+/* With --parallel-sched=yes, threads may run generated code without
+   holding the big lock.  A thread which takes a fault while doing so
+   must call VG_(leave_parallel_code) before touching any shared
+   state: this takes the big lock, waits until no other thread is in
+   generated code, and returns True.  If it then goes back into
+   generated code, it must call VG_(reenter_parallel_code).  For a
+   thread not running in parallel, VG_(leave_parallel_code) does
+   nothing and returns False. */
+extern Bool VG_(leave_parallel_code) ( ThreadId tid );
+extern void VG_(reenter_parallel_code) ( ThreadId tid );
+
+/* The scheduler holds the big lock without stopping threads running
+   generated code in parallel when it deals with events which affect
+   only the running thread.  If such an event turns out to affect
+   other threads after all, this waits until none of them is in
+   generated code.  The caller must hold the big lock. */
+extern void VG_(stop_the_world) ( void );
+
 /* Yield the CPU for a while.  Drops/acquires the lock using the
    normal (non _LL) functions. */
 extern void VG_(vg_yield)(void);
@@ -46,6 +46,20 @@ Bool VG_(translate) ( ThreadId tid,
                       ULong    bbs_done,
                       Bool     allow_redirection );
 
+/* Translate some of the blocks which the ones recently translated
+   are likely to jump to, up to --translate-ahead of them, so that
+   they are ready when needed.  Call this after a block has been
+   translated on demand, when no thread is running generated code.
+   TID is the thread on whose behalf that block was translated. */
+extern void VG_(translate_ahead) ( ThreadId tid, ULong bbs_done );
+
+/* Translate again, as traces which extend along their hot successors,
+   the blocks which have been executed at least --retranslate-hot-sbs
+   times in all (the counts are never reset) and are not traces
+   already.  The traces replace the original translations.  Call only
+   when no thread is running generated code. */
+extern void VG_(retranslate_hot_SBs) ( ThreadId tid, ULong bbs_done );
+
 extern void VG_(print_translation_stats) ( void );
 
 #endif   // __PUB_CORE_TRANSLATE_H
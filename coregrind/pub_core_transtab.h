@@ -37,6 +37,7 @@
 // enabling fast look-ups of them.
 //--------------------------------------------------------------------
 
+#include "pub_tool_transtab.h"
 #include "pub_core_transtab_asm.h"
 
 /* The fast-cache for tt-lookup.  Unused entries are denoted by .guest
@@ -84,6 +85,7 @@ void VG_(add_to_transtab)( VexGuestExtents* vge,
                            Bool             is_self_checking,
                            Int              offs_profInc,
                            UInt             n_guest_instrs,
+                           Bool             is_trace,
                            VexArch          arch_host );
 
 extern
@@ -98,8 +100,7 @@ extern Bool VG_(search_transtab) ( /*OUT*/AddrH* res_hcode,
                                    Addr64        guest_addr, 
                                    Bool          upd_cache );
 
-extern void VG_(discard_translations) ( Addr64 start, ULong range,
-                                        const HChar* who );
+extern void VG_(discard_translation_of_entry) ( Addr64 entry );
 
 extern void VG_(print_tt_tc_stats) ( void );
 
@@ -117,6 +118,32 @@ extern
 Bool VG_(search_unredir_transtab) ( /*OUT*/AddrH* result,
                                     Addr64        guest_addr );
 
+/* Search / add to / save the persistent translation cache
+   (--persistent-transtab).  'flavour' distinguishes translations of
+   the same entry point which must not be used interchangeably, eg
+   redirected vs not.  Search only returns translations whose guest
+   code is identical to what is currently in memory.  Adding does
+   nothing unless the cache is enabled; translations added must not
+   be self-checking or contain profiling counters. */
+
+extern
+Bool VG_(search_persistent_transtab) ( /*OUT*/VexGuestExtents* vge,
+                                       /*OUT*/AddrH*  code,
+                                       /*OUT*/UInt*   code_len,
+                                       /*OUT*/UInt*   n_guest_instrs,
+                                       Addr64         entry,
+                                       UInt           flavour );
+extern
+void VG_(add_to_persistent_transtab)( VexGuestExtents* vge,
+                                      Addr64           entry,
+                                      UInt             flavour,
+                                      AddrH            code,
+                                      UInt             code_len,
+                                      UInt             n_guest_instrs );
+
+/* Write out the translations added this run.  Called at exit. */
+extern void VG_(save_persistent_transtab) ( void );
+
 // SB profiling stuff
 
 typedef struct _SBProfEntry {
@@ -126,6 +153,16 @@ typedef struct _SBProfEntry {
 
 extern ULong VG_(get_SB_profile) ( SBProfEntry tops[], UInt n_tops );
 
+/* The execution count of the translation starting at entry, or 0 if
+   there is none. */
+extern ULong VG_(get_SB_count) ( Addr64 entry );
+
+/* Find up to n_max translations executed at least min_count times
+   which are not traces and have not been found before, and put their
+   entry points in entries[].  Returns how many were found. */
+extern UInt VG_(get_hot_SBs) ( /*OUT*/Addr64 entries[], UInt n_max,
+                               ULong min_count );
+
 #endif   // __PUB_CORE_TRANSTAB_H
 
 /*--------------------------------------------------------------------*/
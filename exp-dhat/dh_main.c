@@ -31,6 +31,7 @@
 
 
 #include "pub_tool_basics.h"
+#include "pub_tool_hashtable.h"
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcassert.h"
 #include "pub_tool_libcprint.h"
@@ -43,6 +44,26 @@
 
 #define HISTOGRAM_SIZE_LIMIT 1024
 
+/* Granularity of the access histograms, in bytes, and its log2.  With
+   the default of 1 there is one counter per payload byte, and only
+   blocks of up to HISTOGRAM_SIZE_LIMIT bytes get a histogram.  With a
+   coarser granularity (eg 64, a cache line) there is one counter per
+   address-aligned line the block overlaps, the first being the line
+   holding its first byte, and every block gets one, whatever its
+   size. */
+static SizeT clo_histogram_granularity = 1;
+static UInt  histo_gran_shift = 0;
+
+/* Number of histogram entries needed for a block of 'szB' bytes at
+   'payload', ie. the number of granules it overlaps. */
+static inline SizeT histo_n_entries ( Addr payload, SizeT szB )
+{
+   if (szB == 0)
+      return 0;
+   return ((payload + szB - 1) >> histo_gran_shift)
+          - (payload >> histo_gran_shift) + 1;
+}
+
 
 //------------------------------------------------------------//
 //--- Globals                                              ---//
@@ -76,10 +97,12 @@ typedef
       ULong       allocd_at; /* instruction number */
       ULong       n_reads;
       ULong       n_writes;
-      /* Approx histogram, one byte per payload byte.  Counts latch up
-         therefore at 0xFFFF.  Can be NULL if the block is resized or if
-         the block is larger than HISTOGRAM_SIZE_LIMIT. */
-      UShort*     histoW; /* [0 .. req_szB-1] */
+      /* Approx histogram, one UShort per histogram granule (by
+         default, per payload byte).  Counts latch up therefore at
+         0xFFFF.  Can be NULL if the block is resized or if the
+         granularity is 1 and the block is larger than
+         HISTOGRAM_SIZE_LIMIT. */
+      UShort*     histoW; /* [0 .. histo_n_entries(payload,req_szB)-1] */
    }
    Block;
 
@@ -101,6 +124,172 @@ static Word interval_tree_Cmp ( UWord k1, UWord k2 )
    return 0;
 }
 
+
+//------------------------------------------------------------//
+//--- a page table of live blocks                          ---//
+//------------------------------------------------------------//
+
+/* Searching the interval tree on every memory access is slow, so
+   find_Block_containing uses this instead.  For each page which
+   overlaps at least one live block, it holds the blocks overlapping
+   the page, sorted by address.  Since blocks don't overlap, the block
+   containing an address (if any) is the last one in the address's
+   page that starts at or below it, which a binary search finds.  Even
+   a page full of the smallest blocks holds only a few hundred of them,
+   so that takes at most a handful of steps, and usually fewer.
+
+   A block is entered in every page it overlaps, which would cost a
+   hash table operation per 4KB page to add or remove a big one.  So
+   blocks spanning more than PT_MAX_BLOCK_PAGES pages are kept out of
+   the page table, in big_block_tree instead, which is only searched
+   when the page table has no block for an address.
+
+   The interval tree remains the master record of the live blocks;
+   these are kept in step with it. */
+
+#define PT_PAGE_BITS        12
+#define PT_MAX_BLOCK_PAGES  4
+
+typedef
+   struct _PageBlocks {
+      struct _PageBlocks* next;
+      UWord   page;       /* key: address >> PT_PAGE_BITS */
+      UInt    n_blocks;
+      UInt    max_blocks;
+      Block** blocks;     /* [0 .. n_blocks-1], sorted by payload */
+   }
+   PageBlocks;
+
+static VgHashTable page_table = NULL;  /* VgHashTable of PageBlocks */
+
+/* The blocks not in the page table, compared as in interval_tree. */
+static WordFM* big_block_tree = NULL;  /* WordFM* Block* void */
+static UWord   n_big_blocks   = 0;
+
+static UWord stats__n_pt_pages = 0;
+static UWord stats__n_pt_lookups = 0;
+static UWord stats__n_pt_steps = 0;
+static UWord stats__n_big_lookups = 0;
+
+/* Returns the index of the last block in 'pb' starting at or below 'a',
+   or -1 if there is none. */
+static Int find_in_PageBlocks ( PageBlocks* pb, Addr a )
+{
+   Int lo = 0, hi = pb->n_blocks - 1, res = -1;
+   while (lo <= hi) {
+      Int mid = (lo + hi) / 2;
+      stats__n_pt_steps++;
+      if (pb->blocks[mid]->payload <= a) {
+         res = mid;
+         lo  = mid + 1;
+      } else {
+         hi  = mid - 1;
+      }
+   }
+   return res;
+}
+
+static Bool is_big_Block ( Block* bk )
+{
+   UWord pg_first = bk->payload >> PT_PAGE_BITS;
+   UWord pg_last  = (bk->payload + bk->req_szB - 1) >> PT_PAGE_BITS;
+   return pg_last - pg_first >= PT_MAX_BLOCK_PAGES;
+}
+
+static void add_Block_to_page_table ( Block* bk )
+{
+   UWord pg;
+   UWord pg_first = bk->payload >> PT_PAGE_BITS;
+   UWord pg_last  = (bk->payload + bk->req_szB - 1) >> PT_PAGE_BITS;
+   tl_assert(bk->req_szB > 0);
+   if (is_big_Block(bk)) {
+      Bool present = VG_(addToFM)( big_block_tree, (UWord)bk, (UWord)0 );
+      tl_assert(!present);
+      n_big_blocks++;
+      return;
+   }
+   for (pg = pg_first; pg <= pg_last; pg++) {
+      PageBlocks* pb = VG_(HT_lookup)( page_table, pg );
+      if (!pb) {
+         pb = VG_(malloc)( "dh.main.abtpt.1", sizeof(PageBlocks) );
+         pb->page       = pg;
+         pb->n_blocks   = 0;
+         pb->max_blocks = 0;
+         pb->blocks     = NULL;
+         VG_(HT_add_node)( page_table, pb );
+         stats__n_pt_pages++;
+      }
+      if (pb->n_blocks == pb->max_blocks) {
+         pb->max_blocks = pb->max_blocks == 0 ? 4 : 2 * pb->max_blocks;
+         pb->blocks = VG_(realloc)( "dh.main.abtpt.2", pb->blocks,
+                                    pb->max_blocks * sizeof(Block*) );
+      }
+      Int i = find_in_PageBlocks( pb, bk->payload ) + 1;
+      VG_(memmove)( &pb->blocks[i+1], &pb->blocks[i],
+                    (pb->n_blocks - i) * sizeof(Block*) );
+      pb->blocks[i] = bk;
+      pb->n_blocks++;
+   }
+}
+
+static void remove_Block_from_page_table ( Block* bk )
+{
+   UWord pg;
+   UWord pg_first = bk->payload >> PT_PAGE_BITS;
+   UWord pg_last  = (bk->payload + bk->req_szB - 1) >> PT_PAGE_BITS;
+   tl_assert(bk->req_szB > 0);
+   if (is_big_Block(bk)) {
+      UWord oldK = 0;
+      Bool found = VG_(delFromFM)( big_block_tree, &oldK, NULL, (UWord)bk );
+      tl_assert(found && oldK == (UWord)bk);
+      n_big_blocks--;
+      return;
+   }
+   for (pg = pg_first; pg <= pg_last; pg++) {
+      PageBlocks* pb = VG_(HT_lookup)( page_table, pg );
+      tl_assert(pb);
+      Int i = find_in_PageBlocks( pb, bk->payload );
+      tl_assert(i >= 0 && pb->blocks[i] == bk);
+      VG_(memmove)( &pb->blocks[i], &pb->blocks[i+1],
+                    (pb->n_blocks - i - 1) * sizeof(Block*) );
+      pb->n_blocks--;
+      if (pb->n_blocks == 0) {
+         PageBlocks* pb2 = VG_(HT_remove)( page_table, pg );
+         tl_assert(pb2 == pb);
+         VG_(free)( pb->blocks );
+         VG_(free)( pb );
+         stats__n_pt_pages--;
+      }
+   }
+}
+
+static Block* find_Block_in_page_table ( Addr a )
+{
+   stats__n_pt_lookups++;
+   PageBlocks* pb = VG_(HT_lookup)( page_table, a >> PT_PAGE_BITS );
+   if (pb) {
+      Int i = find_in_PageBlocks( pb, a );
+      if (i >= 0 && a < pb->blocks[i]->payload + pb->blocks[i]->req_szB)
+         return pb->blocks[i];
+   }
+   if (LIKELY(n_big_blocks == 0))
+      return NULL;
+   Block fake;
+   UWord foundkey = 1;
+   UWord foundval = 1;
+   fake.payload = a;
+   fake.req_szB = 1;
+   stats__n_big_lookups++;
+   if (VG_(lookupFM)( big_block_tree, &foundkey, &foundval, (UWord)&fake ))
+      return (Block*)foundkey;
+   return NULL;
+}
+
+
+//------------------------------------------------------------//
+//--- finding the block containing an address              ---//
+//------------------------------------------------------------//
+
 // 2-entry cache for find_Block_containing
 static Block* fbc_cache0 = NULL;
 static Block* fbc_cache1 = NULL;
@@ -128,21 +317,11 @@ static Block* find_Block_containing ( Addr a )
       stats__n_fBc_cached++;
       return fbc_cache0;
    }
-   Block fake;
-   fake.payload = a;
-   fake.req_szB = 1;
-   UWord foundkey = 1;
-   UWord foundval = 1;
-   Bool found = VG_(lookupFM)( interval_tree,
-                               &foundkey, &foundval, (UWord)&fake );
-   if (!found) {
+   Block* res = find_Block_in_page_table(a);
+   if (!res) {
       stats__n_fBc_notfound++;
       return NULL;
    }
-   tl_assert(foundval == 0); // we don't store vals in the interval tree
-   tl_assert(foundkey != 1);
-   Block* res = (Block*)foundkey;
-   tl_assert(res != &fake);
    // put at the top position
    fbc_cache1 = fbc_cache0;
    fbc_cache0 = res;
@@ -150,6 +329,15 @@ static Block* find_Block_containing ( Addr a )
    return res;
 }
 
+// add a block; asserts if it overlaps one already present.
+static void add_Block ( Block* bk )
+{
+   Bool present = VG_(addToFM)( interval_tree, (UWord)bk, (UWord)0/*no val*/);
+   tl_assert(!present);
+   add_Block_to_page_table(bk);
+   fbc_cache0 = fbc_cache1 = NULL;
+}
+
 // delete a block; asserts if not found.  (viz, 'a' must be
 // known to be present.)
 static void delete_Block_starting_at ( Addr a )
@@ -157,9 +345,11 @@ static void delete_Block_starting_at ( Addr a )
    Block fake;
    fake.payload = a;
    fake.req_szB = 1;
+   UWord oldK = 0;
    Bool found = VG_(delFromFM)( interval_tree,
-                                NULL, NULL, (Addr)&fake );
+                                &oldK, NULL, (Addr)&fake );
    tl_assert(found);
+   remove_Block_from_page_table( (Block*)oldK );
    fbc_cache0 = fbc_cache1 = NULL;
 }
 
@@ -202,6 +392,11 @@ typedef
          What we need therefore is a mechanism to see if this AP
          has only ever allocated blocks of one size.
 
+         With --histogram-granularity > 1 the above restrictions do
+         not apply: the histogram has one entry per line, and blocks
+         of different sizes are aggregated line by line, so it has as
+         many entries as the largest retired block has lines.
+
          3 states:
             Unknown          because no retirement yet 
             Exactly xsize    all retiring blocks are of this size
@@ -209,7 +404,8 @@ typedef
       */
       enum { Unknown=999, Exactly, Mixed } xsize_tag;
       SizeT xsize;
-      UInt* histo; /* [0 .. xsize-1] */
+      UInt* histo; /* [0 .. n_histo-1] */
+      SizeT n_histo;
    }
    APInfo;
 
@@ -342,10 +538,11 @@ static void retire_Block ( Block* bk, Bool because_freed )
          api->xsize = bk->req_szB;
          if (0) VG_(printf)("api %p   -->  Exactly(%lu)\n", api, api->xsize);
          // and allocate the histo
-         if (bk->histoW) {
+         if (bk->histoW && clo_histogram_granularity == 1) {
             api->histo = VG_(malloc)("dh.main.retire_Block.1",
                                      api->xsize * sizeof(UInt));
             VG_(memset)(api->histo, 0, api->xsize * sizeof(UInt));
+            api->n_histo = api->xsize;
          }
          break;
 
@@ -356,10 +553,11 @@ static void retire_Block ( Block* bk, Bool because_freed )
                                api, api->xsize, bk->req_szB);
             api->xsize_tag = Mixed;
             api->xsize = 0;
-            // deallocate the histo, if any
-            if (api->histo) {
+            // deallocate the histo, if any, unless it is by line
+            if (api->histo && clo_histogram_granularity == 1) {
                VG_(free)(api->histo);
                api->histo = NULL;
+               api->n_histo = 0;
             }
          }
          break;
@@ -372,12 +570,29 @@ static void retire_Block ( Block* bk, Bool because_freed )
         tl_assert(0);
    }
 
+   // Line histograms are kept whatever the block sizes are; just
+   // make sure the AP's one is big enough for this block.
+   if (clo_histogram_granularity > 1 && bk->histoW) {
+      SizeT n_lines = histo_n_entries(bk->payload, bk->req_szB);
+      if (n_lines > api->n_histo) {
+         api->histo = VG_(realloc)("dh.main.retire_Block.2", api->histo,
+                                   n_lines * sizeof(UInt));
+         VG_(memset)(&api->histo[api->n_histo], 0,
+                     (n_lines - api->n_histo) * sizeof(UInt));
+         api->n_histo = n_lines;
+      }
+   }
+
    // See if we can fold the histo data from this block into
    // the data for the AP
-   if (api->xsize_tag == Exactly && api->histo && bk->histoW) {
-      tl_assert(api->xsize == bk->req_szB);
+   if ((api->xsize_tag == Exactly || clo_histogram_granularity > 1)
+       && api->histo && bk->histoW) {
+      SizeT n_entries = histo_n_entries(bk->payload, bk->req_szB);
+      tl_assert(n_entries <= api->n_histo);
+      tl_assert(clo_histogram_granularity > 1
+                || api->xsize == bk->req_szB);
       UWord i;
-      for (i = 0; i < api->xsize; i++) {
+      for (i = 0; i < n_entries; i++) {
          // FIXME: do something better in case of overflow of api->histo[..]
          // Right now, at least don't let it overflow/wrap around
          if (api->histo[i] <= 0xFFFE0000)
@@ -481,16 +696,16 @@ void* new_block ( ThreadId tid, void* p, SizeT req_szB, SizeT req_alignB,
    bk->allocd_at = g_guest_instrs_executed;
    bk->n_reads   = 0;
    bk->n_writes  = 0;
-   // set up histogram array, if the block isn't too large
+   // set up histogram array, if the block isn't too large.  Line
+   // histograms are cheap enough to have for blocks of any size.
    bk->histoW = NULL;
-   if (req_szB <= HISTOGRAM_SIZE_LIMIT) {
-      bk->histoW = VG_(malloc)("dh.new_block.2", req_szB * sizeof(UShort));
-      VG_(memset)(bk->histoW, 0, req_szB * sizeof(UShort));
+   if (req_szB <= HISTOGRAM_SIZE_LIMIT || clo_histogram_granularity > 1) {
+      SizeT n_entries = histo_n_entries(bk->payload, req_szB);
+      bk->histoW = VG_(malloc)("dh.new_block.2", n_entries * sizeof(UShort));
+      VG_(memset)(bk->histoW, 0, n_entries * sizeof(UShort));
    }
 
-   Bool present = VG_(addToFM)( interval_tree, (UWord)bk, (UWord)0/*no val*/);
-   tl_assert(!present);
-   fbc_cache0 = fbc_cache1 = NULL;
+   add_Block(bk);
 
    intro_Block(bk);
 
@@ -567,10 +782,13 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
    // Actually do the allocation, if necessary.
    if (new_req_szB <= bk->req_szB) {
 
-      // New size is smaller or same; block not moved.
+      // New size is smaller or same; block not moved.  But it may
+      // overlap fewer pages now, so re-add it.
+      delete_Block_starting_at( (Addr)p_old );
       apinfo_change_cur_bytes_live(bk->ap,
                                    (Long)new_req_szB - (Long)bk->req_szB);
       bk->req_szB = new_req_szB;
+      add_Block(bk);
       return p_old;
 
    } else {
@@ -601,10 +819,7 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
       bk->req_szB = new_req_szB;
 
       // and re-add
-      Bool present
-         = VG_(addToFM)( interval_tree, (UWord)bk, (UWord)0/*no val*/); 
-      tl_assert(!present);
-      fbc_cache0 = fbc_cache1 = NULL;
+      add_Block(bk);
 
       return p_new;
    }
@@ -691,6 +906,11 @@ void inc_histo_for_block ( Block* bk, Addr addr, UWord szB )
    if (offMax1 > bk->req_szB)
       offMax1 = bk->req_szB;
    //VG_(printf)("%lu %lu   (size of block %lu)\n", offMin, offMax1, bk->req_szB);
+   // Each access counts once in every granule it touches.  Granules
+   // are aligned to addresses, not to the start of the block.
+   offMax1 = ((bk->payload + offMax1 - 1) >> histo_gran_shift)
+             - (bk->payload >> histo_gran_shift) + 1;
+   offMin  = (addr >> histo_gran_shift) - (bk->payload >> histo_gran_shift);
    for (i = offMin; i < offMax1; i++) {
       UShort n = bk->histoW[i];
       if (n < 0xFFFF) n++;
@@ -1040,6 +1260,16 @@ static Bool dh_process_cmd_line_option(const HChar* arg)
 {
    if VG_BINT_CLO(arg, "--show-top-n", clo_show_top_n, 1, 100000) {}
 
+   else if VG_BINT_CLO(arg, "--histogram-granularity",
+                       clo_histogram_granularity, 1, 4096) {
+      Int lg = VG_(log2)( (UInt)clo_histogram_granularity );
+      if (lg == -1 /* not a power of 2 */) {
+         VG_(fmsg_bad_option)(arg,
+            "--histogram-granularity must be a power of two\n");
+      }
+      histo_gran_shift = lg;
+   }
+
    else if VG_STR_CLO(arg, "--sort-by", clo_sort_by) {
        ULong (*dummyFn)(APInfo*);
        Bool dummyB;
@@ -1068,6 +1298,9 @@ static void dh_print_usage(void)
 "                max-bytes-live    maximum live bytes [default]\n"
 "                tot-bytes-allocd  total allocation (turnover)\n"
 "                max-blocks-live   maximum live blocks\n"
+"    --histogram-granularity=<number>  access histogram granule in bytes,\n"
+"            a power of two; with more than 1 (eg 64), blocks of any\n"
+"            size get a per-line histogram and a hot/cold summary [1]\n"
    );
 }
 
@@ -1092,6 +1325,74 @@ static void show_N_div_100( /*OUT*/HChar* buf, ULong n )
                 nR);
 }
 
+static Int cmp_UInt_descending ( const void* v1, const void* v2 )
+{
+   UInt n1 = *(const UInt*)v1;
+   UInt n2 = *(const UInt*)v2;
+   return n1 > n2 ? -1 : n1 < n2 ? 1 : 0;
+}
+
+/* Show the by-line histogram of 'api', followed by a summary of how
+   the accesses are spread over the lines: how many lines are touched
+   at all, and what share of the accesses the hottest quarter of the
+   lines gets.  Few touched lines, or a hot quarter getting nearly
+   everything, means the hot fields could be packed into fewer lines
+   (and the cold ones moved out of the way). */
+static void show_line_histo ( APInfo* api )
+{
+   UWord i;
+   SizeT n     = api->n_histo;
+   ULong total = 0;
+   UWord n_hot = 0;
+
+   VG_(umsg)("\nAggregated access counts by %lu-byte line "
+             "(line 0 holds the first byte):\n",
+             clo_histogram_granularity);
+   VG_(umsg)("\n");
+   if (n <= HISTOGRAM_SIZE_LIMIT) {
+      if (n > 0)
+         VG_(umsg)("[   0]  ");
+      for (i = 0; i < n; i++) {
+         if (i > 0 && (i % 16) == 0 && i != n-1) {
+            VG_(umsg)("\n");
+            VG_(umsg)("[%4lu]  ", i);
+         }
+         VG_(umsg)("%u ", api->histo[i]);
+      }
+      VG_(umsg)("\n");
+   } else {
+      VG_(umsg)("(%'lu lines, too many to show)\n", n);
+   }
+
+   if (n == 0)
+      return;
+
+   UInt* sorted = VG_(malloc)("dh.show_line_histo.1", n * sizeof(UInt));
+   for (i = 0; i < n; i++) {
+      sorted[i] = api->histo[i];
+      total += api->histo[i];
+      if (api->histo[i] > 0)
+         n_hot++;
+   }
+   VG_(ssort)(sorted, n, sizeof(UInt), cmp_UInt_descending);
+   UWord n_top = (n + 3) / 4;
+   ULong top   = 0;
+   for (i = 0; i < n_top; i++)
+      top += sorted[i];
+   VG_(free)(sorted);
+
+   HChar bufH[80], bufT[80];
+   show_N_div_100(bufH, (10000ULL * n_hot) / n);
+   if (total > 0)
+      show_N_div_100(bufT, (10000ULL * top) / total);
+   else
+      VG_(strcpy)(bufT, "0.00");
+   VG_(umsg)("\nline usage:  %'lu of %'lu lines accessed (%s%%), "
+             "%'lu cold\n", n_hot, n, bufH, n - n_hot);
+   VG_(umsg)("hot/cold:    hottest %'lu line%s get%s %s%% of accesses\n",
+             n_top, n_top == 1 ? "" : "s", n_top == 1 ? "s" : "", bufT);
+}
+
 static void show_APInfo ( APInfo* api )
 {
    HChar bufA[80];
@@ -1148,7 +1449,10 @@ static void show_APInfo ( APInfo* api )
 
    VG_(pp_ExeContext)(api->ap);
 
-   if (api->histo && api->xsize_tag == Exactly) {
+   if (api->histo && clo_histogram_granularity > 1) {
+      show_line_histo(api);
+   }
+   else if (api->histo && api->xsize_tag == Exactly) {
       VG_(umsg)("\nAggregated access counts by offset:\n");
       VG_(umsg)("\n");
       UWord i;
@@ -1330,6 +1634,11 @@ static void dh_fini(Int exit_status)
                 stats__n_fBc_cached,
                 stats__n_fBc_uncached);
       VG_(dmsg)("          notfound: %'lu\n", stats__n_fBc_notfound);
+      VG_(dmsg)("        page table: %'lu lookups, %'lu search steps, "
+                "%'lu pages at exit\n",
+                stats__n_pt_lookups, stats__n_pt_steps, stats__n_pt_pages);
+      VG_(dmsg)("        big blocks: %'lu lookups\n",
+                stats__n_big_lookups);
       VG_(dmsg)("\n");
    }
 }
@@ -1390,6 +1699,13 @@ static void dh_pre_clo_init(void)
                                VG_(free),
                                interval_tree_Cmp );
 
+   page_table = VG_(HT_construct)( "dh.main.page_table.1" );
+
+   big_block_tree = VG_(newFM)( VG_(malloc),
+                                "dh.main.big_block_tree.1",
+                                VG_(free),
+                                interval_tree_Cmp );
+
    apinfo = VG_(newFM)( VG_(malloc),
                         "dh.main.apinfo.1",
                         VG_(free),
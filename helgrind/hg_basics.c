@@ -78,6 +78,8 @@ UWord HG_(clo_history_level) = 2;
 
 UWord HG_(clo_conflict_cache_size) = 1000000;
 
+UWord HG_(clo_shadow_cache_size) = 65536;
+
 Word  HG_(clo_sanity_flags) = 0;
 
 Bool  HG_(clo_free_is_write) = False;
@@ -86,6 +88,10 @@ UWord HG_(clo_vts_pruning) = 1;
 
 Bool  HG_(clo_check_stack_refs) = True;
 
+Bool  HG_(clo_sample_accesses) = False;
+
+UWord HG_(clo_sample_rate) = 1000;
+
 /*--------------------------------------------------------------------*/
 /*--- end                                              hg_basics.c ---*/
 /*--------------------------------------------------------------------*/
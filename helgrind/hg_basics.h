@@ -99,6 +99,11 @@ extern UWord HG_(clo_history_level);
    amd 10 million.  Default is 1 million. */
 extern UWord HG_(clo_conflict_cache_size);
 
+/* Number of lines in the cache of expanded shadow memory, each
+   covering 64 bytes of address space.  Must be a power of 2 between
+   1024 and 4M.  Default is 64k. */
+extern UWord HG_(clo_shadow_cache_size);
+
 /* Sanity check level.  This is an or-ing of
    SCE_{THREADS,LOCKS,BIGRANGE,ACCESS,LAOG}. */
 extern Word HG_(clo_sanity_flags);
@@ -126,6 +131,13 @@ extern UWord HG_(clo_vts_pruning);
    the stack, which speeds things up a bit.  Default: True. */
 extern Bool HG_(clo_check_stack_refs); 
 
+/* When True, memory accesses are only race-checked on a sample of
+   the times each superblock runs: always at first, then less and less
+   often, down to once every HG_(clo_sample_rate) runs.  Thread and
+   synchronisation events are always tracked.  Default: False. */
+extern Bool  HG_(clo_sample_accesses);
+extern UWord HG_(clo_sample_rate);
+
 #endif /* ! __HG_BASICS_H */
 
 /*--------------------------------------------------------------------*/
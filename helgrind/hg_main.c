@@ -4259,6 +4259,104 @@ Bool HG_(mm_find_containing_block)( /*OUT*/ExeContext** where,
 #define mkU64(_n)                IRExpr_Const(IRConst_U64(_n))
 #define assign(_t, _e)           IRStmt_WrTmp((_t), (_e))
 
+/* Sampling, for --sample-accesses=yes.  Each superblock gets a
+   countdown, decremented inline every time the superblock runs.  The
+   run on which it hits zero has its memory accesses checked, and
+   hg_sample_reset sets the countdown going again, from an interval
+   which doubles on each sampled run, up to --sample-rate.  So code
+   which has only run a few times is checked (almost) every time, and
+   hot code once in --sample-rate runs, as in LiteRace.  Races in
+   cold code, which has been least tested, are the ones most likely
+   to still be there.
+
+   Synchronisation events are not sampled, so happens-before is still
+   computed exactly, and any race reported is between two accesses
+   which really were unordered.  Races involving unsampled accesses
+   are simply missed. */
+typedef
+   struct {
+      UInt countdown; /* runs until the next sampled one, inclusive */
+      UInt interval;  /* what countdown is reset to after that */
+   }
+   SBSample;
+
+/* WordFM guest-Addr-of-superblock SBSample*.  Looked up at
+   translation time, so that a retranslated superblock carries on
+   from where it was rather than starting cold again. */
+static WordFM* map_sb_samples = NULL;
+
+static UWord stats__sample_sbs  = 0;
+static UWord stats__sample_runs = 0;
+
+static SBSample* get_SBSample ( Addr ga )
+{
+   UWord     keyW, valW;
+   SBSample* sbs;
+   if (!map_sb_samples)
+      map_sb_samples = VG_(newFM)( HG_(zalloc), "hg.gSBS.1",
+                                   HG_(free), NULL/*unboxed Word cmp*/ );
+   if (VG_(lookupFM)( map_sb_samples, &keyW, &valW, (UWord)ga )) {
+      tl_assert(keyW == (UWord)ga);
+      return (SBSample*)valW;
+   }
+   sbs = HG_(zalloc)( "hg.gSBS.2", sizeof(SBSample) );
+   sbs->countdown = 1;
+   sbs->interval  = 1;
+   VG_(addToFM)( map_sb_samples, (UWord)ga, (UWord)sbs );
+   stats__sample_sbs++;
+   return sbs;
+}
+
+static VG_REGPARM(1)
+void hg_sample_reset ( SBSample* sbs )
+{
+   stats__sample_runs++;
+   tl_assert(sbs->countdown == 0);
+   if (sbs->interval < HG_(clo_sample_rate))
+      sbs->interval = sbs->interval <= HG_(clo_sample_rate) / 2
+                         ? 2 * sbs->interval : HG_(clo_sample_rate);
+   sbs->countdown = sbs->interval;
+}
+
+/* Add code to decrement sbs->countdown, like this:
+      WrTmp(t1, Load32(&sbs->countdown))
+      WrTmp(t2, Sub32(RdTmp(t1), 1))
+      Store(&sbs->countdown, t2)
+      WrTmp(t3, CmpEQ32(RdTmp(t2), 0))
+      if (t3) hg_sample_reset(sbs)
+   and return t3, which says whether this run is to be checked. */
+static IRTemp gen_sample_check ( IRSB* sbOut, SBSample* sbs )
+{
+#  if defined(VG_BIGENDIAN)
+#    define END Iend_BE
+#  elif defined(VG_LITTLEENDIAN)
+#    define END Iend_LE
+#  else
+#    error "Unknown endianness"
+#  endif
+   IRTemp t1 = newIRTemp(sbOut->tyenv, Ity_I32);
+   IRTemp t2 = newIRTemp(sbOut->tyenv, Ity_I32);
+   IRTemp t3 = newIRTemp(sbOut->tyenv, Ity_I1);
+   HWord  countdown_addr = (HWord)&sbs->countdown;
+
+   addStmtToIRSB(sbOut, assign(t1, IRExpr_Load(END, Ity_I32,
+                                      mkIRExpr_HWord(countdown_addr))));
+   addStmtToIRSB(sbOut, assign(t2, binop(Iop_Sub32, mkexpr(t1), mkU32(1))));
+   addStmtToIRSB(sbOut, IRStmt_Store(END, mkIRExpr_HWord(countdown_addr),
+                                     mkexpr(t2)));
+   addStmtToIRSB(sbOut, assign(t3, binop(Iop_CmpEQ32, mkexpr(t2),
+                                                      mkU32(0))));
+#  undef END
+
+   IRDirty* di = unsafeIRDirty_0_N( 1, "hg_sample_reset",
+                                    VG_(fnptr_to_fnentry)( &hg_sample_reset ),
+                                    mkIRExprVec_1( mkIRExpr_HWord(
+                                                      (HWord)sbs ) ) );
+   di->guard = mkexpr(t3);
+   addStmtToIRSB(sbOut, IRStmt_Dirty(di));
+   return t3;
+}
+
 /* This takes and returns atoms, of course.  Not full IRExprs. */
 static IRExpr* mk_And1 ( IRSB* sbOut, IRExpr* arg1, IRExpr* arg2 )
 {
@@ -4285,7 +4383,8 @@ static void instrument_mem_access ( IRSB*   sbOut,
                                     Bool    isStore,
                                     Int     hWordTy_szB,
                                     Int     goff_sp,
-                                    IRExpr* guard ) /* NULL => True */
+                                    IRExpr* guard, /* NULL => True */
+                                    IRTemp  sampled ) /* INVALID => True */
 {
    IRType   tyAddr   = Ity_INVALID;
    const HChar* hName    = NULL;
@@ -4440,6 +4539,12 @@ static void instrument_mem_access ( IRSB*   sbOut,
       di->guard = mk_And1(sbOut, di->guard, guard);
    }
 
+   /* Likewise if we're sampling and this run might not be one of the
+      sampled ones. */
+   if (sampled != IRTemp_INVALID) {
+      di->guard = mk_And1(sbOut, di->guard, mkexpr(sampled));
+   }
+
    /* Add the helper. */
    addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
 }
@@ -4489,6 +4594,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
    IRStmt* st;
    Bool    inLDSO = False;
    Addr64  inLDSOmask4K = 1; /* mismatches on first check */
+   IRTemp  sampled = IRTemp_INVALID; /* check all accesses */
 
    const Int goff_sp = layout->offset_SP;
 
@@ -4523,6 +4629,11 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
    cia = st->Ist.IMark.addr;
    st = NULL;
 
+   // If sampling, decide at the start of each run whether this one's
+   // accesses are to be checked.
+   if (HG_(clo_sample_accesses))
+      sampled = gen_sample_check( bbOut, get_SBSample( (Addr)closure->readdr ) );
+
    for (/*use current i*/; i < bbIn->stmts_used; i++) {
       st = bbIn->stmts[i];
       tl_assert(st);
@@ -4585,7 +4696,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                      * sizeofIRType(typeOfIRExpr(bbIn->tyenv, cas->dataLo)),
                   False/*!isStore*/,
                   sizeofIRType(hWordTy), goff_sp,
-                  NULL/*no-guard*/
+                  NULL/*no-guard*/, sampled
                );
             }
             break;
@@ -4606,7 +4717,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                      sizeofIRType(dataTy),
                      False/*!isStore*/,
                      sizeofIRType(hWordTy), goff_sp,
-                     NULL/*no-guard*/
+                     NULL/*no-guard*/, sampled
                   );
                }
             } else {
@@ -4624,7 +4735,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                   sizeofIRType(typeOfIRExpr(bbIn->tyenv, st->Ist.Store.data)),
                   True/*isStore*/,
                   sizeofIRType(hWordTy), goff_sp,
-                  NULL/*no-guard*/
+                  NULL/*no-guard*/, sampled
                );
             }
             break;
@@ -4638,7 +4749,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
             instrument_mem_access( bbOut, addr, sizeofIRType(type),
                                    True/*isStore*/,
                                    sizeofIRType(hWordTy),
-                                   goff_sp, sg->guard );
+                                   goff_sp, sg->guard, sampled );
             break;
          }
 
@@ -4652,7 +4763,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
             instrument_mem_access( bbOut, addr, sizeofIRType(type),
                                    False/*!isStore*/,
                                    sizeofIRType(hWordTy),
-                                   goff_sp, lg->guard );
+                                   goff_sp, lg->guard, sampled );
             break;
          }
 
@@ -4666,7 +4777,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                      sizeofIRType(data->Iex.Load.ty),
                      False/*!isStore*/,
                      sizeofIRType(hWordTy), goff_sp,
-                     NULL/*no-guard*/
+                     NULL/*no-guard*/, sampled
                   );
                }
             }
@@ -4686,7 +4797,8 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                   if (!inLDSO) {
                      instrument_mem_access( 
                         bbOut, d->mAddr, dataSize, False/*!isStore*/,
-                        sizeofIRType(hWordTy), goff_sp, NULL/*no-guard*/
+                        sizeofIRType(hWordTy), goff_sp, NULL/*no-guard*/,
+                        sampled
                      );
                   }
                }
@@ -4694,7 +4806,8 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                   if (!inLDSO) {
                      instrument_mem_access( 
                         bbOut, d->mAddr, dataSize, True/*isStore*/,
-                        sizeofIRType(hWordTy), goff_sp, NULL/*no-guard*/
+                        sizeofIRType(hWordTy), goff_sp, NULL/*no-guard*/,
+                        sampled
                      );
                   }
                }
@@ -5162,11 +5275,18 @@ static Bool hg_process_cmd_line_option ( const HChar* arg )
    else if VG_XACT_CLO(arg, "--history-level=full",
                             HG_(clo_history_level), 2);
 
-   /* If you change the 10k/30mill limits, remember to also change
-      them in assertions at the top of event_map_maybe_GC. */
    else if VG_BINT_CLO(arg, "--conflict-cache-size",
                        HG_(clo_conflict_cache_size), 10*1000, 30*1000*1000) {}
 
+   /* If you change the 1k/4M limits, remember to also change them in
+      the assertions in zsm_init. */
+   else if VG_BINT_CLO(arg, "--shadow-cache-size",
+                       HG_(clo_shadow_cache_size), 1024, 4*1024*1024) {
+      if (VG_(log2)( (UInt)HG_(clo_shadow_cache_size) ) == -1)
+         VG_(fmsg_bad_option)(arg,
+            "--shadow-cache-size must be a power of two\n");
+   }
+
    /* "stuvwx" --> stuvwx (binary) */
    else if VG_STR_CLO(arg, "--hg-sanity-flags", tmp_str) {
       Int j;
@@ -5201,6 +5321,11 @@ static Bool hg_process_cmd_line_option ( const HChar* arg )
    else if VG_BOOL_CLO(arg, "--check-stack-refs",
                             HG_(clo_check_stack_refs)) {}
 
+   else if VG_BOOL_CLO(arg, "--sample-accesses",
+                            HG_(clo_sample_accesses)) {}
+   else if VG_BINT_CLO(arg, "--sample-rate",
+                       HG_(clo_sample_rate), 1, 1000*1000) {}
+
    else 
       return VG_(replacement_malloc_process_cmd_line_option)(arg);
 
@@ -5217,8 +5342,14 @@ static void hg_print_usage ( void )
 "       approx: full trace for one thread, approx for the other (faster)\n"
 "       none:   only show trace for one thread in a race (fastest)\n"
 "    --conflict-cache-size=N   size of 'full' history cache [1000000]\n"
+"    --shadow-cache-size=N     lines in the shadow memory cache, a power\n"
+"                              of two from 1024 to 4194304 [65536]\n"
 "    --check-stack-refs=no|yes race-check reads and writes on the\n"
 "                              main stack and thread stacks? [yes]\n"
+"    --sample-accesses=no|yes  only race-check a sample of the runs of\n"
+"                              each code block, favouring cold code [no]\n"
+"    --sample-rate=N           with --sample-accesses=yes, check hot\n"
+"                              code once in N runs [1000]\n"
    );
 }
 
@@ -5300,6 +5431,10 @@ static void hg_print_stats (void)
                stats__lockN_releases
               );
    VG_(printf)("   sanity checks: %'8lu\n", stats__sanity_checks);
+   if (HG_(clo_sample_accesses)) {
+      VG_(printf)("        sampling: %'8lu blocks, %'lu sampled runs\n",
+                  stats__sample_sbs, stats__sample_runs);
+   }
 
    VG_(printf)("\n");
    libhb_shutdown(True); // This in fact only print stats.
@@ -298,6 +298,16 @@ struct _Thr {
       set them to VtsID_INVALID. */
    Bool joinedwith_done;
 
+   /* Is initially False, and is set to True once VTS pruning has
+      removed this thread's entries from every VTS, after which no
+      clock mentions it any more.  See VtsID__mk_Owned. */
+   Bool pruned;
+
+   /* This thread's own scalar clock, viR[thr] == viW[thr].  It only
+      changes when the thread ticks, so we can keep a copy here and
+      spare owned-state accesses a lookup in viW. */
+   ULong tym;
+
    /* A small integer giving a unique identity to this Thr.  See
       comments on the definition of ScalarTS for details. */
    ThrID thrid : SCALARTS_N_THRBITS;
@@ -429,6 +439,10 @@ typedef
    struct {
       UShort descrs[N_LINE_TREES];
       SVal   svals[N_LINE_ARANGE]; // == N_LINE_TREES * 8
+      /* Has any SVal changed since the line was fetched?  If not,
+         the backing store is still up to date and the line can be
+         dropped without a write-back. */
+      Bool   dirty;
    }
    CacheLine;
 
@@ -523,20 +537,22 @@ static inline Bool is_sane_SecMap ( SecMap* sm ) {
 
 /* ------ Cache ------ */
 
-#define N_WAY_BITS 16
-#define N_WAY_NENT (1 << N_WAY_BITS)
-
 /* Each tag is the address of the associated CacheLine, rounded down
    to a CacheLine address boundary.  A CacheLine size must be a power
    of 2 and must be 8 or more.  Hence an easy way to initialise the
    cache so it is empty is to set all the tag values to any value % 8
    != 0, eg 1.  This means all queries in the cache initially miss.
    It does however require us to detect and not writeback, any line
-   with a bogus tag. */
+   with a bogus tag.
+
+   The cache is direct mapped, with --shadow-cache-size lines; that
+   is a power of 2, so 'mask' (the number of lines less one) selects a
+   line from an address. */
 typedef
    struct {
-      CacheLine lyns0[N_WAY_NENT];
-      Addr      tags0[N_WAY_NENT];
+      CacheLine* lyns0;  /* [0 .. mask] */
+      Addr*      tags0;  /* [0 .. mask] */
+      UWord      mask;
    }
    Cache;
 
@@ -567,6 +583,7 @@ static UWord stats__cache_Z_fetches      = 0; // # Z lines fetched
 static UWord stats__cache_Z_wbacks       = 0; // # Z lines written back
 static UWord stats__cache_F_fetches      = 0; // # F lines fetched
 static UWord stats__cache_F_wbacks       = 0; // # F lines written back
+static UWord stats__cache_clean_drops    = 0; // # clean lines not written back
 static UWord stats__cache_invals         = 0; // # cache invals
 static UWord stats__cache_flushes        = 0; // # cache flushes
 static UWord stats__cache_totrefs        = 0; // # total accesses
@@ -599,6 +616,10 @@ static UWord stats__vts__join            = 0; // # calls to VTS__join
 static UWord stats__vts__cmpLEQ          = 0; // # calls to VTS__cmpLEQ
 static UWord stats__vts__cmp_structural  = 0; // # calls to VTS__cmp_structural
 
+// # cmpLEQ/join queries answered from a VTS's epoch instead
+static UWord stats__vts__cmpLEQ_epoch = 0;
+static UWord stats__vts__join_epoch   = 0;
+
 // # calls to VTS__cmp_structural w/ slow case
 static UWord stats__vts__cmp_structural_slow = 0;
 
@@ -1280,7 +1301,7 @@ static __attribute__((noinline)) void cacheline_wback ( UWord wix )
    if (0)
    VG_(printf)("scache wback line %d\n", (Int)wix);
 
-   tl_assert(wix >= 0 && wix < N_WAY_NENT);
+   tl_assert(wix >= 0 && wix <= cache_shmem.mask);
 
    tag =  cache_shmem.tags0[wix];
    cl  = &cache_shmem.lyns0[wix];
@@ -1426,7 +1447,7 @@ static __attribute__((noinline)) void cacheline_fetch ( UWord wix )
    if (0)
    VG_(printf)("scache fetch line %d\n", (Int)wix);
 
-   tl_assert(wix >= 0 && wix < N_WAY_NENT);
+   tl_assert(wix >= 0 && wix <= cache_shmem.mask);
 
    tag =  cache_shmem.tags0[wix];
    cl  = &cache_shmem.lyns0[wix];
@@ -1459,13 +1480,14 @@ static __attribute__((noinline)) void cacheline_fetch ( UWord wix )
       stats__cache_Z_fetches++;
    }
    normalise_CacheLine( cl );
+   cl->dirty = False;
 }
 
 static void shmem__invalidate_scache ( void ) {
    Word wix;
    if (0) VG_(printf)("%s","scache inval\n");
    tl_assert(!is_valid_scache_tag(1));
-   for (wix = 0; wix < N_WAY_NENT; wix++) {
+   for (wix = 0; wix <= cache_shmem.mask; wix++) {
       cache_shmem.tags0[wix] = 1/*INVALID*/;
    }
    stats__cache_invals++;
@@ -1476,13 +1498,16 @@ static void shmem__flush_and_invalidate_scache ( void ) {
    Addr tag;
    if (0) VG_(printf)("%s","scache flush and invalidate\n");
    tl_assert(!is_valid_scache_tag(1));
-   for (wix = 0; wix < N_WAY_NENT; wix++) {
+   for (wix = 0; wix <= cache_shmem.mask; wix++) {
       tag = cache_shmem.tags0[wix];
       if (tag == 1/*INVALID*/) {
          /* already invalid; nothing to do */
       } else {
          tl_assert(is_valid_scache_tag(tag));
-         cacheline_wback( wix );
+         if (cache_shmem.lyns0[wix].dirty)
+            cacheline_wback( wix );
+         else
+            stats__cache_clean_drops++;
       }
       cache_shmem.tags0[wix] = 1/*INVALID*/;
    }
@@ -1523,7 +1548,7 @@ static inline CacheLine* get_cacheline ( Addr a )
    /* tag is 'a' with the in-line offset masked out, 
       eg a[31]..a[4] 0000 */
    Addr       tag = a & ~(N_LINE_ARANGE - 1);
-   UWord      wix = (a >> N_LINE_BITS) & (N_WAY_NENT - 1);
+   UWord      wix = (a >> N_LINE_BITS) & cache_shmem.mask;
    stats__cache_totrefs++;
    if (LIKELY(tag == cache_shmem.tags0[wix])) {
       return &cache_shmem.lyns0[wix];
@@ -1541,7 +1566,7 @@ static __attribute__((noinline))
    CacheLine* cl;
    Addr*      tag_old_p;
    Addr       tag = a & ~(N_LINE_ARANGE - 1);
-   UWord      wix = (a >> N_LINE_BITS) & (N_WAY_NENT - 1);
+   UWord      wix = (a >> N_LINE_BITS) & cache_shmem.mask;
 
    tl_assert(tag != cache_shmem.tags0[wix]);
 
@@ -1555,7 +1580,14 @@ static __attribute__((noinline))
       /* EXPENSIVE and REDUNDANT: callee does it */
       if (CHECK_ZSM)
          tl_assert(is_sane_CacheLine(cl)); /* EXPENSIVE */
-      cacheline_wback( wix );
+      /* A line whose SVals are unchanged since it was fetched need
+         not be re-sequentialised and written back: the backing store
+         still holds the same values (perhaps in a different tree
+         shape, which doesn't matter). */
+      if (cl->dirty)
+         cacheline_wback( wix );
+      else
+         stats__cache_clean_drops++;
    }
    /* and reload the new one */
    *tag_old_p = tag;
@@ -1759,6 +1791,16 @@ static void zsm_init ( void(*p_rcinc)(SVal), void(*p_rcdec)(SVal) )
                            HG_(free), 
                            NULL/*unboxed UWord cmp*/);
    tl_assert(map_shmem != NULL);
+
+   /* Limits must match those in hg_process_cmd_line_option. */
+   UWord nent = HG_(clo_shadow_cache_size);
+   tl_assert(nent >= 1024 && nent <= 4*1024*1024);
+   tl_assert(VG_(log2)( (UInt)nent ) != -1);
+   cache_shmem.mask  = nent - 1;
+   cache_shmem.lyns0 = HG_(zalloc)( "libhb.zsm_init.2 (cache lines)",
+                                    nent * sizeof(CacheLine) );
+   cache_shmem.tags0 = HG_(zalloc)( "libhb.zsm_init.3 (cache tags)",
+                                    nent * sizeof(Addr) );
    shmem__invalidate_scache();
 
    /* a SecMap must contain an integral number of CacheLines */
@@ -1855,12 +1897,24 @@ static void verydead_thread_table_init ( void )
 /* A VTS contains .ts, its vector clock, and also .id, a field to hold
    a backlink for the caller's convenience.  Since we have no idea
    what to set that to in the library, it always gets set to
-   VtsID_INVALID. */
+   VtsID_INVALID.
+
+   .epoch is either empty (.thrid == 0) or (T,t), meaning that this
+   VTS is, by content, the write-clock thread T had when it last had
+   tym t: the one it sent to a SO (or to a child) just before ticking
+   to t+1.  Thread and SO clocks only ever learn about T through such
+   final clocks, or, for T's own clocks, from later ones.  Hence for
+   any thread or SO clock B, this VTS <= B iff B[T] >= t.  That's the
+   FastTrack epoch test: a lookup instead of a walk over both
+   vectors.  It does not hold for B being an arbitrary VTS, eg one
+   stored in shadow memory, which may be a copy of T's clock taken
+   earlier while its tym was still t. */
 typedef
    struct {
       VtsID    id;
       UInt     usedTS;
       UInt     sizeTS;
+      ScalarTS epoch;
       ScalarTS ts[0];
    }
    VTS;
@@ -1921,6 +1975,13 @@ static void VTS__show ( HChar* buf, Int nBuf, VTS* vts );
 /* Debugging only.  Return vts[index], so to speak. */
 static ULong VTS__indexAt_SLOW ( VTS* vts, Thr* idx );
 
+/* Return vts[thrid], so to speak, by binary search. */
+static ULong VTS__find_tym ( VTS* vts, ThrID thrid );
+
+/* Is 'a' <= 'b', given that 'a' has an epoch and 'b' is a thread's or
+   a SO's clock?  See the comment on struct VTS. */
+static Bool VTS__epoch_LEQ ( VTS* a, VTS* b );
+
 /* Notify the VTS machinery that a thread has been declared
    comprehensively dead: that is, it has done an async exit AND it has
    been joined with.  This should ensure that its local clocks (.viR
@@ -2019,6 +2080,11 @@ static VTS* VTS__subtract ( const HChar* who, VTS* vts, XArray* thridsToDel )
    tl_assert(j == nReq);
    tl_assert(j == res->sizeTS);
    res->usedTS = j;
+   /* The epoch stays valid unless its own thread is being removed. */
+   ThrID epoch_thrid = vts->epoch.thrid;
+   if (epoch_thrid != 0
+       && !VG_(lookupXA)(thridsToDel, &epoch_thrid, NULL, NULL))
+      res->epoch = vts->epoch;
    tl_assert( *(ULong*)(&res->ts[j]) == 0x0ddC0ffeeBadF00dULL);
    return res;
 }
@@ -2430,6 +2496,34 @@ ULong VTS__indexAt_SLOW ( VTS* vts, Thr* idx )
 }
 
 
+/* See comment on prototype above.
+*/
+static ULong VTS__find_tym ( VTS* vts, ThrID thrid )
+{
+   Word lo = 0, hi = (Word)vts->usedTS - 1;
+   while (lo <= hi) {
+      Word      mid = (lo + hi) / 2;
+      ScalarTS* st  = &vts->ts[mid];
+      if (st->thrid < thrid)
+         lo = mid + 1;
+      else if (st->thrid > thrid)
+         hi = mid - 1;
+      else
+         return st->tym;
+   }
+   return 0;
+}
+
+
+/* See comment on prototype above.
+*/
+static Bool VTS__epoch_LEQ ( VTS* a, VTS* b )
+{
+   tl_assert(a->epoch.thrid != 0);
+   return VTS__find_tym(b, a->epoch.thrid) >= a->epoch.tym;
+}
+
+
 /* See comment on prototype above.
 */
 static void VTS__declare_thread_very_dead ( Thr* thr )
@@ -2861,6 +2955,15 @@ static void vts_tab__do_GC ( Bool show_stats )
    }
    /* Ok, so the dead thread table has unique and in-order keys. */
 
+   /* After this pruning, none of these threads will appear in any
+      VTS.  Note that, so that owned shadow states (see SVal__isO)
+      of theirs are not later materialised into VTSs mentioning
+      them. */
+   for (i = 0; i < nBT; i++) {
+      ThrID thrid = *(ThrID*)VG_(indexXA)( verydead_thread_table, i );
+      Thr__from_ThrID(thrid)->pruned = True;
+   }
+
    /* We will run through the old table, and create a new table and
       set, at the same time setting the .remap entries in the old
       table to point to the new entries.  Then, visit every VtsID in
@@ -2953,6 +3056,8 @@ static void vts_tab__do_GC ( Bool show_stats )
          tl_assert(valW == 0);
          tl_assert(identical_version != NULL);
          tl_assert(identical_version != new_vts);
+         if (identical_version->epoch.thrid == 0)
+            identical_version->epoch = new_vts->epoch;
          VTS__delete(new_vts);
          new_vts = identical_version;
          tl_assert(new_vts->id != VtsID_INVALID);
@@ -3215,9 +3320,10 @@ static void VtsID__pp ( VtsID vi ) {
    VG_(printf)("%s", buf);
 }
 
-/* compute partial ordering relation of vi1 and vi2. */
+/* compute partial ordering relation of vi1 and vi2.  If vi2 is a
+   thread's or a SO's clock, an epoch in vi1 can answer it quickly. */
 __attribute__((noinline))
-static Bool VtsID__cmpLEQ_WRK ( VtsID vi1, VtsID vi2 ) {
+static Bool VtsID__cmpLEQ_WRK ( VtsID vi1, VtsID vi2, Bool vi2_is_clock ) {
    UInt hash;
    Bool leq;
    VTS  *v1, *v2;
@@ -3233,7 +3339,14 @@ static Bool VtsID__cmpLEQ_WRK ( VtsID vi1, VtsID vi2 ) {
    ////--
    v1  = VtsID__to_VTS(vi1);
    v2  = VtsID__to_VTS(vi2);
-   leq = VTS__cmpLEQ( v1, v2 ) == 0;
+   if (vi2_is_clock && v1->epoch.thrid != 0) {
+      stats__vts__cmpLEQ_epoch++;
+      leq = VTS__epoch_LEQ( v1, v2 );
+      if (CHECK_MSM)
+         tl_assert(leq == (VTS__cmpLEQ( v1, v2 ) == 0));
+   } else {
+      leq = VTS__cmpLEQ( v1, v2 ) == 0;
+   }
    ////++
    cmpLEQ_cache[hash].vi1 = vi1;
    cmpLEQ_cache[hash].vi2 = vi2;
@@ -3242,10 +3355,15 @@ static Bool VtsID__cmpLEQ_WRK ( VtsID vi1, VtsID vi2 ) {
    return leq;
 }
 static inline Bool VtsID__cmpLEQ ( VtsID vi1, VtsID vi2 ) {
-   return LIKELY(vi1 == vi2)  ? True  : VtsID__cmpLEQ_WRK(vi1, vi2);
+   return LIKELY(vi1 == vi2)  ? True  : VtsID__cmpLEQ_WRK(vi1, vi2, False);
+}
+/* As VtsID__cmpLEQ, for when 'clock' is a thread's or a SO's VTS. */
+static inline Bool VtsID__cmpLEQ_clock ( VtsID vi, VtsID clock ) {
+   return LIKELY(vi == clock)  ? True  : VtsID__cmpLEQ_WRK(vi, clock, True);
 }
 
-/* compute binary join */
+/* compute binary join.  vi2 must be a thread's or a SO's clock, so
+   that an epoch in vi1 can tell whether the join is simply vi2. */
 __attribute__((noinline))
 static VtsID VtsID__join2_WRK ( VtsID vi1, VtsID vi2 ) {
    UInt  hash;
@@ -3263,9 +3381,16 @@ static VtsID VtsID__join2_WRK ( VtsID vi1, VtsID vi2 ) {
    ////--
    vts1 = VtsID__to_VTS(vi1);
    vts2 = VtsID__to_VTS(vi2);
-   temp_max_sized_VTS->usedTS = 0;
-   VTS__join(temp_max_sized_VTS, vts1,vts2);
-   res = vts_tab__find__or__clone_and_add(temp_max_sized_VTS);
+   if (vts1->epoch.thrid != 0 && VTS__epoch_LEQ(vts1, vts2)) {
+      stats__vts__join_epoch++;
+      if (CHECK_MSM)
+         tl_assert(VTS__cmpLEQ(vts1, vts2) == 0);
+      res = vi2;
+   } else {
+      temp_max_sized_VTS->usedTS = 0;
+      VTS__join(temp_max_sized_VTS, vts1,vts2);
+      res = vts_tab__find__or__clone_and_add(temp_max_sized_VTS);
+   }
    ////++
    join2_cache[hash].vi1 = vi1;
    join2_cache[hash].vi2 = vi2;
@@ -3292,6 +3417,20 @@ static VtsID VtsID__tick ( VtsID vi, Thr* idx ) {
    return vts_tab__find__or__clone_and_add(temp_max_sized_VTS);
 }
 
+/* 'vi' is the write-clock that 'thr' is about to tick away from, so
+   it is final for thr's current tym: record that as its epoch, if it
+   has none yet. */
+static void VtsID__set_epoch ( VtsID vi, Thr* thr ) {
+   VTS* vts = VtsID__to_VTS(vi);
+   if (vts->epoch.thrid != 0)
+      return;
+   ThrID thrid = Thr__to_ThrID(thr);
+   ULong tym   = VTS__find_tym(vts, thrid);
+   tl_assert(tym >= 1);
+   vts->epoch.thrid = thrid;
+   vts->epoch.tym   = tym;
+}
+
 /* index into a VTS (only for assertions) */
 static ULong VtsID__indexAt ( VtsID vi, Thr* idx ) {
    VTS* vts = VtsID__to_VTS(vi);
@@ -3667,6 +3806,8 @@ static Thr* Thr__new ( void )
    thr->viW = VtsID_INVALID;
    thr->llexit_done = False;
    thr->joinedwith_done = False;
+   thr->pruned = False;
+   thr->tym = 0;
    thr->filter = HG_(zalloc)( "libhb.Thr__new.2", sizeof(Filter) );
    if (HG_(clo_history_level) == 1)
       thr->local_Kws_n_stacks
@@ -3763,12 +3904,32 @@ static Int cmp__ULong_n_EC__by_ULong ( const ULong_n_EC* pair1,
 
       <---------30--------->    <---------30--------->
    00 X-----Rmin-VtsID-----X 00 X-----Wmin-VtsID-----X   C(Rmin,Wmin)
+   01 X--T--X X----Rtym----X X----Wtym----X              O(T,Rtym,Wtym)
    10 X--------------------X XX X--------------------X   A: SVal_NOACCESS
    11 0--------------------0 00 0--------------------0   A: SVal_INVALID
 
+   O is the "owned" state: memory that, since it was allocated by
+   thread T, has only been accessed by T.  It stands for
+   C([T:Rtym], [T:Wtym]), where Rtym is T's scalar clock at its last
+   write (or at the allocation) and Wtym its scalar clock at its last
+   access.  The exact constraints would be copies of T's clock at
+   those times, but since thread and SO clocks only learn about T
+   through clocks T sent at or after then, such a copy is <= a thread
+   clock K iff K[T] >= its tym, which is all the singleton says.  So
+   while T is the only accessor, accesses need only compare thread
+   ids, and make no VTS queries at all.  The first access by any
+   other thread turns it into the equivalent C state (SVal__unO_C)
+   and proceeds as normal.
+
+   T takes SCALARTS_N_THRBITS bits and each tym half of the remaining
+   62.  A thread whose tym has outgrown that just doesn't get owned
+   states.
 */
 #define SVAL_TAGMASK (3ULL << 62)
 
+#define SVAL_O_N_TYMBITS ((62 - SCALARTS_N_THRBITS) / 2)
+#define SVAL_O_TYM_MAX   ((1ULL << SVAL_O_N_TYMBITS) - 1)
+
 static inline Bool SVal__isC ( SVal s ) {
    return (0ULL << 62) == (s & SVAL_TAGMASK);
 }
@@ -3786,6 +3947,55 @@ static inline VtsID SVal__unC_Wmin ( SVal s ) {
    return (VtsID)(s & 0xFFFFFFFFULL);
 }
 
+static inline Bool SVal__isO ( SVal s ) {
+   return (1ULL << 62) == (s & SVAL_TAGMASK);
+}
+static inline SVal SVal__mkO ( ThrID thrid, ULong rtym, ULong wtym ) {
+   if (CHECK_MSM)
+      tl_assert(rtym <= wtym && wtym <= SVAL_O_TYM_MAX);
+   return (1ULL << 62)
+          | (((ULong)thrid) << (2 * SVAL_O_N_TYMBITS))
+          | (rtym << SVAL_O_N_TYMBITS)
+          | wtym;
+}
+static inline ThrID SVal__unO_ThrID ( SVal s ) {
+   tl_assert(SVal__isO(s));
+   return (ThrID)((s >> (2 * SVAL_O_N_TYMBITS))
+                  & ((1ULL << SCALARTS_N_THRBITS) - 1));
+}
+static inline ULong SVal__unO_Rtym ( SVal s ) {
+   tl_assert(SVal__isO(s));
+   return (s >> SVAL_O_N_TYMBITS) & SVAL_O_TYM_MAX;
+}
+static inline ULong SVal__unO_Wtym ( SVal s ) {
+   tl_assert(SVal__isO(s));
+   return s & SVAL_O_TYM_MAX;
+}
+
+/* Is 'thr' able to own memory right now, that is, does its scalar
+   clock fit in an O state? */
+static inline Bool Thr__can_own ( Thr* thr ) {
+   return LIKELY(thr->tym <= SVAL_O_TYM_MAX);
+}
+
+/* The VtsID standing for [owner:tym] in an O state.  Once the owner
+   has been pruned, clocks no longer mention it and the singleton
+   would have been pruned to the empty VTS too, so use that. */
+static VtsID VtsID__mk_Owned ( ThrID owner, ULong tym ) {
+   Thr* thr = Thr__from_ThrID(owner);
+   temp_max_sized_VTS->usedTS = 0;
+   if (!thr->pruned)
+      VTS__singleton(temp_max_sized_VTS, thr, tym);
+   return vts_tab__find__or__clone_and_add(temp_max_sized_VTS);
+}
+
+/* Convert an O state into the equivalent C state. */
+static SVal SVal__unO_C ( SVal s ) {
+   ThrID owner = SVal__unO_ThrID(s);
+   return SVal__mkC( VtsID__mk_Owned( owner, SVal__unO_Rtym(s) ),
+                     VtsID__mk_Owned( owner, SVal__unO_Wtym(s) ) );
+}
+
 static inline Bool SVal__isA ( SVal s ) {
    return (2ULL << 62) == (s & SVAL_TAGMASK);
 }
@@ -3816,8 +4026,6 @@ static void SVal__rcdec ( SVal s ) {
 //                                                     //
 /////////////////////////////////////////////////////////
 
-#define EVENT_MAP_GC_DISCARD_FRACTION  0.5
-
 /* This is in two parts:
 
    1. A hash table of RCECs.  This is a set of reference-counted stack
@@ -3830,8 +4038,8 @@ static void SVal__rcdec ( SVal s ) {
    2. A SparseWA of OldRefs.  These store information about each old
       ref that we need to record.  It is indexed by address of the
       location for which the information is recorded.  For LRU
-      purposes, each OldRef also contains a generation number,
-      indicating when it was most recently accessed.
+      purposes, the OldRefs are also chained in a doubly linked list,
+      in order of most recent access.
 
       The important part of an OldRef is, however, its accs[] array.
       This is an array of N_OLDREF_ACCS which binds (thread, R/W,
@@ -3841,12 +4049,15 @@ static void SVal__rcdec ( SVal s ) {
       falls off the end, that's too bad -- we will lose info about
       that triple's access to this location.
 
-      When the SparseWA becomes too big, we can throw away the OldRefs
-      whose generation numbers are below some threshold; hence doing
-      approximate LRU discarding.  For each discarded OldRef we must
-      of course decrement the reference count on the all RCECs it
-      refers to, in order that entries from (1) eventually get
-      discarded too.
+      The SparseWA never holds more than --conflict-cache-size
+      OldRefs.  Once it is full, recording a new location recycles the
+      least recently used OldRef, so the cost of discarding old
+      information is spread evenly over the binds rather than paid in
+      occasional big GCs, and memory use stays flat.  For each
+      discarded OldRef we must of course decrement the reference count
+      on the all RCECs it refers to.  RCECs whose count has dropped to
+      zero are freed by a sweep that visits one bucket of (1) per
+      bind, for the same reason.
 
    A major improvement in reliability of this mechanism would be to
    have a dynamically sized OldRef.accs[] array, so no entries ever
@@ -4090,10 +4301,11 @@ typedef
 #define N_OLDREF_ACCS 5
 
 typedef
-   struct {
+   struct _OldRef {
+      struct _OldRef *prev; /* LRU list, towards least recently used */
+      struct _OldRef *next; /* LRU list, towards most recently used */
       UWord magic;  /* sanity check only */
-      UWord gen;    /* when most recently accessed */
-                    /* or free list when not in use */
+      Addr  ga;     /* the address this is about, ie its key */
       /* unused slots in this array have .thrid == 0, which is invalid */
       Thr_n_RCEC accs[N_OLDREF_ACCS];
    }
@@ -4106,18 +4318,55 @@ static PoolAlloc* oldref_pool_allocator;
 static OldRef* alloc_OldRef ( void ) {
    return VG_(allocEltPA) ( oldref_pool_allocator );
 }
-
-static void free_OldRef ( OldRef* r ) {
-   tl_assert(r->magic == OldRef_MAGIC);
-   VG_(freeEltPA)( oldref_pool_allocator, r );
-}
 //////////// END OldRef pool allocator
 
 
 static SparseWA* oldrefTree     = NULL; /* SparseWA* OldRef* */
-static UWord     oldrefGen      = 0;    /* current LRU generation # */
 static UWord     oldrefTreeN    = 0;    /* # elems in oldrefTree */
-static UWord     oldrefGenIncAt = 0;    /* inc gen # when size hits this */
+
+/* Sentinel of the circular LRU list of all OldRefs in oldrefTree:
+   mru.next is the least recently used one, mru.prev the most. */
+static OldRef mru;
+
+static UWord stats__oldref_recycled = 0; /* # LRU OldRefs reused */
+
+static inline void OldRef_unchain ( OldRef* ref )
+{
+   ref->next->prev = ref->prev;
+   ref->prev->next = ref->next;
+}
+
+static inline void OldRef_newest ( OldRef* ref )
+{
+   ref->next = &mru;
+   ref->prev = mru.prev;
+   mru.prev->next = ref;
+   mru.prev = ref;
+}
+
+/* Next contextTab bucket to sweep for unreferenced RCECs. */
+static UWord rcec_sweep_ix = 0;
+
+/* Free the RCECs in bucket 'ix' of contextTab which no OldRef refers
+   to any more. */
+static void ctxt__free_unused_in_bucket ( UWord ix )
+{
+   RCEC** pp = &contextTab[ix];
+   RCEC*  p  = *pp;
+   while (p) {
+      if (p->rc == 0) {
+         *pp = p->next;
+         free_RCEC(p);
+         p = *pp;
+         tl_assert(stats__ctxt_tab_curr > 0);
+         stats__ctxt_tab_curr--;
+         stats__ctxt_rcdec_discards++;
+      } else {
+         pp = &p->next;
+         p = p->next;
+      }
+   }
+}
 
 inline static UInt min_UInt ( UInt a, UInt b ) {
    return a < b ? a : b;
@@ -4235,21 +4484,42 @@ static void event_map_bind ( Addr a, SizeT szB, Bool isW, Thr* thr )
          /* tl_assert(thrid != 0); */ /* There's a dominating assert above. */
       }
 
-      ref->gen = oldrefGen;
+      if (ref != mru.prev) {
+         OldRef_unchain(ref);
+         OldRef_newest(ref);
+      }
 
    } else {
 
-      /* We don't have a record for this address.  Create a new one. */
-      if (oldrefTreeN >= oldrefGenIncAt) {
-         oldrefGen++;
-         oldrefGenIncAt = oldrefTreeN + 50000;
-         if (0) VG_(printf)("oldrefTree: new gen %lu at size %lu\n",
-                            oldrefGen, oldrefTreeN );
+      /* We don't have a record for this address.  Create a new one,
+         or if the cache is full, recycle the least recently used
+         one. */
+      if (oldrefTreeN >= HG_(clo_conflict_cache_size)) {
+         ref = mru.next;
+         tl_assert(ref != &mru);
+         tl_assert(ref->magic == OldRef_MAGIC);
+         OldRef_unchain(ref);
+         b = VG_(delFromSWA)( oldrefTree, &keyW, &valW, ref->ga );
+         tl_assert(b);
+         tl_assert(keyW == ref->ga);
+         tl_assert(valW == (UWord)ref);
+         for (j = 0; j < N_OLDREF_ACCS; j++) {
+            if (ref->accs[j].rcec) {
+               tl_assert(ref->accs[j].thrid != 0);
+               stats__ctxt_rcdec3++;
+               ctxt__rcdec( ref->accs[j].rcec );
+            } else {
+               tl_assert(ref->accs[j].thrid == 0);
+            }
+         }
+         stats__oldref_recycled++;
+      } else {
+         ref = alloc_OldRef();
+         ref->magic = OldRef_MAGIC;
+         oldrefTreeN++;
       }
 
-      ref = alloc_OldRef();
-      ref->magic = OldRef_MAGIC;
-      ref->gen   = oldrefGen;
+      ref->ga = a;
       ref->accs[0].thrid      = thrid;
       ref->accs[0].szLg2B     = szLg2B;
       ref->accs[0].isW        = (UInt)(isW & 1);
@@ -4269,9 +4539,16 @@ static void event_map_bind ( Addr a, SizeT szB, Bool isW, Thr* thr )
          ref->accs[j].locksHeldW = 0;
       }
       VG_(addToSWA)( oldrefTree, a, (UWord)ref );
-      oldrefTreeN++;
+      OldRef_newest(ref);
 
    }
+
+   /* Reclaim unreferenced RCECs a bucket at a time, so that the
+      context table never needs a stop-the-world sweep. */
+   ctxt__free_unused_in_bucket( rcec_sweep_ix );
+   rcec_sweep_ix++;
+   if (rcec_sweep_ix == N_RCEC_TAB)
+      rcec_sweep_ix = 0;
 }
 
 
@@ -4431,12 +4708,13 @@ static void event_map_init ( void )
                 );
    tl_assert(oldrefTree);
 
-   oldrefGen = 0;
-   oldrefGenIncAt = 0;
    oldrefTreeN = 0;
+   mru.prev = &mru;
+   mru.next = &mru;
+   mru.magic = OldRef_MAGIC;
 }
 
-static void event_map__check_reference_counts ( Bool before )
+static void event_map__check_reference_counts ( void )
 {
    RCEC*   rcec;
    OldRef* oldref;
@@ -4444,18 +4722,13 @@ static void event_map__check_reference_counts ( Bool before )
    UWord   nEnts = 0;
    UWord   keyW, valW;
 
-   /* Set the 'check' reference counts to zero.  Also, optionally
-      check that the real reference counts are non-zero.  We allow
-      these to fall to zero before a GC, but the GC must get rid of
-      all those that are zero, hence none should be zero after a
-      GC. */
+   /* Set the 'check' reference counts to zero.  The real reference
+      counts may be zero, for RCECs the sweep has not yet reached. */
    for (i = 0; i < N_RCEC_TAB; i++) {
       for (rcec = contextTab[i]; rcec; rcec = rcec->next) {
          nEnts++;
          tl_assert(rcec);
          tl_assert(rcec->magic == RCEC_MAGIC);
-         if (!before)
-            tl_assert(rcec->rc > 0);
          rcec->rcX = 0;
       }
    }
@@ -4464,11 +4737,22 @@ static void event_map__check_reference_counts ( Bool before )
    tl_assert(nEnts == stats__ctxt_tab_curr);
    tl_assert(stats__ctxt_tab_curr <= stats__ctxt_tab_max);
 
+   /* check that the LRU list holds exactly the OldRefs in the tree */
+   UWord nRefs = 0;
+   for (oldref = mru.next; oldref != &mru; oldref = oldref->next) {
+      tl_assert(oldref->magic == OldRef_MAGIC);
+      tl_assert(oldref->next->prev == oldref);
+      nRefs++;
+   }
+   tl_assert(nRefs == oldrefTreeN);
+   tl_assert(nRefs == VG_(sizeSWA)( oldrefTree ));
+
    /* visit all the referencing points, inc check ref counts */
    VG_(initIterSWA)( oldrefTree );
    while (VG_(nextIterSWA)( oldrefTree, &keyW, &valW )) {
       oldref = (OldRef*)valW;
       tl_assert(oldref->magic == OldRef_MAGIC);
+      tl_assert(oldref->ga == keyW);
       for (i = 0; i < N_OLDREF_ACCS; i++) {
          ThrID aThrID = oldref->accs[i].thrid;
          RCEC* aRef   = oldref->accs[i].rcec;
@@ -4490,279 +4774,6 @@ static void event_map__check_reference_counts ( Bool before )
    }
 }
 
-__attribute__((noinline))
-static void event_map_maybe_GC ( void )
-{
-   OldRef* oldref;
-   UWord   keyW, valW, retained, maxGen;
-   XArray* refs2del;
-   Word    i, j, n2del;
-
-   UWord* genMap      = NULL;
-   UWord  genMap_min  = 0;
-   UWord  genMap_size = 0;
-
-   if (LIKELY(oldrefTreeN < HG_(clo_conflict_cache_size)))
-      return;
-
-   if (0)
-      VG_(printf)("libhb: event_map GC at size %lu\n", oldrefTreeN);
-
-   /* Check for sane command line params.  Limit values must match
-      those in hg_process_cmd_line_option. */
-   tl_assert( HG_(clo_conflict_cache_size) >= 10*1000 );
-   tl_assert( HG_(clo_conflict_cache_size) <= 30*1000*1000 );
-
-   /* Check our counting is sane (expensive) */
-   if (CHECK_CEM)
-      tl_assert(oldrefTreeN == VG_(sizeSWA)( oldrefTree ));
-
-   /* Check the reference counts (expensive) */
-   if (CHECK_CEM)
-      event_map__check_reference_counts( True/*before*/ );
-
-   /* Compute the distribution of generation values in the ref tree.
-      There are likely only to be a few different generation numbers
-      in the whole tree, but we don't know what they are.  Hence use a
-      dynamically resized array of counters.  The array is genMap[0
-      .. genMap_size-1], where genMap[0] is the count for the
-      generation number genMap_min, genMap[1] is the count for
-      genMap_min+1, etc.  If a new number is seen outside the range
-      [genMap_min .. genMap_min + genMap_size - 1] then the array is
-      copied into a larger array, and genMap_min and genMap_size are
-      adjusted accordingly. */
-
-   /* genMap :: generation-number -> count-of-nodes-with-that-number */
-
-   VG_(initIterSWA)( oldrefTree );
-   while ( VG_(nextIterSWA)( oldrefTree, &keyW, &valW )) {
-
-       UWord ea, key;
-       oldref = (OldRef*)valW;
-       key = oldref->gen;
-
-      /* BEGIN find 'ea', which is the index in genMap holding the
-         count for generation number 'key'. */
-      if (UNLIKELY(genMap == NULL)) {
-         /* deal with the first key to be seen, so that the following
-            cases don't need to handle the complexity of a NULL count
-            array. */
-         genMap_min  = key;
-         genMap_size = 1;
-         genMap = HG_(zalloc)( "libhb.emmG.1a",
-                                genMap_size * sizeof(UWord) );
-         ea = 0;
-         if (0) VG_(printf)("(%lu) case 1 [%lu .. %lu]\n",
-                            key, genMap_min, genMap_min+genMap_size- 1 );
-      }
-      else
-      if (LIKELY(key >= genMap_min && key < genMap_min + genMap_size)) {
-         /* this is the expected (almost-always-happens) case: 'key'
-            is already mapped in the array. */
-         ea = key - genMap_min;
-      }
-      else
-      if (key < genMap_min) {
-         /* 'key' appears before the start of the current array.
-            Extend the current array by allocating a larger one and
-            copying the current one to the upper end of it. */
-         Word   more;
-         UWord* map2;
-         more = genMap_min - key;
-         tl_assert(more > 0);
-         map2 = HG_(zalloc)( "libhb.emmG.1b",
-                             (genMap_size + more) * sizeof(UWord) );
-         VG_(memcpy)( &map2[more], genMap, genMap_size * sizeof(UWord) );
-         HG_(free)( genMap );
-         genMap = map2;
-         genMap_size += more;
-         genMap_min -= more;
-         ea = 0;
-         tl_assert(genMap_min == key);
-         if (0) VG_(printf)("(%lu) case 2 [%lu .. %lu]\n",
-                            key, genMap_min,  genMap_min+genMap_size- 1 );
-      }
-      else {
-         /* 'key' appears after the end of the current array.  Extend
-            the current array by allocating a larger one and copying
-            the current one to the lower end of it. */
-         Word   more;
-         UWord* map2;
-         tl_assert(key >= genMap_min + genMap_size);
-         more = key - (genMap_min + genMap_size) + 1;
-         tl_assert(more > 0);
-         map2 = HG_(zalloc)( "libhb.emmG.1c",
-                             (genMap_size + more) * sizeof(UWord) );
-         VG_(memcpy)( &map2[0], genMap, genMap_size * sizeof(UWord) );
-         HG_(free)( genMap );
-         genMap = map2;
-         genMap_size += more;
-         ea = genMap_size - 1;;
-         tl_assert(genMap_min + genMap_size - 1 == key);
-         if (0) VG_(printf)("(%lu) case 3 [%lu .. %lu]\n",
-                            key, genMap_min, genMap_min+genMap_size- 1 );
-      }
-      /* END find 'ea' from 'key' */
-
-      tl_assert(ea >= 0 && ea < genMap_size);
-      /* and the whole point of this elaborate computation of 'ea' is .. */
-      genMap[ea]++;
-   }
-
-   tl_assert(genMap);
-   tl_assert(genMap_size > 0);
-
-   /* Sanity check what we just computed */
-   { UWord sum = 0;
-     for (i = 0; i < genMap_size; i++) {
-        if (0) VG_(printf)("  xxx: gen %ld has %lu\n",
-                           i + genMap_min, genMap[i] );
-        sum += genMap[i];
-     }
-     tl_assert(sum == oldrefTreeN);
-   }
-
-   /* Figure out how many generations to throw away */
-   retained = oldrefTreeN;
-   maxGen = 0;
-
-   for (i = 0; i < genMap_size; i++) {
-      keyW = i + genMap_min;
-      valW = genMap[i];
-      tl_assert(keyW > 0); /* can't allow a generation # 0 */
-      if (0) VG_(printf)("  XXX: gen %lu has %lu\n", keyW, valW );
-      tl_assert(keyW >= maxGen);
-      tl_assert(retained >= valW);
-      if (retained - valW
-          > (UWord)(HG_(clo_conflict_cache_size) 
-                    * EVENT_MAP_GC_DISCARD_FRACTION)) {
-         retained -= valW;
-         maxGen = keyW;
-      } else {
-         break;
-      }
-   }
-
-   HG_(free)(genMap);
-
-   tl_assert(retained >= 0 && retained <= oldrefTreeN);
-
-   /* Now make up a big list of the oldrefTree entries we want to
-      delete.  We can't simultaneously traverse the tree and delete
-      stuff from it, so first we need to copy them off somewhere
-      else. (sigh) */
-   refs2del = VG_(newXA)( HG_(zalloc), "libhb.emmG.2",
-                          HG_(free), sizeof(Addr) );
-
-   if (retained < oldrefTreeN) {
-
-      /* This is the normal (expected) case.  We discard any ref whose
-         generation number <= maxGen. */
-      VG_(initIterSWA)( oldrefTree );
-      while (VG_(nextIterSWA)( oldrefTree, &keyW, &valW )) {
-         oldref = (OldRef*)valW;
-         tl_assert(oldref->magic == OldRef_MAGIC);
-         if (oldref->gen <= maxGen) {
-            VG_(addToXA)( refs2del, &keyW );
-         }
-      }
-      if (VG_(clo_stats)) {
-         VG_(message)(Vg_DebugMsg,
-            "libhb: EvM GC: delete generations %lu and below, "
-            "retaining %lu entries\n",
-            maxGen, retained );
-      }
-
-   } else {
-
-      static UInt rand_seed = 0; /* leave as static */
-
-      /* Degenerate case: there's only one generation in the entire
-         tree, so we need to have some other way of deciding which
-         refs to throw away.  Just throw out half of them randomly. */
-      tl_assert(retained == oldrefTreeN);
-      VG_(initIterSWA)( oldrefTree );
-      while (VG_(nextIterSWA)( oldrefTree, &keyW, &valW )) {
-         UInt n;
-         oldref = (OldRef*)valW;
-         tl_assert(oldref->magic == OldRef_MAGIC);
-         n = VG_(random)( &rand_seed );
-         if ((n & 0xFFF) < 0x800) {
-            VG_(addToXA)( refs2del, &keyW );
-            retained--;
-         }
-      }
-      if (VG_(clo_stats)) {
-         VG_(message)(Vg_DebugMsg,
-            "libhb: EvM GC: randomly delete half the entries, "
-            "retaining %lu entries\n",
-            retained );
-      }
-
-   }
-
-   n2del = VG_(sizeXA)( refs2del );
-   tl_assert(n2del == (Word)(oldrefTreeN - retained));
-
-   if (0) VG_(printf)("%s","deleting entries\n");
-   for (i = 0; i < n2del; i++) {
-      Bool  b;
-      Addr  ga2del = *(Addr*)VG_(indexXA)( refs2del, i );
-      b = VG_(delFromSWA)( oldrefTree, &keyW, &valW, ga2del );
-      tl_assert(b);
-      tl_assert(keyW == ga2del);
-      oldref = (OldRef*)valW;
-      for (j = 0; j < N_OLDREF_ACCS; j++) {
-         ThrID aThrID = oldref->accs[j].thrid;
-         RCEC* aRef   = oldref->accs[j].rcec;
-         if (aRef) {
-            tl_assert(aThrID != 0);
-            stats__ctxt_rcdec3++;
-            ctxt__rcdec( aRef );
-         } else {
-            tl_assert(aThrID == 0);
-         }
-      }
-
-      free_OldRef( oldref );
-   }
-
-   VG_(deleteXA)( refs2del );
-
-   tl_assert( VG_(sizeSWA)( oldrefTree ) == retained );
-
-   oldrefTreeN = retained;
-   oldrefGenIncAt = oldrefTreeN; /* start new gen right away */
-
-   /* Throw away all RCECs with zero reference counts */
-   for (i = 0; i < N_RCEC_TAB; i++) {
-      RCEC** pp = &contextTab[i];
-      RCEC*  p  = *pp;
-      while (p) {
-         if (p->rc == 0) {
-            *pp = p->next;
-            free_RCEC(p);
-            p = *pp;
-            tl_assert(stats__ctxt_tab_curr > 0);
-            stats__ctxt_tab_curr--;
-         } else {
-            pp = &p->next;
-            p = p->next;
-         }
-      }
-   }
-
-   /* Check the reference counts (expensive) */
-   if (CHECK_CEM)
-      event_map__check_reference_counts( False/*after*/ );
-
-   //if (0)
-   //VG_(printf)("XXXX final sizes: oldrefTree %ld, contextTree %ld\n\n",
-   //            VG_(OSetGen_Size)(oldrefTree), VG_(OSetGen_Size)(contextTree));
-
-}
-
-
 /////////////////////////////////////////////////////////
 //                                                     //
 // Core MSM                                            //
@@ -4777,6 +4788,8 @@ static ULong stats__msmcread         = 0;
 static ULong stats__msmcread_change  = 0;
 static ULong stats__msmcwrite        = 0;
 static ULong stats__msmcwrite_change = 0;
+static ULong stats__msmc_owned       = 0;
+static ULong stats__msmc_unowned     = 0;
 
 /* Some notes on the H1 history mechanism:
 
@@ -4955,6 +4968,7 @@ static inline SVal msmcread ( SVal svOld,
                               Addr acc_addr, SizeT szB )
 {
    SVal svNew = SVal_INVALID;
+   SVal svC   = svOld;
    stats__msmcread++;
 
    /* Redundant sanity check on the constraints */
@@ -4962,12 +4976,25 @@ static inline SVal msmcread ( SVal svOld,
       tl_assert(is_sane_SVal_C(svOld));
    }
 
-   if (LIKELY(SVal__isC(svOld))) {
+   if (SVal__isO(svOld)) {
+      if (LIKELY(SVal__unO_ThrID(svOld) == acc_thr->thrid
+                 && Thr__can_own(acc_thr))) {
+         /* The owner reading its own memory: no race is possible.
+            As below, Rmin stays and Wmin moves up to our clock. */
+         svNew = SVal__mkO( acc_thr->thrid,
+                            SVal__unO_Rtym(svOld), acc_thr->tym );
+         stats__msmc_owned++;
+         goto out;
+      }
+      svC = SVal__unO_C(svOld);
+      stats__msmc_unowned++;
+   }
+   if (LIKELY(SVal__isC(svC))) {
       VtsID tviR  = acc_thr->viR;
       VtsID tviW  = acc_thr->viW;
-      VtsID rmini = SVal__unC_Rmin(svOld);
-      VtsID wmini = SVal__unC_Wmin(svOld);
-      Bool  leq   = VtsID__cmpLEQ(rmini,tviR);
+      VtsID rmini = SVal__unC_Rmin(svC);
+      VtsID wmini = SVal__unC_Wmin(svC);
+      Bool  leq   = VtsID__cmpLEQ_clock(rmini,tviR);
       if (LIKELY(leq)) {
          /* no race */
          /* Note: RWLOCK subtlety: use tviW, not tviR */
@@ -5003,7 +5030,7 @@ static inline SVal msmcread ( SVal svOld,
    if (UNLIKELY(svNew != svOld)) {
       tl_assert(svNew != SVal_INVALID);
       if (HG_(clo_history_level) >= 2
-          && SVal__isC(svOld) && SVal__isC(svNew)) {
+          && !SVal__isA(svOld) && !SVal__isA(svNew)) {
          event_map_bind( acc_addr, szB, False/*!isWrite*/, acc_thr );
          stats__msmcread_change++;
       }
@@ -5020,6 +5047,7 @@ static inline SVal msmcwrite ( SVal svOld,
                               Addr acc_addr, SizeT szB )
 {
    SVal svNew = SVal_INVALID;
+   SVal svC   = svOld;
    stats__msmcwrite++;
 
    /* Redundant sanity check on the constraints */
@@ -5027,16 +5055,28 @@ static inline SVal msmcwrite ( SVal svOld,
       tl_assert(is_sane_SVal_C(svOld));
    }
 
-   if (LIKELY(SVal__isC(svOld))) {
+   if (SVal__isO(svOld)) {
+      if (LIKELY(SVal__unO_ThrID(svOld) == acc_thr->thrid
+                 && Thr__can_own(acc_thr))) {
+         /* The owner writing its own memory: no race is possible,
+            and both constraints move up to our clock. */
+         svNew = SVal__mkO( acc_thr->thrid, acc_thr->tym, acc_thr->tym );
+         stats__msmc_owned++;
+         goto out;
+      }
+      svC = SVal__unO_C(svOld);
+      stats__msmc_unowned++;
+   }
+   if (LIKELY(SVal__isC(svC))) {
       VtsID tviW  = acc_thr->viW;
-      VtsID wmini = SVal__unC_Wmin(svOld);
-      Bool  leq   = VtsID__cmpLEQ(wmini,tviW);
+      VtsID wmini = SVal__unC_Wmin(svC);
+      Bool  leq   = VtsID__cmpLEQ_clock(wmini,tviW);
       if (LIKELY(leq)) {
          /* no race */
          svNew = SVal__mkC( tviW, tviW );
          goto out;
       } else {
-         VtsID rmini = SVal__unC_Rmin(svOld);
+         VtsID rmini = SVal__unC_Rmin(svC);
          /* assert on sanity of constraints. */
          Bool leqxx = VtsID__cmpLEQ(rmini,wmini);
          tl_assert(leqxx);
@@ -5076,7 +5116,7 @@ static inline SVal msmcwrite ( SVal svOld,
    if (UNLIKELY(svNew != svOld)) {
       tl_assert(svNew != SVal_INVALID);
       if (HG_(clo_history_level) >= 2
-          && SVal__isC(svOld) && SVal__isC(svNew)) {
+          && !SVal__isA(svOld) && !SVal__isA(svNew)) {
          event_map_bind( acc_addr, szB, True/*isWrite*/, acc_thr );
          stats__msmcwrite_change++;
       }
@@ -5114,7 +5154,10 @@ static void zsm_sapply08__msmcread ( Thr* thr, Addr a ) {
    svNew = msmcread( svOld, thr,a,1 );
    if (CHECK_ZSM)
       tl_assert(svNew != SVal_INVALID);
-   cl->svals[cloff] = svNew;
+   if (svNew != svOld) {
+      cl->svals[cloff] = svNew;
+      cl->dirty = True;
+   }
 }
 
 static void zsm_sapply08__msmcwrite ( Thr* thr, Addr a ) {
@@ -5138,7 +5181,10 @@ static void zsm_sapply08__msmcwrite ( Thr* thr, Addr a ) {
    svNew = msmcwrite( svOld, thr,a,1 );
    if (CHECK_ZSM)
       tl_assert(svNew != SVal_INVALID);
-   cl->svals[cloff] = svNew;
+   if (svNew != svOld) {
+      cl->svals[cloff] = svNew;
+      cl->dirty = True;
+   }
 }
 
 /*------------- ZSM accesses: 16 bit sapply ------------- */
@@ -5169,7 +5215,10 @@ static void zsm_sapply16__msmcread ( Thr* thr, Addr a ) {
    svNew = msmcread( svOld, thr,a,2 );
    if (CHECK_ZSM)
       tl_assert(svNew != SVal_INVALID);
-   cl->svals[cloff] = svNew;
+   if (svNew != svOld) {
+      cl->svals[cloff] = svNew;
+      cl->dirty = True;
+   }
    return;
   slowcase: /* misaligned, or must go further down the tree */
    stats__cline_16to8splits++;
@@ -5203,7 +5252,10 @@ static void zsm_sapply16__msmcwrite ( Thr* thr, Addr a ) {
    svNew = msmcwrite( svOld, thr,a,2 );
    if (CHECK_ZSM)
       tl_assert(svNew != SVal_INVALID);
-   cl->svals[cloff] = svNew;
+   if (svNew != svOld) {
+      cl->svals[cloff] = svNew;
+      cl->dirty = True;
+   }
    return;
   slowcase: /* misaligned, or must go further down the tree */
    stats__cline_16to8splits++;
@@ -5239,7 +5291,10 @@ static void zsm_sapply32__msmcread ( Thr* thr, Addr a ) {
    svNew = msmcread( svOld, thr,a,4 );
    if (CHECK_ZSM)
       tl_assert(svNew != SVal_INVALID);
-   cl->svals[cloff] = svNew;
+   if (svNew != svOld) {
+      cl->svals[cloff] = svNew;
+      cl->dirty = True;
+   }
    return;
   slowcase: /* misaligned, or must go further down the tree */
    stats__cline_32to16splits++;
@@ -5273,7 +5328,10 @@ static void zsm_sapply32__msmcwrite ( Thr* thr, Addr a ) {
    svNew = msmcwrite( svOld, thr,a,4 );
    if (CHECK_ZSM)
       tl_assert(svNew != SVal_INVALID);
-   cl->svals[cloff] = svNew;
+   if (svNew != svOld) {
+      cl->svals[cloff] = svNew;
+      cl->dirty = True;
+   }
    return;
   slowcase: /* misaligned, or must go further down the tree */
    stats__cline_32to16splits++;
@@ -5303,7 +5361,10 @@ static void zsm_sapply64__msmcread ( Thr* thr, Addr a ) {
    svNew = msmcread( svOld, thr,a,8 );
    if (CHECK_ZSM)
       tl_assert(svNew != SVal_INVALID);
-   cl->svals[cloff] = svNew;
+   if (svNew != svOld) {
+      cl->svals[cloff] = svNew;
+      cl->dirty = True;
+   }
    return;
   slowcase: /* misaligned, or must go further down the tree */
    stats__cline_64to32splits++;
@@ -5331,7 +5392,10 @@ static void zsm_sapply64__msmcwrite ( Thr* thr, Addr a ) {
    svNew = msmcwrite( svOld, thr,a,8 );
    if (CHECK_ZSM)
       tl_assert(svNew != SVal_INVALID);
-   cl->svals[cloff] = svNew;
+   if (svNew != svOld) {
+      cl->svals[cloff] = svNew;
+      cl->dirty = True;
+   }
    return;
   slowcase: /* misaligned, or must go further down the tree */
    stats__cline_64to32splits++;
@@ -5360,6 +5424,7 @@ void zsm_swrite08 ( Addr a, SVal svNew ) {
    }
    tl_assert(svNew != SVal_INVALID);
    cl->svals[cloff] = svNew;
+   cl->dirty = True;
 }
 
 /*--------------- ZSM accesses: 16 bit swrite --------------- */
@@ -5393,6 +5458,7 @@ void zsm_swrite16 ( Addr a, SVal svNew ) {
       }
    }
    tl_assert(svNew != SVal_INVALID);
+   cl->dirty = True;
    cl->svals[cloff + 0] = svNew;
    cl->svals[cloff + 1] = SVal_INVALID;
    return;
@@ -5433,6 +5499,7 @@ void zsm_swrite32 ( Addr a, SVal svNew ) {
       }
    }
    tl_assert(svNew != SVal_INVALID);
+   cl->dirty = True;
    cl->svals[cloff + 0] = svNew;
    cl->svals[cloff + 1] = SVal_INVALID;
    cl->svals[cloff + 2] = SVal_INVALID;
@@ -5459,6 +5526,7 @@ void zsm_swrite64 ( Addr a, SVal svNew ) {
    //toff  = get_tree_offset(a); /* == 0, unused */
    cl->descrs[tno] = TREE_DESCR_64;
    tl_assert(svNew != SVal_INVALID);
+   cl->dirty = True;
    cl->svals[cloff + 0] = svNew;
    cl->svals[cloff + 1] = SVal_INVALID;
    cl->svals[cloff + 2] = SVal_INVALID;
@@ -5635,7 +5703,7 @@ static void zsm_sset_range ( Addr a, SizeT len, SVal svNew )
       /* tag is 'a' with the in-line offset masked out, 
          eg a[31]..a[4] 0000 */
       Addr       tag = a & ~(N_LINE_ARANGE - 1);
-      UWord      wix = (a >> N_LINE_BITS) & (N_WAY_NENT - 1);
+      UWord      wix = (a >> N_LINE_BITS) & cache_shmem.mask;
       if (LIKELY(tag == cache_shmem.tags0[wix])) {
          n_New_in_cache++;
       } else {
@@ -5683,7 +5751,7 @@ static void zsm_sset_range ( Addr a, SizeT len, SVal svNew )
             break;
          tl_assert(get_cacheline_offset(aligned_start) == 0);
          tag = aligned_start & ~(N_LINE_ARANGE - 1);
-         wix = (aligned_start >> N_LINE_BITS) & (N_WAY_NENT - 1);
+         wix = (aligned_start >> N_LINE_BITS) & cache_shmem.mask;
          if (tag == cache_shmem.tags0[wix]) {
             UWord i;
             for (i = 0; i < N_LINE_ARANGE / 8; i++)
@@ -6119,6 +6187,7 @@ Thr* libhb_init (
    vi  = VtsID__mk_Singleton( thr, 1 );
    thr->viR = vi;
    thr->viW = vi;
+   thr->tym = 1;
    VtsID__rcinc(thr->viR);
    VtsID__rcinc(thr->viW);
 
@@ -6146,12 +6215,17 @@ Thr* libhb_create ( Thr* parent )
 
    tl_assert(VtsID__indexAt( child->viR, child ) == 1);
    tl_assert(VtsID__indexAt( child->viW, child ) == 1);
+   child->tym = 1;
 
    /* and the parent has to move along too */
+   VtsID__set_epoch(parent->viW, parent);
    VtsID__rcdec(parent->viR);
    VtsID__rcdec(parent->viW);
    parent->viR = VtsID__tick( parent->viR, parent );
    parent->viW = VtsID__tick( parent->viW, parent );
+   parent->tym++;
+   if (CHECK_MSM)
+      tl_assert(parent->tym == VtsID__indexAt( parent->viW, parent ));
    Filter__clear(parent->filter, "libhb_create(parent)");
    VtsID__rcinc(parent->viR);
    VtsID__rcinc(parent->viW);
@@ -6190,6 +6264,8 @@ void libhb_shutdown ( Bool show_stats )
                   stats__cache_Z_fetches, stats__cache_F_fetches );
       VG_(printf)("   cache: %'14lu Z-wback,    %'14lu F-wback\n",
                   stats__cache_Z_wbacks, stats__cache_F_wbacks );
+      VG_(printf)("   cache: %'14lu clean drops (%'lu lines)\n",
+                  stats__cache_clean_drops, cache_shmem.mask + 1 );
       VG_(printf)("   cache: %'14lu invals,     %'14lu flushes\n",
                   stats__cache_invals, stats__cache_flushes );
       VG_(printf)("   cache: %'14llu arange_New  %'14llu direct-to-Zreps\n",
@@ -6234,6 +6310,8 @@ void libhb_shutdown ( Bool show_stats )
                   stats__msmcread, stats__msmcread_change);
       VG_(printf)("   libhb: %'13llu msmcwrite (%'llu dragovers)\n",
                   stats__msmcwrite, stats__msmcwrite_change);
+      VG_(printf)("   libhb: %'13llu owned accesses (%'llu by others)\n",
+                  stats__msmc_owned, stats__msmc_unowned);
       VG_(printf)("   libhb: %'13llu cmpLEQ queries (%'llu misses)\n",
                   stats__cmpLEQ_queries, stats__cmpLEQ_misses);
       VG_(printf)("   libhb: %'13llu join2  queries (%'llu misses)\n",
@@ -6242,6 +6320,8 @@ void libhb_shutdown ( Bool show_stats )
       VG_(printf)("%s","\n");
       VG_(printf)( "   libhb: VTSops: tick %'lu,  join %'lu,  cmpLEQ %'lu\n",
                    stats__vts__tick, stats__vts__join,  stats__vts__cmpLEQ );
+      VG_(printf)( "   libhb: VTSops: by epoch: cmpLEQ %'lu,  join %'lu\n",
+                   stats__vts__cmpLEQ_epoch, stats__vts__join_epoch );
       VG_(printf)( "   libhb: VTSops: cmp_structural %'lu (%'lu slow)\n",
                    stats__vts__cmp_structural, stats__vts__cmp_structural_slow );
       VG_(printf)( "   libhb: VTSset: find__or__clone_and_add %'lu (%'lu allocd)\n",
@@ -6264,6 +6344,8 @@ void libhb_shutdown ( Bool show_stats )
                    stats__ctxt_rcdec3 );
       VG_(printf)( "   libhb: ctxt__rcdec: calls %lu, discards %lu\n",
                    stats__ctxt_rcdec_calls, stats__ctxt_rcdec_discards);
+      VG_(printf)( "   libhb: oldrefTree: %lu entries, %lu recycled\n",
+                   oldrefTreeN, stats__oldref_recycled );
       VG_(printf)( "   libhb: contextTab: %lu slots, %lu max ents\n",
                    (UWord)N_RCEC_TAB,
                    stats__ctxt_tab_curr );
@@ -6398,10 +6480,14 @@ void libhb_so_send ( Thr* thr, SO* so, Bool strong_send )
    }
 
    /* move both parent clocks along */
+   VtsID__set_epoch(thr->viW, thr);
    VtsID__rcdec(thr->viR);
    VtsID__rcdec(thr->viW);
    thr->viR = VtsID__tick( thr->viR, thr );
    thr->viW = VtsID__tick( thr->viW, thr );
+   thr->tym++;
+   if (CHECK_MSM)
+      tl_assert(thr->tym == VtsID__indexAt( thr->viW, thr ));
    if (!thr->llexit_done) {
       Filter__clear(thr->filter, "libhb_so_send");
       note_local_Kw_n_stack_for(thr);
@@ -6499,7 +6585,11 @@ static void trace ( Thr* thr, Addr a, SizeT szB, const HChar* s )
 
 void libhb_srange_new ( Thr* thr, Addr a, SizeT szB )
 {
-   SVal sv = SVal__mkC(thr->viW, thr->viW);
+   /* New memory starts out owned by the allocating thread, if it
+      can; otherwise constrained by that thread's clock. */
+   SVal sv = Thr__can_own(thr)
+                ? SVal__mkO(thr->thrid, thr->tym, thr->tym)
+                : SVal__mkC(thr->viW, thr->viW);
    tl_assert(is_sane_SVal_C(sv));
    if (0 && TRACEME(a,szB)) trace(thr,a,szB,"nw-before");
    zsm_sset_range( a, szB, sv );
@@ -6550,7 +6640,10 @@ void libhb_copy_shadow_state ( Thr* thr, Addr src, Addr dst, SizeT len )
 
 void libhb_maybe_GC ( void )
 {
-   event_map_maybe_GC();
+   /* The conflicting-access cache needs no GC: it is kept within
+      --conflict-cache-size by event_map_bind.  Check it (expensive). */
+   if (CHECK_CEM)
+      event_map__check_reference_counts();
    /* If there are still freelist entries available, no need for a
       GC. */
    if (vts_tab_freelist != VtsID_INVALID)
@@ -0,0 +1,33 @@
+/* Memory allocated by one thread starts out owned by it.  Check that a
+   race on it between two other threads is still reported. */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int *shared;
+
+static void *th(void *v)
+{
+	(*shared)++;
+
+	return 0;
+}
+
+int main()
+{
+	pthread_t a, b;
+
+	shared = malloc(sizeof(int));
+	*shared = 0;		/* owned by the root thread */
+
+	pthread_create(&a, NULL, th, NULL);
+	sleep(1);		/* force ordering */
+	pthread_create(&b, NULL, th, NULL);
+
+	pthread_join(a, NULL);
+	pthread_join(b, NULL);
+
+	free(shared);
+	return 0;
+}
@@ -0,0 +1,33 @@
+/* Memory allocated by one thread starts out owned by it.  Check that a
+   race between the owner and a thread it created, which accesses the
+   block without synchronising with it, is reported. */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int *shared;
+
+static void *th(void *v)
+{
+	*shared = 1;
+
+	return 0;
+}
+
+int main()
+{
+	pthread_t a;
+
+	shared = malloc(sizeof(int));
+	*shared = 0;		/* owned by the root thread */
+
+	pthread_create(&a, NULL, th, NULL);
+	sleep(1);		/* force ordering */
+	*shared = 2;		/* races with th */
+
+	pthread_join(a, NULL);
+
+	free(shared);
+	return 0;
+}
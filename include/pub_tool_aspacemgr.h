@@ -148,6 +148,12 @@ extern Bool VG_(am_is_valid_for_client) ( Addr start, SizeT len,
 /* Really just a wrapper around VG_(am_mmap_anon_float_valgrind). */
 extern void* VG_(am_shadow_alloc)(SizeT size);
 
+/* As VG_(am_shadow_alloc), but the memory is mapped shared, so that
+   writes to it by a process created with VG_(fork) are seen by its
+   parent and vice versa.  Returns NULL on failure.  Free it with
+   VG_(am_munmap_valgrind). */
+extern void* VG_(am_shared_alloc)(SizeT size);
+
 /* Unmap the given address range and update the segment array
    accordingly.  This fails if the range isn't valid for valgrind. */
 extern SysRes VG_(am_munmap_valgrind)( Addr start, SizeT length );
@@ -96,7 +96,6 @@ extern UInt VG_(get_ECU_from_ExeContext)( ExeContext* e );
 extern Int VG_(get_ExeContext_n_ips)( ExeContext* e );
 
 // Find the ExeContext that has the given ECU, if any.
-// NOTE: very slow.  Do not call often.
 extern ExeContext* VG_(get_ExeContext_from_ECU)( UInt uniq );
 
 // Make an ExeContext containing just 'a', and nothing else
@@ -43,6 +43,17 @@
 extern Int VG_(sigprocmask) ( Int how, const vki_sigset_t* set,
                               vki_sigset_t* oldset );
 
+extern Int VG_(sigaction)   ( Int signum,
+                              const vki_sigaction_toK_t* act,
+                              vki_sigaction_fromK_t* oldact );
+
+/* Convert a sigaction which you got from the kernel (a _fromK_t) to
+   one which you can give back to the kernel (a _toK_t).  On Linux,
+   vki_sigaction_{toK,fromK}_t are identical, so this is a no-op
+   (structure copy), but on Darwin it's not a no-op. */
+extern void VG_(convert_sigaction_fromK_to_toK)(
+               vki_sigaction_fromK_t*, /*OUT*/vki_sigaction_toK_t*);
+
 #endif   // __PUB_TOOL_LIBCBSIGNAL_H
 
 /*--------------------------------------------------------------------*/
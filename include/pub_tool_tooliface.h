@@ -496,6 +496,29 @@ extern void VG_(needs_xml_output) ( void );
    function here. */
 extern void VG_(needs_final_IR_tidy_pass) ( IRSB*(*final_tidy)(IRSB*) );
 
+/* Are the tool's translations a pure function of the guest code and
+   the command line options?  That is, does the instrumentation avoid
+   embedding pointers to run-time-allocated tool data, and does the
+   tool not need to see each translation via instrument()?  If so, the
+   core may save translations to disk (--persistent-transtab) and
+   reuse them, without calling instrument(), in later runs.  Since
+   this can depend on the options, it may be called from
+   post_clo_init.  Translations are never reused when any of the
+   track_new_mem_stack_*_w_ECU handlers are in use, since the calls
+   to those embed ECUs that are only valid in the current run. */
+extern void VG_(needs_reusable_translations) ( void );
+
+/* Can the tool's instrumented code be run by several threads at
+   once?  That is, do the instrumentation and any helpers it calls
+   touch only the running thread's guest state and memory, and
+   nothing shared by the tool?  If so, the core may let client threads
+   execute translated code in parallel, without holding the big lock
+   (--parallel-sched=yes).  Note that VG_(get_running_tid) is not
+   meaningful in helpers called from code run this way.  Everything
+   else (instrument(), core events, client requests, syscall
+   wrappers) is still called with all other threads stopped. */
+extern void VG_(needs_thread_safe_instrumentation) ( void );
+
 
 /* ------------------------------------------------------------------ */
 /* Core events to track */
@@ -0,0 +1,50 @@
+/*--------------------------------------------------------------------*/
+/*--- The translation table and cache.                             ---*/
+/*---                                          pub_tool_transtab.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Valgrind, a dynamic binary instrumentation
+   framework.
+
+   Copyright (C) 2000-2013 Julian Seward
+      jseward@acm.org
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef __PUB_TOOL_TRANSTAB_H
+#define __PUB_TOOL_TRANSTAB_H
+
+#include "pub_tool_basics.h"   // Addr64, ULong
+
+/* Discard all translations of guest code in [start, start+range), so
+   that it is instrumented again when it is next executed.  Tools
+   which instrument code differently over time can use this.  It must
+   not be called from generated code (e.g. from a helper called by
+   instrumented code), only from tool callbacks invoked by the core
+   outside generated code, such as client request handlers and memory
+   event callbacks for syscalls.  'who' is used for debug output. */
+extern void VG_(discard_translations) ( Addr64 start, ULong range,
+                                        const HChar* who );
+
+#endif   // __PUB_TOOL_TRANSTAB_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                      pub_tool_transtab.h ---*/
+/*--------------------------------------------------------------------*/
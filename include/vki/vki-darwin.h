@@ -729,6 +729,11 @@ typedef
 #define	VKI_W_OK	W_OK
 #define	VKI_R_OK	R_OK
 
+
+#include <sys/wait.h>
+
+#define VKI_WNOHANG     WNOHANG
+
 #define vki_accessx_descriptor         accessx_descriptor
 #define VKI_ACCESSX_MAX_DESCRIPTORS    ACCESSX_MAX_DESCRIPTORS
 
@@ -75,10 +75,10 @@
 //   [Introduction of --time-unit=i as the default slowed things down by
 //   roughly 0--20%.]
 //
-// - get_XCon accounts for about 9% of konqueror startup time.  Try
-//   keeping XPt children sorted by 'ip' and use binary search in get_XCon.
-//   Requires factoring out binary search code from various places into a
-//   VG_(bsearch) function.  
+// - get_XCon used to account for about 9% of konqueror startup time,
+//   mostly searching XPt children linearly.  XPts with many children now
+//   also keep them sorted by 'ip' (see 'children_by_ip'), for binary search.
+//   Run perf/many-alloc-sites to measure it.
 //
 // Todo -- low priority:
 // - In each XPt, record both bytes and the number of allocations, and
@@ -250,6 +250,7 @@ static UInt n_stack_frees           = 0;
 static UInt n_xpts                  = 0;
 static UInt n_xpt_init_expansions   = 0;
 static UInt n_xpt_later_expansions  = 0;
+static UInt n_xpt_child_indexes     = 0;
 static UInt n_sxpt_allocs           = 0;
 static UInt n_sxpt_frees            = 0;
 static UInt n_skipped_snapshots     = 0;
@@ -391,6 +392,8 @@ static const HChar* TimeUnit_to_string(TimeUnit time_unit)
    }
 }
 
+typedef enum { OutText, OutBinary } OutFormat;
+
 static Bool   clo_heap            = True;
    // clo_heap_admin is deliberately a word-sized type.  At one point it was
    // a UInt, but this caused problems on 64-bit machines when it was
@@ -406,6 +409,7 @@ static Int    clo_time_unit       = TimeI;
 static Int    clo_detailed_freq   = 10;
 static Int    clo_max_snapshots   = 100;
 static const HChar* clo_massif_out_file = "massif.out.%p";
+static Int    clo_massif_out_format = OutText;
 
 static XArray* args_for_massif;
 
@@ -451,6 +455,11 @@ static Bool ms_process_cmd_line_option(const HChar* arg)
 
    else if VG_STR_CLO(arg, "--massif-out-file", clo_massif_out_file) {}
 
+   else if VG_XACT_CLO(arg, "--massif-out-format=text",
+                       clo_massif_out_format, OutText)   {}
+   else if VG_XACT_CLO(arg, "--massif-out-format=binary",
+                       clo_massif_out_format, OutBinary) {}
+
    else
       return VG_(replacement_malloc_process_cmd_line_option)(arg);
 
@@ -475,6 +484,8 @@ static void ms_print_usage(void)
 "    --detailed-freq=<N>       every Nth snapshot should be detailed [10]\n"
 "    --max-snapshots=<N>       maximum number of snapshots recorded [100]\n"
 "    --massif-out-file=<file>  output file name [massif.out.%%p]\n"
+"    --massif-out-format=text|binary  write all snapshots as text at exit,\n"
+"                              or stream them in binary as taken [text]\n"
    );
 }
 
@@ -549,8 +560,22 @@ struct _XPt {
    UInt  n_children;       // number of children
    UInt  max_children;     // capacity of children array
    XPt** children;         // pointers to children XPts
+
+   // If there are more than XPT_MAX_LINEAR_CHILDREN children, the same
+   // pointers sorted by 'ip', so get_XCon can find a child by binary search
+   // (eg. alloc_xpt can have tens of thousands of children).  Otherwise
+   // NULL.  Nb: 'children' itself stays in order of creation, which
+   // decides the printing order of children of equal size.
+   XPt** children_by_ip;   // capacity is max_children
+
+   // Has szB changed since the last detailed snapshot?  See 'dirty_xpts'.
+   Bool  is_dirty;
 };
 
+// A linear search of this many children is about as fast as a binary
+// search, and needs no extra memory.
+#define XPT_MAX_LINEAR_CHILDREN   16
+
 typedef
    enum {
       SigSXPt,
@@ -585,6 +610,31 @@ struct _SXPt {
 // parent node to all top-XPts.
 static XPt* alloc_xpt;
 
+// Detailed snapshots in the snapshots array don't copy the whole XTree,
+// which is expensive for big XTrees.  Instead, each one records just the
+// XPts that have changed since the previous detailed snapshot, and their
+// sizes (an "XTree delta", see take_XTree_delta).  The changed XPts are
+// collected by update_XCon in 'dirty_xpts'.  New XPts count as changed, so
+// a delta also tells which XPts existed at the time.  Detailed snapshots'
+// XTrees are rebuilt from the deltas when they are printed, at exit.
+//
+// This isn't done with --massif-out-format=binary, which writes detailed
+// snapshots as soon as they are taken.
+static Bool    track_xtree_deltas = False;
+static XArray* dirty_xpts         = NULL;   // XPt*
+
+static __inline__ void mark_xpt_dirty(XPt* xpt)
+{
+   if (!xpt->is_dirty) {
+      xpt->is_dirty = True;
+      VG_(addToXA)(dirty_xpts, &xpt);
+   }
+}
+
+// The size of an XPt that didn't exist yet, while rebuilding an XTree
+// from XTree deltas.
+#define XPT_ABSENT_SZB   ((SizeT)-1)
+
 static XPt* new_XPt(Addr ip, XPt* parent)
 {
    // XPts are never freed, so we can use VG_(perm_malloc) to allocate them.
@@ -598,9 +648,14 @@ static XPt* new_XPt(Addr ip, XPt* parent)
    // We don't initially allocate any space for children.  We let that
    // happen on demand.  Many XPts (ie. all the bottom-XPts) don't have any
    // children anyway.
-   xpt->n_children   = 0;
-   xpt->max_children = 0;
-   xpt->children     = NULL;
+   xpt->n_children     = 0;
+   xpt->max_children   = 0;
+   xpt->children       = NULL;
+   xpt->children_by_ip = NULL;
+   xpt->is_dirty       = False;
+   if (track_xtree_deltas) {
+      mark_xpt_dirty(xpt);
+   }
 
    // Update statistics
    n_xpts++;
@@ -608,6 +663,15 @@ static XPt* new_XPt(Addr ip, XPt* parent)
    return xpt;
 }
 
+static Int XPt_cmp_ip(const void* n1, const void* n2)
+{
+   const XPt* xpt1 = *(const XPt *const *)n1;
+   const XPt* xpt2 = *(const XPt *const *)n2;
+   return ( xpt1->ip < xpt2->ip ? -1
+          : xpt1->ip > xpt2->ip ?  1
+          :                        0);
+}
+
 static void add_child_xpt(XPt* parent, XPt* child)
 {
    // Expand 'children' if necessary.
@@ -623,12 +687,65 @@ static void add_child_xpt(XPt* parent, XPt* child)
          parent->children = VG_(realloc)( "ms.main.acx.2",
                                           parent->children,
                                           parent->max_children * sizeof(XPt*) );
+         if (parent->children_by_ip) {
+            parent->children_by_ip =
+               VG_(realloc)( "ms.main.acx.3", parent->children_by_ip,
+                             parent->max_children * sizeof(XPt*) );
+         }
          n_xpt_later_expansions++;
       }
    }
 
    // Insert new child XPt in parent's children list.
    parent->children[ parent->n_children++ ] = child;
+
+   // Keep the sorted index up to date, creating it when it becomes
+   // worthwhile.  Insertion is O(n), but it only happens once per XPt,
+   // whereas the search happens for every allocation.
+   if (parent->children_by_ip) {
+      Int lo = 0, hi = parent->n_children - 2;     // -2: 'child' isn't in it
+      while (lo <= hi) {
+         Int mid = (lo + hi) / 2;
+         tl_assert(parent->children_by_ip[mid]->ip != child->ip);
+         if (parent->children_by_ip[mid]->ip < child->ip) lo = mid + 1;
+         else                                             hi = mid - 1;
+      }
+      VG_(memmove)( &parent->children_by_ip[lo+1],
+                    &parent->children_by_ip[lo],
+                    (parent->n_children - 1 - lo) * sizeof(XPt*) );
+      parent->children_by_ip[lo] = child;
+
+   } else if (parent->n_children > XPT_MAX_LINEAR_CHILDREN) {
+      parent->children_by_ip = VG_(malloc)( "ms.main.acx.4",
+                                            parent->max_children * sizeof(XPt*) );
+      VG_(memcpy)( parent->children_by_ip, parent->children,
+                   parent->n_children * sizeof(XPt*) );
+      VG_(ssort)( parent->children_by_ip, parent->n_children, sizeof(XPt*),
+                  XPt_cmp_ip );
+      n_xpt_child_indexes++;
+   }
+}
+
+// Finds the child of 'parent' with the given ip, or returns NULL.
+static XPt* find_child_xpt(XPt* parent, Addr ip)
+{
+   Int i;
+   if (parent->children_by_ip) {
+      Int lo = 0, hi = parent->n_children - 1;
+      while (lo <= hi) {
+         Int  mid = (lo + hi) / 2;
+         XPt* xpt = parent->children_by_ip[mid];
+         if      (xpt->ip < ip) lo = mid + 1;
+         else if (xpt->ip > ip) hi = mid - 1;
+         else                   return xpt;
+      }
+   } else {
+      for (i = 0; i < parent->n_children; i++) {
+         if (ip == parent->children[i]->ip)
+            return parent->children[i];
+      }
+   }
+   return NULL;
 }
 
 // Reverse comparison for a reverse sort -- biggest to smallest.
@@ -674,13 +791,19 @@ static SXPt* dup_XTree(XPt* xpt, SizeT total_szB)
    }
 
    // How many children are significant?  And do we need an aggregate SXPt?
+   // (Nb: when rebuilding an XTree from XTree deltas, we skip children that
+   // didn't exist at the time of the snapshot.)
    n_sig_children = 0;
+   n_insig_children = 0;
    for (i = 0; i < xpt->n_children; i++) {
-      if (xpt->children[i]->szB >= sig_child_threshold_szB) {
+      if (XPT_ABSENT_SZB == xpt->children[i]->szB) {
+         continue;
+      } else if (xpt->children[i]->szB >= sig_child_threshold_szB) {
          n_sig_children++;
+      } else {
+         n_insig_children++;
       }
    }
-   n_insig_children = xpt->n_children - n_sig_children;
    n_child_sxpts = n_sig_children + ( n_insig_children > 0 ? 1 : 0 );
 
    // Duplicate the XPt.
@@ -702,7 +825,9 @@ static SXPt* dup_XTree(XPt* xpt, SizeT total_szB)
       // insig_children_szB doesn't necessarily equal xpt->szB.)
       j = 0;
       for (i = 0; i < xpt->n_children; i++) {
-         if (xpt->children[i]->szB >= sig_child_threshold_szB) {
+         if (XPT_ABSENT_SZB == xpt->children[i]->szB) {
+            continue;
+         } else if (xpt->children[i]->szB >= sig_child_threshold_szB) {
             sxpt->Sig.children[j++] = dup_XTree(xpt->children[i], total_szB);
             sig_children_szB   += xpt->children[i]->szB;
          } else {
@@ -918,26 +1043,16 @@ static XPt* get_XCon( ThreadId tid, Bool exclude_first_entry )
    // Now do the search/insertion of the XCon.
    for (i = 0; i < n_ips; i++) {
       Addr ip = ips[i];
-      Int ch;
       // Look for IP in xpt's children.
-      // Linear search, ugh -- about 10% of time for konqueror startup tried
-      // caching last result, only hit about 4% for konqueror.
       // Nb:  this search hits about 98% of the time for konqueror
-      for (ch = 0; True; ch++) {
-         if (ch == xpt->n_children) {
-            // IP not found in the children.
-            // Create and add new child XPt, then stop.
-            XPt* new_child_xpt = new_XPt(ip, xpt);
-            add_child_xpt(xpt, new_child_xpt);
-            xpt = new_child_xpt;
-            break;
-
-         } else if (ip == xpt->children[ch]->ip) {
-            // Found the IP in the children, stop.
-            xpt = xpt->children[ch];
-            break;
-         }
+      XPt* child_xpt = find_child_xpt(xpt, ip);
+      if (NULL == child_xpt) {
+         // IP not found in the children.
+         // Create and add new child XPt.
+         child_xpt = new_XPt(ip, xpt);
+         add_child_xpt(xpt, child_xpt);
       }
+      xpt = child_xpt;
    }
 
    // [Note: several comments refer to this comment.  Do not delete it
@@ -993,10 +1108,12 @@ static void update_XCon(XPt* xpt, SSizeT space_delta)
    while (xpt != alloc_xpt) {
       if (space_delta < 0) tl_assert(xpt->szB >= -space_delta);
       xpt->szB += space_delta;
+      if (track_xtree_deltas) mark_xpt_dirty(xpt);
       xpt = xpt->parent;
    }
    if (space_delta < 0) tl_assert(alloc_xpt->szB >= -space_delta);
    alloc_xpt->szB += space_delta;
+   if (track_xtree_deltas) mark_xpt_dirty(alloc_xpt);
 }
 
 
@@ -1033,9 +1150,19 @@ typedef
       SizeT heap_extra_szB;// Heap slop + admin bytes.
       SizeT stacks_szB;
       SXPt* alloc_sxpt;    // Heap XTree root, if a detailed snapshot,
-   }                       // otherwise NULL.
+                           // otherwise NULL.
+      XArray* xtree_delta; // Or instead, if a detailed snapshot in the
+                           // snapshots array, its XTree delta (XPtDeltas).
+   }
    Snapshot;
 
+typedef
+   struct {
+      XPt*  xpt;
+      SizeT szB;
+   }
+   XPtDelta;
+
 static UInt      next_snapshot_i = 0;  // Index of where next snapshot will go.
 static Snapshot* snapshots;            // Array of snapshots.
 
@@ -1048,6 +1175,7 @@ static Bool is_snapshot_in_use(Snapshot* snapshot)
       tl_assert(snapshot->heap_szB       == 0);
       tl_assert(snapshot->stacks_szB     == 0);
       tl_assert(snapshot->alloc_sxpt     == NULL);
+      tl_assert(snapshot->xtree_delta    == NULL);
       return False;
    } else {
       tl_assert(snapshot->time           != UNUSED_SNAPSHOT_TIME);
@@ -1057,7 +1185,7 @@ static Bool is_snapshot_in_use(Snapshot* snapshot)
 
 static Bool is_detailed_snapshot(Snapshot* snapshot)
 {
-   return (snapshot->alloc_sxpt ? True : False);
+   return (snapshot->alloc_sxpt || snapshot->xtree_delta ? True : False);
 }
 
 static Bool is_uncullable_snapshot(Snapshot* snapshot)
@@ -1099,6 +1227,83 @@ static void clear_snapshot(Snapshot* snapshot, Bool do_sanity_check)
    snapshot->heap_szB       = 0;
    snapshot->stacks_szB     = 0;
    snapshot->alloc_sxpt     = NULL;
+   snapshot->xtree_delta    = NULL;
+}
+
+static Int XPtDelta_cmp(const void* n1, const void* n2)
+{
+   const XPtDelta* d1 = n1;
+   const XPtDelta* d2 = n2;
+   return ( d1->xpt < d2->xpt ? -1
+          : d1->xpt > d2->xpt ?  1
+          :                      0);
+}
+
+// Record the size of every XPt that has changed since the last detailed
+// snapshot, sorted by XPt, and start afresh.
+static XArray* take_XTree_delta(void)
+{
+   Word i, n_dirty = VG_(sizeXA)(dirty_xpts);
+   XArray* delta = VG_(newXA)(VG_(malloc), "ms.main.tXd.1", VG_(free),
+                              sizeof(XPtDelta));
+   VG_(setCmpFnXA)(delta, XPtDelta_cmp);
+   for (i = 0; i < n_dirty; i++) {
+      XPtDelta d;
+      d.xpt = *(XPt**)VG_(indexXA)(dirty_xpts, i);
+      d.szB = d.xpt->szB;
+      d.xpt->is_dirty = False;
+      VG_(addToXA)(delta, &d);
+   }
+   VG_(dropTailXA)(dirty_xpts, n_dirty);
+   VG_(sortXA)(delta);
+   return delta;
+}
+
+// Merge two XTree deltas, the later taking precedence.  The result is
+// sorted by XPt, like the inputs.
+static XArray* merge_XTree_deltas(XArray* earlier, XArray* later)
+{
+   Word i = 0, n_earlier = VG_(sizeXA)(earlier);
+   Word j = 0, n_later   = VG_(sizeXA)(later);
+   XArray* merged = VG_(newXA)(VG_(malloc), "ms.main.mXd.1", VG_(free),
+                               sizeof(XPtDelta));
+   while (i < n_earlier || j < n_later) {
+      XPtDelta* e = ( i < n_earlier ? VG_(indexXA)(earlier, i) : NULL );
+      XPtDelta* l = ( j < n_later   ? VG_(indexXA)(later,   j) : NULL );
+      if (NULL == l || (e && e->xpt < l->xpt)) {
+         VG_(addToXA)(merged, e);
+         i++;
+      } else {
+         if (e && e->xpt == l->xpt)
+            i++;            // Superseded by the later one.
+         VG_(addToXA)(merged, l);
+         j++;
+      }
+   }
+   return merged;
+}
+
+// The XTree delta of a snapshot that is being culled can't just be thrown
+// away, because later snapshots are relative to it.  So we fold it into
+// the next detailed snapshot's delta, or, if there is none, mark its XPts
+// dirty so that the next detailed snapshot to be taken records them.
+static void pass_on_XTree_delta(Snapshot* snapshot, XArray* delta)
+{
+   Int i, j;
+   i = snapshot - snapshots;
+   tl_assert(0 <= i && i < clo_max_snapshots);
+   for (j = i+1; j < clo_max_snapshots; j++) {
+      if (is_snapshot_in_use(&snapshots[j]) && snapshots[j].xtree_delta) {
+         XArray* merged = merge_XTree_deltas(delta, snapshots[j].xtree_delta);
+         VG_(deleteXA)(snapshots[j].xtree_delta);
+         snapshots[j].xtree_delta = merged;
+         return;
+      }
+   }
+   for (j = 0; j < VG_(sizeXA)(delta); j++) {
+      XPtDelta* d = VG_(indexXA)(delta, j);
+      mark_xpt_dirty(d->xpt);
+   }
 }
 
 // This zeroes all the fields in the snapshot, and frees the heap XTree if
@@ -1108,11 +1313,16 @@ static void delete_snapshot(Snapshot* snapshot)
    // Nb: if there's an XTree, we free it after calling clear_snapshot,
    // because clear_snapshot does a sanity check which includes checking the
    // XTree.
-   SXPt* tmp_sxpt = snapshot->alloc_sxpt;
+   SXPt*   tmp_sxpt  = snapshot->alloc_sxpt;
+   XArray* tmp_delta = snapshot->xtree_delta;
    clear_snapshot(snapshot, /*do_sanity_check*/True);
    if (tmp_sxpt) {
       free_SXTree(tmp_sxpt);
    }
+   if (tmp_delta) {
+      pass_on_XTree_delta(snapshot, tmp_delta);
+      VG_(deleteXA)(tmp_delta);
+   }
 }
 
 static void VERB_snapshot(Int verbosity, const HChar* prefix, Int i)
@@ -1308,7 +1518,7 @@ static Time get_time(void)
 // in /usr/include/time.h on Darwin.
 static void
 take_snapshot(Snapshot* snapshot, SnapshotKind kind, Time my_time,
-              Bool is_detailed)
+              Bool is_detailed, Bool as_delta)
 {
    tl_assert(!is_snapshot_in_use(snapshot));
    if (!clo_pages_as_heap) {
@@ -1318,7 +1528,10 @@ take_snapshot(Snapshot* snapshot, SnapshotKind kind, Time my_time,
    // Heap and heap admin.
    if (clo_heap) {
       snapshot->heap_szB = heap_szB;
-      if (is_detailed) {
+      if (is_detailed && as_delta) {
+         snapshot->xtree_delta = take_XTree_delta();
+         tl_assert(           alloc_xpt->szB == heap_szB);
+      } else if (is_detailed) {
          SizeT total_szB = heap_szB + heap_extra_szB + stacks_szB;
          snapshot->alloc_sxpt = dup_XTree(alloc_xpt, total_szB);
          tl_assert(           alloc_xpt->szB == heap_szB);
@@ -1344,6 +1557,9 @@ take_snapshot(Snapshot* snapshot, SnapshotKind kind, Time my_time,
 }
 
 
+static void stream_snapshot(Snapshot* snapshot);
+static void stream_superseded_peak(Snapshot* snapshot);
+
 // Take a snapshot, if it's time, or if we've hit a peak.
 static void
 maybe_take_snapshot(SnapshotKind kind, const HChar* what)
@@ -1398,7 +1614,7 @@ maybe_take_snapshot(SnapshotKind kind, const HChar* what)
 
    // Take the snapshot.
    snapshot = & snapshots[next_snapshot_i];
-   take_snapshot(snapshot, kind, my_time, is_detailed);
+   take_snapshot(snapshot, kind, my_time, is_detailed, track_xtree_deltas);
 
    // Record if it was detailed.
    if (is_detailed) {
@@ -1419,15 +1635,24 @@ maybe_take_snapshot(SnapshotKind kind, const HChar* what)
       peak_snapshot_total_szB = snapshot_total_szB;
 
       // Find the old peak snapshot, if it exists, and mark it as normal.
+      // When streaming, write it out now if that hasn't happened yet.
       for (i = 0; i < next_snapshot_i; i++) {
          if (Peak == snapshots[i].kind) {
             snapshots[i].kind = Normal;
             number_of_peaks_snapshots_found++;
+            if (OutBinary == clo_massif_out_format) {
+               stream_superseded_peak(&snapshots[i]);
+            }
          }
       }
       tl_assert(number_of_peaks_snapshots_found <= 1);
    }
 
+   // Write it to the output file now, if we're streaming.
+   if (OutBinary == clo_massif_out_format) {
+      stream_snapshot(snapshot);
+   }
+
    // Finish up verbosity and stats stuff.
    if (n_skipped_snapshots_since_last_snapshot > 0) {
       VERB(2, "  (skipped %d snapshot%s)\n",
@@ -2133,6 +2358,16 @@ static const HChar* make_perc(double x)
    return mbuf;
 }
 
+// The description of alloc_xpt, the root of every heap XTree.
+static const HChar* alloc_xpt_desc(void)
+{
+   return
+      ( clo_pages_as_heap
+      ? "(page allocation syscalls) mmap/mremap/brk, --alloc-fns, etc."
+      : "(heap allocation functions) malloc/new/new[], --alloc-fns, etc."
+      );
+}
+
 static void pp_snapshot_SXPt(Int fd, SXPt* sxpt, Int depth, HChar* depth_str,
                             Int depth_str_len,
                             SizeT snapshot_heap_szB, SizeT snapshot_total_szB)
@@ -2151,11 +2386,7 @@ static void pp_snapshot_SXPt(Int fd, SXPt* sxpt, Int depth, HChar* depth_str,
       // Print the SXPt itself.
       if (0 == depth) {
          if (clo_heap) {
-            ip_desc = 
-               ( clo_pages_as_heap
-               ? "(page allocation syscalls) mmap/mremap/brk, --alloc-fns, etc."
-               : "(heap allocation functions) malloc/new/new[], --alloc-fns, etc."
-               );
+            ip_desc = alloc_xpt_desc();
          } else {
             // XXX: --alloc-fns?
 
@@ -2298,6 +2529,26 @@ static void pp_snapshot(Int fd, Snapshot* snapshot, Int snapshot_n)
    }
 }
 
+// Rebuilding the XTrees of snapshots with XTree deltas starts with no XPts
+// at all, and then applies the deltas in order.  Nb: this overwrites the
+// XPts' sizes, so it's only done at exit.
+static void clear_XTree_for_replay(XPt* xpt)
+{
+   UInt i;
+   xpt->szB = XPT_ABSENT_SZB;
+   for (i = 0; i < xpt->n_children; i++)
+      clear_XTree_for_replay(xpt->children[i]);
+}
+
+static void apply_XTree_delta(XArray* delta)
+{
+   Word i;
+   for (i = 0; i < VG_(sizeXA)(delta); i++) {
+      XPtDelta* d = VG_(indexXA)(delta, i);
+      d->xpt->szB = d->szB;
+   }
+}
+
 static void write_snapshots_to_file(const HChar* massif_out_file, 
                                     Snapshot snapshots_array[], 
                                     Int nr_elements)
@@ -2347,7 +2598,19 @@ static void write_snapshots_to_file(const HChar* massif_out_file,
 
    for (i = 0; i < nr_elements; i++) {
       Snapshot* snapshot = & snapshots_array[i];
+      if (snapshot->xtree_delta) {
+         // Bring the XTree up to the time of this snapshot, and copy it.
+         SizeT total_szB = snapshot->heap_szB + snapshot->heap_extra_szB
+                         + snapshot->stacks_szB;
+         apply_XTree_delta(snapshot->xtree_delta);
+         snapshot->alloc_sxpt = dup_XTree(alloc_xpt, total_szB);
+         tl_assert(snapshot->alloc_sxpt->szB == snapshot->heap_szB);
+      }
       pp_snapshot(fd, snapshot, i);     // Detailed snapshot!
+      if (snapshot->xtree_delta) {
+         free_SXTree(snapshot->alloc_sxpt);
+         snapshot->alloc_sxpt = NULL;
+      }
    }
    VG_(close) (fd);
 }
@@ -2361,10 +2624,326 @@ static void write_snapshots_array_to_file(void)
    // happened in 3.3.0.
    HChar* massif_out_file =
       VG_(expand_file_name)("--massif-out-file", clo_massif_out_file);
+   if (track_xtree_deltas) {
+      track_xtree_deltas = False;
+      clear_XTree_for_replay(alloc_xpt);
+   }
    write_snapshots_to_file (massif_out_file, snapshots, next_snapshot_i);
    VG_(free)(massif_out_file);
 }
 
+//------------------------------------------------------------//
+//--- Streaming snapshots                                  ---//
+//------------------------------------------------------------//
+
+// With --massif-out-format=binary, each snapshot is appended to the output
+// file as soon as it is taken, rather than being kept in 'snapshots' until
+// the end and then printed as text.  The snapshots array is still used to
+// decide when to take snapshots (culling it makes them less frequent as
+// the program runs), but detailed snapshots' XTrees are freed as soon as
+// they have been written.  ms_print reads either format.
+//
+// The format is designed to be cheap to write.  Numbers are unsigned
+// LEB128 ("uleb"): 7 bits per byte, least significant first, with the top
+// bit set on all but the last byte.  Strings are a uleb length followed by
+// that many bytes, with no terminating NUL.
+//
+//   file     ::= "massif-binary-1\n" header record*
+//   header   ::= uleb n_args string*n_args         -- Massif's options
+//                uleb n_cmd  string*n_cmd          -- client exe and args
+//                string                            -- time unit
+//                string                            -- threshold, eg. "1.00%"
+//   record   ::= 'S' uleb snapshot_n uleb time
+//                    uleb heap_szB uleb heap_extra_szB uleb stacks_szB
+//                    byte tree_kind                -- 0:empty 1:detailed 2:peak
+//                    [node]                        -- if tree_kind != 0
+//   node     ::= uleb (n_children << 1)   uleb delta uleb ip_id [string]
+//                node*n_children                   -- a SigSXPt
+//              | uleb (n_xpts << 1 | 1)   uleb delta   -- an InsigSXPt
+//
+// Code addresses are interned:  the first time an IP is written, its
+// description string follows its id;  later it is just the id.  Id 0 is
+// the root of the tree, alloc_xpt.  Children are written biggest first,
+// and a node's 'delta' is the amount by which it is smaller than its
+// previous sibling, or than its parent if it is the first child, or than
+// the snapshot's heap size if it is the root.  So most of the numbers in
+// a tree are small.
+//
+// A peak snapshot is not written until the next normal snapshot is taken
+// (or at exit), because a bigger peak often follows soon after, and only
+// then do we know whether it is still the peak.  If it has been superseded
+// it is written as a normal detailed snapshot, which is what it stays as in
+// the snapshots array when writing text.
+
+#define STREAM_MAGIC    "massif-binary-1\n"
+#define STREAM_BUF_LEN  65536
+
+typedef
+   struct _StreamIP {
+      struct _StreamIP* next;
+      Addr  ip;                  // key
+      UInt  id;
+      Bool  is_main_or_below;
+   }
+   StreamIP;
+
+static Bool        stream_is_open = False;
+static Int         stream_fd = -1;       // -1 if the file couldn't be opened
+static Int         stream_pid;           // Who opened the stream
+static VgHashTable stream_ips = NULL;    // StreamIPs
+static UInt        stream_next_ip_id = 1;
+static Bool        stream_sent_root_desc;
+static Int         stream_next_snapshot_n;
+static Bool        stream_peak_pending = False;
+static UChar       stream_buf[STREAM_BUF_LEN];
+static Int         stream_buf_used = 0;
+
+static ULong n_stream_bytes     = 0;
+static UInt  n_stream_snapshots = 0;
+
+static void stream_flush(void)
+{
+   if (stream_buf_used > 0 && stream_fd >= 0) {
+      VG_(write)(stream_fd, stream_buf, stream_buf_used);
+   }
+   n_stream_bytes += stream_buf_used;
+   stream_buf_used = 0;
+}
+
+static INLINE void stream_put_byte(UChar b)
+{
+   if (STREAM_BUF_LEN == stream_buf_used)
+      stream_flush();
+   stream_buf[stream_buf_used++] = b;
+}
+
+static void stream_put_uleb(ULong n)
+{
+   while (n >= 0x80) {
+      stream_put_byte( (UChar)(n & 0x7f) | 0x80 );
+      n >>= 7;
+   }
+   stream_put_byte( (UChar)n );
+}
+
+static void stream_put_string(const HChar* str)
+{
+   SizeT i, len = VG_(strlen)(str);
+   stream_put_uleb(len);
+   for (i = 0; i < len; i++)
+      stream_put_byte( (UChar)str[i] );
+}
+
+// Opens the output file and writes the header.  Nb: like the text output
+// file, the name is expanded as late as possible, so that %p is right
+// after a fork.  If the file can't be opened, we carry on but throw the
+// data away.
+static void stream_open(void)
+{
+   Int    i, n_cmd;
+   HChar* massif_out_file;
+   const HChar* m;
+   SysRes sres;
+
+   // A forked child inherits the parent's file;  leave that to the parent
+   // and start a file of our own.  (The buffer is always flushed after
+   // each snapshot, so none of the parent's data is in it.)
+   if (stream_is_open) {
+      if (stream_fd >= 0) VG_(close)(stream_fd);
+      VG_(HT_destruct)(stream_ips, VG_(free));
+   }
+   stream_is_open         = True;
+   stream_ips             = VG_(HT_construct)("Massif's streamed IPs");
+   stream_next_ip_id      = 1;         // 0 is alloc_xpt
+   stream_sent_root_desc  = False;
+   stream_next_snapshot_n = 0;
+   stream_buf_used        = 0;
+   stream_pid             = VG_(getpid)();
+
+   massif_out_file =
+      VG_(expand_file_name)("--massif-out-file", clo_massif_out_file);
+   sres = VG_(open)(massif_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                                     VKI_S_IRUSR|VKI_S_IWUSR);
+   if (sr_isError(sres)) {
+      VG_(umsg)("error: can't open output file '%s'\n", massif_out_file );
+      VG_(umsg)("       ... so profiling results will be missing.\n");
+      stream_fd = -1;
+   } else {
+      stream_fd = sr_Res(sres);
+   }
+   VG_(free)(massif_out_file);
+
+   for (m = STREAM_MAGIC; *m; m++)
+      stream_put_byte( (UChar)*m );
+
+   stream_put_uleb( VG_(sizeXA)(args_for_massif) );
+   for (i = 0; i < VG_(sizeXA)(args_for_massif); i++)
+      stream_put_string( *(HChar**)VG_(indexXA)(args_for_massif, i) );
+
+   n_cmd = 0;
+   if (VG_(args_the_exename)) {
+      n_cmd = 1;
+      for (i = 0; i < VG_(sizeXA)( VG_(args_for_client) ); i++) {
+         if (* (HChar**) VG_(indexXA)( VG_(args_for_client), i ))
+            n_cmd++;
+      }
+   }
+   stream_put_uleb(n_cmd);
+   if (n_cmd > 0) {
+      stream_put_string( VG_(args_the_exename) );
+      for (i = 0; i < VG_(sizeXA)( VG_(args_for_client) ); i++) {
+         HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_client), i );
+         if (arg)
+            stream_put_string(arg);
+      }
+   }
+
+   stream_put_string( TimeUnit_to_string(clo_time_unit) );
+   stream_put_string( make_perc(clo_threshold) );
+   stream_flush();
+}
+
+static void stream_SXPt(SXPt* sxpt, Int depth, SizeT prev_szB)
+{
+   static HChar ip_desc_array[BUF_LEN];
+   const HChar* ip_desc = NULL;
+   StreamIP* sip;
+   UInt id;
+   Int  i, n_children;
+
+   tl_assert(sxpt->szB <= prev_szB);
+   switch (sxpt->tag) {
+    case SigSXPt:
+      n_children = sxpt->Sig.n_children;
+      if (0 == depth) {
+         id = 0;
+         if (!stream_sent_root_desc) {
+            ip_desc = alloc_xpt_desc();
+            stream_sent_root_desc = True;
+         }
+      } else {
+         sip = VG_(HT_lookup)(stream_ips, sxpt->Sig.ip);
+         if (NULL == sip) {
+            Vg_FnNameKind kind = VG_(get_fnname_kind_from_IP)(sxpt->Sig.ip);
+            sip = VG_(malloc)("ms.main.sSXPt.1", sizeof(StreamIP));
+            sip->ip = sxpt->Sig.ip;
+            sip->id = stream_next_ip_id++;
+            sip->is_main_or_below =
+               Vg_FnNameMain == kind || Vg_FnNameBelowMain == kind;
+            VG_(HT_add_node)(stream_ips, sip);
+            // See pp_snapshot_SXPt for the -1.
+            ip_desc = VG_(describe_IP)(sxpt->Sig.ip-1, ip_desc_array,
+                                       BUF_LEN);
+         }
+         // As in pp_snapshot_SXPt, we (if appropriate) ignore everything
+         // below main-or-below-main.
+         if ( ! VG_(clo_show_below_main) && sip->is_main_or_below ) {
+            n_children = 0;
+         }
+         id = sip->id;
+      }
+      stream_put_uleb((ULong)n_children << 1);
+      stream_put_uleb(prev_szB - sxpt->szB);
+      stream_put_uleb(id);
+      if (ip_desc)
+         stream_put_string(ip_desc);
+
+      // Biggest children first, as in pp_snapshot_SXPt.
+      VG_(ssort)(sxpt->Sig.children, sxpt->Sig.n_children, sizeof(SXPt*),
+                 SXPt_revcmp_szB);
+      prev_szB = sxpt->szB;
+      for (i = 0; i < n_children; i++) {
+         stream_SXPt(sxpt->Sig.children[i], depth+1, prev_szB);
+         prev_szB = sxpt->Sig.children[i]->szB;
+      }
+      break;
+
+    case InsigSXPt:
+      stream_put_uleb(((ULong)sxpt->Insig.n_xpts << 1) | 1);
+      stream_put_uleb(prev_szB - sxpt->szB);
+      break;
+
+    default:
+      tl_assert2(0, "stream_SXPt: unrecognised SXPt tag");
+   }
+}
+
+static void stream_write_snapshot(Snapshot* snapshot)
+{
+   sanity_check_snapshot(snapshot);
+   if (!stream_is_open || stream_pid != VG_(getpid)())
+      stream_open();
+   tl_assert(snapshot->time >= 0);
+
+   stream_put_byte('S');
+   stream_put_uleb(stream_next_snapshot_n++);
+   stream_put_uleb(snapshot->time);
+   stream_put_uleb(snapshot->heap_szB);
+   stream_put_uleb(snapshot->heap_extra_szB);
+   stream_put_uleb(snapshot->stacks_szB);
+   if (is_detailed_snapshot(snapshot)) {
+      stream_put_byte( Peak == snapshot->kind ? 2 : 1 );
+      stream_SXPt(snapshot->alloc_sxpt, 0, snapshot->heap_szB);
+      // We won't need the XTree again.
+      free_SXTree(snapshot->alloc_sxpt);
+      snapshot->alloc_sxpt = NULL;
+   } else {
+      stream_put_byte(0);
+   }
+   stream_flush();
+   n_stream_snapshots++;
+}
+
+static void stream_pending_peak(void)
+{
+   Int i;
+   if (!stream_peak_pending)
+      return;
+   for (i = 0; i < next_snapshot_i; i++) {
+      if (Peak == snapshots[i].kind) {
+         stream_write_snapshot(&snapshots[i]);
+         break;
+      }
+   }
+   stream_peak_pending = False;
+}
+
+// 'snapshot' was the peak and has just been made normal by a bigger one.
+// If it is still pending, write it as the detailed normal snapshot it now
+// is.
+static void stream_superseded_peak(Snapshot* snapshot)
+{
+   tl_assert(Normal == snapshot->kind);
+   if (!stream_peak_pending)
+      return;
+   stream_write_snapshot(snapshot);
+   stream_peak_pending = False;
+}
+
+static void stream_snapshot(Snapshot* snapshot)
+{
+   if (Peak == snapshot->kind) {
+      // Any earlier pending peak has been written by maybe_take_snapshot.
+      tl_assert(!stream_peak_pending);
+      stream_peak_pending = True;
+   } else {
+      stream_pending_peak();
+      stream_write_snapshot(snapshot);
+   }
+}
+
+static void stream_close(void)
+{
+   stream_pending_peak();
+   // Make sure there's a file, even if no snapshots were taken.
+   if (!stream_is_open || stream_pid != VG_(getpid)())
+      stream_open();
+   stream_flush();
+   if (stream_fd >= 0) {
+      VG_(close)(stream_fd);
+   }
+}
+
 static void handle_snapshot_monitor_command (const HChar *filename,
                                              Bool detailed)
 {
@@ -2378,7 +2957,7 @@ static void handle_snapshot_monitor_command (const HChar *filename,
    }
 
    clear_snapshot(&snapshot, /* do_sanity_check */ False);
-   take_snapshot(&snapshot, Normal, get_time(), detailed);
+   take_snapshot(&snapshot, Normal, get_time(), detailed, /*as_delta*/False);
    write_snapshots_to_file ((filename == NULL) ? 
                             "massif.vgdb.out" : filename,
                             &snapshot,
@@ -2441,6 +3020,7 @@ static void ms_print_stats (void)
       ( n_xpts ? alloc_xpt->n_children * 100 / n_xpts : 0));
    STATS("XPt init expansions:   %u\n", n_xpt_init_expansions);
    STATS("XPt later expansions:  %u\n", n_xpt_later_expansions);
+   STATS("XPt child indexes:     %u\n", n_xpt_child_indexes);
    STATS("SXPt allocs:           %u\n", n_sxpt_allocs);
    STATS("SXPt frees:            %u\n", n_sxpt_frees);
    STATS("skipped snapshots:     %u\n", n_skipped_snapshots);
@@ -2449,6 +3029,11 @@ static void ms_print_stats (void)
    STATS("peak snapshots:        %u\n", n_peak_snapshots);
    STATS("cullings:              %u\n", n_cullings);
    STATS("XCon redos:            %u\n", n_XCon_redos);
+   if (OutBinary == clo_massif_out_format) {
+      STATS("streamed snapshots:    %u\n", n_stream_snapshots);
+      STATS("streamed IPs:          %u\n", stream_next_ip_id - 1);
+      STATS("streamed bytes:        %llu\n", n_stream_bytes);
+   }
 #undef STATS
 }
 
@@ -2459,7 +3044,11 @@ static void ms_print_stats (void)
 static void ms_fini(Int exit_status)
 {
    // Output.
-   write_snapshots_array_to_file();
+   if (OutBinary == clo_massif_out_format) {
+      stream_close();
+   } else {
+      write_snapshots_array_to_file();
+   }
 
    // Stats
    tl_assert(n_xpts > 0);  // always have alloc_xpt
@@ -2491,6 +3080,14 @@ static void ms_post_clo_init(void)
       clo_pages_as_heap = False;
    }
 
+   // Detailed snapshots kept until exit are stored as XTree deltas.
+   if (clo_heap && OutText == clo_massif_out_format) {
+      track_xtree_deltas = True;
+      dirty_xpts = VG_(newXA)(VG_(malloc), "ms.main.mpoci.1", VG_(free),
+                              sizeof(XPt*));
+      mark_xpt_dirty(alloc_xpt);
+   }
+
    // If --pages-as-heap=yes we don't want malloc replacement to occur.  So we
    // disable vgpreload_massif-$PLATFORM.so by removing it from LD_PRELOAD (or
    // platform-equivalent).  We replace it entirely with spaces because then
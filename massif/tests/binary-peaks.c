@@ -0,0 +1,13 @@
+#include <stdlib.h>
+
+int main(void)
+{
+   int i;
+   for (i = 0; i < 200; i++) {
+      int* p;           // Every 'free' is a new peak.  Once culling has
+      p = malloc(1600); // made the interval between normal snapshots
+      p = malloc(16);   // longer than one iteration, several peaks are
+      free(p);          // taken in a row, each superseding the last.
+   }
+   return 0;
+}
@@ -793,7 +793,7 @@ void MC_(record_freemismatch_error) ( ThreadId tid, MC_Chunk* mc )
    ai->tag = Addr_Block;
    ai->Addr.Block.block_kind = Block_Mallocd;  // Nb: Not 'Block_Freed'
    ai->Addr.Block.block_desc = "block";
-   ai->Addr.Block.block_szB  = mc->szB;
+   ai->Addr.Block.block_szB  = MC_(chunk_szB)(mc);
    ai->Addr.Block.rwoffset   = 0;
    ai->Addr.Block.allocated_at = MC_(allocated_at) (mc);
    ai->Addr.Block.freed_at = MC_(freed_at) (mc);
@@ -927,13 +927,13 @@ Bool MC_(eq_Error) ( VgRes res, Error* e1, Error* e2 )
 static
 Bool addr_is_in_MC_Chunk_default_REDZONE_SZB(MC_Chunk* mc, Addr a)
 {
-   return VG_(addr_is_in_block)( a, mc->data, mc->szB,
+   return VG_(addr_is_in_block)( a, mc->data, MC_(chunk_szB)(mc),
                                  MC_(Malloc_Redzone_SzB) );
 }
 static
 Bool addr_is_in_MC_Chunk_with_REDZONE_SZB(MC_Chunk* mc, Addr a, SizeT rzB)
 {
-   return VG_(addr_is_in_block)( a, mc->data, mc->szB,
+   return VG_(addr_is_in_block)( a, mc->data, MC_(chunk_szB)(mc),
                                  rzB );
 }
 
@@ -976,7 +976,7 @@ static void describe_addr ( Addr a, /*OUT*/AddrInfo* ai )
             ai->Addr.Block.block_desc = "recently re-allocated block";
          else
             ai->Addr.Block.block_desc = "block";
-         ai->Addr.Block.block_szB  = mc->szB;
+         ai->Addr.Block.block_szB  = MC_(chunk_szB)(mc);
          ai->Addr.Block.rwoffset   = (Word)a - (Word)mc->data;
          ai->Addr.Block.allocated_at = MC_(allocated_at)(mc);
          ai->Addr.Block.freed_at = MC_(freed_at)(mc);
@@ -989,7 +989,7 @@ static void describe_addr ( Addr a, /*OUT*/AddrInfo* ai )
       ai->tag = Addr_Block;
       ai->Addr.Block.block_kind = Block_Freed;
       ai->Addr.Block.block_desc = "block";
-      ai->Addr.Block.block_szB  = mc->szB;
+      ai->Addr.Block.block_szB  = MC_(chunk_szB)(mc);
       ai->Addr.Block.rwoffset   = (Word)a - (Word)mc->data;
       ai->Addr.Block.allocated_at = MC_(allocated_at)(mc);
       ai->Addr.Block.freed_at = MC_(freed_at)(mc);
@@ -1149,7 +1149,7 @@ static Bool mempool_block_maybe_describe( Addr a,
                ai->tag = Addr_Block;
                ai->Addr.Block.block_kind = Block_MempoolChunk;
                ai->Addr.Block.block_desc = "block";
-               ai->Addr.Block.block_szB  = mc->szB;
+               ai->Addr.Block.block_szB  = MC_(chunk_szB)(mc);
                ai->Addr.Block.rwoffset   = (Word)a - (Word)mc->data;
                ai->Addr.Block.allocated_at = MC_(allocated_at)(mc);
                ai->Addr.Block.freed_at = MC_(freed_at)(mc);
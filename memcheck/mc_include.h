@@ -60,19 +60,38 @@ typedef
    MC_AllocKind;
    
 /* This describes a heap block. Nb: first two fields must match core's
- * VgHashNode. */
+ * VgHashNode.
+ * There can be many millions of these, so they are kept small: the
+ * stack traces are stored as 32-bit ECUs rather than ExeContext
+ * pointers, and only sizes below MC_CHUNK_BIG_SZB are stored in the
+ * chunk itself.  Use MC_(chunk_szB) and MC_(set_chunk_szB) to access
+ * the size. */
+#define MC_CHUNK_BIG_SZB ((1 << 30) - 1)
 typedef
    struct _MC_Chunk {
       struct _MC_Chunk* next;
       Addr         data;            // Address of the actual block.
-      SizeT        szB : (sizeof(SizeT)*8)-2; // Size requested; 30 or 62 bits.
+      UInt         small_szB : 30;  // Size requested, or MC_CHUNK_BIG_SZB.
       MC_AllocKind allockind : 2;   // Which operation did the allocation.
-      ExeContext*  where[0];
+      UInt         where[0];
       /* Variable-length array. The size depends on MC_(clo_keep_stacktraces).
-         This array optionally stores the alloc and/or free stack trace. */
+         This array optionally stores the ECU of the alloc and/or free
+         stack trace, or 0 if not (yet) recorded. */
    }
    MC_Chunk;
 
+/* Size of the blocks of size >= MC_CHUNK_BIG_SZB. */
+SizeT MC_(big_chunk_szB) ( const MC_Chunk* mc );
+
+static inline SizeT MC_(chunk_szB) ( const MC_Chunk* mc )
+{
+   if (LIKELY(mc->small_szB != MC_CHUNK_BIG_SZB))
+      return mc->small_szB;
+   return MC_(big_chunk_szB)(mc);
+}
+
+void MC_(set_chunk_szB) ( MC_Chunk* mc, SizeT szB );
+
 /* Returns the execontext where the MC_Chunk was allocated/freed.
    Returns VG_(null_ExeContext)() if the execontext has not been recorded (due
    to MC_(clo_keep_stacktraces) and/or because block not yet freed). */
@@ -83,9 +102,12 @@ ExeContext* MC_(freed_at) (MC_Chunk*);
 void  MC_(set_allocated_at) (ThreadId, MC_Chunk*);
 void  MC_(set_freed_at) (ThreadId, MC_Chunk*);
 
-/* number of pointers needed according to MC_(clo_keep_stacktraces). */
+/* number of ECUs needed according to MC_(clo_keep_stacktraces). */
 UInt MC_(n_where_pointers) (void);
 
+/* Size of a MC_Chunk, including its where[] array. */
+SizeT MC_(chunk_size) (void);
+
 /* Memory pool.  Nb: first two fields must match core's VgHashNode. */
 typedef
    struct _MC_Mempool {
@@ -139,6 +161,24 @@ void MC_(make_mem_undefined_w_otag)( Addr a, SizeT len, UInt otag );
 void MC_(make_mem_defined)         ( Addr a, SizeT len );
 void MC_(copy_address_range_state) ( Addr src, Addr dst, SizeT len );
 
+/* Compress cold secondary maps if --compress-secmaps=yes and enough of
+   them are in use.  Must only be called when no SecMap pointer is
+   live, ie. on entry to a tool callback. */
+void MC_(maybe_compress_secmaps) ( void );
+
+/* With --sampled-superblocks=<n> (n < 100), change the set of fully
+   instrumented superblocks if --sampling-period has elapsed.  Only
+   reads the timer every so many calls.  Same calling constraints as
+   MC_(maybe_compress_secmaps). */
+void MC_(maybe_rotate_sample) ( void );
+
+/* Changes each time the set of sampled superblocks changes. */
+extern UInt MC_(sample_epoch);
+
+/* Stats: superblocks instrumented in and out of the sample. */
+extern ULong MC_(n_sampled_SBs);
+extern ULong MC_(n_unsampled_SBs);
+
 void MC_(print_malloc_stats) ( void );
 /* nr of free operations done */
 SizeT MC_(get_cmalloc_n_frees) ( void );
@@ -377,6 +417,13 @@ extern HChar * MC_(snprintf_delta) (HChar * buf, Int size,
 Bool MC_(is_valid_aligned_word)     ( Addr a );
 Bool MC_(is_within_valid_secondary) ( Addr a );
 
+// For --incremental-leak-check.  MC_(is_SM_dirty_tracked) tells if the
+// writes to the SM_SIZE aligned chunk of memory at 'a' are tracked.  If
+// so, MC_(test_and_clear_SM_dirty) tells if the chunk may have changed
+// since the previous call for it.
+Bool MC_(is_SM_dirty_tracked)       ( Addr a );
+Bool MC_(test_and_clear_SM_dirty)   ( Addr a );
+
 // Prints as user msg a description of the given loss record.
 void MC_(pp_LossRecord)(UInt n_this_record, UInt n_total_records,
                         LossRecord* l);
@@ -535,6 +582,16 @@ typedef
    Default : no heuristic. */
 extern UInt MC_(clo_leak_check_heuristics);
 
+/* Number of processes sharing the marking phase of the leak search.
+   Default : 1, i.e. the search is done by Valgrind itself. */
+#define MC_MAX_LEAK_CHECK_WORKERS 64
+extern Int MC_(clo_leak_check_workers);
+
+/* Keep the result of scanning each 64KB chunk of memory from one leak
+   search to the next, and rescan only the chunks written since.
+   Default : NO */
+extern Bool MC_(clo_incremental_leak_check);
+
 /* Assume accesses immediately below %esp are due to gcc-2.96 bugs.
  * default: NO */
 extern Bool MC_(clo_workaround_gcc296_bugs);
@@ -562,6 +619,28 @@ typedef
    KeepStacktraces;
 extern KeepStacktraces MC_(clo_keep_stacktraces);
 
+/* Run-length compress secondary maps which have not been used
+   recently?  default: NO */
+extern Bool MC_(clo_compress_secmaps);
+
+/* With --compress-secmaps=yes, the number of most recently issued or
+   expanded secondary maps which are never compressed. */
+extern Int MC_(clo_hot_secmaps);
+
+/* With --track-origins=yes, the number of sets of the first level
+   origin cache, rounded up to a power of 2.  Each set holds the
+   origins of two 32-byte lines of memory.  Default : 1 << 20 */
+extern Int MC_(clo_origin_cache_sets);
+
+/* Percentage of superblocks which get full instrumentation.  The
+   others only keep the shadow state consistent, without checking
+   anything.  Default : 100 */
+extern Int MC_(clo_sampled_superblocks);
+
+/* With --sampled-superblocks < 100, milliseconds between changes of
+   the set of fully instrumented superblocks.  Default : 2000 */
+extern Int MC_(clo_sampling_period);
+
 /* Indicates the level of instrumentation/checking done by Memcheck.
 
    1 = No undefined value checking, Addrcheck-style behaviour only:
@@ -37,6 +37,7 @@
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcassert.h"
 #include "pub_tool_libcprint.h"
+#include "pub_tool_libcproc.h"
 #include "pub_tool_libcsignal.h"
 #include "pub_tool_machine.h"
 #include "pub_tool_mallocfree.h"
@@ -46,6 +47,7 @@
 #include "pub_tool_signals.h"       // Needed for mc_include.h
 #include "pub_tool_libcsetjmp.h"    // setjmp facilities
 #include "pub_tool_tooliface.h"     // Needed for mc_include.h
+#include "pub_tool_xarray.h"
 
 #include "mc_include.h"
 
@@ -234,6 +236,34 @@
 //   start-pointers and interior-pointers the same for direct/indirect leak
 //   checking.  If we added a PossibleIndirectLeak state then this would
 //   change.
+//
+// A note on --leak-check-workers:
+// - Valgrind and the tools are single threaded, so the root-set scan and
+//   the clique == -1 mark phase are shared between the Valgrind process
+//   and worker processes created with VG_(fork).  Each process scans
+//   pieces of the root set, and pushes the blocks it finds onto its own
+//   copy of the mark stack.
+// - The reachedness of each block lives in a word of a shared mapping
+//   (see LC_Shared), updated with compare-and-swap.  A block is pushed
+//   only by the process which changed its state, so each block is scanned
+//   at most twice (Possible, then Reachable) whatever the nr of workers.
+// - A process with more than one pending block gives half of them to a
+//   shared queue when another process is idle.  The search finishes when
+//   all processes are idle and the queue is empty.
+// - Once the workers have exited, the states are copied back into
+//   lc_extras and the rest of the leak search (registers excepted, which
+//   are scanned by Valgrind before it starts working) is sequential.
+//
+// A note on --incremental-leak-check:
+// - Memcheck marks a 64KB chunk of memory dirty whenever the client
+//   writes to it or its V+A bits change.  The words of a clean chunk are
+//   the same as when it was last scanned, so the leak search keeps, for
+//   each chunk it has scanned, the valid aligned words whose value could
+//   be a pointer to a block (see LC_ChunkCache), and uses them instead
+//   of reading the chunk again.  Only the dirty chunks are rescanned.
+// - The graph traversal itself is redone by each search, from the cached
+//   words: blocks come and go between searches, so the cached values are
+//   resolved to blocks again each time.
 
 
 // Define to debug the memory-leak-detector.
@@ -269,7 +299,7 @@ Int find_chunk_for_OLD ( Addr       ptr,
    for (i = 0; i < n_chunks; i++) {
       PROF_EVENT(71, "find_chunk_for_OLD(loop)");
       a_lo = chunks[i]->data;
-      a_hi = ((Addr)chunks[i]->data) + chunks[i]->szB;
+      a_hi = ((Addr)chunks[i]->data) + MC_(chunk_szB)(chunks[i]);
       if (a_lo <= ptr && ptr < a_hi)
          return i;
    }
@@ -297,14 +327,14 @@ Int find_chunk_for ( Addr       ptr,
 
       mid      = (lo + hi) / 2;
       a_mid_lo = chunks[mid]->data;
-      a_mid_hi = chunks[mid]->data + chunks[mid]->szB;
+      a_mid_hi = chunks[mid]->data + MC_(chunk_szB)(chunks[mid]);
       // Extent of block 'mid' is [a_mid_lo .. a_mid_hi).
       // Special-case zero-sized blocks - treat them as if they had
       // size 1.  Not doing so causes them to not cover any address
       // range at all and so will never be identified as the target of
       // any pointer, which causes them to be incorrectly reported as
       // definitely leaked.
-      if (chunks[mid]->szB == 0)
+      if (MC_(chunk_szB)(chunks[mid]) == 0)
          a_mid_hi++;
 
       if (ptr < a_mid_lo) {
@@ -376,8 +406,8 @@ find_active_chunks(Int* pn_chunks)
          }
 
          // Possibly invalidate the malloc holding the end of this chunk.
-         if (mc->szB > 1) {
-            m = find_chunk_for(mc->data + (mc->szB - 1), mallocs, n_mallocs);
+         if (MC_(chunk_szB)(mc) > 1) {
+            m = find_chunk_for(mc->data + (MC_(chunk_szB)(mc) - 1), mallocs, n_mallocs);
             if (m != -1 && malloc_chunk_holds_a_pool_chunk[m] == False) {
                tl_assert(n_chunks > 0);
                n_chunks--;
@@ -496,6 +526,53 @@ static SizeT lc_scanned_szB;
 // caused a signal such as SIGSEGV.
 static SizeT lc_sig_skipped_szB;
 
+// State shared between the processes doing the clique == -1 phase when
+// --leak-check-workers > 1.  All of it, including what 'state' and
+// 'queue' point to, lives in a single shared mapping.
+typedef
+   struct {
+      volatile UInt go;          // Set once all the workers are running.
+      volatile UInt failed;      // Set if a worker died.
+      volatile UInt n_workers;   // Nr of processes (including Valgrind).
+      volatile UInt n_idle;      // Nr of processes looking for work.
+      volatile UInt next_piece;  // Next root-set piece to scan.
+      volatile UInt head;        // Next queue entry to take.
+      volatile UInt tail;        // Next queue entry to fill.
+      UInt          queue_size;
+      // Per-worker totals of lc_scanned_szB and lc_sig_skipped_szB.
+      SizeT scanned_szB[MC_MAX_LEAK_CHECK_WORKERS];
+      SizeT sig_skipped_szB[MC_MAX_LEAK_CHECK_WORKERS];
+      // For each block, its Reachedness | (its LeakCheckHeuristic << 2).
+      volatile UInt* state;
+      // Blocks given away by busy workers.  An entry is -1 until it has
+      // been filled.  Each entry is a distinct push, so 2 * lc_n_chunks
+      // entries are enough.
+      volatile Int* queue;
+   }
+   LC_Shared;
+
+#define LC_PAR_STATE(w) ((Reachedness)((w) & 3))
+#define LC_PAR_HEUR(w)  ((LeakCheckHeuristic)((w) >> 2))
+
+// Non-NULL while the clique == -1 phase is done by several processes.
+static LC_Shared* lc_par;
+// Worker nr of this process, 0 being Valgrind itself.
+static Int lc_par_worker;
+// The processes forked by Valgrind, and whether they have been waited for.
+static Int  lc_par_pids[MC_MAX_LEAK_CHECK_WORKERS];
+static Bool lc_par_reaped[MC_MAX_LEAK_CHECK_WORKERS];
+static Int  lc_par_n_forked;
+
+// Root-set pieces are scanned by the workers in chunks of this size.
+#define LC_ROOT_PIECE_SZB (16 * SM_SIZE)
+
+typedef
+   struct {
+      Addr  start;
+      SizeT szB;
+   }
+   LC_RootPiece;
+
 
 SizeT MC_(bytes_leaked)     = 0;
 SizeT MC_(bytes_indirect)   = 0;
@@ -544,7 +621,7 @@ lc_is_a_chunk_ptr(Addr ptr, Int* pch_no, MC_Chunk** pch, LC_Extra** pex)
          ex = &(lc_extras[ch_no]);
 
          tl_assert(ptr >= ch->data);
-         tl_assert(ptr < ch->data + ch->szB + (ch->szB==0  ? 1  : 0));
+         tl_assert(ptr < ch->data + MC_(chunk_szB)(ch) + (MC_(chunk_szB)(ch)==0  ? 1  : 0));
 
          if (VG_DEBUG_LEAKCHECK)
             VG_(printf)("ptr=%#lx -> block %d\n", ptr, ch_no);
@@ -563,7 +640,7 @@ static void lc_push(Int ch_no, MC_Chunk* ch)
 {
    if (!lc_extras[ch_no].pending) {
       if (0) {
-         VG_(printf)("pushing %#lx-%#lx\n", ch->data, ch->data + ch->szB);
+         VG_(printf)("pushing %#lx-%#lx\n", ch->data, ch->data + MC_(chunk_szB)(ch));
       }
       lc_markstack_top++;
       tl_assert(lc_markstack_top < lc_n_chunks);
@@ -695,7 +772,7 @@ static LeakCheckHeuristic heuristic_reachedness (Addr ptr,
       if ( ptr == ch->data + 3 * sizeof(SizeT)
            && MC_(is_valid_aligned_word)(ch->data + sizeof(SizeT))) {
          const SizeT capacity = *((SizeT*)(ch->data + sizeof(SizeT)));
-         if (3 * sizeof(SizeT) + capacity + 1 == ch->szB
+         if (3 * sizeof(SizeT) + capacity + 1 == MC_(chunk_szB)(ch)
             && MC_(is_valid_aligned_word)(ch->data)) {
             const SizeT length = *((SizeT*)ch->data);
             if (length <= capacity) {
@@ -731,7 +808,7 @@ static LeakCheckHeuristic heuristic_reachedness (Addr ptr,
       if ( ptr == ch->data + sizeof(SizeT)
            && MC_(is_valid_aligned_word)(ch->data)) {
          const SizeT nr_elts = *((SizeT*)ch->data);
-         if (nr_elts > 0 && (ch->szB - sizeof(SizeT)) % nr_elts == 0) {
+         if (nr_elts > 0 && (MC_(chunk_szB)(ch) - sizeof(SizeT)) % nr_elts == 0) {
             // ??? could check that ch->allockind is MC_AllocNewVec ???
             return LchNewArray;
          }
@@ -774,6 +851,56 @@ static LeakCheckHeuristic heuristic_reachedness (Addr ptr,
 }
 
 
+// Version of lc_push_without_clique_if_a_chunk_ptr used by the leak
+// check workers.  The state transitions are the same, but they are done
+// on the shared lc_par->state with compare-and-swap, and the block is
+// pushed only by the process whose swap succeeded.
+static void
+lc_par_push_without_clique_if_a_chunk_ptr(Addr ptr, Bool is_prior_definite)
+{
+   Int ch_no;
+   MC_Chunk* ch;
+   LC_Extra* ex;
+   Reachedness ch_via_ptr;
+   LeakCheckHeuristic heur = LchNone;
+   volatile UInt* st;
+   UInt old, new;
+
+   if ( ! lc_is_a_chunk_ptr(ptr, &ch_no, &ch, &ex) )
+      return;
+
+   if (ptr == ch->data)
+      ch_via_ptr = Reachable;
+   else if (detect_memory_leaks_last_heuristics) {
+      heur = heuristic_reachedness (ptr, ch, ex,
+                                    detect_memory_leaks_last_heuristics);
+      ch_via_ptr = heur ? Reachable : Possible;
+   } else
+      ch_via_ptr = Possible;
+
+   st = &lc_par->state[ch_no];
+   while (True) {
+      old = *st;
+      if (LC_PAR_STATE(old) == Reachable) {
+         // Clear the heuristic if the block is now directly reachable.
+         if (LC_PAR_HEUR(old) != LchNone && ptr == ch->data
+             && !__sync_bool_compare_and_swap(st, old, Reachable))
+            continue;
+         return;
+      }
+      if (ch_via_ptr == Reachable && is_prior_definite)
+         new = Reachable | (heur << 2);
+      else if (LC_PAR_STATE(old) == Unreached)
+         new = Possible;
+      else
+         return;
+      if (__sync_bool_compare_and_swap(st, old, new)) {
+         lc_push(ch_no, ch);
+         return;
+      }
+   }
+}
+
 // If 'ptr' is pointing to a heap-allocated block which hasn't been seen
 // before, push it onto the mark stack.
 static void
@@ -784,6 +911,11 @@ lc_push_without_clique_if_a_chunk_ptr(Addr ptr, Bool is_prior_definite)
    LC_Extra* ex;
    Reachedness ch_via_ptr; // Is ch reachable via ptr, and how ?
 
+   if (lc_par) {
+      lc_par_push_without_clique_if_a_chunk_ptr(ptr, is_prior_definite);
+      return;
+   }
+
    if ( ! lc_is_a_chunk_ptr(ptr, &ch_no, &ch, &ex) )
       return;
 
@@ -871,14 +1003,14 @@ lc_push_with_clique_if_a_chunk_ptr(Addr ptr, Int clique, Int cur_clique)
       if (VG_DEBUG_CLIQUE) {
          if (ex->IorC.indirect_szB > 0)
             VG_(printf)("  clique %d joining clique %d adding %lu+%lu\n", 
-                        ch_no, clique, (unsigned long)ch->szB,
+                        ch_no, clique, (unsigned long)MC_(chunk_szB)(ch),
 			(unsigned long)ex->IorC.indirect_szB);
          else
             VG_(printf)("  block %d joining clique %d adding %lu\n", 
-                        ch_no, clique, (unsigned long)ch->szB);
+                        ch_no, clique, (unsigned long)MC_(chunk_szB)(ch));
       }
 
-      lc_extras[clique].IorC.indirect_szB += ch->szB;
+      lc_extras[clique].IorC.indirect_szB += MC_(chunk_szB)(ch);
       lc_extras[clique].IorC.indirect_szB += ex->IorC.indirect_szB;
       ex->state = IndirectLeak;
       ex->IorC.clique = (SizeT) cur_clique;
@@ -896,6 +1028,273 @@ lc_push_if_a_chunk_ptr(Addr ptr,
 }
 
 
+/*------------------------------------------------------------*/
+/*--- Incremental leak search.                             ---*/
+/*------------------------------------------------------------*/
+
+// The result of scanning some pages of a SM_SIZE aligned chunk of
+// memory: their valid aligned words whose value is in
+// [lc_cache_lo, lc_cache_hi[, i.e. which can point to a block.  Only the
+// pages which have been asked for are scanned, so that nothing outside the
+// root segments and the blocks is read.
+//
+// Only writes seen by Memcheck mark a chunk dirty.  Memory which another
+// process or the kernel can write behind our back is not cached: file and
+// shared memory mappings are always scanned again.  Shared anonymous
+// mappings and asynchronous kernel writes (e.g. aio) cannot be told apart
+// and are still cached.
+typedef
+   struct _LC_ChunkCache {
+      struct _LC_ChunkCache* next;
+      UWord   base;       // Start of the chunk.
+      UInt    search_gen; // MC_(leak_search_gen) when last used.
+      UInt    pages;      // Bit i set if page i of the chunk was scanned.
+      UInt    n_words;
+      Addr*   vals;       // The values of these words ...
+      UShort* idxs;       // ... and their (increasing) word index.
+   }
+   LC_ChunkCache;
+
+// Non-NULL with --incremental-leak-check=yes.
+static VgHashTable lc_chunk_caches;
+// Only values in [lc_cache_lo, lc_cache_hi[ are kept.  When the blocks
+// are no longer in this range, all the caches are dropped.
+static Addr lc_cache_lo;
+static Addr lc_cache_hi;
+// How many bytes were searched using a cache rather than the memory.
+static SizeT lc_reused_szB;
+
+static VG_MINIMAL_JMP_BUF(cachescan_jmpbuf);
+static volatile Addr cachescan_bad_addr;
+
+static
+void cache_scan_catcher ( Int sigNo, Addr addr )
+{
+   if (sigNo == VKI_SIGSEGV || sigNo == VKI_SIGBUS) {
+      cachescan_bad_addr = addr;
+      VG_MINIMAL_LONGJMP(cachescan_jmpbuf);
+   }
+}
+
+#define LC_WORDS_PER_CHUNK (SM_SIZE / sizeof(Addr))
+static Addr   cachescan_vals[LC_WORDS_PER_CHUNK];
+static UShort cachescan_idxs[LC_WORDS_PER_CHUNK];
+static UInt   cachescan_n_words;
+
+#define LC_PAGES_PER_CHUNK (SM_SIZE / VKI_PAGE_SIZE)
+
+// The mask of the pages of the chunk at 'base' which [start, end[
+// overlaps.
+static UInt chunk_pages(Addr base, Addr start, Addr end)
+{
+   UInt first = (start - base) / VKI_PAGE_SIZE;
+   UInt last  = (end - 1 - base) / VKI_PAGE_SIZE;
+   tl_assert(start < end && last < LC_PAGES_PER_CHUNK);
+   return (last == 31 ? ~0U : (1U << (last + 1)) - 1) & ~((1U << first) - 1);
+}
+
+// Can the words of the pages 'pages' of the chunk at 'base' be cached?
+// Not if they are part of a file or shared memory mapping, which can be
+// changed without Memcheck seeing it.
+static Bool chunk_pages_cacheable(Addr base, UInt pages)
+{
+   UInt i;
+   for (i = 0; i < LC_PAGES_PER_CHUNK; i++) {
+      NSegment const* seg;
+      if (!(pages & (1U << i)))
+         continue;
+      seg = VG_(am_find_nsegment)(base + i * VKI_PAGE_SIZE);
+      if (seg != NULL && (seg->kind == SkFileC || seg->kind == SkShmC))
+         return False;
+   }
+   return True;
+}
+
+// Scans the pages 'pages' of the chunk at 'base' and returns a new cache
+// for them.  The words in [start, end[ count as scanned.
+static LC_ChunkCache* build_chunk_cache(Addr base, UInt pages,
+                                        Addr start, Addr end)
+{
+   // Read after a longjmp, so volatile.
+   volatile Addr ptr = base;
+   const Addr lim = base + SM_SIZE;
+   vki_sigset_t sigmask;
+   LC_ChunkCache* cc;
+
+   cachescan_n_words = 0;
+   if (MC_(is_within_valid_secondary)(base)) {
+      VG_(sigprocmask)(VKI_SIG_SETMASK, NULL, &sigmask);
+      VG_(set_fault_catcher)(cache_scan_catcher);
+      if (VG_MINIMAL_SETJMP(cachescan_jmpbuf) != 0) {
+         // A read failed: skip the rest of the page.
+         VG_(sigprocmask)(VKI_SIG_SETMASK, &sigmask, NULL);
+         lc_sig_skipped_szB += VG_PGROUNDUP(ptr+1) - ptr;
+         ptr = VG_PGROUNDUP(ptr+1);
+      }
+      while (ptr < lim) {
+         if ((ptr % VKI_PAGE_SIZE) == 0
+             && (!(pages & (1U << ((ptr - base) / VKI_PAGE_SIZE)))
+                 || !VG_(am_is_valid_for_client)(ptr, sizeof(Addr),
+                                                 VKI_PROT_READ))) {
+            ptr += VKI_PAGE_SIZE;
+            continue;
+         }
+         if (MC_(is_valid_aligned_word)(ptr)) {
+            Addr addr;
+            if (ptr >= start && ptr < end)
+               lc_scanned_szB += sizeof(Addr);
+            addr = *(Addr *)ptr;
+            if (addr >= lc_cache_lo && addr < lc_cache_hi) {
+               cachescan_vals[cachescan_n_words] = addr;
+               cachescan_idxs[cachescan_n_words]
+                  = (ptr - base) / sizeof(Addr);
+               cachescan_n_words++;
+            }
+         }
+         ptr += sizeof(Addr);
+      }
+      VG_(sigprocmask)(VKI_SIG_SETMASK, &sigmask, NULL);
+      VG_(set_fault_catcher)(NULL);
+   }
+
+   cc = VG_(malloc)("mc.bcc.1", sizeof(LC_ChunkCache)
+                    + cachescan_n_words * (sizeof(Addr) + sizeof(UShort)));
+   cc->base    = base;
+   cc->pages   = pages;
+   cc->n_words = cachescan_n_words;
+   cc->vals    = (Addr*)(cc + 1);
+   cc->idxs    = (UShort*)(cc->vals + cachescan_n_words);
+   VG_(memcpy)(cc->vals, cachescan_vals, cachescan_n_words * sizeof(Addr));
+   VG_(memcpy)(cc->idxs, cachescan_idxs, cachescan_n_words * sizeof(UShort));
+   return cc;
+}
+
+// Returns an up to date cache for the chunk at 'base' covering the pages
+// of [start, end[, which is going to be searched.
+static LC_ChunkCache* get_chunk_cache(Addr base, UInt pages,
+                                      Addr start, Addr end)
+{
+   Bool dirty = MC_(test_and_clear_SM_dirty)(base);
+   LC_ChunkCache* cc = VG_(HT_lookup)(lc_chunk_caches, base);
+
+   if (cc != NULL && (dirty || (cc->pages & pages) != pages)) {
+      // Rescan the pages it already covered too, so it keeps covering
+      // them.
+      if (!dirty)
+         pages |= cc->pages;
+      VG_(HT_remove)(lc_chunk_caches, base);
+      VG_(free)(cc);
+      cc = NULL;
+   }
+   if (cc == NULL) {
+      cc = build_chunk_cache(base, pages, start, end);
+      VG_(HT_add_node)(lc_chunk_caches, cc);
+   } else {
+      lc_reused_szB += end - start;
+   }
+   cc->search_gen = MC_(leak_search_gen);
+   return cc;
+}
+
+// Called at the start of a leak search, once lc_chunks is sorted.  Drops
+// all the caches if they do not cover the values pointing to the blocks.
+static void prepare_chunk_caches(void)
+{
+   Addr  lo, hi;
+   SizeT half;
+
+   if (lc_chunk_caches == NULL)
+      lc_chunk_caches = VG_(HT_construct)("mc.pcc.1");
+   lc_reused_szB = 0;
+
+   lo = lc_chunks[0]->data;
+   hi = lc_chunks[lc_n_chunks-1]->data + MC_(chunk_szB)(lc_chunks[lc_n_chunks-1]) + 1;
+   if (lo >= lc_cache_lo && hi <= lc_cache_hi)
+      return;
+
+   VG_(HT_destruct)(lc_chunk_caches, VG_(free));
+   lc_chunk_caches = VG_(HT_construct)("mc.pcc.1");
+
+   // Leave some room for the heap to grow or move.
+   half = (hi - lo) / 2;
+   lc_cache_lo = lo > half ? VG_ROUNDDN(lo - half, SM_SIZE) : 0;
+   lc_cache_hi = hi + half > hi ? VG_ROUNDUP(hi + half, SM_SIZE) : ~(Addr)0;
+   if (lc_cache_hi < hi)
+      lc_cache_hi = ~(Addr)0;
+   if (VG_(clo_verbosity) > 1 && !VG_(clo_xml))
+      VG_(umsg)("Dropped the leak search caches, new range %#lx-%#lx\n",
+                lc_cache_lo, lc_cache_hi);
+}
+
+// Called at the end of a leak search: drops the caches of the chunks
+// which were not scanned, e.g. because they have been unmapped.
+static void prune_chunk_caches(void)
+{
+   UInt i, n;
+   VgHashNode** ccs = VG_(HT_to_array)(lc_chunk_caches, &n);
+
+   for (i = 0; i < n; i++) {
+      LC_ChunkCache* cc = (LC_ChunkCache*)ccs[i];
+      if (cc->search_gen != MC_(leak_search_gen)) {
+         VG_(HT_remove)(lc_chunk_caches, cc->base);
+         VG_(free)(cc);
+      }
+   }
+   VG_(free)(ccs);
+}
+
+static void lc_scan_memory_wrk(Addr start, SizeT len, Bool is_prior_definite,
+                               Int clique, Int cur_clique,
+                               Addr searched, SizeT szB);
+
+// As lc_scan_memory in leak check mode, but takes the words of the
+// chunks whose writes are tracked from their cache.
+static void
+lc_scan_memory_cached(Addr start, SizeT len, Bool is_prior_definite,
+                      Int clique, Int cur_clique)
+{
+   Addr ptr = VG_ROUNDUP(start, sizeof(Addr));
+   const Addr end = VG_ROUNDDN(start+len, sizeof(Addr));
+
+   while (ptr < end) {
+      Addr base = VG_ROUNDDN(ptr, SM_SIZE);
+      Addr lim  = base + SM_SIZE;
+      LC_ChunkCache* cc;
+      UInt lo, hi, first, last, i, pages;
+
+      if (lim < base || lim > end)
+         lim = end;    // Last chunk, or at the top of memory.
+
+      pages = MC_(is_SM_dirty_tracked)(base)
+              ? chunk_pages(base, ptr, lim) : 0;
+      if (pages == 0 || !chunk_pages_cacheable(base, pages)) {
+         lc_scan_memory_wrk(ptr, lim - ptr, is_prior_definite,
+                            clique, cur_clique, /*searched*/0, 0);
+      } else {
+         cc = get_chunk_cache(base, pages, ptr, lim);
+         // Binary search for the first word at or above ptr.
+         first = (ptr - base) / sizeof(Addr);
+         last  = (lim - base) / sizeof(Addr);
+         lo = 0;
+         hi = cc->n_words;
+         while (lo < hi) {
+            UInt mid = (lo + hi) / 2;
+            if (cc->idxs[mid] < first)
+               lo = mid + 1;
+            else
+               hi = mid;
+         }
+         for (i = lo; i < cc->n_words && cc->idxs[i] < last; i++)
+            lc_push_if_a_chunk_ptr(cc->vals[i],
+                                   clique, cur_clique, is_prior_definite);
+      }
+      if (lim == end)
+         break;
+      ptr = lim;
+   }
+}
+
+
 static VG_MINIMAL_JMP_BUF(memscan_jmpbuf);
 static volatile Addr bad_scanned_addr;
 
@@ -939,10 +1338,13 @@ void scan_all_valid_memory_catcher ( Int sigNo, Addr addr )
 // In such a case, lc_scan_memory just scans [start..start+len[ for pointers
 // to searched and outputs the places where searched is found.
 // It does not recursively scans the found memory.
+//
+// With --incremental-leak-check=yes, lc_scan_memory takes what it can
+// from the chunk caches; lc_scan_memory_wrk always reads the memory.
 static void
-lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
-               Int clique, Int cur_clique,
-               Addr searched, SizeT szB)
+lc_scan_memory_wrk(Addr start, SizeT len, Bool is_prior_definite,
+                   Int clique, Int cur_clique,
+                   Addr searched, SizeT szB)
 {
    /* memory scan is based on the assumption that valid pointers are aligned
       on a multiple of sizeof(Addr). So, we can (and must) skip the begin and
@@ -1086,6 +1488,103 @@ lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
    VG_(set_fault_catcher)(NULL);
 }
 
+static void
+lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
+               Int clique, Int cur_clique,
+               Addr searched, SizeT szB)
+{
+   if (lc_chunk_caches != NULL && searched == 0 && lc_par == NULL
+       && MC_(is_SM_dirty_tracked)(VG_ROUNDDN(start, SM_SIZE)))
+      lc_scan_memory_cached(start, len, is_prior_definite,
+                            clique, cur_clique);
+   else
+      lc_scan_memory_wrk(start, len, is_prior_definite,
+                         clique, cur_clique, searched, szB);
+}
+
+
+// Give the bottom half of the mark stack to the shared queue, for the
+// idle workers to take.
+static void lc_par_give_work(void)
+{
+   Int  i, n = (lc_markstack_top + 1) / 2;
+   UInt tail;
+
+   if (n == 0)
+      return;
+   tail = __sync_fetch_and_add(&lc_par->tail, n);
+   tl_assert(tail + n <= lc_par->queue_size);
+   for (i = 0; i < n; i++) {
+      tl_assert(lc_extras[lc_markstack[i]].pending);
+      lc_extras[lc_markstack[i]].pending = False;
+      lc_par->queue[tail + i] = lc_markstack[i];
+   }
+   for (i = n; i <= lc_markstack_top; i++)
+      lc_markstack[i - n] = lc_markstack[i];
+   lc_markstack_top -= n;
+}
+
+// Waits for the workers which have exited, and sets lc_par->failed if
+// one of them did not exit normally.  A worker only exits normally once
+// the search is finished.  If 'block', waits for all of them.
+static void lc_par_reap_workers(Bool block)
+{
+   Int i, status, res;
+
+   for (i = 0; i < lc_par_n_forked; i++) {
+      if (lc_par_reaped[i])
+         continue;
+      status = -1;
+      res = VG_(waitpid)(lc_par_pids[i], &status, block ? 0 : VKI_WNOHANG);
+      if (res == 0)
+         continue;  // Still running.
+      lc_par_reaped[i] = True;
+      if (res != lc_par_pids[i] || status != 0)
+         lc_par->failed = True;
+   }
+}
+
+// Called by a worker whose mark stack is empty.  Waits until a block can
+// be taken from the shared queue and pushes it, returning True, or until
+// all the workers are idle with nothing left in the queue, returning
+// False.  Also returns False if a worker died, as the search can then
+// never finish.
+static Bool lc_par_take_work(void)
+{
+   UInt head, tail;
+   Int  ch_no;
+   UInt n_spins = 0;
+
+   tl_assert(lc_markstack_top == -1);
+   __sync_fetch_and_add(&lc_par->n_idle, 1);
+   while (True) {
+      if (lc_par->failed)
+         return False;
+      if (lc_par_worker == 0 && (++n_spins % 100000) == 0)
+         lc_par_reap_workers(/*block*/False);
+      tail = lc_par->tail;
+      head = lc_par->head;
+      if (head < tail) {
+         __sync_fetch_and_sub(&lc_par->n_idle, 1);
+         if (__sync_bool_compare_and_swap(&lc_par->head, head, head + 1)) {
+            // The giver may have claimed the entry but not yet filled it.
+            while ((ch_no = lc_par->queue[head]) == -1) {
+               if (lc_par->failed)
+                  return False;
+            }
+            tl_assert(ch_no >= 0 && ch_no < lc_n_chunks);
+            lc_push(ch_no, lc_chunks[ch_no]);
+            return True;
+         }
+         __sync_fetch_and_add(&lc_par->n_idle, 1);
+      } else if (lc_par->n_idle == lc_par->n_workers
+                 && lc_par->tail == tail) {
+         // Nobody is working and the queue has been empty since we read
+         // head, so no work can appear any more.
+         return False;
+      }
+   }
+}
 
 // Process the mark stack until empty.
 static void lc_process_markstack(Int clique)
@@ -1097,11 +1596,17 @@ static void lc_process_markstack(Int clique)
       tl_assert(top >= 0 && top < lc_n_chunks);
 
       // See comment about 'is_prior_definite' at the top to understand this.
-      is_prior_definite = ( Possible != lc_extras[top].state );
+      if (lc_par)
+         is_prior_definite = ( Possible != LC_PAR_STATE(lc_par->state[top]) );
+      else
+         is_prior_definite = ( Possible != lc_extras[top].state );
 
-      lc_scan_memory(lc_chunks[top]->data, lc_chunks[top]->szB,
+      lc_scan_memory(lc_chunks[top]->data, MC_(chunk_szB)(lc_chunks[top]),
                      is_prior_definite, clique, (clique == -1 ? -1 : top),
                      /*searched*/ 0, 0);
+
+      if (lc_par && lc_par->n_idle > 0 && lc_markstack_top >= 1)
+         lc_par_give_work();
    }
 }
 
@@ -1288,12 +1793,12 @@ static void print_results(ThreadId tid, LeakCheckParams* lcp)
       lrkey.allocated_at = MC_(allocated_at)(ch);
 
      if (ex->heuristic) {
-        MC_(bytes_heuristically_reachable)[ex->heuristic] += ch->szB;
+        MC_(bytes_heuristically_reachable)[ex->heuristic] += MC_(chunk_szB)(ch);
         MC_(blocks_heuristically_reachable)[ex->heuristic]++;
         if (VG_DEBUG_LEAKCHECK)
            VG_(printf)("heuristic %s %#lx len %lu\n",
                        pp_heuristic(ex->heuristic),
-                       ch->data, (unsigned long)ch->szB);
+                       ch->data, (unsigned long)MC_(chunk_szB)(ch));
      }
 
       old_lr = VG_(OSetGen_Lookup)(lr_table, &lrkey);
@@ -1301,7 +1806,7 @@ static void print_results(ThreadId tid, LeakCheckParams* lcp)
          // We found an existing loss record matching this chunk.  Update the
          // loss record's details in-situ.  This is safe because we don't
          // change the elements used as the OSet key.
-         old_lr->szB          += ch->szB;
+         old_lr->szB          += MC_(chunk_szB)(ch);
          if (ex->state == Unreached)
             old_lr->indirect_szB += ex->IorC.indirect_szB;
          old_lr->num_blocks++;
@@ -1310,7 +1815,7 @@ static void print_results(ThreadId tid, LeakCheckParams* lcp)
          // record, initialise it from the chunk, and insert it into lr_table.
          lr = VG_(OSetGen_AllocNode)(lr_table, sizeof(LossRecord));
          lr->key              = lrkey;
-         lr->szB              = ch->szB;
+         lr->szB              = MC_(chunk_szB)(ch);
          if (ex->state == Unreached)
             lr->indirect_szB     = ex->IorC.indirect_szB;
          else
@@ -1502,12 +2007,12 @@ static void print_clique (Int clique, UInt level)
          for (i = 0; i < level; i++)
             VG_(umsg)("  ");
          VG_(umsg)("%p[%lu] indirect loss record %d\n",
-                   (void *)ind_ch->data, (unsigned long)ind_ch->szB,
+                   (void *)ind_ch->data, (unsigned long)MC_(chunk_szB)(ind_ch),
                    lr_i+1); // lr_i+1 for user numbering.
          if (lr_i >= n_lossrecords)
             VG_(umsg)
                ("error: no indirect loss record found for %p[%lu]?????\n",
-                (void *)ind_ch->data, (unsigned long)ind_ch->szB);
+                (void *)ind_ch->data, (unsigned long)MC_(chunk_szB)(ind_ch));
          print_clique(ind, level+1);
       }
    }
@@ -1554,7 +2059,7 @@ Bool MC_(print_block_list) ( UInt loss_record_nr)
          // If this is the loss record we are looking for, output the pointer.
          if (old_lr == lr_array[loss_record_nr]) {
             VG_(umsg)("%p[%lu]\n",
-                      (void *)ch->data, (unsigned long) ch->szB);
+                      (void *)ch->data, (unsigned long) MC_(chunk_szB)(ch));
             if (ex->state != Reachable) {
                // We can print the clique in all states, except Reachable.
                // In Unreached state, lc_chunk[i] is the clique leader.
@@ -1568,7 +2073,30 @@ Bool MC_(print_block_list) ( UInt loss_record_nr)
       } else {
          // No existing loss record matches this chunk ???
          VG_(umsg)("error: no loss record found for %p[%lu]?????\n",
-                   (void *)ch->data, (unsigned long) ch->szB);
+                   (void *)ch->data, (unsigned long) MC_(chunk_szB)(ch));
+      }
+   }
+   return True;
+}
+
+// Is seg part of the memory root set ?
+static Bool lc_is_root_segment(NSegment const* seg)
+{
+   if (seg->kind != SkFileC && seg->kind != SkAnonC) return False;
+   if (!(seg->hasR && seg->hasW))                    return False;
+   if (seg->isCH)                                    return False;
+
+   // Don't poke around in device segments as this may cause
+   // hangs.  Exclude /dev/zero just in case someone allocated
+   // memory by explicitly mapping /dev/zero.
+   if (seg->kind == SkFileC 
+       && (VKI_S_ISCHR(seg->mode) || VKI_S_ISBLK(seg->mode))) {
+      HChar* dev_name = VG_(am_get_filename)( seg );
+      if (dev_name && 0 == VG_(strcmp)(dev_name, "/dev/zero")) {
+         // Don't skip /dev/zero.
+      } else {
+         // Skip this device mapping.
+         return False;
       }
    }
    return True;
@@ -1595,23 +2123,8 @@ static void scan_memory_root_set(Addr searched, SizeT szB)
       NSegment const* seg = VG_(am_find_nsegment)( seg_starts[i] );
       tl_assert(seg);
 
-      if (seg->kind != SkFileC && seg->kind != SkAnonC) continue;
-      if (!(seg->hasR && seg->hasW))                    continue;
-      if (seg->isCH)                                    continue;
-
-      // Don't poke around in device segments as this may cause
-      // hangs.  Exclude /dev/zero just in case someone allocated
-      // memory by explicitly mapping /dev/zero.
-      if (seg->kind == SkFileC 
-          && (VKI_S_ISCHR(seg->mode) || VKI_S_ISBLK(seg->mode))) {
-         HChar* dev_name = VG_(am_get_filename)( seg );
-         if (dev_name && 0 == VG_(strcmp)(dev_name, "/dev/zero")) {
-            // Don't skip /dev/zero.
-         } else {
-            // Skip this device mapping.
-            continue;
-         }
-      }
+      if (!lc_is_root_segment(seg))
+         continue;
 
       if (0)
          VG_(printf)("ACCEPT %2d  %#lx %#lx\n", i, seg->start, seg->end);
@@ -1631,6 +2144,175 @@ static void scan_memory_root_set(Addr searched, SizeT szB)
    VG_(free)(seg_starts);
 }
 
+// Splits the memory root set in pieces of at most LC_ROOT_PIECE_SZB bytes.
+static XArray* /* of LC_RootPiece */ get_root_pieces(void)
+{
+   Int     i;
+   Int     n_seg_starts;
+   Addr*   seg_starts = VG_(get_segment_starts)( &n_seg_starts );
+   XArray* pieces = VG_(newXA)(VG_(malloc), "mc.grp.1", VG_(free),
+                               sizeof(LC_RootPiece));
+
+   tl_assert(seg_starts && n_seg_starts > 0);
+
+   for (i = 0; i < n_seg_starts; i++) {
+      LC_RootPiece rp;
+      Addr a;
+      NSegment const* seg = VG_(am_find_nsegment)( seg_starts[i] );
+      tl_assert(seg);
+
+      if (!lc_is_root_segment(seg))
+         continue;
+
+      for (a = seg->start; a <= seg->end; a += rp.szB) {
+         rp.start = a;
+         rp.szB   = seg->end - a + 1;
+         if (rp.szB > LC_ROOT_PIECE_SZB)
+            rp.szB = LC_ROOT_PIECE_SZB;
+         VG_(addToXA)(pieces, &rp);
+         if (rp.szB < LC_ROOT_PIECE_SZB)
+            break;  // Avoid wrapping around at the top of memory.
+      }
+   }
+   VG_(free)(seg_starts);
+   return pieces;
+}
+
+// The work done by each of the processes of a parallel leak search:
+// scan root-set pieces until there are none left, then help process the
+// mark stacks until the whole reachable graph has been traced.
+static void lc_par_work(Int worker, XArray* pieces)
+{
+   UInt piece;
+   UInt n_pieces = VG_(sizeXA)(pieces);
+
+   while (!lc_par->go)
+      ;
+
+   lc_par_worker = worker;
+   lc_scanned_szB = 0;
+   lc_sig_skipped_szB = 0;
+
+   while ((piece = __sync_fetch_and_add(&lc_par->next_piece, 1)) < n_pieces) {
+      LC_RootPiece* rp = VG_(indexXA)(pieces, piece);
+      lc_scan_memory(rp->start, rp->szB, /*is_prior_definite*/True,
+                     /*clique*/-1, /*cur_clique*/-1,
+                     /*searched*/0, 0);
+      lc_process_markstack(/*clique*/-1);
+   }
+
+   do {
+      lc_process_markstack(/*clique*/-1);
+   } while (lc_par_take_work());
+
+   lc_par->scanned_szB[worker]     = lc_scanned_szB;
+   lc_par->sig_skipped_szB[worker] = lc_sig_skipped_szB;
+}
+
+// Does the root-set scan and the clique == -1 mark phase with
+// MC_(clo_leak_check_workers) processes.  On success, the states are in
+// lc_extras and True is returned.  Returns False if the shared memory
+// could not be allocated or a worker died: the caller must then do the
+// work sequentially.
+static Bool lc_parallel_mark(void)
+{
+   SizeT   shared_szB, queue_size, j;
+   XArray* pieces;
+   Int     i, ir, ch_no;
+   Bool    ok;
+   vki_sigaction_toK_t   sa, sa2;
+   vki_sigaction_fromK_t saved_sa;
+
+   tl_assert(MC_(clo_leak_check_workers) > 1);
+   tl_assert(MC_(clo_leak_check_workers) <= MC_MAX_LEAK_CHECK_WORKERS);
+
+   queue_size = 2 * (SizeT)lc_n_chunks;
+   shared_szB = VG_ROUNDUP(sizeof(LC_Shared), sizeof(Addr))
+                + VG_ROUNDUP(lc_n_chunks * sizeof(UInt), sizeof(Addr))
+                + queue_size * sizeof(Int);
+   shared_szB = VG_PGROUNDUP(shared_szB);
+   lc_par = VG_(am_shared_alloc)(shared_szB);
+   if (lc_par == NULL)
+      return False;
+
+   lc_par->state = (UInt*)((Addr)lc_par
+                           + VG_ROUNDUP(sizeof(LC_Shared), sizeof(Addr)));
+   lc_par->queue = (Int*)((Addr)lc_par->state
+                          + VG_ROUNDUP(lc_n_chunks * sizeof(UInt),
+                                       sizeof(Addr)));
+   lc_par->queue_size = queue_size;
+   for (i = 0; i < lc_n_chunks; i++)
+      lc_par->state[i] = Unreached | (LchNone << 2);
+   for (j = 0; j < queue_size; j++)
+      lc_par->queue[j] = -1;
+
+   pieces = get_root_pieces();
+
+   // As for VG_(system), SIGCHLD must have its default behaviour so that
+   // the exit of the workers is not reported to the client.
+   VG_(memset)( &sa, 0, sizeof(sa) );
+   sa.ksa_handler = VKI_SIG_DFL;
+   ir = VG_(sigaction)(VKI_SIGCHLD, &sa, &saved_sa);
+   tl_assert(ir == 0);
+
+   lc_par_n_forked = 0;
+   for (i = 1; i < MC_(clo_leak_check_workers); i++) {
+      Int pid = VG_(fork)();
+      if (pid == 0) {
+         lc_par_work(i, pieces);
+         VG_(exit)(0);
+      }
+      if (pid < 0)
+         break;
+      lc_par_pids[lc_par_n_forked] = pid;
+      lc_par_reaped[lc_par_n_forked] = False;
+      lc_par_n_forked++;
+   }
+   if (VG_(clo_verbosity) > 1 && !VG_(clo_xml))
+      VG_(umsg)("Searching with %d processes\n", lc_par_n_forked + 1);
+
+   lc_par->n_workers = lc_par_n_forked + 1;
+   __sync_synchronize();
+   lc_par->go = True;
+
+   // The registers can only be scanned here, by Valgrind.
+   VG_(apply_to_GP_regs)(lc_push_if_a_chunk_ptr_register);
+   lc_par_work(0, pieces);
+
+   lc_par_reap_workers(/*block*/True);
+   VG_(convert_sigaction_fromK_to_toK)( &saved_sa, &sa2 );
+   ir = VG_(sigaction)(VKI_SIGCHLD, &sa2, NULL);
+   tl_assert(ir == 0);
+   VG_(deleteXA)(pieces);
+
+   ok = !lc_par->failed;
+   if (ok) {
+      lc_scanned_szB = 0;
+      lc_sig_skipped_szB = 0;
+      for (i = 0; i <= lc_par_n_forked; i++) {
+         lc_scanned_szB     += lc_par->scanned_szB[i];
+         lc_sig_skipped_szB += lc_par->sig_skipped_szB[i];
+      }
+      for (i = 0; i < lc_n_chunks; i++) {
+         UInt w = lc_par->state[i];
+         tl_assert(!lc_extras[i].pending);
+         lc_extras[i].state     = LC_PAR_STATE(w);
+         lc_extras[i].heuristic = LC_PAR_HEUR(w);
+      }
+   } else {
+      // Forget what this process had left to do.
+      while (lc_pop(&ch_no))
+         ;
+      if (VG_(clo_verbosity) > 1 && !VG_(clo_xml))
+         VG_(umsg)("A leak search worker failed, searching again\n");
+   }
+
+   tl_assert(lc_markstack_top == -1);
+   VG_(am_munmap_valgrind)((Addr)lc_par, shared_szB);
+   lc_par = NULL;
+   return ok;
+}
+
 /*------------------------------------------------------------*/
 /*--- Top-level entry point.                               ---*/
 /*------------------------------------------------------------*/
@@ -1709,8 +2391,8 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
 
       Addr start1    = ch1->data;
       Addr start2    = ch2->data;
-      Addr end1      = ch1->data + ch1->szB - 1;
-      Addr end2      = ch2->data + ch2->szB - 1;
+      Addr end1      = ch1->data + MC_(chunk_szB)(ch1) - 1;
+      Addr end2      = ch2->data + MC_(chunk_szB)(ch2) - 1;
       Bool isCustom1 = ch1->allockind == MC_AllocCustom;
       Bool isCustom2 = ch2->allockind == MC_AllocCustom;
 
@@ -1750,6 +2432,9 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
       }
    }
 
+   if (MC_(clo_incremental_leak_check))
+      prepare_chunk_caches();
+
    // Initialise lc_extras.
    if (lc_extras) {
       VG_(free)(lc_extras);
@@ -1776,19 +2461,24 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
                  lc_n_chunks );
    }
 
-   // Scan the memory root-set, pushing onto the mark stack any blocks
-   // pointed to.
-   scan_memory_root_set(/*searched*/0, 0);
+   if (MC_(clo_leak_check_workers) == 1 || !lc_parallel_mark()) {
+      // Scan the memory root-set, pushing onto the mark stack any blocks
+      // pointed to.
+      scan_memory_root_set(/*searched*/0, 0);
 
-   // Scan GP registers for chunk pointers.
-   VG_(apply_to_GP_regs)(lc_push_if_a_chunk_ptr_register);
+      // Scan GP registers for chunk pointers.
+      VG_(apply_to_GP_regs)(lc_push_if_a_chunk_ptr_register);
 
-   // Process the pushed blocks.  After this, every block that is reachable
-   // from the root-set has been traced.
-   lc_process_markstack(/*clique*/-1);
+      // Process the pushed blocks.  After this, every block that is
+      // reachable from the root-set has been traced.
+      lc_process_markstack(/*clique*/-1);
+   }
 
    if (VG_(clo_verbosity) > 1 && !VG_(clo_xml)) {
       VG_(umsg)("Checked %'lu bytes\n", lc_scanned_szB);
+      if (lc_chunk_caches != NULL)
+         VG_(umsg)("Reused %'lu bytes checked by previous searches\n",
+                   lc_reused_szB);
       if (lc_sig_skipped_szB > 0)
          VG_(umsg)("Skipped %'lu bytes due to read errors\n",
                    lc_sig_skipped_szB);
@@ -1824,6 +2514,9 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
          tl_assert(ex->state == Unreached);
       }
    }
+
+   if (lc_chunk_caches != NULL)
+      prune_chunk_caches();
       
    print_results( tid, lcp);
 
@@ -1872,7 +2565,7 @@ void MC_(who_points_at) ( Addr address, SizeT szB)
 
    // Scan active malloc-ed chunks
    for (i = 0; i < n_chunks; i++) {
-      lc_scan_memory(chunks[i]->data, chunks[i]->szB,
+      lc_scan_memory(chunks[i]->data, MC_(chunk_szB)(chunks[i]),
                      /*is_prior_definite*/True,
                      /*clique*/-1, /*cur_clique*/-1,
                      address, szB);
@@ -46,6 +46,8 @@
 #include "pub_tool_replacemalloc.h"
 #include "pub_tool_tooliface.h"
 #include "pub_tool_threadstate.h"
+#include "pub_tool_transtab.h"
+#include "pub_tool_libcproc.h"      // VG_(read_millisecond_timer)
 
 #include "mc_include.h"
 #include "memcheck.h"   /* for client requests */
@@ -140,7 +142,8 @@ static void ocache_sarp_Clear_Origins ( Addr, UWord ); /* fwds */
    scheme we'd have a four-level table which would require too many memory
    accesses.  So instead the top-level map table has 2^19 entries (indexed
    using bits 16..34 of the address);  this covers the bottom 32GB.  Any
-   accesses above 32GB are handled with a slow, sparse auxiliary table.
+   accesses above 32GB are handled with a sparse radix table, which
+   costs a few more memory accesses per lookup.
    Valgrind's address space manager tries very hard to keep things below
    this 32GB barrier so that performance doesn't suffer too much.
 
@@ -285,8 +288,19 @@ static INLINE Bool is_distinguished_sm ( SecMap* sm ) {
    return sm >= &sm_distinguished[0] && sm <= &sm_distinguished[2];
 }
 
-// Forward declaration
+// With --compress-secmaps=yes, a primary map entry may instead hold
+// SM_COMPRESSED, meaning that the secondary is held run-length encoded
+// in compressed_SMs (see "Compressed secondary maps" below).
+// get_secmap_for_writing expands such a secondary before returning it.
+// get_secmap_for_reading returns SM_COMPRESSED as it is: it reads as
+// all noaccess, which sends the LOADV/STOREV fast cases to their slow
+// paths, and those decode the V+A bits from the compressed form.
+static SecMap sm_compressed;
+#define SM_COMPRESSED (&sm_compressed)
+
+// Forward declarations
 static void update_SM_counts(SecMap* oldSM, SecMap* newSM);
+static void note_hot_SM(SecMap* sm);
 
 /* dist_sm points to one of our three distinguished secondaries.  Make
    a copy of it so that we can write to it.
@@ -304,6 +318,7 @@ static SecMap* copy_for_writing ( SecMap* dist_sm )
                                    sizeof(SecMap) );
    VG_(memcpy)(new_sm, dist_sm, sizeof(SecMap));
    update_SM_counts(dist_sm, new_sm);
+   note_hot_SM(new_sm);
    return new_sm;
 }
 
@@ -319,14 +334,14 @@ static Int   max_noaccess_SMs  = 0;
 static Int   max_undefined_SMs = 0;
 static Int   max_defined_SMs   = 0;
 static Int   max_non_DSM_SMs   = 0;
+static Int   n_compressed_SMs  = 0;
+static Int   max_compressed_SMs = 0;
 
-/* # searches initiated in auxmap_L1, and # base cmps required */
-static ULong n_auxmap_L1_searches  = 0;
-static ULong n_auxmap_L1_cmps      = 0;
-/* # of searches that missed in auxmap_L1 and therefore had to
-   be handed to auxmap_L2. And the number of nodes inserted. */
-static ULong n_auxmap_L2_searches  = 0;
-static ULong n_auxmap_L2_nodes     = 0;
+/* # of auxmap lookups which found the node at each level (level 0 is
+   the root, so that is the number of lookups), and the number of nodes
+   allocated at each level. */
+static ULong n_auxmap_level_hits[4] = { 0, 0, 0, 0 };
+static ULong n_auxmap_nodes[4]      = { 0, 0, 0, 0 };
 
 static Int   n_sanity_cheap     = 0;
 static Int   n_sanity_expensive = 0;
@@ -339,12 +354,14 @@ static void update_SM_counts(SecMap* oldSM, SecMap* newSM)
    if      (oldSM == &sm_distinguished[SM_DIST_NOACCESS ]) n_noaccess_SMs --;
    else if (oldSM == &sm_distinguished[SM_DIST_UNDEFINED]) n_undefined_SMs--;
    else if (oldSM == &sm_distinguished[SM_DIST_DEFINED  ]) n_defined_SMs  --;
+   else if (oldSM == SM_COMPRESSED)                        n_compressed_SMs--;
    else                                                  { n_non_DSM_SMs  --;
                                                            n_deissued_SMs ++; }
 
    if      (newSM == &sm_distinguished[SM_DIST_NOACCESS ]) n_noaccess_SMs ++;
    else if (newSM == &sm_distinguished[SM_DIST_UNDEFINED]) n_undefined_SMs++;
    else if (newSM == &sm_distinguished[SM_DIST_DEFINED  ]) n_defined_SMs  ++;
+   else if (newSM == SM_COMPRESSED)                        n_compressed_SMs++;
    else                                                  { n_non_DSM_SMs  ++;
                                                            n_issued_SMs   ++; }
 
@@ -352,6 +369,8 @@ static void update_SM_counts(SecMap* oldSM, SecMap* newSM)
    if (n_undefined_SMs > max_undefined_SMs) max_undefined_SMs = n_undefined_SMs;
    if (n_defined_SMs   > max_defined_SMs  ) max_defined_SMs   = n_defined_SMs;
    if (n_non_DSM_SMs   > max_non_DSM_SMs  ) max_non_DSM_SMs   = n_non_DSM_SMs;   
+   if (n_compressed_SMs > max_compressed_SMs)
+      max_compressed_SMs = n_compressed_SMs;
 }
 
 /* --------------- Primary maps --------------- */
@@ -363,228 +382,541 @@ static void update_SM_counts(SecMap* oldSM, SecMap* newSM)
 static SecMap* primary_map[N_PRIMARY_MAP];
 
 
-/* An entry in the auxiliary primary map.  base must be a 64k-aligned
-   value, and sm points at the relevant secondary map.  As with the
-   main primary map, the secondary may be either a real secondary, or
-   one of the three distinguished secondaries.  DO NOT CHANGE THIS
-   LAYOUT: the first word has to be the key for OSet fast lookups.
+/* The auxiliary primary map, which covers addresses above
+   MAX_PRIMARY_ADDRESS (so it is only ever used on 64-bit platforms).
+   It is a radix tree indexed by address bits [63:16], AUXMAP_BITS
+   bits per level, so every lookup takes exactly AUXMAP_LEVELS loads.
+   Nodes are allocated on first use.  The leaves hold the SecMap
+   pointers for AUXMAP_FANOUT consecutive 64k chunks (256MB); as with
+   the main primary map, each may be a real secondary or one of the
+   distinguished ones, and a fresh leaf is all noaccess.
 */
+#define AUXMAP_LEVELS  4
+#define AUXMAP_BITS    12
+#define AUXMAP_FANOUT  (1 << AUXMAP_BITS)
+
 typedef
-   struct { 
-      Addr    base;
-      SecMap* sm;
+   struct {
+      void* child[AUXMAP_FANOUT]; // AuxMapNode*, or AuxMapLeaf* at the
+                                  // last level; NULL if not yet needed
    }
-   AuxMapEnt;
+   AuxMapNode;
 
-/* Tunable parameter: How big is the L1 queue? */
-#define N_AUXMAP_L1 24
+typedef
+   struct {
+      SecMap* sm[AUXMAP_FANOUT];
+   }
+   AuxMapLeaf;
 
-/* Tunable parameter: How far along the L1 queue to insert
-   entries resulting from L2 lookups? */
-#define AUXMAP_L1_INSERT_IX 12
+static AuxMapNode* auxmap_root = NULL;
 
-static struct {
-          Addr       base;
-          AuxMapEnt* ent; // pointer to the matching auxmap_L2 node
-       } 
-       auxmap_L1[N_AUXMAP_L1];
+/* Index into the node at 'level' (0 = root) for address 'a'. */
+static INLINE UWord auxmap_index ( Addr a, Int level )
+{
+   ULong chunk = ((ULong)a) >> 16;
+   return (UWord)(chunk >> (AUXMAP_BITS * (AUXMAP_LEVELS - 1 - level)))
+          & (AUXMAP_FANOUT - 1);
+}
 
-static OSet* auxmap_L2 = NULL;
+static void init_auxmap ( void )
+{
+   tl_assert(16 + AUXMAP_LEVELS * AUXMAP_BITS == 64);
+   auxmap_root = VG_(calloc)( "mc.iaux.1", 1, sizeof(AuxMapNode) );
+   n_auxmap_nodes[0] = 1;
+}
 
-static void init_auxmap_L1_L2 ( void )
+/* Walk the auxiliary map, calling fn on every chunk which has a leaf
+   entry. */
+static void auxmap_walk ( void* node, Int level, Addr base,
+                          void (*fn)(SecMap** p, Addr base, void* opaque),
+                          void* opaque )
 {
-   Int i;
-   for (i = 0; i < N_AUXMAP_L1; i++) {
-      auxmap_L1[i].base = 0;
-      auxmap_L1[i].ent  = NULL;
+   UWord i;
+   Int   shift = 16 + AUXMAP_BITS * (AUXMAP_LEVELS - 1 - level);
+   if (level == AUXMAP_LEVELS - 1) {
+      AuxMapLeaf* leaf = node;
+      for (i = 0; i < AUXMAP_FANOUT; i++)
+         fn( &leaf->sm[i], base + (((ULong)i) << shift), opaque );
+   } else {
+      AuxMapNode* nd = node;
+      for (i = 0; i < AUXMAP_FANOUT; i++) {
+         if (nd->child[i])
+            auxmap_walk( nd->child[i], level + 1,
+                         base + (((ULong)i) << shift), fn, opaque );
+      }
    }
+}
 
-   tl_assert(0 == offsetof(AuxMapEnt,base));
-   tl_assert(sizeof(Addr) == sizeof(void*));
-   auxmap_L2 = VG_(OSetGen_Create)( /*keyOff*/  offsetof(AuxMapEnt,base),
-                                    /*fastCmp*/ NULL,
-                                    VG_(malloc), "mc.iaLL.1", VG_(free) );
+static void count_auxmap_secmaps ( SecMap** p, Addr base, void* opaque )
+{
+   Word* counts = opaque;
+   if (*p == SM_COMPRESSED)
+      counts[1]++;
+   else if (!is_distinguished_sm(*p))
+      counts[0]++;
+   if (base <= MAX_PRIMARY_ADDRESS && *p != &sm_distinguished[SM_DIST_NOACCESS])
+      counts[2]++;
 }
 
 /* Check representation invariants; if OK return NULL; else a
    descriptive bit of text.  Also return the number of
-   non-distinguished secondary maps referred to from the auxiliary
-   primary maps. */
-
-static const HChar* check_auxmap_L1_L2_sanity ( Word* n_secmaps_found )
-{
-   Word i, j;
-   /* On a 32-bit platform, the L2 and L1 tables should
-      both remain empty forever.
-
-      On a 64-bit platform:
-      In the L2 table:
-       all .base & 0xFFFF == 0
-       all .base > MAX_PRIMARY_ADDRESS
-      In the L1 table:
-       all .base & 0xFFFF == 0
-       all (.base > MAX_PRIMARY_ADDRESS
-            .base & 0xFFFF == 0
-            and .ent points to an AuxMapEnt with the same .base)
-           or
-           (.base == 0 and .ent == NULL)
-   */
-   *n_secmaps_found = 0;
+   non-distinguished and of compressed secondary maps referred to from
+   the auxiliary primary map. */
+
+static const HChar* check_auxmap_sanity ( Word* n_secmaps_found,
+                                          Word* n_compressed_found )
+{
+   Word counts[3] = { 0, 0, 0 };
+   UWord i;
+   /* On a 32-bit platform the auxmap should remain empty forever. */
    if (sizeof(void*) == 4) {
-      /* 32-bit platform */
-      if (VG_(OSetGen_Size)(auxmap_L2) != 0)
-         return "32-bit: auxmap_L2 is non-empty";
-      for (i = 0; i < N_AUXMAP_L1; i++) 
-        if (auxmap_L1[i].base != 0 || auxmap_L1[i].ent != NULL)
-      return "32-bit: auxmap_L1 is non-empty";
-   } else {
-      /* 64-bit platform */
-      UWord elems_seen = 0;
-      AuxMapEnt *elem, *res;
-      AuxMapEnt key;
-      /* L2 table */
-      VG_(OSetGen_ResetIter)(auxmap_L2);
-      while ( (elem = VG_(OSetGen_Next)(auxmap_L2)) ) {
-         elems_seen++;
-         if (0 != (elem->base & (Addr)0xFFFF))
-            return "64-bit: nonzero .base & 0xFFFF in auxmap_L2";
-         if (elem->base <= MAX_PRIMARY_ADDRESS)
-            return "64-bit: .base <= MAX_PRIMARY_ADDRESS in auxmap_L2";
-         if (elem->sm == NULL)
-            return "64-bit: .sm in _L2 is NULL";
-         if (!is_distinguished_sm(elem->sm))
-            (*n_secmaps_found)++;
-      }
-      if (elems_seen != n_auxmap_L2_nodes)
-         return "64-bit: disagreement on number of elems in _L2";
-      /* Check L1-L2 correspondence */
-      for (i = 0; i < N_AUXMAP_L1; i++) {
-         if (auxmap_L1[i].base == 0 && auxmap_L1[i].ent == NULL)
-            continue;
-         if (0 != (auxmap_L1[i].base & (Addr)0xFFFF))
-            return "64-bit: nonzero .base & 0xFFFF in auxmap_L1";
-         if (auxmap_L1[i].base <= MAX_PRIMARY_ADDRESS)
-            return "64-bit: .base <= MAX_PRIMARY_ADDRESS in auxmap_L1";
-         if (auxmap_L1[i].ent == NULL)
-            return "64-bit: .ent is NULL in auxmap_L1";
-         if (auxmap_L1[i].ent->base != auxmap_L1[i].base)
-            return "64-bit: _L1 and _L2 bases are inconsistent";
-         /* Look it up in auxmap_L2. */
-         key.base = auxmap_L1[i].base;
-         key.sm   = 0;
-         res = VG_(OSetGen_Lookup)(auxmap_L2, &key);
-         if (res == NULL)
-            return "64-bit: _L1 .base not found in _L2";
-         if (res != auxmap_L1[i].ent)
-            return "64-bit: _L1 .ent disagrees with _L2 entry";
-      }
-      /* Check L1 contains no duplicates */
-      for (i = 0; i < N_AUXMAP_L1; i++) {
-         if (auxmap_L1[i].base == 0)
-            continue;
-	 for (j = i+1; j < N_AUXMAP_L1; j++) {
-            if (auxmap_L1[j].base == 0)
-               continue;
-            if (auxmap_L1[j].base == auxmap_L1[i].base)
-               return "64-bit: duplicate _L1 .base entries";
-         }
-      }
-   }
+      for (i = 0; i < AUXMAP_FANOUT; i++)
+         if (auxmap_root->child[i] != NULL)
+            return "32-bit: auxmap is non-empty";
+   }
+   /* Nothing at or below MAX_PRIMARY_ADDRESS may be accessible via
+      the auxmap. */
+   auxmap_walk( auxmap_root, 0, 0, count_auxmap_secmaps, counts );
+   if (counts[2] != 0)
+      return "auxmap has accessible entries at or below MAX_PRIMARY_ADDRESS";
+   *n_secmaps_found    = counts[0];
+   *n_compressed_found = counts[1];
    return NULL; /* ok */
 }
 
-static void insert_into_auxmap_L1_at ( Word rank, AuxMapEnt* ent )
+static INLINE SecMap** maybe_find_in_auxmap ( Addr a )
 {
-   Word i;
-   tl_assert(ent);
-   tl_assert(rank >= 0 && rank < N_AUXMAP_L1);
-   for (i = N_AUXMAP_L1-1; i > rank; i--)
-      auxmap_L1[i] = auxmap_L1[i-1];
-   auxmap_L1[rank].base = ent->base;
-   auxmap_L1[rank].ent  = ent;
+   void* node = auxmap_root;
+   Int   level;
+
+   tl_assert(a > MAX_PRIMARY_ADDRESS);
+   n_auxmap_level_hits[0]++;
+   for (level = 0; level < AUXMAP_LEVELS - 1; level++) {
+      node = ((AuxMapNode*)node)->child[ auxmap_index(a, level) ];
+      if (node == NULL)
+         return NULL;
+      n_auxmap_level_hits[level + 1]++;
+   }
+   return &((AuxMapLeaf*)node)->sm[ auxmap_index(a, AUXMAP_LEVELS - 1) ];
 }
 
-static INLINE AuxMapEnt* maybe_find_in_auxmap ( Addr a )
+static SecMap** find_or_alloc_in_auxmap ( Addr a )
 {
-   AuxMapEnt  key;
-   AuxMapEnt* res;
-   Word       i;
+   SecMap** res;
+   void**   slot;
+   Int      level;
+   UWord    i;
 
-   tl_assert(a > MAX_PRIMARY_ADDRESS);
-   a &= ~(Addr)0xFFFF;
+   /* First see if we already have it. */
+   res = maybe_find_in_auxmap( a );
+   if (LIKELY(res))
+      return res;
+
+   /* Ok, some of the path is missing, so fill it in. */
+   slot = &auxmap_root->child[ auxmap_index(a, 0) ];
+   for (level = 1; level < AUXMAP_LEVELS; level++) {
+      if (*slot == NULL) {
+         if (level < AUXMAP_LEVELS - 1) {
+            *slot = VG_(calloc)( "mc.foaia.1", 1, sizeof(AuxMapNode) );
+         } else {
+            AuxMapLeaf* leaf = VG_(malloc)( "mc.foaia.2", sizeof(AuxMapLeaf) );
+            for (i = 0; i < AUXMAP_FANOUT; i++)
+               leaf->sm[i] = &sm_distinguished[SM_DIST_NOACCESS];
+            *slot = leaf;
+         }
+         n_auxmap_nodes[level]++;
+      }
+      if (level < AUXMAP_LEVELS - 1)
+         slot = &((AuxMapNode*)*slot)->child[ auxmap_index(a, level) ];
+   }
+   res = maybe_find_in_auxmap( a );
+   tl_assert(res);
+   return res;
+}
+
+/* --------------- Compressed secondary maps --------------- */
+
+/* With --compress-secmaps=yes, secondary maps which have not been
+   issued or expanded recently are run-length encoded at "safe points"
+   -- the start of a tool callback, where no caller can be holding a
+   SecMap* -- and the full map is unmapped.  Large heaps are mostly
+   defined with the odd undefined or unaddressable hole, so most maps
+   encode to a few runs.  A map consisting of a single
+   noaccess/undefined/defined run simply reverts to the distinguished
+   secondary.  Reads decode the V+A bits straight from the runs (see
+   get_vabits8_for_reading); only get_secmap_for_writing expands the
+   map again into a freshly allocated SecMap.  Expansion never frees
+   anything, so a SecMap* obtained earlier in the same callback stays
+   valid.
 
-   /* First search the front-cache, which is a self-organising
-      list containing the most popular entries. */
+   Each run is 3 bytes: the vabits8 value, then the run length minus 1
+   as a little-endian 16-bit number. */
 
-   if (LIKELY(auxmap_L1[0].base == a))
-      return auxmap_L1[0].ent;
-   if (LIKELY(auxmap_L1[1].base == a)) {
-      Addr       t_base = auxmap_L1[0].base;
-      AuxMapEnt* t_ent  = auxmap_L1[0].ent;
-      auxmap_L1[0].base = auxmap_L1[1].base;
-      auxmap_L1[0].ent  = auxmap_L1[1].ent;
-      auxmap_L1[1].base = t_base;
-      auxmap_L1[1].ent  = t_ent;
-      return auxmap_L1[0].ent;
+typedef
+   struct _CompressedSM {
+      struct _CompressedSM* next;   // for the hash table
+      Addr   base;                  // key: start of the 64k chunk
+      UInt   n_runs;
+      UChar  runs[0];               // Variable-length array: 3 * n_runs
    }
+   CompressedSM;
 
-   n_auxmap_L1_searches++;
+/* Only bother compressing maps that shrink to a quarter or better. */
+#define MAX_SM_RUNS  (sizeof(SecMap) / (4 * 3))
 
-   for (i = 0; i < N_AUXMAP_L1; i++) {
-      if (auxmap_L1[i].base == a) {
-         break;
+static VgHashTable compressed_SMs = NULL;
+
+/* The most recently issued or expanded SecMaps, which are left alone
+   by the next compression pass.  A ring of MC_(clo_hot_secmaps)
+   entries; the pointers may be stale, which does no harm. */
+static SecMap** hot_SMs      = NULL;
+static UInt     hot_SMs_next = 0;
+
+/* Run a compression pass once n_non_DSM_SMs reaches this. */
+static Int   next_SM_compression = 0x7FFFFFFF;
+
+static ULong n_SM_compress_passes = 0;
+static ULong n_SM_compressions    = 0;
+static ULong n_SM_reversions      = 0;
+static ULong n_SM_expansions      = 0;
+static ULong n_SM_decodes         = 0;
+static SizeT compressed_SMs_szB   = 0;
+
+/* The run last found by get_compressed_vabits8, so that scanning a
+   compressed chunk in address order doesn't walk the runs from the
+   start every time.  Cleared whenever a CompressedSM is freed. */
+static CompressedSM* decode_csm     = NULL;
+static UInt          decode_run     = 0;
+static UInt          decode_run_off = 0;
+
+static void note_hot_SM ( SecMap* sm )
+{
+   if (hot_SMs == NULL)
+      return;
+   hot_SMs[hot_SMs_next] = sm;
+   hot_SMs_next++;
+   if (hot_SMs_next == MC_(clo_hot_secmaps))
+      hot_SMs_next = 0;
+}
+
+static void init_compressed_SMs ( void )
+{
+   Int i;
+   tl_assert(MC_(clo_hot_secmaps) > 0);
+   compressed_SMs = VG_(HT_construct)( "mc.compressed_SMs" );
+   hot_SMs = VG_(malloc)( "mc.icSM.1",
+                          MC_(clo_hot_secmaps) * sizeof(SecMap*) );
+   for (i = 0; i < MC_(clo_hot_secmaps); i++)
+      hot_SMs[i] = NULL;
+   next_SM_compression = 2 * MC_(clo_hot_secmaps);
+}
+
+/* *p is SM_COMPRESSED.  Expand the secondary for the chunk at 'a' into
+   a new SecMap and install that in *p. */
+static void expand_SM ( SecMap** p, Addr a )
+{
+   CompressedSM* csm;
+   SecMap*       sm;
+   UInt          i, j, len, off = 0;
+
+   tl_assert(*p == SM_COMPRESSED);
+   csm = VG_(HT_remove)( compressed_SMs, start_of_this_sm(a) );
+   tl_assert(csm);
+
+   sm = VG_(am_shadow_alloc)(sizeof(SecMap));
+   if (sm == NULL)
+      VG_(out_of_memory_NORETURN)( "memcheck:expand compressed SecMap",
+                                   sizeof(SecMap) );
+   for (i = 0; i < csm->n_runs; i++) {
+      UChar* run = &csm->runs[3 * i];
+      len = 1 + (run[1] | (run[2] << 8));
+      tl_assert(off + len <= SM_CHUNKS);
+      for (j = 0; j < len; j++)
+         sm->vabits8[off + j] = run[0];
+      off += len;
+   }
+   tl_assert(off == SM_CHUNKS);
+
+   compressed_SMs_szB -= sizeof(CompressedSM) + 3 * csm->n_runs;
+   if (csm == decode_csm)
+      decode_csm = NULL;
+   VG_(free)(csm);
+   n_SM_expansions++;
+   update_SM_counts(SM_COMPRESSED, sm);
+   note_hot_SM(sm);
+   *p = sm;
+}
+
+/* The chunk containing 'a' is compressed.  Return the vabits8 for the
+   aligned 4 bytes containing 'a', without expanding the chunk. */
+static UChar get_compressed_vabits8 ( Addr a )
+{
+   CompressedSM* csm = decode_csm;
+   UWord         sm_off = SM_OFF(a);
+   UInt          i, off, len;
+
+   n_SM_decodes++;
+   if (csm == NULL || csm->base != start_of_this_sm(a)) {
+      csm = VG_(HT_lookup)( compressed_SMs, start_of_this_sm(a) );
+      tl_assert(csm);
+      decode_csm = csm;
+      decode_run = decode_run_off = 0;
+   } else if (sm_off < decode_run_off) {
+      decode_run = decode_run_off = 0;
+   }
+
+   off = decode_run_off;
+   for (i = decode_run; i < csm->n_runs; i++) {
+      UChar* run = &csm->runs[3 * i];
+      len = 1 + (run[1] | (run[2] << 8));
+      if (sm_off < off + len) {
+         decode_run     = i;
+         decode_run_off = off;
+         return run[0];
       }
+      off += len;
    }
-   tl_assert(i >= 0 && i <= N_AUXMAP_L1);
+   tl_assert2(0, "get_compressed_vabits8: offset beyond last run");
+   /*NOTREACHED*/
+   return VA_BITS8_NOACCESS;
+}
+
+/* *p is a non-distinguished SecMap for the chunk at 'base'.  Replace it
+   by a distinguished secondary or a compressed one if that is
+   worthwhile. */
+static void maybe_compress_SM ( SecMap** p, Addr base )
+{
+   SecMap*       sm = *p;
+   CompressedSM* csm;
+   UInt          i, n_runs, start;
 
-   n_auxmap_L1_cmps += (ULong)(i+1);
+   tl_assert(!is_distinguished_sm(sm) && sm != SM_COMPRESSED);
 
-   if (i < N_AUXMAP_L1) {
-      if (i > 0) {
-         Addr       t_base = auxmap_L1[i-1].base;
-         AuxMapEnt* t_ent  = auxmap_L1[i-1].ent;
-         auxmap_L1[i-1].base = auxmap_L1[i-0].base;
-         auxmap_L1[i-1].ent  = auxmap_L1[i-0].ent;
-         auxmap_L1[i-0].base = t_base;
-         auxmap_L1[i-0].ent  = t_ent;
-         i--;
+   n_runs = 1;
+   for (i = 1; i < SM_CHUNKS; i++) {
+      if (sm->vabits8[i] != sm->vabits8[i-1]) {
+         n_runs++;
+         if (n_runs > MAX_SM_RUNS)
+            return;
       }
-      return auxmap_L1[i].ent;
    }
 
-   n_auxmap_L2_searches++;
+   if (n_runs == 1 && (sm->vabits8[0] == VA_BITS8_NOACCESS
+                       || sm->vabits8[0] == VA_BITS8_UNDEFINED
+                       || sm->vabits8[0] == VA_BITS8_DEFINED)) {
+      SecMap* dsm
+         = &sm_distinguished[ sm->vabits8[0] == VA_BITS8_NOACCESS
+                              ? SM_DIST_NOACCESS
+                              : sm->vabits8[0] == VA_BITS8_UNDEFINED
+                              ? SM_DIST_UNDEFINED : SM_DIST_DEFINED ];
+      n_SM_reversions++;
+      update_SM_counts(sm, dsm);
+      *p = dsm;
+   } else {
+      csm = VG_(malloc)( "mc.mcSM.1", sizeof(CompressedSM) + 3 * n_runs );
+      csm->base   = base;
+      csm->n_runs = n_runs;
+      n_runs = 0;
+      start  = 0;
+      for (i = 1; i <= SM_CHUNKS; i++) {
+         if (i == SM_CHUNKS || sm->vabits8[i] != sm->vabits8[start]) {
+            UChar* run = &csm->runs[3 * n_runs];
+            run[0] = sm->vabits8[start];
+            run[1] = (i - start - 1) & 0xFF;
+            run[2] = (i - start - 1) >> 8;
+            n_runs++;
+            start = i;
+         }
+      }
+      tl_assert(n_runs == csm->n_runs);
+      VG_(HT_add_node)( compressed_SMs, csm );
+      compressed_SMs_szB += sizeof(CompressedSM) + 3 * n_runs;
+      n_SM_compressions++;
+      update_SM_counts(sm, SM_COMPRESSED);
+      *p = SM_COMPRESSED;
+   }
 
-   /* First see if we already have it. */
-   key.base = a;
-   key.sm   = 0;
+   SysRes sres = VG_(am_munmap_valgrind)((Addr)sm, sizeof(SecMap));
+   tl_assert2(! sr_isError(sres), "SecMap valgrind munmap failure\n");
+}
 
-   res = VG_(OSetGen_Lookup)(auxmap_L2, &key);
-   if (res)
-      insert_into_auxmap_L1_at( AUXMAP_L1_INSERT_IX, res );
-   return res;
+static Int cmp_SecMap_ptrs ( const void* v1, const void* v2 )
+{
+   const SecMap* sm1 = *(SecMap* const*)v1;
+   const SecMap* sm2 = *(SecMap* const*)v2;
+   if (sm1 < sm2) return -1;
+   if (sm1 > sm2) return 1;
+   return 0;
 }
 
-static AuxMapEnt* find_or_alloc_in_auxmap ( Addr a )
+static Bool is_hot_SM ( SecMap** sorted_hot, SecMap* sm )
 {
-   AuxMapEnt *nyu, *res;
+   Word lo = 0, hi = MC_(clo_hot_secmaps) - 1;
+   while (lo <= hi) {
+      Word mid = (lo + hi) / 2;
+      if (sorted_hot[mid] == sm) return True;
+      if (sorted_hot[mid] < sm) lo = mid + 1; else hi = mid - 1;
+   }
+   return False;
+}
 
-   /* First see if we already have it. */
-   res = maybe_find_in_auxmap( a );
-   if (LIKELY(res))
-      return res;
+static void maybe_compress_cold_SM ( SecMap** p, Addr base,
+                                     void* sorted_hot )
+{
+   if (is_distinguished_sm(*p) || *p == SM_COMPRESSED
+       || is_hot_SM(sorted_hot, *p))
+      return;
+   maybe_compress_SM( p, base );
+}
+
+/* Called at safe points (see above).  Once enough SecMaps are in use,
+   compress all but the hot ones. */
+void MC_(maybe_compress_secmaps) ( void )
+{
+   SecMap**   sorted_hot;
+   UWord      i;
+
+   if (LIKELY(n_non_DSM_SMs < next_SM_compression))
+      return;
+
+   tl_assert(hot_SMs);
+   n_SM_compress_passes++;
+   sorted_hot = VG_(malloc)( "mc.mcSMs.1",
+                             MC_(clo_hot_secmaps) * sizeof(SecMap*) );
+   VG_(memcpy)( sorted_hot, hot_SMs,
+                MC_(clo_hot_secmaps) * sizeof(SecMap*) );
+   VG_(ssort)( sorted_hot, MC_(clo_hot_secmaps), sizeof(SecMap*),
+               cmp_SecMap_ptrs );
+
+   for (i = 0; i < N_PRIMARY_MAP; i++)
+      maybe_compress_cold_SM( &primary_map[i], ((Addr)i) << 16, sorted_hot );
+   auxmap_walk( auxmap_root, 0, 0, maybe_compress_cold_SM, sorted_hot );
+
+   VG_(free)(sorted_hot);
+
+   /* Maps that did not compress stay in use; don't rescan them until
+      another batch has been issued. */
+   next_SM_compression = n_non_DSM_SMs + MC_(clo_hot_secmaps);
+   if (next_SM_compression < 2 * MC_(clo_hot_secmaps))
+      next_SM_compression = 2 * MC_(clo_hot_secmaps);
+}
+
+/* --------------- Superblock sampling --------------- */
+
+/* With --sampled-superblocks=<n> for n < 100, MC_(instrument) only
+   fully instruments the superblocks whose address and
+   MC_(sample_epoch) hash into the sample.  Every
+   --sampling-period milliseconds, MC_(sample_epoch) is changed and
+   all translations are discarded, so that the code gets instrumented
+   again according to the new sample.  As translations must not be
+   discarded while generated code is running, this is only checked on
+   entry to tool callbacks: the malloc/free and brk/mmap ones, which
+   call MC_(maybe_rotate_sample), and stop_client_code, which the
+   scheduler calls after each run of generated code, so that loops
+   which never allocate rotate too.  Reading the timer is a syscall,
+   so each of them only does so once every so many events. */
+
+/* Number of MC_(maybe_rotate_sample) calls, and number of superblocks
+   run, between two reads of the timer. */
+#define SAMPLE_CHECK_CALLS  256
+#define SAMPLE_CHECK_BBS    100000
+
+UInt         MC_(sample_epoch)     = 0;
+ULong        MC_(n_sampled_SBs)    = 0;
+ULong        MC_(n_unsampled_SBs)  = 0;
+static UInt  next_sample_rotation  = 0; /* VG_(read_millisecond_timer) */
+static UInt  sample_check_calls    = 0;
+static ULong next_sample_check_bbs = SAMPLE_CHECK_BBS;
+static ULong n_sample_rotations    = 0;
+
+static void rotate_sample_if_due ( void )
+{
+   UInt now = VG_(read_millisecond_timer)();
+   if ((Int)(now - next_sample_rotation) < 0)
+      return;
+   next_sample_rotation = now + MC_(clo_sampling_period);
+   MC_(sample_epoch)++;
+   n_sample_rotations++;
+   VG_(discard_translations)( 0, ~0ULL, "memcheck sampling" );
+}
+
+void MC_(maybe_rotate_sample) ( void )
+{
+   if (LIKELY(MC_(clo_sampled_superblocks) == 100))
+      return;
+   if (LIKELY(++sample_check_calls < SAMPLE_CHECK_CALLS))
+      return;
+   sample_check_calls = 0;
+   rotate_sample_if_due();
+}
 
-   /* Ok, there's no entry in the secondary map, so we'll have
-      to allocate one. */
-   a &= ~(Addr)0xFFFF;
+/* Only registered with --sampled-superblocks=<n> for n < 100.  Like
+   gdbserver, this may discard the translation that just ran: the
+   chaining done afterwards copes with that. */
+static void mc_stop_client_code ( ThreadId tid, ULong bbs_done )
+{
+   if (LIKELY(bbs_done < next_sample_check_bbs))
+      return;
+   next_sample_check_bbs = bbs_done + SAMPLE_CHECK_BBS;
+   rotate_sample_if_due();
+}
+
+/* --------------- Dirty secondary maps --------------- */
 
-   nyu = (AuxMapEnt*) VG_(OSetGen_AllocNode)( auxmap_L2, sizeof(AuxMapEnt) );
-   tl_assert(nyu);
-   nyu->base = a;
-   nyu->sm   = &sm_distinguished[SM_DIST_NOACCESS];
-   VG_(OSetGen_Insert)( auxmap_L2, nyu );
-   insert_into_auxmap_L1_at( AUXMAP_L1_INSERT_IX, nyu );
-   n_auxmap_L2_nodes++;
-   return nyu;
+/* With --incremental-leak-check=yes, dirty_SMs has one byte for each
+   64KB chunk of the address space covered by the primary map.  It is
+   set whenever the client may have written to the chunk or its V+A bits
+   may have changed, and cleared by the leak checker when it rescans the
+   chunk (MC_(test_and_clear_SM_dirty)).  Chunks above
+   MAX_PRIMARY_ADDRESS are always considered dirty.  NULL when the
+   option is off, so that the stores only pay for a test. */
+static UChar* dirty_SMs = NULL;
+
+static INLINE void mark_SM_dirty_low ( Addr a )
+{
+   if (UNLIKELY(dirty_SMs != NULL))
+      dirty_SMs[a >> 16] = 1;
+}
+
+static INLINE void mark_SM_dirty ( Addr a )
+{
+   if (a <= MAX_PRIMARY_ADDRESS)
+      mark_SM_dirty_low(a);
+}
+
+static void mark_SMs_dirty ( Addr a, SizeT len )
+{
+   Addr last;
+
+   if (LIKELY(dirty_SMs == NULL) || len == 0 || a > MAX_PRIMARY_ADDRESS)
+      return;
+   last = a + len - 1;
+   if (last < a || last > MAX_PRIMARY_ADDRESS)
+      last = MAX_PRIMARY_ADDRESS;
+   VG_(memset)(&dirty_SMs[a >> 16], 1, (last >> 16) - (a >> 16) + 1);
+}
+
+static void init_dirty_SMs ( void )
+{
+   /* Everything starts dirty, as nothing has been scanned yet. */
+   dirty_SMs = VG_(malloc)("mc.ids.1", N_PRIMARY_MAP);
+   VG_(memset)(dirty_SMs, 1, N_PRIMARY_MAP);
+}
+
+Bool MC_(is_SM_dirty_tracked) ( Addr a )
+{
+   return dirty_SMs != NULL && a <= MAX_PRIMARY_ADDRESS;
+}
+
+Bool MC_(test_and_clear_SM_dirty) ( Addr a )
+{
+   Bool dirty;
+
+   tl_assert((a & (SM_SIZE-1)) == 0);
+   tl_assert(MC_(is_SM_dirty_tracked)(a));
+   dirty = dirty_SMs[a >> 16];
+   dirty_SMs[a >> 16] = 0;
+   return dirty;
 }
 
 /* --------------- SecMap fundamentals --------------- */
@@ -603,8 +935,7 @@ static INLINE SecMap** get_secmap_low_ptr ( Addr a )
 
 static INLINE SecMap** get_secmap_high_ptr ( Addr a )
 {
-   AuxMapEnt* am = find_or_alloc_in_auxmap(a);
-   return &am->sm;
+   return find_or_alloc_in_auxmap(a);
 }
 
 static INLINE SecMap** get_secmap_ptr ( Addr a )
@@ -616,18 +947,23 @@ static INLINE SecMap** get_secmap_ptr ( Addr a )
 
 static INLINE SecMap* get_secmap_for_reading_low ( Addr a )
 {
-   return *get_secmap_low_ptr(a);
+   SecMap** p = get_secmap_low_ptr(a);
+   return *p;
 }
 
 static INLINE SecMap* get_secmap_for_reading_high ( Addr a )
 {
-   return *get_secmap_high_ptr(a);
+   SecMap** p = get_secmap_high_ptr(a);
+   return *p;
 }
 
 static INLINE SecMap* get_secmap_for_writing_low(Addr a)
 {
    SecMap** p = get_secmap_low_ptr(a);
-   if (UNLIKELY(is_distinguished_sm(*p)))
+   mark_SM_dirty_low(a);
+   if (UNLIKELY(*p == SM_COMPRESSED))
+      expand_SM(p, a);
+   else if (UNLIKELY(is_distinguished_sm(*p)))
       *p = copy_for_writing(*p);
    return *p;
 }
@@ -635,7 +971,9 @@ static INLINE SecMap* get_secmap_for_writing_low(Addr a)
 static INLINE SecMap* get_secmap_for_writing_high ( Addr a )
 {
    SecMap** p = get_secmap_high_ptr(a);
-   if (UNLIKELY(is_distinguished_sm(*p)))
+   if (UNLIKELY(*p == SM_COMPRESSED))
+      expand_SM(p, a);
+   else if (UNLIKELY(is_distinguished_sm(*p)))
       *p = copy_for_writing(*p);
    return *p;
 }
@@ -643,7 +981,8 @@ static INLINE SecMap* get_secmap_for_writing_high ( Addr a )
 /* Produce the secmap for 'a', either from the primary map or by
    ensuring there is an entry for it in the aux primary map.  The
    secmap may be a distinguished one as the caller will only want to
-   be able to read it. 
+   be able to read it.  It may also be SM_COMPRESSED, which reads as
+   noaccess; use get_vabits8_for_reading to get the real V+A bits.
 */
 static INLINE SecMap* get_secmap_for_reading ( Addr a )
 {
@@ -668,15 +1007,17 @@ static INLINE SecMap* get_secmap_for_writing ( Addr a )
 
 /* If 'a' has a SecMap, produce it.  Else produce NULL.  But don't
    allocate one if one doesn't already exist.  This is used by the
-   leak checker.
+   leak checker.  The result may be SM_COMPRESSED, which is not
+   expanded since the caller only compares it with the distinguished
+   secondaries.
 */
 static SecMap* maybe_get_secmap_for ( Addr a )
 {
    if (a <= MAX_PRIMARY_ADDRESS) {
-      return get_secmap_for_reading_low(a);
+      return *get_secmap_low_ptr(a);
    } else {
-      AuxMapEnt* am = maybe_find_in_auxmap(a);
-      return am ? am->sm : NULL;
+      SecMap** p = maybe_find_in_auxmap(a);
+      return p ? *p : NULL;
    }
 }
 
@@ -735,11 +1076,19 @@ void set_vabits2 ( Addr a, UChar vabits2 )
 }
 
 static INLINE
-UChar get_vabits2 ( Addr a )
+UChar get_vabits8_for_reading ( Addr a )
 {
    SecMap* sm       = get_secmap_for_reading(a);
    UWord   sm_off   = SM_OFF(a);
-   UChar   vabits8  = sm->vabits8[sm_off];
+   if (UNLIKELY(sm == SM_COMPRESSED))
+      return get_compressed_vabits8(a);
+   return sm->vabits8[sm_off];
+}
+
+static INLINE
+UChar get_vabits2 ( Addr a )
+{
+   UChar   vabits8  = get_vabits8_for_reading(a);
    return extract_vabits2_from_vabits8(a, vabits8);
 }
 
@@ -750,10 +1099,7 @@ UChar get_vabits2 ( Addr a )
 static INLINE
 UChar get_vabits8_for_aligned_word32 ( Addr a )
 {
-   SecMap* sm       = get_secmap_for_reading(a);
-   UWord   sm_off   = SM_OFF(a);
-   UChar   vabits8  = sm->vabits8[sm_off];
-   return vabits8;
+   return get_vabits8_for_reading(a);
 }
 
 static INLINE
@@ -1467,6 +1813,9 @@ void mc_STOREVn_slow ( Addr a, SizeT nBits, ULong vbytes, Bool bigendian )
 
    PROF_EVENT(35, "mc_STOREVn_slow");
 
+   mark_SM_dirty(a);
+   mark_SM_dirty(a + szB - 1);
+
    /* ------------ BEGIN semi-fast cases ------------ */
    /* These deal quickly-ish with the common auxiliary primary map
       cases on 64-bit platforms.  Are merely a speedup hack; can be
@@ -1570,6 +1919,8 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
    if (lenT == 0)
       return;
 
+   mark_SMs_dirty(a, lenT);
+
    if (lenT > 256 * 1024 * 1024) {
       if (VG_(clo_verbosity) > 0 && !VG_(clo_xml)) {
          const HChar* s = "unknown???";
@@ -1660,6 +2011,8 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
 
    // If it's distinguished, make it undistinguished if necessary.
    sm_ptr = get_secmap_ptr(a);
+   if (UNLIKELY(*sm_ptr == SM_COMPRESSED))
+      expand_SM(sm_ptr, a);
    if (is_distinguished_sm(*sm_ptr)) {
       if (*sm_ptr == example_dsm) {
          // Sec-map already has the V+A bits that we want, so skip.
@@ -1718,7 +2071,15 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
       tl_assert(is_start_of_sm(a));
       PROF_EVENT(159, "set_address_range_perms-loop64K");
       sm_ptr = get_secmap_ptr(a);
-      if (!is_distinguished_sm(*sm_ptr)) {
+      if (*sm_ptr == SM_COMPRESSED) {
+         // Just drop the compressed version.
+         CompressedSM* csm = VG_(HT_remove)( compressed_SMs, a );
+         tl_assert(csm);
+         compressed_SMs_szB -= sizeof(CompressedSM) + 3 * csm->n_runs;
+         if (csm == decode_csm)
+            decode_csm = NULL;
+         VG_(free)(csm);
+      } else if (!is_distinguished_sm(*sm_ptr)) {
          PROF_EVENT(160, "set_address_range_perms-loop64K-free-dist-sm");
          // Free the non-distinguished sec-map that we're replacing.  This
          // case happens moderately often, enough to be worthwhile.
@@ -1744,6 +2105,8 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
 
    // If it's distinguished, make it undistinguished if necessary.
    sm_ptr = get_secmap_ptr(a);
+   if (UNLIKELY(*sm_ptr == SM_COMPRESSED))
+      expand_SM(sm_ptr, a);
    if (is_distinguished_sm(*sm_ptr)) {
       if (*sm_ptr == example_dsm) {
          // Sec-map already has the V+A bits that we want, so stop.
@@ -1823,12 +2186,16 @@ void make_mem_undefined_w_tid_and_okind ( Addr a, SizeT len,
 static
 void mc_new_mem_w_tid_make_ECU  ( Addr a, SizeT len, ThreadId tid )
 {
+   MC_(maybe_compress_secmaps)();
+   MC_(maybe_rotate_sample)();
    make_mem_undefined_w_tid_and_okind ( a, len, tid, MC_OKIND_UNKNOWN );
 }
 
 static
 void mc_new_mem_w_tid_no_ECU  ( Addr a, SizeT len, ThreadId tid )
 {
+   MC_(maybe_compress_secmaps)();
+   MC_(maybe_rotate_sample)();
    MC_(make_mem_undefined_w_otag) ( a, len, MC_OKIND_UNKNOWN );
 }
 
@@ -2039,7 +2406,8 @@ void MC_(copy_address_range_state) ( Addr src, Addr dst, SizeT len )
    Memory is shadowed using a two level cache structure (ocacheL1 and
    ocacheL2).  Memory references are first directed to ocacheL1.  This
    is a traditional 2-way set associative cache with 32-byte lines and
-   approximate LRU replacement within each set.
+   approximate LRU replacement within each set.  The number of sets is
+   given by --origin-cache-sets.
 
    A naive implementation would require storing one 32 bit otag for
    each byte of memory covered, a 4:1 space overhead.  Instead, there
@@ -2057,10 +2425,10 @@ void MC_(copy_address_range_state) ( Addr src, Addr dst, SizeT len )
    zeroes to be installed.  However, ejecting a line containing
    nonzeroes risks losing origin information permanently.  In order to
    prevent such lossage, ejected nonzero lines are placed in a
-   secondary cache (ocacheL2), which is an OSet (AVL tree) of cache
-   lines.  This can grow arbitrarily large, and so should ensure that
-   Memcheck runs out of memory in preference to losing useful origin
-   info due to cache size limitations.
+   secondary cache (ocacheL2), which is a hash table of cache lines,
+   keyed by line address.  This can grow arbitrarily large, and so
+   should ensure that Memcheck runs out of memory in preference to
+   losing useful origin info due to cache size limitations.
 
    Shadowing registers is a bit tricky, because the shadow values are
    32 bits, regardless of the size of the register.  That gives a
@@ -2285,6 +2653,8 @@ static UWord stats_ocacheL1_movefwds       = 0;
 static UWord stats__ocacheL2_refs          = 0;
 static UWord stats__ocacheL2_misses        = 0;
 static UWord stats__ocacheL2_n_nodes_max   = 0;
+static UWord stats__ocacheL2_probes        = 0;
+static UWord stats__ocacheL2_resizes       = 0;
 
 /* Cache of 32-bit values, one every 32 bits of address space */
 
@@ -2300,13 +2670,13 @@ static INLINE Bool is_valid_oc_tag ( Addr tag ) {
 
 #define OC_LINES_PER_SET 2
 
-#define OC_N_SET_BITS    20
-#define OC_N_SETS        (1 << OC_N_SET_BITS)
-
-/* These settings give:
+/* The number of sets is MC_(clo_origin_cache_sets), rounded up to a
+   power of 2.  The default of 1 << 20 sets gives:
    64 bit host: ocache:  100,663,296 sizeB    67,108,864 useful
    32 bit host: ocache:   92,274,688 sizeB    67,108,864 useful
 */
+static UWord oc_n_sets    = 0;
+static UWord oc_sets_mask = 0; /* oc_n_sets - 1 */
 
 #define OC_MOVE_FORWARDS_EVERY_BITS 7
 
@@ -2342,14 +2712,9 @@ typedef
    }
    OCacheSet;
 
-typedef
-   struct {
-      OCacheSet set[OC_N_SETS];
-   }
-   OCache;
-
-static OCache* ocacheL1 = NULL;
-static UWord   ocacheL1_event_ctr = 0;
+/* ocacheL1[0 .. oc_n_sets-1] */
+static OCacheSet* ocacheL1 = NULL;
+static UWord      ocacheL1_event_ctr = 0;
 
 static void init_ocacheL2 ( void ); /* fwds */
 static void init_OCache ( void )
@@ -2357,15 +2722,19 @@ static void init_OCache ( void )
    UWord line, set;
    tl_assert(MC_(clo_mc_level) >= 3);
    tl_assert(ocacheL1 == NULL);
-   ocacheL1 = VG_(am_shadow_alloc)(sizeof(OCache));
+   oc_n_sets = 1;
+   while (oc_n_sets < MC_(clo_origin_cache_sets))
+      oc_n_sets <<= 1;
+   oc_sets_mask = oc_n_sets - 1;
+   ocacheL1 = VG_(am_shadow_alloc)(oc_n_sets * sizeof(OCacheSet));
    if (ocacheL1 == NULL) {
       VG_(out_of_memory_NORETURN)( "memcheck:allocating ocacheL1", 
-                                   sizeof(OCache) );
+                                   oc_n_sets * sizeof(OCacheSet) );
    }
    tl_assert(ocacheL1 != NULL);
-   for (set = 0; set < OC_N_SETS; set++) {
+   for (set = 0; set < oc_n_sets; set++) {
       for (line = 0; line < OC_LINES_PER_SET; line++) {
-         ocacheL1->set[set].line[line].tag = 1/*invalid*/;
+         ocacheL1[set].line[line].tag = 1/*invalid*/;
       }
    }
    init_ocacheL2();
@@ -2393,67 +2762,175 @@ static void zeroise_OCacheLine ( OCacheLine* line, Addr tag ) {
 //////////////////////////////////////////////////////////////
 //// OCache backing store
 
-static OSet* ocacheL2 = NULL;
+/* ocacheL2 is a chained hash table of OCacheLines, keyed by tag.  It
+   is looked up on every ocacheL1 miss, so it must be fast, and it can
+   hold millions of lines, so it must be compact.  The nodes are not
+   individually allocated: they live in arrays of OC_L2_NODES_PER_CHUNK
+   nodes, and are linked (in their hash chain, or in the free list)
+   by a UInt index rather than a pointer.  Index 0 means 'none', so
+   node n is at ocacheL2_chunks[(n-1) / OC_L2_NODES_PER_CHUNK]. */
+
+typedef
+   struct {
+      OCacheLine line;
+      UInt       next;
+   }
+   OCacheL2Node;
+
+#define OC_L2_NODES_PER_CHUNK (1 << 14)
+
+static OCacheL2Node** ocacheL2_chunks   = NULL;
+static UInt           ocacheL2_n_chunks = 0; /* in use */
+static UInt           ocacheL2_chunks_size = 0; /* allocated */
+static UInt           ocacheL2_n_used   = 0; /* nodes ever handed out */
+static UInt           ocacheL2_free_list = 0;
 
-static void* ocacheL2_malloc ( const HChar* cc, SizeT szB ) {
-   return VG_(malloc)(cc, szB);
+/* ocacheL2[0 .. (1 << ocacheL2_bits) - 1] are the heads of the hash chains. */
+static UInt* ocacheL2      = NULL;
+static UInt  ocacheL2_bits = 0;
+
+/* Stats: # nodes currently in table */
+static UWord stats__ocacheL2_n_nodes = 0;
+
+static INLINE OCacheL2Node* ocacheL2_node ( UInt n )
+{
+   if (OC_ENABLE_ASSERTIONS)
+      tl_assert(n > 0 && n <= ocacheL2_n_used);
+   n--;
+   return &ocacheL2_chunks[n / OC_L2_NODES_PER_CHUNK]
+                          [n % OC_L2_NODES_PER_CHUNK];
 }
-static void ocacheL2_free ( void* v ) {
-   VG_(free)( v );
+
+static INLINE UWord ocacheL2_hash ( Addr tag )
+{
+   ULong h = (ULong)(tag >> OC_BITS_PER_LINE) * 0x9E3779B97F4A7C15ULL;
+   return (UWord)(h >> (64 - ocacheL2_bits));
 }
 
-/* Stats: # nodes currently in tree */
-static UWord stats__ocacheL2_n_nodes = 0;
+static UInt* ocacheL2_alloc_buckets ( UInt bits )
+{
+   SizeT szB = sizeof(UInt) << bits;
+   UInt* buckets = VG_(malloc)("mc.ioL2.1", szB);
+   VG_(memset)(buckets, 0, szB);
+   return buckets;
+}
 
 static void init_ocacheL2 ( void )
 {
    tl_assert(!ocacheL2);
-   tl_assert(sizeof(Word) == sizeof(Addr)); /* since OCacheLine.tag :: Addr */
-   tl_assert(0 == offsetof(OCacheLine,tag));
-   ocacheL2 
-      = VG_(OSetGen_Create)( offsetof(OCacheLine,tag), 
-                             NULL, /* fast cmp */
-                             ocacheL2_malloc, "mc.ioL2", ocacheL2_free);
-   tl_assert(ocacheL2);
+   ocacheL2_bits = 16;
+   ocacheL2 = ocacheL2_alloc_buckets(ocacheL2_bits);
    stats__ocacheL2_n_nodes = 0;
 }
 
-/* Find line with the given tag in the tree, or NULL if not found. */
+/* Double the number of hash chains. */
+static void ocacheL2_resize ( void )
+{
+   UInt* old      = ocacheL2;
+   UWord old_size = (UWord)1 << ocacheL2_bits;
+   UWord i;
+
+   stats__ocacheL2_resizes++;
+   ocacheL2_bits++;
+   ocacheL2 = ocacheL2_alloc_buckets(ocacheL2_bits);
+   for (i = 0; i < old_size; i++) {
+      UInt n = old[i];
+      while (n != 0) {
+         OCacheL2Node* node = ocacheL2_node(n);
+         UInt next = node->next;
+         UWord h = ocacheL2_hash(node->line.tag);
+         node->next = ocacheL2[h];
+         ocacheL2[h] = n;
+         n = next;
+      }
+   }
+   VG_(free)(old);
+}
+
+static UInt ocacheL2_alloc_node ( void )
+{
+   UInt n;
+   if (ocacheL2_free_list != 0) {
+      n = ocacheL2_free_list;
+      ocacheL2_free_list = ocacheL2_node(n)->next;
+      return n;
+   }
+   if (ocacheL2_n_used == ocacheL2_n_chunks * OC_L2_NODES_PER_CHUNK) {
+      if (ocacheL2_n_chunks == ocacheL2_chunks_size) {
+         ocacheL2_chunks_size = ocacheL2_chunks_size == 0 
+                                   ? 64 : 2 * ocacheL2_chunks_size;
+         ocacheL2_chunks 
+            = VG_(realloc)("mc.ioL2.2", ocacheL2_chunks,
+                           ocacheL2_chunks_size * sizeof(OCacheL2Node*));
+      }
+      ocacheL2_chunks[ocacheL2_n_chunks++]
+         = VG_(malloc)("mc.ioL2.3",
+                       OC_L2_NODES_PER_CHUNK * sizeof(OCacheL2Node));
+   }
+   tl_assert(ocacheL2_n_used < 0xFFFFFFFF);
+   return ++ocacheL2_n_used;
+}
+
+/* Find line with the given tag in the table, or NULL if not found. */
 static OCacheLine* ocacheL2_find_tag ( Addr tag )
 {
-   OCacheLine* line;
+   UInt n;
    tl_assert(is_valid_oc_tag(tag));
    stats__ocacheL2_refs++;
-   line = VG_(OSetGen_Lookup)( ocacheL2, &tag );
-   return line;
+   n = ocacheL2[ocacheL2_hash(tag)];
+   while (n != 0) {
+      OCacheL2Node* node = ocacheL2_node(n);
+      stats__ocacheL2_probes++;
+      if (node->line.tag == tag)
+         return &node->line;
+      n = node->next;
+   }
+   return NULL;
 }
 
-/* Delete the line with the given tag from the tree, if it is present, and
-   free up the associated memory. */
+/* Delete the line with the given tag from the table, if it is
+   present, and free up the associated memory. */
 static void ocacheL2_del_tag ( Addr tag )
 {
-   OCacheLine* line;
+   UInt* prev;
    tl_assert(is_valid_oc_tag(tag));
    stats__ocacheL2_refs++;
-   line = VG_(OSetGen_Remove)( ocacheL2, &tag );
-   if (line) {
-      VG_(OSetGen_FreeNode)(ocacheL2, line);
-      tl_assert(stats__ocacheL2_n_nodes > 0);
-      stats__ocacheL2_n_nodes--;
+   prev = &ocacheL2[ocacheL2_hash(tag)];
+   while (*prev != 0) {
+      UInt n = *prev;
+      OCacheL2Node* node = ocacheL2_node(n);
+      stats__ocacheL2_probes++;
+      if (node->line.tag == tag) {
+         *prev = node->next;
+         node->line.tag = 1/*invalid*/;
+         node->next = ocacheL2_free_list;
+         ocacheL2_free_list = n;
+         tl_assert(stats__ocacheL2_n_nodes > 0);
+         stats__ocacheL2_n_nodes--;
+         return;
+      }
+      prev = &node->next;
    }
 }
 
-/* Add a copy of the given line to the tree.  It must not already be
+/* Add a copy of the given line to the table.  It must not already be
    present. */
 static void ocacheL2_add_line ( OCacheLine* line )
 {
-   OCacheLine* copy;
+   UInt n;
+   UWord h;
+   OCacheL2Node* node;
    tl_assert(is_valid_oc_tag(line->tag));
-   copy = VG_(OSetGen_AllocNode)( ocacheL2, sizeof(OCacheLine) );
-   tl_assert(copy);
-   *copy = *line;
    stats__ocacheL2_refs++;
-   VG_(OSetGen_Insert)( ocacheL2, copy );
+   if (stats__ocacheL2_n_nodes >= ((UWord)1 << ocacheL2_bits)
+       && ocacheL2_bits < 30)
+      ocacheL2_resize();
+   n = ocacheL2_alloc_node();
+   node = ocacheL2_node(n);
+   node->line = *line;
+   h = ocacheL2_hash(line->tag);
+   node->next = ocacheL2[h];
+   ocacheL2[h] = n;
    stats__ocacheL2_n_nodes++;
    if (stats__ocacheL2_n_nodes > stats__ocacheL2_n_nodes_max)
       stats__ocacheL2_n_nodes_max = stats__ocacheL2_n_nodes;
@@ -2468,14 +2945,14 @@ static OCacheLine* find_OCacheLine_SLOW ( Addr a )
    OCacheLine *victim, *inL2;
    UChar c;
    UWord line;
-   UWord setno   = (a >> OC_BITS_PER_LINE) & (OC_N_SETS - 1);
+   UWord setno   = (a >> OC_BITS_PER_LINE) & oc_sets_mask;
    UWord tagmask = ~((1 << OC_BITS_PER_LINE) - 1);
    UWord tag     = a & tagmask;
-   tl_assert(setno >= 0 && setno < OC_N_SETS);
+   tl_assert(setno >= 0 && setno < oc_n_sets);
 
    /* we already tried line == 0; skip therefore. */
    for (line = 1; line < OC_LINES_PER_SET; line++) {
-      if (ocacheL1->set[setno].line[line].tag == tag) {
+      if (ocacheL1[setno].line[line].tag == tag) {
          if (line == 1) {
             stats_ocacheL1_found_at_1++;
          } else {
@@ -2483,10 +2960,10 @@ static OCacheLine* find_OCacheLine_SLOW ( Addr a )
          }
          if (UNLIKELY(0 == (ocacheL1_event_ctr++ 
                             & ((1<<OC_MOVE_FORWARDS_EVERY_BITS)-1)))) {
-            moveLineForwards( &ocacheL1->set[setno], line );
+            moveLineForwards( &ocacheL1[setno], line );
             line--;
          }
-         return &ocacheL1->set[setno].line[line];
+         return &ocacheL1[setno].line[line];
       }
    }
 
@@ -2498,7 +2975,7 @@ static OCacheLine* find_OCacheLine_SLOW ( Addr a )
    tl_assert(line > 0);
 
    /* First, move the to-be-ejected line to the L2 cache. */
-   victim = &ocacheL1->set[setno].line[line];
+   victim = &ocacheL1[setno].line[line];
    c = classify_OCacheLine(victim);
    switch (c) {
       case 'e':
@@ -2533,36 +3010,36 @@ static OCacheLine* find_OCacheLine_SLOW ( Addr a )
    inL2 = ocacheL2_find_tag( tag );
    if (inL2) {
       /* We're in luck.  It's in the L2. */
-      ocacheL1->set[setno].line[line] = *inL2;
+      ocacheL1[setno].line[line] = *inL2;
    } else {
       /* Missed at both levels of the cache hierarchy.  We have to
          declare it as full of zeroes (unknown origins). */
       stats__ocacheL2_misses++;
-      zeroise_OCacheLine( &ocacheL1->set[setno].line[line], tag );
+      zeroise_OCacheLine( &ocacheL1[setno].line[line], tag );
    }
 
    /* Move it one forwards */
-   moveLineForwards( &ocacheL1->set[setno], line );
+   moveLineForwards( &ocacheL1[setno], line );
    line--;
 
-   return &ocacheL1->set[setno].line[line];
+   return &ocacheL1[setno].line[line];
 }
 
 static INLINE OCacheLine* find_OCacheLine ( Addr a )
 {
-   UWord setno   = (a >> OC_BITS_PER_LINE) & (OC_N_SETS - 1);
+   UWord setno   = (a >> OC_BITS_PER_LINE) & oc_sets_mask;
    UWord tagmask = ~((1 << OC_BITS_PER_LINE) - 1);
    UWord tag     = a & tagmask;
 
    stats_ocacheL1_find++;
 
    if (OC_ENABLE_ASSERTIONS) {
-      tl_assert(setno >= 0 && setno < OC_N_SETS);
+      tl_assert(setno >= 0 && setno < oc_n_sets);
       tl_assert(0 == (tag & (4 * OC_W32S_PER_LINE - 1)));
    }
 
-   if (LIKELY(ocacheL1->set[setno].line[0].tag == tag)) {
-      return &ocacheL1->set[setno].line[0];
+   if (LIKELY(ocacheL1[setno].line[0].tag == tag)) {
+      return &ocacheL1[setno].line[0];
    }
 
    return find_OCacheLine_SLOW( a );
@@ -4059,6 +4536,8 @@ static
 void mc_new_mem_mmap ( Addr a, SizeT len, Bool rr, Bool ww, Bool xx,
                        ULong di_handle )
 {
+   MC_(maybe_compress_secmaps)();
+   MC_(maybe_rotate_sample)();
    if (rr || ww || xx) {
       /* (2) mmap/mprotect other -> defined */
       MC_(make_mem_defined)(a, len);
@@ -4071,6 +4550,8 @@ void mc_new_mem_mmap ( Addr a, SizeT len, Bool rr, Bool ww, Bool xx,
 static
 void mc_new_mem_mprotect ( Addr a, SizeT len, Bool rr, Bool ww, Bool xx )
 {
+   /* The leak checker skips unreadable pages. */
+   mark_SMs_dirty(a, len);
    if (rr || ww || xx) {
       /* (4) mprotect other  ->  change any "noaccess" to "defined" */
       make_mem_defined_if_noaccess(a, len);
@@ -4425,6 +4906,7 @@ void mc_STOREV64 ( Addr a, ULong vbits64, Bool isBigEndian )
          return;
       }
 
+      mark_SM_dirty_low(a);
       sm       = get_secmap_for_reading_low(a);
       sm_off16 = SM_OFF_16(a);
       vabits16 = ((UShort*)(sm->vabits8))[sm_off16];
@@ -4541,6 +5023,7 @@ void mc_STOREV32 ( Addr a, UWord vbits32, Bool isBigEndian )
          return;
       }
 
+      mark_SM_dirty_low(a);
       sm      = get_secmap_for_reading_low(a);
       sm_off  = SM_OFF(a);
       vabits8 = sm->vabits8[sm_off];
@@ -4671,6 +5154,7 @@ void mc_STOREV16 ( Addr a, UWord vbits16, Bool isBigEndian )
          return;
       }
 
+      mark_SM_dirty_low(a);
       sm      = get_secmap_for_reading_low(a);
       sm_off  = SM_OFF(a);
       vabits8 = sm->vabits8[sm_off];
@@ -4784,6 +5268,7 @@ void MC_(helperc_STOREV8) ( Addr a, UWord vbits8 )
          return;
       }
 
+      mark_SM_dirty_low(a);
       sm      = get_secmap_for_reading_low(a);
       sm_off  = SM_OFF(a);
       vabits8 = sm->vabits8[sm_off];
@@ -5044,6 +5529,10 @@ static void init_shadow_memory ( void )
    sm = &sm_distinguished[SM_DIST_DEFINED];
    for (i = 0; i < SM_CHUNKS; i++) sm->vabits8[i] = VA_BITS8_DEFINED;
 
+   /* SM_COMPRESSED reads as noaccess; see its definition. */
+   sm = SM_COMPRESSED;
+   for (i = 0; i < SM_CHUNKS; i++) sm->vabits8[i] = VA_BITS8_NOACCESS;
+
    /* Set up the primary map. */
    /* These entries gradually get overwritten as the used address
       space expands. */
@@ -5051,7 +5540,7 @@ static void init_shadow_memory ( void )
       primary_map[i] = &sm_distinguished[SM_DIST_NOACCESS];
 
    /* Auxiliary primary maps */
-   init_auxmap_L1_L2();
+   init_auxmap();
 
    /* auxmap_size = auxmap_used = 0; 
       no ... these are statically initialised */
@@ -5080,6 +5569,7 @@ static Bool mc_expensive_sanity_check ( void )
 {
    Int     i;
    Word    n_secmaps_found;
+   Word    n_compressed_found = 0;
    SecMap* sm;
    const HChar*  errmsg;
    Bool    bad = False;
@@ -5127,22 +5617,24 @@ static Bool mc_expensive_sanity_check ( void )
          return False;
    }
 
-   /* check the auxiliary maps, very thoroughly */
+   /* check the auxiliary map, very thoroughly */
    n_secmaps_found = 0;
-   errmsg = check_auxmap_L1_L2_sanity( &n_secmaps_found );
+   errmsg = check_auxmap_sanity( &n_secmaps_found, &n_compressed_found );
    if (errmsg) {
       VG_(printf)("memcheck expensive sanity, auxmaps:\n\t%s", errmsg);
       return False;
    }
 
-   /* n_secmaps_found is now the number referred to by the auxiliary
-      primary map.  Now add on the ones referred to by the main
-      primary map. */
+   /* n_secmaps_found and n_compressed_found are now the numbers
+      referred to by the auxiliary primary map.  Now add on the ones
+      referred to by the main primary map. */
    for (i = 0; i < N_PRIMARY_MAP; i++) {
       if (primary_map[i] == NULL) {
          bad = True;
       } else {
-         if (!is_distinguished_sm(primary_map[i]))
+         if (primary_map[i] == SM_COMPRESSED)
+            n_compressed_found++;
+         else if (!is_distinguished_sm(primary_map[i]))
             n_secmaps_found++;
       }
    }
@@ -5152,6 +5644,16 @@ static Bool mc_expensive_sanity_check ( void )
    if (n_secmaps_found != (n_issued_SMs - n_deissued_SMs))
       bad = True;
 
+   /* and that the compressed secmaps referred to from the primary
+      maps are exactly those in compressed_SMs */
+   if (compressed_SMs) {
+      if (n_compressed_found != n_compressed_SMs
+          || n_compressed_found != VG_(HT_count_nodes)(compressed_SMs))
+         bad = True;
+   } else if (n_compressed_found != 0) {
+      bad = True;
+   }
+
    if (bad) {
       VG_(printf)("memcheck expensive sanity: "
                   "apparent secmap leakage\n");
@@ -5182,11 +5684,18 @@ VgRes         MC_(clo_leak_resolution)        = Vg_HighRes;
 UInt          MC_(clo_show_leak_kinds)        = R2S(Possible) | R2S(Unreached);
 UInt          MC_(clo_error_for_leak_kinds)   = R2S(Possible) | R2S(Unreached);
 UInt          MC_(clo_leak_check_heuristics)  = 0;
+Int           MC_(clo_leak_check_workers)     = 1;
+Bool          MC_(clo_incremental_leak_check) = False;
 Bool          MC_(clo_workaround_gcc296_bugs) = False;
 Int           MC_(clo_malloc_fill)            = -1;
 Int           MC_(clo_free_fill)              = -1;
 KeepStacktraces MC_(clo_keep_stacktraces)     = KS_alloc_then_free;
 Int           MC_(clo_mc_level)               = 2;
+Bool          MC_(clo_compress_secmaps)       = False;
+Int           MC_(clo_hot_secmaps)            = 4096;
+Int           MC_(clo_origin_cache_sets)      = 1 << 20;
+Int           MC_(clo_sampled_superblocks)    = 100;
+Int           MC_(clo_sampling_period)        = 2000;
 
 static Bool MC_(parse_leak_heuristics) ( const HChar *str0, UInt *lhs )
 {
@@ -5251,6 +5760,11 @@ static Bool mc_process_cmd_line_options(const HChar* arg)
       if (!MC_(parse_leak_heuristics)(tmp_str, &MC_(clo_leak_check_heuristics)))
          return False;
    }
+   else if VG_BINT_CLO(arg, "--leak-check-workers",
+                       MC_(clo_leak_check_workers),
+                       1, MC_MAX_LEAK_CHECK_WORKERS) {}
+   else if VG_BOOL_CLO(arg, "--incremental-leak-check",
+                       MC_(clo_incremental_leak_check)) {}
    else if (VG_BOOL_CLO(arg, "--show-reachable", tmp_show)) {
       if (tmp_show) {
          MC_(clo_show_leak_kinds) = RallS;
@@ -5335,6 +5849,16 @@ static Bool mc_process_cmd_line_options(const HChar* arg)
    else if VG_XACT_CLO(arg, "--keep-stacktraces=none",
                        MC_(clo_keep_stacktraces), KS_none) {}
 
+   else if VG_BOOL_CLO(arg, "--compress-secmaps", MC_(clo_compress_secmaps)) {}
+   else if VG_BINT_CLO(arg, "--hot-secmaps", MC_(clo_hot_secmaps),
+                       1, 1000000) {}
+   else if VG_BINT_CLO(arg, "--origin-cache-sets",
+                       MC_(clo_origin_cache_sets), 1 << 10, 1 << 24) {}
+   else if VG_BINT_CLO(arg, "--sampled-superblocks",
+                       MC_(clo_sampled_superblocks), 0, 100) {}
+   else if VG_BINT_CLO(arg, "--sampling-period",
+                       MC_(clo_sampling_period), 1, 1000000000) {}
+
    else
       return VG_(replacement_malloc_process_cmd_line_option)(arg);
 
@@ -5359,6 +5883,9 @@ static void mc_print_usage(void)
 "    --leak-check-heuristics=heur1,heur2,... which heuristics to use for\n"
 "        improving leak search false positive [none]\n"
 "        where heur is one of stdstring newarray multipleinheritance all none\n"
+"    --leak-check-workers=<number>    processes used to search for leaks [1]\n"
+"    --incremental-leak-check=no|yes  only rescan memory written since the\n"
+"                                     previous leak search? [no]\n"
 "    --show-reachable=yes             same as --show-leak-kinds=all\n"
 "    --show-reachable=no --show-possibly-lost=yes\n"
 "                                     same as --show-leak-kinds=definite,possible\n"
@@ -5366,6 +5893,8 @@ static void mc_print_usage(void)
 "                                     same as --show-leak-kinds=definite\n"
 "    --undef-value-errors=no|yes      check for undefined value errors [yes]\n"
 "    --track-origins=no|yes           show origins of undefined values? [no]\n"
+"    --origin-cache-sets=<number>     sets in the origin tracking cache,\n"
+"                                     each covering 64 bytes [1048576]\n"
 "    --partial-loads-ok=no|yes        too hard to explain here; see manual [no]\n"
 "    --freelist-vol=<number>          volume of freed blocks queue     [20000000]\n"
 "    --freelist-big-blocks=<number>   releases first blocks with size>= [1000000]\n"
@@ -5375,6 +5904,13 @@ static void mc_print_usage(void)
 "    --free-fill=<hexnumber>          fill free'd areas with given value\n"
 "    --keep-stacktraces=alloc|free|alloc-and-free|alloc-then-free|none\n"
 "        stack trace(s) to keep for malloc'd/free'd areas       [alloc-then-free]\n"
+"    --compress-secmaps=no|yes        compress cold shadow memory? [no]\n"
+"    --hot-secmaps=<number>           recently used 64k chunks of shadow\n"
+"                                     memory kept uncompressed [4096]\n"
+"    --sampled-superblocks=<number>   percentage of the code checked at\n"
+"                                     any time [100]\n"
+"    --sampling-period=<number>       milliseconds between changes of\n"
+"                                     the checked code [2000]\n"
    );
 }
 
@@ -6534,6 +7070,25 @@ static void mc_post_clo_init ( void )
 
    tl_assert( MC_(clo_mc_level) >= 1 && MC_(clo_mc_level) <= 3 );
 
+   if (MC_(clo_compress_secmaps))
+      init_compressed_SMs();
+
+   if (MC_(clo_incremental_leak_check))
+      init_dirty_SMs();
+
+   if (MC_(clo_sampled_superblocks) < 100) {
+      next_sample_rotation = VG_(read_millisecond_timer)()
+                             + MC_(clo_sampling_period);
+      VG_(track_stop_client_code) ( mc_stop_client_code );
+   }
+
+   /* Memcheck's instrumentation depends only on the guest code and
+      the options, except that with origin tracking the core embeds
+      this run's ECUs in calls to the new_mem_stack_w_ECU handlers
+      below.  So translations can only be reused without it. */
+   if (MC_(clo_mc_level) < 3)
+      VG_(needs_reusable_translations) ();
+
    if (MC_(clo_mc_level) == 3) {
       /* We're doing origin tracking. */
 #     ifdef PERF_FAST_STACK
@@ -6633,7 +7188,7 @@ static void mc_post_clo_init ( void )
    }
 
    MC_(chunk_poolalloc) = VG_(newPA)
-      (sizeof(MC_Chunk) + MC_(n_where_pointers)() * sizeof(ExeContext*),
+      (MC_(chunk_size)(),
        1000,
        VG_(malloc),
        "mc.cMC.1 (MC_Chunk pools)",
@@ -6664,20 +7219,21 @@ static void mc_print_stats (void)
       " memcheck: sanity checks: %d cheap, %d expensive\n",
       n_sanity_cheap, n_sanity_expensive );
    VG_(message)(Vg_DebugMsg,
-      " memcheck: auxmaps: %lld auxmap entries (%lldk, %lldM) in use\n",
-      n_auxmap_L2_nodes, 
-      n_auxmap_L2_nodes * 64, 
-      n_auxmap_L2_nodes / 16 );
+      " memcheck: auxmap: %llu/%llu/%llu/%llu nodes per level (%lluk)\n",
+      n_auxmap_nodes[0], n_auxmap_nodes[1],
+      n_auxmap_nodes[2], n_auxmap_nodes[3],
+      (n_auxmap_nodes[0] + n_auxmap_nodes[1]
+       + n_auxmap_nodes[2] + n_auxmap_nodes[3]) * sizeof(AuxMapNode) / 1024 );
    VG_(message)(Vg_DebugMsg,
-      " memcheck: auxmaps_L1: %lld searches, %lld cmps, ratio %lld:10\n",
-      n_auxmap_L1_searches, n_auxmap_L1_cmps,
-      (10ULL * n_auxmap_L1_cmps) 
-         / (n_auxmap_L1_searches ? n_auxmap_L1_searches : 1) 
-   );   
-   VG_(message)(Vg_DebugMsg,
-      " memcheck: auxmaps_L2: %lld searches, %lld nodes\n",
-      n_auxmap_L2_searches, n_auxmap_L2_nodes
-   );   
+      " memcheck: auxmap: %llu/%llu/%llu/%llu lookups hit per level\n",
+      n_auxmap_level_hits[0], n_auxmap_level_hits[1],
+      n_auxmap_level_hits[2], n_auxmap_level_hits[3] );
+
+   if (MC_(clo_sampled_superblocks) < 100)
+      VG_(message)(Vg_DebugMsg,
+         " memcheck: sampling: %'llu SBs sampled, %'llu not, "
+         "%'llu rotations\n",
+         MC_(n_sampled_SBs), MC_(n_unsampled_SBs), n_sample_rotations );
 
    print_SM_info("n_issued     ", n_issued_SMs);
    print_SM_info("n_deissued   ", n_deissued_SMs);
@@ -6710,6 +7266,21 @@ static void mc_print_stats (void)
       " memcheck: max shadow mem size:   %ldk, %ldM\n",
       max_shmem_szB / 1024, max_shmem_szB / (1024 * 1024));
 
+   if (MC_(clo_compress_secmaps)) {
+      ULong ratio10 = compressed_SMs_szB == 0 ? 0
+         : (10ULL * n_compressed_SMs * sizeof(SecMap)) / compressed_SMs_szB;
+      print_SM_info("n_compressed ", n_compressed_SMs);
+      print_SM_info("max_compressd", max_compressed_SMs);
+      VG_(message)(Vg_DebugMsg,
+         " memcheck: compressed SMs: %ldk, ratio %llu.%llu:1\n",
+         compressed_SMs_szB / 1024, ratio10 / 10, ratio10 % 10);
+      VG_(message)(Vg_DebugMsg,
+         " memcheck: SM compression: %llu passes, %llu compressed, "
+         "%llu to DSMs, %llu expanded, %llu decoded\n",
+         n_SM_compress_passes, n_SM_compressions, n_SM_reversions,
+         n_SM_expansions, n_SM_decodes);
+   }
+
    if (MC_(clo_mc_level) >= 3) {
       VG_(message)(Vg_DebugMsg,
                    " ocacheL1: %'12lu refs   %'12lu misses (%'lu lossage)\n",
@@ -6727,9 +7298,9 @@ static void mc_print_stats (void)
                    stats_ocacheL1_found_at_N,
                    stats_ocacheL1_movefwds );
       VG_(message)(Vg_DebugMsg,
-                   " ocacheL1: %'12lu sizeB  %'12u useful\n",
-                   (UWord)sizeof(OCache),
-                   4 * OC_W32S_PER_LINE * OC_LINES_PER_SET * OC_N_SETS );
+                   " ocacheL1: %'12lu sizeB  %'12lu useful\n",
+                   oc_n_sets * (UWord)sizeof(OCacheSet),
+                   4 * OC_W32S_PER_LINE * OC_LINES_PER_SET * oc_n_sets );
       VG_(message)(Vg_DebugMsg,
                    " ocacheL2: %'12lu refs   %'12lu misses\n",
                    stats__ocacheL2_refs, 
@@ -6738,6 +7309,16 @@ static void mc_print_stats (void)
                    " ocacheL2:    %'9lu max nodes %'9lu curr nodes\n",
                    stats__ocacheL2_n_nodes_max,
                    stats__ocacheL2_n_nodes );
+      VG_(message)(Vg_DebugMsg,
+                   " ocacheL2: %'12lu probes %'12lu resizes\n",
+                   stats__ocacheL2_probes,
+                   stats__ocacheL2_resizes );
+      VG_(message)(Vg_DebugMsg,
+                   " ocacheL2: %'12lu sizeB  %'12lu chains\n",
+                   (UWord)ocacheL2_n_chunks * OC_L2_NODES_PER_CHUNK
+                      * sizeof(OCacheL2Node)
+                   + ((UWord)sizeof(UInt) << ocacheL2_bits),
+                   (UWord)1 << ocacheL2_bits );
       VG_(message)(Vg_DebugMsg,
                    " niacache: %'12lu refs   %'12lu misses\n",
                    stats__nia_cache_queries, stats__nia_cache_misses);
@@ -38,6 +38,7 @@
 #include "pub_tool_libcprint.h"
 #include "pub_tool_mallocfree.h"
 #include "pub_tool_options.h"
+#include "pub_tool_oset.h"
 #include "pub_tool_replacemalloc.h"
 #include "pub_tool_threadstate.h"
 #include "pub_tool_tooliface.h"     // Needed for mc_include.h
@@ -94,12 +95,90 @@ void delete_MC_Chunk (MC_Chunk* mc);
 static MC_Chunk* freed_list_start[2]  = {NULL, NULL};
 static MC_Chunk* freed_list_end[2]    = {NULL, NULL};
 
+/* The freed blocks queues can hold millions of blocks, so they are also
+   indexed by address, for MC_(get_freed_block_bracketting).  The blocks
+   are split by size: freed_index[c] holds the blocks whose size is in
+   [2^c, 2^(c+1)[ (blocks of size 0 are in freed_index[0]), ordered by
+   address.  A block of freed_index[c] bracketting a starts less than
+   2^(c+1) + redzone bytes below a, so only a few blocks of each
+   freed_index[c] need to be looked at.
+   'seq' is the position of the block in its queue: when several freed
+   blocks bracket a, the first one in the queues is chosen, as a walk of
+   the queues would do. */
+typedef
+   struct {
+      Addr      data;   // Key, together with mc.
+      MC_Chunk* mc;
+      Long      seq;
+      Int       l;      // Index in freed_list_start.
+   }
+   FreedBlock;
+
+#define N_FREED_INDEXES (sizeof(SizeT) * 8)
+static OSet* freed_index[N_FREED_INDEXES];
+// Next seq to use for a block put at the start/end of freed_list[l].
+static Long  freed_seq_start[2] = {-1, -1};
+static Long  freed_seq_end[2]   = {0, 0};
+
+static Word cmp_FreedBlock ( const void* key, const void* elem )
+{
+   const FreedBlock* k = key;
+   const FreedBlock* e = elem;
+
+   if (k->data < e->data) return -1;
+   if (k->data > e->data) return  1;
+   if (k->mc   < e->mc)   return -1;
+   if (k->mc   > e->mc)   return  1;
+   return 0;
+}
+
+static UInt freed_index_nr ( SizeT szB )
+{
+   UInt c = 0;
+   while (szB > 1) {
+      szB >>= 1;
+      c++;
+   }
+   return c;
+}
+
+static void add_to_freed_index ( MC_Chunk* mc, Int l, Long seq )
+{
+   UInt c = freed_index_nr(MC_(chunk_szB)(mc));
+   FreedBlock* fb;
+
+   if (freed_index[c] == NULL)
+      freed_index[c] = VG_(OSetGen_Create_With_Pool)
+                          (offsetof(FreedBlock, data), cmp_FreedBlock,
+                           VG_(malloc), "mc.atfi.1", VG_(free),
+                           1000, sizeof(FreedBlock));
+   fb = VG_(OSetGen_AllocNode)(freed_index[c], sizeof(FreedBlock));
+   fb->data = mc->data;
+   fb->mc   = mc;
+   fb->seq  = seq;
+   fb->l    = l;
+   VG_(OSetGen_Insert)(freed_index[c], fb);
+}
+
+static void remove_from_freed_index ( MC_Chunk* mc )
+{
+   UInt c = freed_index_nr(MC_(chunk_szB)(mc));
+   FreedBlock key;
+   FreedBlock* fb;
+
+   key.data = mc->data;
+   key.mc   = mc;
+   fb = VG_(OSetGen_Remove)(freed_index[c], &key);
+   tl_assert(fb != NULL);
+   VG_(OSetGen_FreeNode)(freed_index[c], fb);
+}
+
 /* Put a shadow chunk on the freed blocks queue, possibly freeing up
    some of the oldest blocks in the queue at the same time. */
 static void add_to_freed_queue ( MC_Chunk* mc )
 {
    const Bool show = False;
-   const int l = (mc->szB >= MC_(clo_freelist_big_blocks) ? 0 : 1);
+   const int l = (MC_(chunk_szB)(mc) >= MC_(clo_freelist_big_blocks) ? 0 : 1);
 
    /* Put it at the end of the freed list, unless the block
       would be directly released any way : in this case, we
@@ -108,18 +187,21 @@ static void add_to_freed_queue ( MC_Chunk* mc )
       tl_assert(freed_list_start[l] == NULL);
       mc->next = NULL;
       freed_list_end[l]    = freed_list_start[l] = mc;
+      add_to_freed_index(mc, l, freed_seq_end[l]++);
    } else {
       tl_assert(freed_list_end[l]->next == NULL);
-      if (mc->szB >= MC_(clo_freelist_vol)) {
+      if (MC_(chunk_szB)(mc) >= MC_(clo_freelist_vol)) {
          mc->next = freed_list_start[l];
          freed_list_start[l] = mc;
+         add_to_freed_index(mc, l, freed_seq_start[l]--);
       } else {
          mc->next = NULL;
          freed_list_end[l]->next = mc;
          freed_list_end[l]       = mc;
+         add_to_freed_index(mc, l, freed_seq_end[l]++);
       }
    }
-   VG_(free_queue_volume) += (Long)mc->szB;
+   VG_(free_queue_volume) += (Long)MC_(chunk_szB)(mc);
    if (show)
       VG_(printf)("mc_freelist: acquire: volume now %lld\n", 
                   VG_(free_queue_volume));
@@ -146,7 +228,7 @@ static void release_oldest_block(void)
          tl_assert(freed_list_end[i] != NULL);
          
          mc1 = freed_list_start[i];
-         VG_(free_queue_volume) -= (Long)mc1->szB;
+         VG_(free_queue_volume) -= (Long)MC_(chunk_szB)(mc1);
          VG_(free_queue_length)--;
          if (show)
             VG_(printf)("mc_freelist: discard: volume now %lld\n", 
@@ -159,6 +241,7 @@ static void release_oldest_block(void)
             freed_list_start[i] = mc1->next;
          }
          mc1->next = NULL; /* just paranoia */
+         remove_from_freed_index(mc1);
 
          /* free MC_Chunk */
          if (MC_AllocCustom != mc1->allockind)
@@ -170,18 +253,86 @@ static void release_oldest_block(void)
 
 MC_Chunk* MC_(get_freed_block_bracketting) (Addr a)
 {
-   int i;
-   for (i = 0; i < 2; i++) {
-      MC_Chunk*  mc;
-      mc = freed_list_start[i];
-      while (mc) {
-         if (VG_(addr_is_in_block)( a, mc->data, mc->szB,
-                                    MC_(Malloc_Redzone_SzB) ))
-            return mc;
-         mc = mc->next;
+   const SizeT rz = MC_(Malloc_Redzone_SzB);
+   FreedBlock* best = NULL;
+   FreedBlock* fb;
+   FreedBlock  key;
+   UInt        c;
+
+   for (c = 0; c < N_FREED_INDEXES; c++) {
+      if (freed_index[c] == NULL || VG_(OSetGen_Size)(freed_index[c]) == 0)
+         continue;
+
+      // Start at the lowest address a block of this size can start at
+      // and still bracket a.
+      key.data = 0;
+      if (c + 1 < N_FREED_INDEXES && a > rz + ((SizeT)1 << (c + 1)))
+         key.data = a - rz - ((SizeT)1 << (c + 1));
+      key.mc = NULL;
+      VG_(OSetGen_ResetIterAt)(freed_index[c], &key);
+      while ( (fb = VG_(OSetGen_Next)(freed_index[c])) ) {
+         if (fb->data > a && fb->data - a > rz)
+            break;
+         if (VG_(addr_is_in_block)( a, fb->data, MC_(chunk_szB)(fb->mc), rz )
+             && (best == NULL
+                 || fb->l < best->l
+                 || (fb->l == best->l && fb->seq < best->seq)))
+            best = fb;
       }
    }
-   return NULL;
+   return best ? best->mc : NULL;
+}
+
+/* The size of the blocks which do not fit in MC_Chunk.small_szB,
+   keyed by MC_Chunk address.  Such blocks are rare. */
+typedef
+   struct _MC_BigChunkSzB {
+      struct _MC_BigChunkSzB* next;
+      UWord                   key;   // MC_Chunk address
+      SizeT                   szB;
+   }
+   MC_BigChunkSzB;
+
+static VgHashTable big_chunk_szBs = NULL;
+
+SizeT MC_(big_chunk_szB) ( const MC_Chunk* mc )
+{
+   MC_BigChunkSzB* big;
+   tl_assert(mc->small_szB == MC_CHUNK_BIG_SZB);
+   big = VG_(HT_lookup)( big_chunk_szBs, (UWord)mc );
+   tl_assert(big);
+   return big->szB;
+}
+
+void MC_(set_chunk_szB) ( MC_Chunk* mc, SizeT szB )
+{
+   MC_BigChunkSzB* big;
+   if (mc->small_szB == MC_CHUNK_BIG_SZB) {
+      if (szB >= MC_CHUNK_BIG_SZB) {
+         big = VG_(HT_lookup)( big_chunk_szBs, (UWord)mc );
+         tl_assert(big);
+         big->szB = szB;
+         return;
+      }
+      big = VG_(HT_remove)( big_chunk_szBs, (UWord)mc );
+      tl_assert(big);
+      VG_(free)(big);
+   } else if (szB >= MC_CHUNK_BIG_SZB) {
+      if (big_chunk_szBs == NULL)
+         big_chunk_szBs = VG_(HT_construct)( "MC_(big_chunk_szBs)" );
+      big = VG_(malloc)("mc.scs.1", sizeof(MC_BigChunkSzB));
+      big->key = (UWord)mc;
+      big->szB = szB;
+      VG_(HT_add_node)( big_chunk_szBs, big );
+   }
+   mc->small_szB = szB >= MC_CHUNK_BIG_SZB ? MC_CHUNK_BIG_SZB : szB;
+}
+
+SizeT MC_(chunk_size) (void)
+{
+   return VG_ROUNDUP(offsetof(MC_Chunk, where)
+                     + MC_(n_where_pointers)() * sizeof(UInt),
+                     sizeof(UWord));
 }
 
 /* Allocate a shadow chunk, put it on the appropriate list.
@@ -192,7 +343,8 @@ MC_Chunk* create_MC_Chunk ( ThreadId tid, Addr p, SizeT szB,
 {
    MC_Chunk* mc  = VG_(allocEltPA)(MC_(chunk_poolalloc));
    mc->data      = p;
-   mc->szB       = szB;
+   mc->small_szB = 0;
+   MC_(set_chunk_szB)(mc, szB);
    mc->allockind = kind;
    switch ( MC_(n_where_pointers)() ) {
       case 2: mc->where[1] = 0; // fallback to 1
@@ -211,7 +363,7 @@ MC_Chunk* create_MC_Chunk ( ThreadId tid, Addr p, SizeT szB,
       the mc->data field isn't visible to the leak checker.  If memory
       management is working correctly, any pointer returned by VG_(malloc)
       should be noaccess as far as the client is concerned. */
-   if (!MC_(check_mem_is_noaccess)( (Addr)mc, sizeof(MC_Chunk), NULL )) {
+   if (!MC_(check_mem_is_noaccess)( (Addr)mc, MC_(chunk_size)(), NULL )) {
       VG_(tool_panic)("create_MC_Chunk: shadow area is accessible");
    } 
    return mc;
@@ -220,6 +372,8 @@ MC_Chunk* create_MC_Chunk ( ThreadId tid, Addr p, SizeT szB,
 static inline
 void delete_MC_Chunk (MC_Chunk* mc)
 {
+   if (UNLIKELY(mc->small_szB == MC_CHUNK_BIG_SZB))
+      MC_(set_chunk_szB)(mc, 0);
    VG_(freeEltPA) (MC_(chunk_poolalloc), mc);
 }
 
@@ -238,7 +392,7 @@ static Bool in_block_list (VgHashTable block_list, MC_Chunk* mc)
          twice in MC_(malloc_list) is a recipe for bugs.
          We might maybe better create a "standard" mempool to
          handle all this more cleanly. */
-      if (found_mc->szB != mc->szB
+      if (MC_(chunk_szB)(found_mc) != MC_(chunk_szB)(mc)
           || found_mc->allockind != mc->allockind)
          return False;
       tl_assert (found_mc == mc);
@@ -264,15 +418,27 @@ static Bool live_block (MC_Chunk* mc)
    return in_block_list ( MC_(malloc_list), mc );
 }
 
+// The ExeContext for an ECU stored in MC_Chunk.where
+static ExeContext* where_ec (UInt ecu)
+{
+   ExeContext* ec;
+   if (ecu == 0)
+      return VG_(null_ExeContext) ();
+   ec = VG_(get_ExeContext_from_ECU) (ecu);
+   tl_assert (ec);
+   return ec;
+}
+
 ExeContext* MC_(allocated_at) (MC_Chunk* mc)
 {
    switch (MC_(clo_keep_stacktraces)) {
       case KS_none:            return VG_(null_ExeContext) ();
-      case KS_alloc:           return mc->where[0];
+      case KS_alloc:           return where_ec(mc->where[0]);
       case KS_free:            return VG_(null_ExeContext) ();
       case KS_alloc_then_free: return (live_block(mc) ?
-                                       mc->where[0] : VG_(null_ExeContext) ());
-      case KS_alloc_and_free:  return mc->where[0];
+                                       where_ec(mc->where[0])
+                                       : VG_(null_ExeContext) ());
+      case KS_alloc_and_free:  return where_ec(mc->where[0]);
       default: tl_assert (0);
    }
 }
@@ -282,12 +448,11 @@ ExeContext* MC_(freed_at) (MC_Chunk* mc)
    switch (MC_(clo_keep_stacktraces)) {
       case KS_none:            return VG_(null_ExeContext) ();
       case KS_alloc:           return VG_(null_ExeContext) ();
-      case KS_free:            return (mc->where[0] ?
-                                       mc->where[0] : VG_(null_ExeContext) ());
+      case KS_free:            return where_ec(mc->where[0]);
       case KS_alloc_then_free: return (live_block(mc) ?
-                                       VG_(null_ExeContext) () : mc->where[0]);
-      case KS_alloc_and_free:  return (mc->where[1] ?
-                                       mc->where[1] : VG_(null_ExeContext) ());
+                                       VG_(null_ExeContext) ()
+                                       : where_ec(mc->where[0]));
+      case KS_alloc_and_free:  return where_ec(mc->where[1]);
       default: tl_assert (0);
    }
 }
@@ -302,7 +467,8 @@ void  MC_(set_allocated_at) (ThreadId tid, MC_Chunk* mc)
       case KS_alloc_and_free:  break;
       default: tl_assert (0);
    }
-   mc->where[0] = VG_(record_ExeContext) ( tid, 0/*first_ip_delta*/ );
+   mc->where[0] = VG_(get_ECU_from_ExeContext)
+                     (VG_(record_ExeContext) ( tid, 0/*first_ip_delta*/ ));
 }
 
 void  MC_(set_freed_at) (ThreadId tid, MC_Chunk* mc)
@@ -316,7 +482,8 @@ void  MC_(set_freed_at) (ThreadId tid, MC_Chunk* mc)
       case KS_alloc_and_free:  pos = 1; break;
       default: tl_assert (0);
    }
-   mc->where[pos] = VG_(record_ExeContext) ( tid, 0/*first_ip_delta*/ );
+   mc->where[pos] = VG_(get_ECU_from_ExeContext)
+                       (VG_(record_ExeContext) ( tid, 0/*first_ip_delta*/ ));
 }
 
 UInt MC_(n_where_pointers) (void)
@@ -369,6 +536,9 @@ void* MC_(new_block) ( ThreadId tid,
 {
    MC_Chunk* mc;
 
+   MC_(maybe_compress_secmaps)();
+   MC_(maybe_rotate_sample)();
+
    // Allocate and zero if necessary
    if (p) {
       tl_assert(MC_AllocCustom == kind);
@@ -461,12 +631,12 @@ void die_and_free_mem ( ThreadId tid, MC_Chunk* mc, SizeT rzB )
       by MEMPOOL or by MALLOC/FREELIKE_BLOCK requests. */
    if (MC_(clo_free_fill) != -1 && MC_AllocCustom != mc->allockind ) {
       tl_assert(MC_(clo_free_fill) >= 0x00 && MC_(clo_free_fill) <= 0xFF);
-      VG_(memset)((void*)mc->data, MC_(clo_free_fill), mc->szB);
+      VG_(memset)((void*)mc->data, MC_(clo_free_fill), MC_(chunk_szB)(mc));
    }
 
    /* Note: make redzones noaccess again -- just in case user made them
       accessible with a client request... */
-   MC_(make_mem_noaccess)( mc->data-rzB, mc->szB + 2*rzB );
+   MC_(make_mem_noaccess)( mc->data-rzB, MC_(chunk_szB)(mc) + 2*rzB );
 
    /* Record where freed */
    MC_(set_freed_at) (tid, mc);
@@ -499,6 +669,7 @@ void MC_(handle_free) ( ThreadId tid, Addr p, UInt rzB, MC_AllocKind kind )
    MC_Chunk* mc;
 
    cmalloc_n_frees++;
+   MC_(maybe_rotate_sample)();
 
    mc = VG_(HT_remove) ( MC_(malloc_list), (UWord)p );
    if (mc == NULL) {
@@ -561,7 +732,7 @@ void* MC_(realloc) ( ThreadId tid, void* p_old, SizeT new_szB )
       /* but keep going anyway */
    }
 
-   old_szB = old_mc->szB;
+   old_szB = MC_(chunk_szB)(old_mc);
 
    /* Get new memory */
    a_new = (Addr)VG_(cli_malloc)(VG_(clo_alignment), new_szB);
@@ -651,7 +822,7 @@ SizeT MC_(malloc_usable_size) ( ThreadId tid, void* p )
 
    // There may be slop, but pretend there isn't because only the asked-for
    // area will be marked as addressable.
-   return ( mc ? mc->szB : 0 );
+   return ( mc ? MC_(chunk_szB)(mc) : 0 );
 }
 
 /* This handles the in place resize of a block, as performed by the
@@ -662,7 +833,7 @@ void MC_(handle_resizeInPlace)(ThreadId tid, Addr p,
                                SizeT oldSizeB, SizeT newSizeB, SizeT rzB)
 {
    MC_Chunk* mc = VG_(HT_lookup) ( MC_(malloc_list), (UWord)p );
-   if (!mc || mc->szB != oldSizeB || newSizeB == 0) {
+   if (!mc || MC_(chunk_szB)(mc) != oldSizeB || newSizeB == 0) {
       /* Reject if: p is not found, or oldSizeB is wrong,
          or new block would be empty. */
       MC_(record_free_error) ( tid, p );
@@ -672,7 +843,7 @@ void MC_(handle_resizeInPlace)(ThreadId tid, Addr p,
    if (oldSizeB == newSizeB)
       return;
 
-   mc->szB = newSizeB;
+   MC_(set_chunk_szB)(mc, newSizeB);
    if (newSizeB < oldSizeB) {
       MC_(make_mem_noaccess)( p + newSizeB, oldSizeB - newSizeB + rzB );
    } else {
@@ -757,7 +928,7 @@ void MC_(destroy_mempool)(Addr pool)
    while ( (mc = VG_(HT_Next)(mp->chunks)) ) {
       /* Note: make redzones noaccess again -- just in case user made them
          accessible with a client request... */
-      MC_(make_mem_noaccess)(mc->data-mp->rzB, mc->szB + 2*mp->rzB );
+      MC_(make_mem_noaccess)(mc->data-mp->rzB, MC_(chunk_szB)(mc) + 2*mp->rzB );
    }
    // Destroy the chunk table
    VG_(HT_destruct)(mp->chunks, (void (*)(void *))delete_MC_Chunk);
@@ -823,7 +994,7 @@ check_mempool_sane(MC_Mempool* mp)
    
    /* Sanity check -- make sure they don't overlap */
    for (i = 0; i < n_chunks-1; i++) {
-      if (chunks[i]->data + chunks[i]->szB > chunks[i+1]->data ) {
+      if (chunks[i]->data + MC_(chunk_szB)(chunks[i]) > chunks[i+1]->data ) {
          VG_(message)(Vg_UserMsg, 
                       "Mempool chunk %d / %d overlaps with its successor\n", 
                       i+1, n_chunks);
@@ -841,9 +1012,9 @@ check_mempool_sane(MC_Mempool* mp)
                          "[%lx,%lx), allocated:\n",
                          i+1, 
                          n_chunks, 
-                         chunks[i]->szB + 0UL,
+                         MC_(chunk_szB)(chunks[i]) + 0UL,
                          chunks[i]->data, 
-                         chunks[i]->data + chunks[i]->szB);
+                         chunks[i]->data + MC_(chunk_szB)(chunks[i]));
 
             VG_(pp_ExeContext)(MC_(allocated_at)(chunks[i]));
          }
@@ -907,7 +1078,7 @@ void MC_(mempool_free)(Addr pool, Addr addr)
    if (VG_(clo_verbosity) > 2) {
       VG_(message)(Vg_UserMsg, 
 		   "mempool_free(0x%lx, 0x%lx) freed chunk of %ld bytes\n",
-		   pool, addr, mc->szB + 0UL);
+		   pool, addr, MC_(chunk_szB)(mc) + 0UL);
    }
 
    die_and_free_mem ( tid, mc, mp->rzB );
@@ -950,7 +1121,7 @@ void MC_(mempool_trim)(Addr pool, Addr addr, SizeT szB)
       mc = (MC_Chunk*) chunks[i];
 
       lo = mc->data;
-      hi = mc->szB == 0 ? mc->data : mc->data + mc->szB - 1;
+      hi = MC_(chunk_szB)(mc) == 0 ? mc->data : mc->data + MC_(chunk_szB)(mc) - 1;
 
 #define EXTENT_CONTAINS(x) ((addr <= (x)) && ((x) < addr + szB))
 
@@ -1018,7 +1189,7 @@ void MC_(mempool_trim)(Addr pool, Addr addr, SizeT szB)
          }
 
          mc->data = lo;
-         mc->szB = (UInt) (hi - lo);
+         MC_(set_chunk_szB)(mc, hi - lo);
          VG_(HT_add_node)( mp->chunks, mc );        
       }
 
@@ -1078,7 +1249,7 @@ void MC_(mempool_change)(Addr pool, Addr addrA, Addr addrB, SizeT szB)
    }
 
    mc->data = addrB;
-   mc->szB  = szB;
+   MC_(set_chunk_szB)(mc, szB);
    VG_(HT_add_node)( mp->chunks, mc );
 
    check_mempool_sane(mp);
@@ -1115,18 +1286,29 @@ void MC_(print_malloc_stats) ( void )
    VG_(HT_ResetIter)(MC_(malloc_list));
    while ( (mc = VG_(HT_Next)(MC_(malloc_list))) ) {
       nblocks++;
-      nbytes += (ULong)mc->szB;
+      nbytes += (ULong)MC_(chunk_szB)(mc);
    }
 
    VG_(umsg)(
       "HEAP SUMMARY:\n"
       "    in use at exit: %'llu bytes in %'lu blocks\n"
-      "  total heap usage: %'lu allocs, %'lu frees, %'llu bytes allocated\n"
-      "\n",
+      "  total heap usage: %'lu allocs, %'lu frees, %'llu bytes allocated\n",
       nbytes, nblocks,
       cmalloc_n_mallocs,
       cmalloc_n_frees, cmalloc_bs_mallocd
    );
+   if (VG_(clo_verbosity) > 1) {
+      /* Memcheck's own bookkeeping for the blocks in use, not
+         counting the malloc_list hash table chains. */
+      SizeT nbig = big_chunk_szBs == NULL ? 0
+                   : VG_(HT_count_nodes)(big_chunk_szBs);
+      ULong metadata = (ULong)nblocks * MC_(chunk_size)()
+                       + (ULong)nbig * sizeof(MC_BigChunkSzB);
+      VG_(umsg)(
+         "     metadata size: %'llu bytes, %'llu bytes per block in use\n",
+         metadata, nblocks == 0 ? 0ULL : metadata / nblocks);
+   }
+   VG_(umsg)("\n");
 }
 
 SizeT MC_(get_cmalloc_n_frees) ( void )
@@ -209,6 +209,11 @@ typedef
          arguments of type 'HWord' to be passed to helper functions.
          Ity_I32 or Ity_I64 only. */
       IRType hWordTy;
+
+      /* READONLY: False if the superblock is not in the sample (see
+         --sampled-superblocks), in which case computed values are
+         considered defined, and nothing is checked. */
+      Bool sampled;
    }
    MCEnv;
 
@@ -5948,6 +5953,23 @@ static Bool checkForBogusLiterals ( /*FLAT*/ IRStmt* st )
 }
 
 
+/* Is the superblock at guest address 'a' in the current sample?  The
+   address is hashed together with MC_(sample_epoch), so that each
+   epoch samples a different, pseudo-random, set of superblocks. */
+static Bool is_sampled_SB ( Addr64 a )
+{
+   UInt h;
+   if (MC_(clo_sampled_superblocks) == 100)
+      return True;
+   h = (UInt)(a ^ (a >> 32)) ^ (MC_(sample_epoch) * 0x9E3779B9U);
+   h ^= h >> 16;
+   h *= 0x85EBCA6BU;
+   h ^= h >> 13;
+   h *= 0xC2B2AE35U;
+   h ^= h >> 16;
+   return (h % 100) < (UInt)MC_(clo_sampled_superblocks);
+}
+
 IRSB* MC_(instrument) ( VgCallbackClosure* closure,
                         IRSB* sb_in, 
                         VexGuestLayout* layout, 
@@ -5992,6 +6014,11 @@ IRSB* MC_(instrument) ( VgCallbackClosure* closure,
    mce.layout         = layout;
    mce.hWordTy        = hWordTy;
    mce.bogusLiterals  = False;
+   mce.sampled        = is_sampled_SB(closure->nraddr);
+   if (mce.sampled)
+      MC_(n_sampled_SBs)++;
+   else
+      MC_(n_unsampled_SBs)++;
 
    /* Do expensive interpretation for Iop_Add32 and Iop_Add64 on
       Darwin.  10.7 is mostly built with LLVM, which uses these for
@@ -6122,6 +6149,23 @@ IRSB* MC_(instrument) ( VgCallbackClosure* closure,
          VG_(printf)("\n");
       }
 
+      /* Outside the sample, the value of each tmp is considered
+         defined, with no origin.  As everything else only uses tmps
+         and constants, the shadow state of registers and memory is
+         kept consistent (the values written are defined), loads do
+         not need to be shadowed and no checks are generated, or they
+         are optimised away. */
+      if (!mce.sampled && st->tag == Ist_WrTmp) {
+         IRTemp tmp_v = findShadowTmpV(&mce, st->Ist.WrTmp.tmp);
+         assign( 'V', &mce, tmp_v,
+                 definedOfType( typeOfIRTemp(sb_out->tyenv, tmp_v) ) );
+         if (MC_(clo_mc_level) == 3)
+            assign( 'B', &mce, findShadowTmpB(&mce, st->Ist.WrTmp.tmp),
+                    mkU32(0)/* UNKNOWN ORIGIN */ );
+         stmt('C', &mce, st);
+         continue;
+      }
+
       if (MC_(clo_mc_level) == 3) {
          /* See comments on case Ist_CAS below. */
          if (st->tag != Ist_CAS) 
@@ -6165,7 +6209,8 @@ IRSB* MC_(instrument) ( VgCallbackClosure* closure,
             break;
 
          case Ist_Exit:
-            complainIfUndefined( &mce, st->Ist.Exit.guard, NULL );
+            if (mce.sampled)
+               complainIfUndefined( &mce, st->Ist.Exit.guard, NULL );
             break;
 
          case Ist_IMark:
@@ -6236,7 +6281,8 @@ IRSB* MC_(instrument) ( VgCallbackClosure* closure,
       VG_(printf)("\n\n");
    }
 
-   complainIfUndefined( &mce, sb_in->next, NULL );
+   if (mce.sampled)
+      complainIfUndefined( &mce, sb_in->next, NULL );
 
    if (0 && verboze) {
       for (j = first_stmt; j < sb_out->stmts_used; j++) {
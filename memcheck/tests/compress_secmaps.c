@@ -0,0 +1,41 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* Fill lots of 64k chunks with mostly defined memory, so that with
+   --compress-secmaps=yes most of their shadow memory gets compressed,
+   then check that the holes are still undefined. */
+
+#define N_BLOCKS  64
+#define BLOCK_SZB (128 * 1024)
+#define HOLE      (BLOCK_SZB / 2 + 13)
+
+int main ( void )
+{
+   char* blocks[N_BLOCKS];
+   int i, j, sum = 0;
+
+   for (i = 0; i < N_BLOCKS; i++) {
+      blocks[i] = malloc(BLOCK_SZB);
+      memset(blocks[i], i, HOLE);
+      memset(blocks[i] + HOLE + 1, i, BLOCK_SZB - HOLE - 1);
+   }
+
+   /* Only one error for this, from block 0. */
+   for (i = 0; i < N_BLOCKS; i++) {
+      if (blocks[i][HOLE] == 'x')
+         sum++;
+      blocks[i][HOLE] = 0;
+   }
+
+   /* No errors from these. */
+   for (i = 0; i < N_BLOCKS; i++)
+      for (j = 0; j < BLOCK_SZB; j += 4096)
+         sum += blocks[i][j];
+   if (sum == 42)
+      printf("unlikely\n");
+
+   for (i = 0; i < N_BLOCKS; i++)
+      free(blocks[i]);
+   return 0;
+}
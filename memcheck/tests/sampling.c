@@ -0,0 +1,23 @@
+/* With --sampled-superblocks=0, no code is in the sample: undefined
+   values are not reported, but invalid writes and frees still are. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main ( void )
+{
+   int* volatile p = malloc(10 * sizeof(int));
+   int* volatile q = malloc(sizeof(int));
+   int x;
+
+   p[10] = 1;
+   if (*q == 42)
+      x = 1;
+   else
+      x = 2;
+   free(q);
+   free(q);
+   free(p);
+   printf("done %d\n", x > 0);
+   return 0;
+}
@@ -65,7 +65,11 @@ static void nl_pre_clo_init(void)
                                  nl_instrument,
                                  nl_fini);
 
-   /* No needs, no core events to track */
+   /* Translations are plain copies of the guest code, so they can be
+      saved and reused across runs, and run by several threads at
+      once.  No other needs, no core events to track. */
+   VG_(needs_reusable_translations) ();
+   VG_(needs_thread_safe_instrumentation) ();
 }
 
 VG_DETERMINE_INTERFACE_VERSION(nl_pre_clo_init)
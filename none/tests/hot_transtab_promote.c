@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include "../../include/valgrind.h"
+
+/* Keep throwing away and remaking the translations of fooble, so as
+   to fill up the translation table, while the loop in main stays hot.
+   When the sector holding main's translations is recycled, they are
+   moved to the hot sector. */
+
+static volatile int v[4];
+
+#define OPS4(x) v[0] += (x); v[1] ^= v[0]; v[2] -= v[1]; v[3] += v[2] >> 1;
+#define OPS16(x) OPS4(x) OPS4(x+1) OPS4(x+2) OPS4(x+3)
+
+__attribute__((noinline))
+void fooble ( int x )
+{
+   OPS16(x) OPS16(x+4) OPS16(x+8) OPS16(x+12)
+}
+
+__attribute__((noinline))
+void someother ( void )
+{
+}
+
+int main ( void )
+{
+   int   i;
+   char* start = (char*)&fooble;
+   long  len   = (char*)&someother - start;
+   if (len <= 0)
+      len = 1;
+   for (i = 0; i < 60000; i++) {
+      fooble(i);
+      VALGRIND_DISCARD_TRANSLATIONS( start, len );
+   }
+   printf("done\n");
+   return 0;
+}
@@ -0,0 +1,47 @@
+/* Several threads computing at once, sharing a counter and doing
+   the odd syscall, to check that --parallel-sched=yes gives the same
+   results as running them one at a time. */
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define N_THREADS 4
+#define N_ITERS   2000000
+
+static volatile unsigned long shared_count = 0;
+static unsigned long long sums[N_THREADS];
+
+static void *worker(void *v)
+{
+   long me = (long)v;
+   unsigned long long i, sum = 0, x = me + 1;
+
+   for (i = 0; i < N_ITERS; i++) {
+      x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+      sum += x >> 33;
+      if ((i & 0xffff) == 0) {
+         __sync_fetch_and_add(&shared_count, 1);
+         getpid();
+      }
+   }
+   sums[me] = sum;
+   return NULL;
+}
+
+int main(void)
+{
+   pthread_t th[N_THREADS];
+   unsigned long long total = 0;
+   long i;
+
+   for (i = 0; i < N_THREADS; i++)
+      pthread_create(&th[i], NULL, worker, (void*)i);
+   for (i = 0; i < N_THREADS; i++)
+      pthread_join(th[i], NULL);
+
+   for (i = 0; i < N_THREADS; i++)
+      total ^= sums[i];
+   printf("shared count %lu\n", shared_count);
+   printf("checksum %llx\n", total);
+   return 0;
+}
@@ -0,0 +1,22 @@
+#include <stdio.h>
+
+/* Run a loop made of several blocks for long enough that the
+   scheduler looks for hot blocks at least once, so that the loop gets
+   re-translated as a trace. */
+
+static volatile int v = 3;
+
+int main ( void )
+{
+   int  i;
+   long sum = 0;
+   for (i = 0; i < 20000000; i++) {
+      if (i & 1)
+         sum += i;
+      else
+         sum -= v;
+   }
+   v = (int)sum;
+   printf("done\n");
+   return 0;
+}
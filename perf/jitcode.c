@@ -0,0 +1,91 @@
+// This artificial program behaves a bit like a JIT compiler.  It first
+// runs lots of copies of a function, so that there are many translations
+// resident, and then repeatedly "recompiles" code into a small number of
+// page-sized slots, telling Valgrind about each rewrite with
+// VALGRIND_DISCARD_TRANSLATIONS, and runs the new code.
+//
+// It's a stress test for the discarding of translations over a small
+// address range when a lot of other code has been translated.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#if defined(__mips__)
+#include <asm/cachectl.h>
+#include <sys/syscall.h>
+#endif
+#include "tests/sys_mman.h"
+#include "valgrind.h"
+
+#define FN_SIZE     996      // Must be big enough to hold the compiled f()
+#define N_RESIDENT  4000     // Copies of f() that stay translated
+#define SLOT_SIZE   4096     // Size of a JIT code slot
+#define N_SLOTS     16
+#define N_REWRITES  20000    // Number of slot rewrites
+
+int f(int x, int y)
+{
+   int i;
+   for (i = 0; i < 50; i++) {
+      switch (x % 8) {
+       case 1:  y += 3;
+       case 2:  y += x;
+       case 3:  y *= 2;
+       default: y--;
+      }
+   }
+   return y;
+}
+
+static void flush_icache(char* p, int len)
+{
+#if defined(__mips__)
+   syscall(__NR_cacheflush, p, len, ICACHE);
+#else
+   (void)p; (void)len;
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+   int i, sum = 0;
+   int n_rewrites = N_REWRITES;
+
+   if (argc > 1)
+      n_rewrites = atoi(argv[1]);
+   printf("%d resident copies of f(), %d rewrites of %d slots\n",
+          N_RESIDENT, n_rewrites, N_SLOTS);
+
+   char* a = mmap(0, FN_SIZE * N_RESIDENT,
+                     PROT_EXEC|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS, -1,0);
+   assert(a != (char*)MAP_FAILED);
+   char* jit = mmap(0, SLOT_SIZE * N_SLOTS,
+                       PROT_EXEC|PROT_WRITE,
+                       MAP_PRIVATE|MAP_ANONYMOUS, -1,0);
+   assert(jit != (char*)MAP_FAILED);
+
+   // Get plenty of code translated.
+   for (i = 0; i < N_RESIDENT; i++)
+      memcpy(&a[FN_SIZE*i], f, FN_SIZE);
+   flush_icache(a, FN_SIZE * N_RESIDENT);
+   for (i = 0; i < N_RESIDENT; i++) {
+      int(*fn)(int,int) = (void*)&a[FN_SIZE*i];
+      sum += fn(i, N_RESIDENT-i);
+   }
+
+   // Now keep regenerating code in the slots, as a JIT would.
+   for (i = 0; i < n_rewrites; i++) {
+      char* slot = &jit[SLOT_SIZE * (i % N_SLOTS)];
+      int(*fn)(int,int) = (void*)slot;
+      memcpy(slot, f, FN_SIZE);
+      flush_icache(slot, SLOT_SIZE);
+      VALGRIND_DISCARD_TRANSLATIONS(slot, SLOT_SIZE);
+      sum += fn(i, n_rewrites-i);
+      if (i % 1000 == 0)
+         printf(".");
+   }
+   printf("result = %d\n", sum);
+   return 0;
+}
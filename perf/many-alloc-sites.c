@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// Like many-xpts, but instead of a deep XTree this makes a wide one:
+// malloc is called from 8192 different places, so Massif's alloc_xpt (the
+// root of its XTree) gets 8192 children.  This is what happens to a
+// program which does all its allocation through a single wrapper function
+// named with --alloc-fn.  Every allocation has to find its call site among
+// those children, so this measures malloc throughput under Massif with a
+// very wide XTree.
+
+#define N_PASSES   30
+
+// 'sink' is volatile so the compiler can't optimise the malloc/free away.
+static void* volatile sink;
+
+#define SITE       { sink = malloc(16); free(sink); }
+#define SITE4      SITE SITE SITE SITE
+#define SITE16     SITE4 SITE4 SITE4 SITE4
+#define SITE64     SITE16 SITE16 SITE16 SITE16
+#define SITE256    SITE64 SITE64 SITE64 SITE64
+#define SITE1024   SITE256 SITE256 SITE256 SITE256
+#define SITE8192   SITE1024 SITE1024 SITE1024 SITE1024 \
+                   SITE1024 SITE1024 SITE1024 SITE1024
+
+int main(void)
+{
+   int i;
+
+   for (i = 0; i < N_PASSES; i++) {
+      SITE8192
+   }
+   printf("%d allocations\n", N_PASSES * 8192);
+   return 0;
+}
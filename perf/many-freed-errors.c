@@ -0,0 +1,36 @@
+// This artificial program frees a lot of small blocks and then reads from
+// some of them at many different places in the code.  Each read is a
+// different use-after-free error, whose address Memcheck has to describe
+// by finding the freed block containing it.  With a big --freelist-vol,
+// all the freed blocks stay in Memcheck's freed blocks queue.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N_BLOCKS  1000000
+
+static char* blocks[N_BLOCKS];
+static int   next = 0;
+static int   sum  = 0;
+
+// Read from a different freed block each time.
+#define R1   sum += *(volatile char*)blocks[(next += 997) % N_BLOCKS];
+#define R10  R1 R1 R1 R1 R1 R1 R1 R1 R1 R1
+#define R100 R10 R10 R10 R10 R10 R10 R10 R10 R10 R10
+
+int main(void)
+{
+   int i;
+
+   for (i = 0; i < N_BLOCKS; i++)
+      blocks[i] = malloc(16 + i % 32);
+   for (i = 0; i < N_BLOCKS; i++)
+      free(blocks[i]);
+
+   // 1000 reads, each at a different place in the code.  (Memcheck stops
+   // reporting errors after 1000 different ones.)
+   R100 R100 R100 R100 R100 R100 R100 R100 R100 R100
+
+   printf("done %d\n", sum != 12345);
+   return 0;
+}
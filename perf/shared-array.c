@@ -0,0 +1,56 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Several threads work in lock step over a large shared array: in each
+// round every thread first writes its own slice of the array, then,
+// after a barrier, reads all of it.  The array is much bigger than
+// Helgrind's shadow memory cache, so this measures the cost of moving
+// shadow lines in and out of that cache, most of which have only been
+// read since they were last fetched.  The barriers order all the
+// accesses, so there are no races to report.
+
+#define N_THREADS  8
+#define N_WORDS    (4 * 1024 * 1024)
+#define N_ROUNDS   2
+
+static long* array;
+static pthread_barrier_t barrier;
+static long sums[N_THREADS];
+
+static void* worker(void* arg)
+{
+   long me = (long)arg;
+   long slice = N_WORDS / N_THREADS;
+   long i, r, sum = 0;
+
+   for (r = 0; r < N_ROUNDS; r++) {
+      for (i = me * slice; i < (me + 1) * slice; i++)
+         array[i] = i + r;
+      pthread_barrier_wait(&barrier);
+      for (i = 0; i < N_WORDS; i++)
+         sum += array[i];
+      pthread_barrier_wait(&barrier);
+   }
+   sums[me] = sum;
+   return NULL;
+}
+
+int main(void)
+{
+   pthread_t threads[N_THREADS];
+   long i, total = 0;
+
+   array = malloc(N_WORDS * sizeof(long));
+   pthread_barrier_init(&barrier, NULL, N_THREADS);
+   for (i = 0; i < N_THREADS; i++)
+      pthread_create(&threads[i], NULL, worker, (void*)i);
+   for (i = 0; i < N_THREADS; i++) {
+      pthread_join(threads[i], NULL);
+      total += sums[i];
+   }
+   pthread_barrier_destroy(&barrier);
+   free(array);
+   printf("total %ld\n", total);
+   return 0;
+}